@@ -145,10 +145,11 @@ grub_usb_device_initialize (grub_usb_device_t dev)
 
   for (i = 0; i < descdev->configcnt; i++)
     {
-      int pos;
-      int currif;
+      int pos, dst;
+      int currif, currep;
       char *data;
       struct grub_usb_desc *desc;
+      struct grub_usb_desc_endp *endp;
 
       /* First just read the first 4 bytes of the configuration
 	 descriptor, after that it is known how many bytes really have
@@ -208,8 +209,40 @@ grub_usb_device_initialize (grub_usb_device_t dev)
 	  /* Point to the first endpoint.  */
 	  dev->config[i].interf[currif].descendp
 	    = (struct grub_usb_desc_endp *) &data[pos];
-	  pos += (sizeof (struct grub_usb_desc_endp)
-		  * dev->config[i].interf[currif].descif->endpointcnt);
+
+	  /* SuperSpeed devices follow every endpoint descriptor with a
+	     companion descriptor.  Move the endpoint descriptors together
+	     so that descendp can be used as an array, remembering MaxBurst
+	     on the way.  */
+	  dst = pos;
+	  endp = NULL;
+	  currep = 0;
+	  while (pos < config.totallen)
+	    {
+	      desc = (struct grub_usb_desc *) &data[pos];
+	      if (!desc->length)
+		{
+		  err = GRUB_USB_ERR_BADDEVICE;
+		  goto fail;
+		}
+	      if (desc->type == GRUB_USB_DESCRIPTOR_SS_ENDPOINT_COMPANION)
+		{
+		  if (endp && i == 0)
+		    dev->maxburst[grub_usb_ep_index (endp->endp_addr)]
+		      = ((struct grub_usb_desc_ss_ep_comp *) desc)->maxburst;
+		}
+	      else if (currep
+		       == dev->config[i].interf[currif].descif->endpointcnt)
+		break;
+	      else if (desc->type == GRUB_USB_DESCRIPTOR_ENDPOINT)
+		{
+		  grub_memmove (&data[dst], desc, sizeof (*endp));
+		  endp = (struct grub_usb_desc_endp *) &data[dst];
+		  dst += sizeof (*endp);
+		  currep++;
+		}
+	      pos += desc->length;
+	    }
 	}
     }
 
@@ -45,11 +45,14 @@ static struct grub_usb_hub *hubs;
 static grub_usb_controller_dev_t grub_usb_list;
 
 /* Add a device that currently has device number 0 and resides on
-   CONTROLLER, the Hub reported that the device speed is SPEED.  */
+   CONTROLLER, the Hub reported that the device speed is SPEED.  The
+   device is connected to port PORT of HUB, or of the root hub when HUB
+   is NULL.  */
 static grub_usb_device_t
 grub_usb_hub_add_dev (grub_usb_controller_t controller,
                       grub_usb_speed_t speed,
-                      int split_hubport, int split_hubaddr)
+                      int split_hubport, int split_hubaddr,
+		      grub_usb_device_t hub, int port)
 {
   grub_usb_device_t dev;
   int i;
@@ -65,10 +68,24 @@ grub_usb_hub_add_dev (grub_usb_controller_t controller,
   dev->speed = speed;
   dev->split_hubport = split_hubport;
   dev->split_hubaddr = split_hubaddr;
+  dev->hub = hub;
+  dev->port = port;
+
+  if (controller->dev->attach_dev)
+    {
+      err = controller->dev->attach_dev (controller, dev);
+      if (err)
+	{
+	  grub_free (dev);
+	  return NULL;
+	}
+    }
 
   err = grub_usb_device_initialize (dev);
   if (err)
     {
+      if (controller->dev->detach_dev)
+	controller->dev->detach_dev (controller, dev);
       grub_free (dev);
       return NULL;
     }
@@ -82,18 +99,23 @@ grub_usb_hub_add_dev (grub_usb_controller_t controller,
   if (i == GRUB_USBHUB_MAX_DEVICES)
     {
       grub_error (GRUB_ERR_IO, "can't assign address to USB device");
+      if (controller->dev->detach_dev)
+	controller->dev->detach_dev (controller, dev);
       for (i = 0; i < 8; i++)
         grub_free (dev->config[i].descconf);
       grub_free (dev);
       return NULL;
     }
 
-  err = grub_usb_control_msg (dev,
-			      (GRUB_USB_REQTYPE_OUT
-			       | GRUB_USB_REQTYPE_STANDARD
-			       | GRUB_USB_REQTYPE_TARGET_DEV),
-			      GRUB_USB_REQ_SET_ADDRESS,
-			      i, 0, 0, NULL);
+  /* The controller has already addressed the device if it has an
+     attach_dev hook; I stays the index into grub_usb_devs.  */
+  if (!controller->dev->attach_dev)
+    err = grub_usb_control_msg (dev,
+				(GRUB_USB_REQTYPE_OUT
+				 | GRUB_USB_REQTYPE_STANDARD
+				 | GRUB_USB_REQTYPE_TARGET_DEV),
+				GRUB_USB_REQ_SET_ADDRESS,
+				i, 0, 0, NULL);
   if (err)
     {
       for (i = 0; i < 8; i++)
@@ -224,7 +246,7 @@ attach_root_port (struct grub_usb_hub *hub, int portno,
      and full/low speed device connected to OHCI/UHCI needs not
      transaction translation - e.g. hubport and hubaddr should be
      always none (zero) for any device connected to any root hub. */
-  dev = grub_usb_hub_add_dev (hub->controller, speed, 0, 0);
+  dev = grub_usb_hub_add_dev (hub->controller, speed, 0, 0, NULL, portno + 1);
   hub->controller->dev->pending_reset = 0;
   npending--;
   if (! dev)
@@ -413,6 +435,8 @@ detach_device (grub_usb_device_t dev)
 	  if (inter && inter->detach_hook)
 	    inter->detach_hook (dev, i, k);
 	}
+  if (dev->controller.dev->detach_dev)
+    dev->controller.dev->detach_dev (&dev->controller, dev);
   grub_usb_devs[dev->addr] = 0;
 }
 
@@ -645,7 +669,8 @@ poll_nonroot_hub (grub_usb_device_t dev)
 		
 	      /* Add the device and assign a device address to it.  */
 	      next_dev = grub_usb_hub_add_dev (&dev->controller, speed,
-					       split_hubport, split_hubaddr);
+					       split_hubport, split_hubaddr,
+					       dev, i);
 	      if (dev->controller.dev->pending_reset)
 		{
 		  dev->controller.dev->pending_reset = 0;
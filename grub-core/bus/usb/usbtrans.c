@@ -146,6 +146,7 @@ grub_usb_control_msg (grub_usb_device_t dev,
   transfer->type = GRUB_USB_TRANSACTION_TYPE_CONTROL;
   transfer->max = max;
   transfer->dev = dev;
+  transfer->setup = setupdata;
 
   /* Allocate an array of transfer data structures.  */
   transfer->transactions = grub_malloc (transfer->transcnt
@@ -270,6 +271,7 @@ grub_usb_bulk_setup_readwrite (grub_usb_device_t dev,
   transfer->last_trans = -1; /* Reset index of last processed transaction (TD) */
   transfer->data_chunk = data_chunk;
   transfer->data = data_in;
+  transfer->setup = NULL;
 
   /* Allocate an array of transfer data structures.  */
   transfer->transactions = grub_malloc (transfer->transcnt
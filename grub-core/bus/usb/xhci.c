@@ -0,0 +1,1698 @@
+/* xhci.c - xHCI Support.  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/mm.h>
+#include <grub/usb.h>
+#include <grub/usbtrans.h>
+#include <grub/misc.h>
+#include <grub/pci.h>
+#include <grub/cpu/pci.h>
+#include <grub/time.h>
+#include <grub/loader.h>
+#include <grub/disk.h>
+#include <grub/dma.h>
+#include <grub/cache.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* This driver handles one event ring, polled, and one transfer ring per
+   endpoint.  The USB core keeps at most one transfer in flight per
+   endpoint, so a single ring segment is enough.  Devices are addressed
+   by the controller itself in grub_xhci_attach_dev, endpoints are
+   configured the first time they are used.  */
+
+/* Capability registers.  */
+enum
+  {
+    GRUB_XHCI_CAP_CAPLENGTH = 0x00,
+    GRUB_XHCI_CAP_HCSPARAMS1 = 0x04,
+    GRUB_XHCI_CAP_HCSPARAMS2 = 0x08,
+    GRUB_XHCI_CAP_HCCPARAMS1 = 0x10,
+    GRUB_XHCI_CAP_DBOFF = 0x14,
+    GRUB_XHCI_CAP_RTSOFF = 0x18,
+    GRUB_XHCI_CAP_SIZE = 0x20
+  };
+
+#define GRUB_XHCI_HCS1_MAX_SLOTS(x)	((x) & 0xff)
+#define GRUB_XHCI_HCS1_MAX_PORTS(x)	((x) >> 24)
+#define GRUB_XHCI_HCS2_MAX_SCRATCH(x)	((((x) >> 21) & 0x1f) << 5 \
+					 | ((x) >> 27))
+#define GRUB_XHCI_HCC1_CSZ		(1 << 2)
+#define GRUB_XHCI_HCC1_PPC		(1 << 3)
+#define GRUB_XHCI_HCC1_XECP(x)		((x) >> 16)
+
+/* Operational registers.  */
+enum
+  {
+    GRUB_XHCI_OP_USBCMD = 0x00,
+    GRUB_XHCI_OP_USBSTS = 0x04,
+    GRUB_XHCI_OP_PAGESIZE = 0x08,
+    GRUB_XHCI_OP_CRCR_LO = 0x18,
+    GRUB_XHCI_OP_CRCR_HI = 0x1c,
+    GRUB_XHCI_OP_DCBAAP_LO = 0x30,
+    GRUB_XHCI_OP_DCBAAP_HI = 0x34,
+    GRUB_XHCI_OP_CONFIG = 0x38,
+    GRUB_XHCI_OP_PORTSC = 0x400
+  };
+
+enum
+  {
+    GRUB_XHCI_CMD_RS = (1 << 0),
+    GRUB_XHCI_CMD_HCRST = (1 << 1)
+  };
+
+enum
+  {
+    GRUB_XHCI_STS_HCH = (1 << 0),
+    GRUB_XHCI_STS_CNR = (1 << 11)
+  };
+
+enum
+  {
+    GRUB_XHCI_PORTSC_CCS = (1 << 0),
+    GRUB_XHCI_PORTSC_PED = (1 << 1),
+    GRUB_XHCI_PORTSC_PR = (1 << 4),
+    GRUB_XHCI_PORTSC_PP = (1 << 9),
+    GRUB_XHCI_PORTSC_CSC = (1 << 17),
+    GRUB_XHCI_PORTSC_PEC = (1 << 18),
+    GRUB_XHCI_PORTSC_PRC = (1 << 21),
+    /* Bits which may be written back unchanged: everything except the
+       write-1-to-clear change bits, PED and PR.  */
+    GRUB_XHCI_PORTSC_PRESERVE = 0x4e00ffe9
+  };
+
+#define GRUB_XHCI_PORTSC_SPEED(x)	(((x) >> 10) & 0xf)
+
+/* Interrupter 0 registers, relative to the runtime registers.  */
+enum
+  {
+    GRUB_XHCI_IR_IMAN = 0x20,
+    GRUB_XHCI_IR_ERSTSZ = 0x28,
+    GRUB_XHCI_IR_ERSTBA_LO = 0x30,
+    GRUB_XHCI_IR_ERSTBA_HI = 0x34,
+    GRUB_XHCI_IR_ERDP_LO = 0x38,
+    GRUB_XHCI_IR_ERDP_HI = 0x3c
+  };
+
+#define GRUB_XHCI_ERDP_EHB		(1 << 3)
+
+/* USB Legacy Support extended capability.  */
+#define GRUB_XHCI_XECP_ID(x)		((x) & 0xff)
+#define GRUB_XHCI_XECP_NEXT(x)		(((x) >> 8) & 0xff)
+#define GRUB_XHCI_XECP_LEGACY		1
+#define GRUB_XHCI_LEGACY_BIOS_OWNED	(1 << 16)
+#define GRUB_XHCI_LEGACY_OS_OWNED	(1 << 24)
+#define GRUB_XHCI_LEGACY_SMI_KEEP	((0x7 << 1) | (0xff << 5) | (0x7 << 17))
+#define GRUB_XHCI_LEGACY_SMI_EVENTS	(0x7 << 29)
+
+/* TRB types.  */
+enum
+  {
+    GRUB_XHCI_TRB_NORMAL = 1,
+    GRUB_XHCI_TRB_SETUP = 2,
+    GRUB_XHCI_TRB_DATA = 3,
+    GRUB_XHCI_TRB_STATUS = 4,
+    GRUB_XHCI_TRB_LINK = 6,
+    GRUB_XHCI_TRB_ENABLE_SLOT = 9,
+    GRUB_XHCI_TRB_DISABLE_SLOT = 10,
+    GRUB_XHCI_TRB_ADDRESS_DEVICE = 11,
+    GRUB_XHCI_TRB_CONFIGURE_EP = 12,
+    GRUB_XHCI_TRB_EVALUATE_CONTEXT = 13,
+    GRUB_XHCI_TRB_RESET_EP = 14,
+    GRUB_XHCI_TRB_STOP_EP = 15,
+    GRUB_XHCI_TRB_SET_TR_DEQUEUE = 16,
+    GRUB_XHCI_TRB_TRANSFER_EVENT = 32,
+    GRUB_XHCI_TRB_COMMAND_COMPLETION = 33
+  };
+
+/* TRB control field.  */
+enum
+  {
+    GRUB_XHCI_TRB_C = (1 << 0),
+    GRUB_XHCI_TRB_TC = (1 << 1),
+    GRUB_XHCI_TRB_ISP = (1 << 2),
+    GRUB_XHCI_TRB_CH = (1 << 4),
+    GRUB_XHCI_TRB_IOC = (1 << 5),
+    GRUB_XHCI_TRB_IDT = (1 << 6),
+    GRUB_XHCI_TRB_DIR_IN = (1 << 16)
+  };
+
+#define GRUB_XHCI_TRB_TYPE(x)		(((x) >> 10) & 0x3f)
+#define GRUB_XHCI_TRB_TYPE_SHIFT	10
+#define GRUB_XHCI_TRB_SLOT_SHIFT	24
+#define GRUB_XHCI_TRB_EP_SHIFT		16
+#define GRUB_XHCI_TRB_TRT_SHIFT		16
+#define GRUB_XHCI_TRB_TD_SIZE_SHIFT	17
+
+/* Completion codes.  */
+enum
+  {
+    GRUB_XHCI_CC_INVALID = 0,
+    GRUB_XHCI_CC_SUCCESS = 1,
+    GRUB_XHCI_CC_DATA_BUFFER = 2,
+    GRUB_XHCI_CC_BABBLE = 3,
+    GRUB_XHCI_CC_TRANSACTION = 4,
+    GRUB_XHCI_CC_STALL = 6,
+    GRUB_XHCI_CC_SHORT_PACKET = 13
+  };
+
+/* Slot and endpoint context fields.  */
+#define GRUB_XHCI_SLOT_SPEED_SHIFT	20
+#define GRUB_XHCI_SLOT_HUB		(1 << 26)
+#define GRUB_XHCI_SLOT_ENTRIES_SHIFT	27
+#define GRUB_XHCI_SLOT_ROOTPORT_SHIFT	16
+#define GRUB_XHCI_SLOT_NPORTS_SHIFT	24
+#define GRUB_XHCI_SLOT_TT_PORT_SHIFT	8
+
+#define GRUB_XHCI_EP_INTERVAL_SHIFT	16
+#define GRUB_XHCI_EP_CERR_SHIFT		1
+#define GRUB_XHCI_EP_TYPE_SHIFT		3
+#define GRUB_XHCI_EP_BURST_SHIFT	8
+#define GRUB_XHCI_EP_MPS_SHIFT		16
+#define GRUB_XHCI_EP_ESIT_SHIFT		16
+#define GRUB_XHCI_EP_TYPE_CONTROL	4
+/* Add 4 for IN endpoints.  */
+#define GRUB_XHCI_EP_TYPE_ISOCH_OUT	1
+#define GRUB_XHCI_EP_TYPE_BULK_OUT	2
+#define GRUB_XHCI_EP_TYPE_INTR_OUT	3
+
+/* Port speed IDs (default protocol speed IDs).  */
+enum
+  {
+    GRUB_XHCI_SPEED_FULL = 1,
+    GRUB_XHCI_SPEED_LOW = 2,
+    GRUB_XHCI_SPEED_HIGH = 3,
+    GRUB_XHCI_SPEED_SUPER = 4
+  };
+
+/* Number of TRBs in each ring, the last one of a transfer or command
+   ring is the link back to the start.  4KiB, so that a ring never
+   crosses a 64KiB boundary.  */
+#define GRUB_XHCI_RING_TRBS		256
+/* Normal TRBs must not cross a 64KiB boundary.  */
+#define GRUB_XHCI_TRB_MAX_LEN		0x10000
+#define GRUB_XHCI_TIMEOUT_MS		1000
+
+struct grub_xhci_trb
+{
+  grub_uint64_t ptr;
+  grub_uint32_t status;
+  grub_uint32_t control;
+} GRUB_PACKED;
+
+struct grub_xhci_erst_entry
+{
+  grub_uint64_t base;
+  grub_uint32_t size;
+  grub_uint32_t reserved;
+} GRUB_PACKED;
+
+struct grub_xhci_ring
+{
+  struct grub_pci_dma_chunk *chunk;
+  volatile struct grub_xhci_trb *trbs;
+  grub_uint32_t phys;
+  /* Enqueue index for transfer and command rings, dequeue index for
+     the event ring.  */
+  unsigned idx;
+  grub_uint32_t cycle;
+};
+
+struct grub_xhci;
+
+struct grub_xhci_slot
+{
+  struct grub_xhci *x;
+  /* Slot ID, 0 once the controller has been reset under us.  */
+  unsigned id;
+  grub_uint32_t route;
+  unsigned rootport;
+  unsigned depth;
+  unsigned speed;
+  unsigned ep0_mps;
+  struct grub_pci_dma_chunk *in_chunk;
+  volatile grub_uint32_t *in;
+  grub_uint32_t in_phys;
+  struct grub_pci_dma_chunk *out_chunk;
+  volatile grub_uint32_t *out;
+  grub_uint32_t out_phys;
+  /* Transfer rings, indexed by device context index.  */
+  struct grub_xhci_ring *rings[32];
+};
+
+/* One TRB of a transfer and which bytes of the buffer it covers.  */
+struct grub_xhci_td_trb
+{
+  grub_uint32_t phys;
+  grub_uint32_t offset;
+  grub_uint32_t len;
+};
+
+struct grub_xhci_transfer_controller_data
+{
+  struct grub_xhci_transfer_controller_data *next;
+  struct grub_xhci_slot *slot;
+  unsigned dci;
+  int control;
+  int done;
+  int short_packet;
+  grub_uint32_t cc;
+  grub_size_t actual;
+  unsigned ntrbs;
+  struct grub_xhci_td_trb trbs[0];
+};
+
+struct grub_xhci
+{
+  volatile grub_uint8_t *cap;
+  volatile grub_uint32_t *oper;
+  volatile grub_uint8_t *runtime;
+  volatile grub_uint32_t *db;
+  unsigned maxslots;
+  unsigned nports;
+  unsigned ctxsize;
+  grub_uint32_t hccparams1;
+
+  struct grub_pci_dma_chunk *dcbaa_chunk;
+  volatile grub_uint64_t *dcbaa;
+  grub_uint32_t dcbaa_phys;
+  struct grub_pci_dma_chunk *scratch_chunk;
+  struct grub_pci_dma_chunk **scratch_bufs;
+  unsigned nscratch;
+
+  struct grub_xhci_ring cmd;
+  struct grub_xhci_ring event;
+  struct grub_pci_dma_chunk *erst_chunk;
+  volatile struct grub_xhci_erst_entry *erst;
+
+  /* Last command issued and its completion.  */
+  grub_uint32_t cmd_trb;
+  int cmd_done;
+  grub_uint32_t cmd_cc;
+  unsigned cmd_slot;
+
+  struct grub_xhci_slot *slots[256];
+  struct grub_xhci_transfer_controller_data *transfers;
+  /* Ports whose devices were lost by a controller reset.  */
+  grub_uint8_t port_lost[256];
+
+  struct grub_xhci *next;
+};
+
+static struct grub_xhci *xhci;
+
+static inline grub_uint32_t
+grub_xhci_cap_read32 (struct grub_xhci *x, grub_uint32_t addr)
+{
+  return grub_le_to_cpu32 (*(volatile grub_uint32_t *) (x->cap + addr));
+}
+
+static inline grub_uint32_t
+grub_xhci_oper_read32 (struct grub_xhci *x, grub_uint32_t addr)
+{
+  return grub_le_to_cpu32 (x->oper[addr / 4]);
+}
+
+static inline void
+grub_xhci_oper_write32 (struct grub_xhci *x, grub_uint32_t addr,
+			grub_uint32_t value)
+{
+  x->oper[addr / 4] = grub_cpu_to_le32 (value);
+}
+
+static inline void
+grub_xhci_rt_write32 (struct grub_xhci *x, grub_uint32_t addr,
+		      grub_uint32_t value)
+{
+  *(volatile grub_uint32_t *) (x->runtime + addr) = grub_cpu_to_le32 (value);
+}
+
+static inline grub_uint32_t
+grub_xhci_port_read (struct grub_xhci *x, unsigned port)
+{
+  return grub_xhci_oper_read32 (x, GRUB_XHCI_OP_PORTSC + 0x10 * port);
+}
+
+/* Write VALUE to PORTSC of PORT, leaving the state of all other bits
+   alone.  */
+static inline void
+grub_xhci_port_write (struct grub_xhci *x, unsigned port,
+		      grub_uint32_t portsc, grub_uint32_t value)
+{
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OP_PORTSC + 0x10 * port,
+			  (portsc & GRUB_XHCI_PORTSC_PRESERVE) | value);
+}
+
+static inline void
+grub_xhci_doorbell (struct grub_xhci *x, unsigned slot, unsigned target)
+{
+  x->db[slot] = grub_cpu_to_le32 (target);
+}
+
+/* Context N of the input or output context at BASE.  */
+static inline volatile grub_uint32_t *
+grub_xhci_ctx (struct grub_xhci *x, volatile grub_uint32_t *base, unsigned n)
+{
+  return (volatile grub_uint32_t *) ((volatile grub_uint8_t *) base
+				     + n * x->ctxsize);
+}
+
+static void
+grub_xhci_ring_reset (struct grub_xhci_ring *ring, int link)
+{
+  grub_memset ((void *) ring->trbs, 0,
+	       GRUB_XHCI_RING_TRBS * sizeof (ring->trbs[0]));
+  ring->idx = 0;
+  ring->cycle = 1;
+  if (link)
+    {
+      ring->trbs[GRUB_XHCI_RING_TRBS - 1].ptr = grub_cpu_to_le64 (ring->phys);
+      ring->trbs[GRUB_XHCI_RING_TRBS - 1].control
+	= grub_cpu_to_le32 ((GRUB_XHCI_TRB_LINK << GRUB_XHCI_TRB_TYPE_SHIFT)
+			    | GRUB_XHCI_TRB_TC);
+    }
+}
+
+static grub_err_t
+grub_xhci_ring_init (struct grub_xhci_ring *ring, int link)
+{
+  ring->chunk = grub_memalign_dma32 (4096, GRUB_XHCI_RING_TRBS
+				     * sizeof (ring->trbs[0]));
+  if (!ring->chunk)
+    return grub_errno;
+  ring->trbs = grub_dma_get_virt (ring->chunk);
+  ring->phys = grub_dma_get_phys (ring->chunk);
+  grub_xhci_ring_reset (ring, link);
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_xhci_ring *
+grub_xhci_ring_alloc (void)
+{
+  struct grub_xhci_ring *ring;
+
+  ring = grub_malloc (sizeof (*ring));
+  if (!ring)
+    return NULL;
+  if (grub_xhci_ring_init (ring, 1))
+    {
+      grub_free (ring);
+      return NULL;
+    }
+  return ring;
+}
+
+static void
+grub_xhci_ring_free (struct grub_xhci_ring *ring)
+{
+  if (!ring)
+    return;
+  grub_dma_free (ring->chunk);
+  grub_free (ring);
+}
+
+/* Number of TRBs that can be queued on RING without overwriting the
+   ones still owned by the controller, assuming it is idle.  */
+#define GRUB_XHCI_RING_FREE		(GRUB_XHCI_RING_TRBS - 2)
+
+/* Queue one TRB and return its physical address.  When HOLD is set the
+   cycle bit is left inverted so the controller doesn't see the TRB
+   yet; it is handed over with grub_xhci_ring_release once the whole TD
+   is written.  */
+static grub_uint32_t
+grub_xhci_ring_push (struct grub_xhci_ring *ring, grub_uint64_t ptr,
+		     grub_uint32_t status, grub_uint32_t control, int hold)
+{
+  volatile struct grub_xhci_trb *trb = &ring->trbs[ring->idx];
+  grub_uint32_t phys = ring->phys + ring->idx * sizeof (*trb);
+
+  trb->ptr = grub_cpu_to_le64 (ptr);
+  trb->status = grub_cpu_to_le32 (status);
+  trb->control = grub_cpu_to_le32 (control
+				   | (hold ? !ring->cycle : ring->cycle));
+
+  if (++ring->idx == GRUB_XHCI_RING_TRBS - 1)
+    {
+      /* Chain the link TRB if the TD continues past it.  */
+      ring->trbs[ring->idx].control
+	= grub_cpu_to_le32 ((GRUB_XHCI_TRB_LINK << GRUB_XHCI_TRB_TYPE_SHIFT)
+			    | GRUB_XHCI_TRB_TC
+			    | (control & GRUB_XHCI_TRB_CH) | ring->cycle);
+      ring->idx = 0;
+      ring->cycle ^= 1;
+    }
+  return phys;
+}
+
+static void
+grub_xhci_ring_release (struct grub_xhci_ring *ring, grub_uint32_t phys)
+{
+  volatile struct grub_xhci_trb *trb;
+
+  trb = &ring->trbs[(phys - ring->phys) / sizeof (*trb)];
+  trb->control ^= grub_cpu_to_le32 (GRUB_XHCI_TRB_C);
+}
+
+static void
+grub_xhci_transfer_event (struct grub_xhci *x,
+			  volatile struct grub_xhci_trb *ev)
+{
+  struct grub_xhci_transfer_controller_data *cdata;
+  grub_uint32_t status = grub_le_to_cpu32 (ev->status);
+  grub_uint32_t control = grub_le_to_cpu32 (ev->control);
+  grub_uint32_t phys = grub_le_to_cpu64 (ev->ptr);
+  grub_uint32_t cc = status >> 24;
+  grub_uint32_t residual = status & 0xffffff;
+  unsigned slot = control >> GRUB_XHCI_TRB_SLOT_SHIFT;
+  unsigned dci = (control >> GRUB_XHCI_TRB_EP_SHIFT) & 0x1f;
+  unsigned i;
+
+  for (cdata = x->transfers; cdata; cdata = cdata->next)
+    {
+      if (cdata->done || cdata->slot->id != slot || cdata->dci != dci)
+	continue;
+
+      for (i = 0; i < cdata->ntrbs; i++)
+	if (cdata->trbs[i].phys == phys)
+	  break;
+      if (i == cdata->ntrbs)
+	continue;
+
+      if (residual > cdata->trbs[i].len)
+	residual = cdata->trbs[i].len;
+      if (!cdata->short_packet)
+	cdata->actual = cdata->trbs[i].offset + cdata->trbs[i].len - residual;
+
+      /* After a short packet in the data stage the controller still runs
+	 the status stage of a control transfer.  */
+      if (cc == GRUB_XHCI_CC_SHORT_PACKET && cdata->control
+	  && i != cdata->ntrbs - 1)
+	{
+	  cdata->short_packet = 1;
+	  return;
+	}
+
+      cdata->cc = cc;
+      cdata->done = 1;
+      return;
+    }
+
+  grub_dprintf ("xhci", "stray transfer event: slot %u dci %u cc %u\n",
+		slot, dci, cc);
+}
+
+static void
+grub_xhci_process_events (struct grub_xhci *x)
+{
+  volatile struct grub_xhci_trb *ev;
+  grub_uint32_t control;
+  int n = 0;
+
+  while (1)
+    {
+      ev = &x->event.trbs[x->event.idx];
+      control = grub_le_to_cpu32 (ev->control);
+      if ((control & GRUB_XHCI_TRB_C) != x->event.cycle)
+	break;
+
+      switch (GRUB_XHCI_TRB_TYPE (control))
+	{
+	case GRUB_XHCI_TRB_TRANSFER_EVENT:
+	  grub_xhci_transfer_event (x, ev);
+	  break;
+
+	case GRUB_XHCI_TRB_COMMAND_COMPLETION:
+	  if ((grub_uint32_t) grub_le_to_cpu64 (ev->ptr) == x->cmd_trb)
+	    {
+	      x->cmd_cc = grub_le_to_cpu32 (ev->status) >> 24;
+	      x->cmd_slot = control >> GRUB_XHCI_TRB_SLOT_SHIFT;
+	      x->cmd_done = 1;
+	    }
+	  break;
+
+	default:
+	  /* Port status changes are picked up by detect_dev.  */
+	  break;
+	}
+
+      if (++x->event.idx == GRUB_XHCI_RING_TRBS)
+	{
+	  x->event.idx = 0;
+	  x->event.cycle ^= 1;
+	}
+      n++;
+    }
+
+  if (n)
+    {
+      grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERDP_LO,
+			    (x->event.phys
+			     + x->event.idx * sizeof (x->event.trbs[0]))
+			    | GRUB_XHCI_ERDP_EHB);
+      grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERDP_HI, 0);
+    }
+}
+
+/* Run a command and wait for it to complete.  Return the completion
+   code; the slot ID from the completion event is stored in SLOT.  */
+static grub_uint32_t
+grub_xhci_command (struct grub_xhci *x, grub_uint64_t ptr,
+		   grub_uint32_t control, unsigned *slot)
+{
+  grub_uint64_t endtime;
+
+  x->cmd_done = 0;
+  x->cmd_trb = grub_xhci_ring_push (&x->cmd, ptr, 0, control, 0);
+  grub_xhci_doorbell (x, 0, 0);
+
+  endtime = grub_get_time_ms () + GRUB_XHCI_TIMEOUT_MS;
+  while (!x->cmd_done)
+    {
+      grub_xhci_process_events (x);
+      if (!x->cmd_done && grub_get_time_ms () > endtime)
+	{
+	  grub_dprintf ("xhci", "command %u timed out\n",
+			GRUB_XHCI_TRB_TYPE (control));
+	  x->cmd_trb = 0;
+	  return GRUB_XHCI_CC_INVALID;
+	}
+    }
+
+  if (x->cmd_cc != GRUB_XHCI_CC_SUCCESS)
+    grub_dprintf ("xhci", "command %u failed: cc %u\n",
+		  GRUB_XHCI_TRB_TYPE (control), x->cmd_cc);
+
+  if (slot)
+    *slot = x->cmd_slot;
+  return x->cmd_cc;
+}
+
+static grub_uint32_t
+grub_xhci_slot_command (struct grub_xhci_slot *slot, unsigned type,
+			grub_uint64_t ptr, grub_uint32_t flags)
+{
+  return grub_xhci_command (slot->x, ptr,
+			    (type << GRUB_XHCI_TRB_TYPE_SHIFT)
+			    | (slot->id << GRUB_XHCI_TRB_SLOT_SHIFT) | flags,
+			    NULL);
+}
+
+/* Point the controller's dequeue pointer for DCI at our enqueue
+   pointer, dropping whatever was left on the ring.  The endpoint must
+   be stopped or halted.  */
+static void
+grub_xhci_skip_ring (struct grub_xhci_slot *slot, unsigned dci)
+{
+  struct grub_xhci_ring *ring = slot->rings[dci];
+
+  grub_xhci_slot_command (slot, GRUB_XHCI_TRB_SET_TR_DEQUEUE,
+			  (ring->phys + ring->idx * sizeof (ring->trbs[0]))
+			  | ring->cycle,
+			  dci << GRUB_XHCI_TRB_EP_SHIFT);
+}
+
+static grub_usb_err_t
+grub_xhci_usb_err (grub_uint32_t cc)
+{
+  switch (cc)
+    {
+    case GRUB_XHCI_CC_SUCCESS:
+    case GRUB_XHCI_CC_SHORT_PACKET:
+      return GRUB_USB_ERR_NONE;
+    case GRUB_XHCI_CC_STALL:
+      return GRUB_USB_ERR_STALL;
+    case GRUB_XHCI_CC_BABBLE:
+      return GRUB_USB_ERR_BABBLE;
+    case GRUB_XHCI_CC_DATA_BUFFER:
+    case GRUB_XHCI_CC_TRANSACTION:
+      return GRUB_USB_ERR_DATA;
+    default:
+      return GRUB_USB_ERR_INTERNAL;
+    }
+}
+
+static grub_usb_speed_t
+grub_xhci_usb_speed (unsigned speed)
+{
+  switch (speed)
+    {
+    case GRUB_XHCI_SPEED_LOW:
+      return GRUB_USB_SPEED_LOW;
+    case GRUB_XHCI_SPEED_HIGH:
+      return GRUB_USB_SPEED_HIGH;
+    case GRUB_XHCI_SPEED_FULL:
+    /* USB 2 ports report their speed only after the reset.  */
+    case 0:
+      return GRUB_USB_SPEED_FULL;
+    default:
+      return GRUB_USB_SPEED_SUPER;
+    }
+}
+
+static unsigned
+grub_xhci_speed_id (grub_usb_speed_t speed)
+{
+  switch (speed)
+    {
+    case GRUB_USB_SPEED_LOW:
+      return GRUB_XHCI_SPEED_LOW;
+    case GRUB_USB_SPEED_HIGH:
+      return GRUB_XHCI_SPEED_HIGH;
+    case GRUB_USB_SPEED_SUPER:
+      return GRUB_XHCI_SPEED_SUPER;
+    default:
+      return GRUB_XHCI_SPEED_FULL;
+    }
+}
+
+static struct grub_usb_desc_endp *
+grub_xhci_find_endp (grub_usb_device_t dev, int endp_addr)
+{
+  unsigned c;
+  int i, e;
+
+  for (c = 0; c < ARRAY_SIZE (dev->config); c++)
+    {
+      if (!dev->config[c].descconf)
+	continue;
+      for (i = 0; i < dev->config[c].descconf->numif
+	     && i < (int) ARRAY_SIZE (dev->config[c].interf); i++)
+	{
+	  struct grub_usb_interface *interf = &dev->config[c].interf[i];
+
+	  for (e = 0; e < interf->descif->endpointcnt; e++)
+	    if (interf->descendp[e].endp_addr == endp_addr)
+	      return &interf->descendp[e];
+	}
+    }
+  return NULL;
+}
+
+static grub_usb_err_t
+grub_xhci_configure_ep (struct grub_xhci_slot *slot, grub_usb_device_t dev,
+			int endp_addr, unsigned dci)
+{
+  struct grub_xhci *x = slot->x;
+  struct grub_usb_desc_endp *endp;
+  struct grub_xhci_ring *ring;
+  volatile grub_uint32_t *ctx, *out;
+  grub_uint32_t type, mps, burst = 0, interval = 0, entries;
+  int periodic;
+
+  endp = grub_xhci_find_endp (dev, endp_addr);
+  if (!endp)
+    return GRUB_USB_ERR_BADDEVICE;
+
+  ring = grub_xhci_ring_alloc ();
+  if (!ring)
+    return GRUB_USB_ERR_INTERNAL;
+
+  mps = grub_le_to_cpu16 (endp->maxpacket);
+  switch (grub_usb_get_ep_type (endp))
+    {
+    case GRUB_USB_EP_ISOCHRONOUS:
+      type = GRUB_XHCI_EP_TYPE_ISOCH_OUT;
+      break;
+    case GRUB_USB_EP_INTERRUPT:
+      type = GRUB_XHCI_EP_TYPE_INTR_OUT;
+      break;
+    default:
+      type = GRUB_XHCI_EP_TYPE_BULK_OUT;
+      break;
+    }
+  if (endp_addr & 0x80)
+    type += 4;
+  periodic = (type & 3) != GRUB_XHCI_EP_TYPE_BULK_OUT;
+
+  if (dev->speed == GRUB_USB_SPEED_SUPER)
+    burst = dev->maxburst[grub_usb_ep_index (endp_addr)];
+  else if (dev->speed == GRUB_USB_SPEED_HIGH && periodic)
+    burst = (mps >> 11) & 3;
+  mps &= 0x7ff;
+
+  if (periodic)
+    {
+      unsigned ival = endp->interval ? : 1;
+
+      if (dev->speed >= GRUB_USB_SPEED_HIGH
+	  || grub_usb_get_ep_type (endp) == GRUB_USB_EP_ISOCHRONOUS)
+	/* 2^(bInterval - 1) microframes.  */
+	interval = (ival > 16 ? 16 : ival) - 1
+	  + (dev->speed < GRUB_USB_SPEED_HIGH ? 3 : 0);
+      else
+	/* bInterval frames, rounded down to a power of two.  */
+	for (interval = 3; interval < 10
+	       && (1U << (interval + 1)) <= ival * 8; interval++);
+    }
+
+  grub_memset ((void *) slot->in, 0, 33 * x->ctxsize);
+  /* Add flags: the slot and this endpoint.  */
+  slot->in[1] = grub_cpu_to_le32 ((1 << 0) | (1 << dci));
+
+  out = grub_xhci_ctx (x, slot->out, 0);
+  ctx = grub_xhci_ctx (x, slot->in, 1);
+  ctx[0] = out[0];
+  ctx[1] = out[1];
+  ctx[2] = out[2];
+  entries = grub_le_to_cpu32 (out[0]) >> GRUB_XHCI_SLOT_ENTRIES_SHIFT;
+  if (dci > entries)
+    ctx[0] = grub_cpu_to_le32 ((grub_le_to_cpu32 (out[0])
+				& ~(0x1fU << GRUB_XHCI_SLOT_ENTRIES_SHIFT))
+			       | (dci << GRUB_XHCI_SLOT_ENTRIES_SHIFT));
+  /* By now a hub knows its number of ports.  */
+  if (dev->descdev.class == GRUB_USB_CLASS_HUB && dev->nports)
+    {
+      ctx[0] |= grub_cpu_to_le32 (GRUB_XHCI_SLOT_HUB);
+      ctx[1] = grub_cpu_to_le32 ((grub_le_to_cpu32 (ctx[1]) & 0x00ffffff)
+				 | (dev->nports
+				    << GRUB_XHCI_SLOT_NPORTS_SHIFT));
+    }
+
+  ctx = grub_xhci_ctx (x, slot->in, 1 + dci);
+  ctx[0] = grub_cpu_to_le32 (interval << GRUB_XHCI_EP_INTERVAL_SHIFT);
+  ctx[1] = grub_cpu_to_le32 ((type == GRUB_XHCI_EP_TYPE_ISOCH_OUT
+			      || type == GRUB_XHCI_EP_TYPE_ISOCH_OUT + 4
+			      ? 0 : 3 << GRUB_XHCI_EP_CERR_SHIFT)
+			     | (type << GRUB_XHCI_EP_TYPE_SHIFT)
+			     | (burst << GRUB_XHCI_EP_BURST_SHIFT)
+			     | (mps << GRUB_XHCI_EP_MPS_SHIFT));
+  ctx[2] = grub_cpu_to_le32 (ring->phys | ring->cycle);
+  ctx[3] = 0;
+  if (periodic)
+    ctx[4] = grub_cpu_to_le32 (mps
+			       | ((mps * (burst + 1))
+				  << GRUB_XHCI_EP_ESIT_SHIFT));
+  else
+    ctx[4] = grub_cpu_to_le32 (3072);
+
+  if (grub_xhci_slot_command (slot, GRUB_XHCI_TRB_CONFIGURE_EP,
+			      slot->in_phys, 0) != GRUB_XHCI_CC_SUCCESS)
+    {
+      grub_xhci_ring_free (ring);
+      return GRUB_USB_ERR_INTERNAL;
+    }
+
+  grub_dprintf ("xhci", "slot %u: configured dci %u type %u mps %u burst %u"
+		" interval %u\n", slot->id, dci, type, mps, burst, interval);
+  slot->rings[dci] = ring;
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Full speed devices tell their control endpoint packet size only in
+   the device descriptor, which was read with the minimum of 8.  */
+static grub_usb_err_t
+grub_xhci_update_ep0 (struct grub_xhci_slot *slot, unsigned mps)
+{
+  struct grub_xhci *x = slot->x;
+  volatile grub_uint32_t *ctx;
+
+  grub_memset ((void *) slot->in, 0, 33 * x->ctxsize);
+  slot->in[1] = grub_cpu_to_le32 (1 << 1);
+  ctx = grub_xhci_ctx (x, slot->in, 2);
+  ctx[1] = grub_cpu_to_le32 ((3 << GRUB_XHCI_EP_CERR_SHIFT)
+			     | (GRUB_XHCI_EP_TYPE_CONTROL
+				<< GRUB_XHCI_EP_TYPE_SHIFT)
+			     | (mps << GRUB_XHCI_EP_MPS_SHIFT));
+
+  if (grub_xhci_slot_command (slot, GRUB_XHCI_TRB_EVALUATE_CONTEXT,
+			      slot->in_phys, 0) != GRUB_XHCI_CC_SUCCESS)
+    return GRUB_USB_ERR_INTERNAL;
+  slot->ep0_mps = mps;
+  return GRUB_USB_ERR_NONE;
+}
+
+/* Value for the TD Size field: packets left in the TD after this TRB.  */
+static inline grub_uint32_t
+grub_xhci_td_size (grub_size_t remaining, unsigned mps)
+{
+  grub_size_t packets = (remaining + mps - 1) / mps;
+
+  return (packets > 31 ? 31 : packets) << GRUB_XHCI_TRB_TD_SIZE_SHIFT;
+}
+
+static unsigned
+grub_xhci_count_trbs (grub_uint32_t data, grub_size_t len)
+{
+  unsigned n = 0;
+  grub_uint32_t end = data + len;
+
+  while (data < end)
+    {
+      data = ALIGN_UP (data + 1, GRUB_XHCI_TRB_MAX_LEN);
+      n++;
+    }
+  return n ? : 1;
+}
+
+static grub_usb_err_t
+grub_xhci_setup_transfer (grub_usb_controller_t dev,
+			  grub_usb_transfer_t transfer)
+{
+  struct grub_xhci *x = dev->data;
+  struct grub_xhci_slot *slot = transfer->dev->hc_data;
+  struct grub_xhci_transfer_controller_data *cdata;
+  struct grub_xhci_ring *ring;
+  grub_uint32_t data = 0, first, control, trt = 0;
+  grub_size_t len, offset;
+  unsigned dci, ndata, mps, n = 0;
+  int in, is_control = transfer->type == GRUB_USB_TRANSACTION_TYPE_CONTROL;
+  grub_usb_err_t err;
+
+  if (!slot || !slot->id)
+    return GRUB_USB_ERR_BADDEVICE;
+
+  if (is_control)
+    {
+      dci = 1;
+      len = transfer->size;
+      in = !!(transfer->setup->reqtype & 0x80);
+      if (len)
+	data = transfer->transactions[1].data;
+      if (transfer->dev->speed == GRUB_USB_SPEED_FULL
+	  && transfer->dev->descdev.maxsize0
+	  && transfer->dev->descdev.maxsize0 != slot->ep0_mps)
+	{
+	  err = grub_xhci_update_ep0 (slot, transfer->dev->descdev.maxsize0);
+	  if (err)
+	    return err;
+	}
+      mps = slot->ep0_mps;
+    }
+  else
+    {
+      in = transfer->dir == GRUB_USB_TRANSFER_TYPE_IN;
+      dci = grub_usb_ep_index (transfer->endpoint);
+      len = transfer->size + 1;
+      if (len)
+	data = transfer->transactions[0].data;
+      mps = transfer->max ? : 64;
+      if (!slot->rings[dci])
+	{
+	  err = grub_xhci_configure_ep (slot, transfer->dev,
+					transfer->endpoint, dci);
+	  if (err)
+	    return err;
+	}
+    }
+  ring = slot->rings[dci];
+
+  ndata = (len || !is_control) ? grub_xhci_count_trbs (data, len) : 0;
+  if (ndata + 2 > GRUB_XHCI_RING_FREE)
+    return GRUB_USB_ERR_INTERNAL;
+
+  cdata = grub_zalloc (sizeof (*cdata)
+		       + (ndata + 2) * sizeof (cdata->trbs[0]));
+  if (!cdata)
+    return GRUB_USB_ERR_INTERNAL;
+  cdata->slot = slot;
+  cdata->dci = dci;
+  cdata->control = is_control;
+
+  /* The first TRB is handed to the controller last.  */
+  first = 0;
+  if (is_control)
+    {
+      grub_uint64_t setup;
+
+      grub_memcpy (&setup, (void *) transfer->setup, sizeof (setup));
+      if (len)
+	trt = in ? 3 : 2;
+      first = grub_xhci_ring_push (ring, grub_le_to_cpu64 (setup), 8,
+				   (GRUB_XHCI_TRB_SETUP
+				    << GRUB_XHCI_TRB_TYPE_SHIFT)
+				   | GRUB_XHCI_TRB_IDT
+				   | (trt << GRUB_XHCI_TRB_TRT_SHIFT), 1);
+      cdata->trbs[n].phys = first;
+      n++;
+    }
+
+  for (offset = 0; offset < len || (offset == 0 && ndata); )
+    {
+      grub_uint32_t chunk = ALIGN_UP (data + offset + 1,
+				      GRUB_XHCI_TRB_MAX_LEN)
+	- (data + offset);
+      grub_uint32_t trb;
+
+      if (chunk > len - offset)
+	chunk = len - offset;
+
+      if (is_control && offset == 0)
+	control = (GRUB_XHCI_TRB_DATA << GRUB_XHCI_TRB_TYPE_SHIFT)
+	  | (in ? GRUB_XHCI_TRB_DIR_IN : 0);
+      else
+	control = GRUB_XHCI_TRB_NORMAL << GRUB_XHCI_TRB_TYPE_SHIFT;
+      control |= GRUB_XHCI_TRB_ISP;
+      if (offset + chunk < len)
+	control |= GRUB_XHCI_TRB_CH;
+      else if (!is_control)
+	control |= GRUB_XHCI_TRB_IOC;
+
+      trb = grub_xhci_ring_push (ring, data + offset,
+				 chunk | grub_xhci_td_size (len - offset
+							    - chunk, mps),
+				 control, !first);
+      if (!first)
+	first = trb;
+      cdata->trbs[n].phys = trb;
+      cdata->trbs[n].offset = offset;
+      cdata->trbs[n].len = chunk;
+      n++;
+      offset += chunk;
+      if (!chunk)
+	break;
+    }
+
+  if (is_control)
+    {
+      cdata->trbs[n].phys
+	= grub_xhci_ring_push (ring, 0, 0,
+			       (GRUB_XHCI_TRB_STATUS
+				<< GRUB_XHCI_TRB_TYPE_SHIFT)
+			       | GRUB_XHCI_TRB_IOC
+			       | ((!len || !in) ? GRUB_XHCI_TRB_DIR_IN : 0), 0);
+      cdata->trbs[n].offset = len;
+      n++;
+    }
+  cdata->ntrbs = n;
+
+  cdata->next = x->transfers;
+  x->transfers = cdata;
+  transfer->controller_data = cdata;
+
+  grub_xhci_ring_release (ring, first);
+  grub_xhci_doorbell (x, slot->id, dci);
+
+  return GRUB_USB_ERR_NONE;
+}
+
+static void
+grub_xhci_finish_transfer (struct grub_xhci *x,
+			   grub_usb_transfer_t transfer)
+{
+  struct grub_xhci_transfer_controller_data *cdata, **prev;
+
+  cdata = transfer->controller_data;
+  for (prev = &x->transfers; *prev; prev = &(*prev)->next)
+    if (*prev == cdata)
+      {
+	*prev = cdata->next;
+	break;
+      }
+  grub_free (cdata);
+  transfer->controller_data = NULL;
+}
+
+static grub_usb_err_t
+grub_xhci_check_transfer (grub_usb_controller_t dev,
+			  grub_usb_transfer_t transfer, grub_size_t *actual)
+{
+  struct grub_xhci *x = dev->data;
+  struct grub_xhci_transfer_controller_data *cdata;
+  grub_usb_err_t err;
+
+  cdata = transfer->controller_data;
+  grub_xhci_process_events (x);
+  if (!cdata->done)
+    return GRUB_USB_ERR_WAIT;
+
+  *actual = cdata->actual;
+  err = grub_xhci_usb_err (cdata->cc);
+  if (err)
+    {
+      grub_dprintf ("xhci", "slot %u dci %u: transfer failed, cc %u\n",
+		    cdata->slot->id, cdata->dci, cdata->cc);
+      /* The endpoint is halted, get it running again and drop the rest
+	 of the TD.  */
+      if (cdata->slot->id)
+	{
+	  grub_xhci_slot_command (cdata->slot, GRUB_XHCI_TRB_RESET_EP, 0,
+				  cdata->dci << GRUB_XHCI_TRB_EP_SHIFT);
+	  grub_xhci_skip_ring (cdata->slot, cdata->dci);
+	}
+    }
+
+  grub_xhci_finish_transfer (x, transfer);
+  return err;
+}
+
+static grub_usb_err_t
+grub_xhci_cancel_transfer (grub_usb_controller_t dev,
+			   grub_usb_transfer_t transfer)
+{
+  struct grub_xhci *x = dev->data;
+  struct grub_xhci_transfer_controller_data *cdata;
+
+  cdata = transfer->controller_data;
+  if (cdata->slot->id)
+    {
+      /* Fails harmlessly if the endpoint is already stopped or
+	 halted.  */
+      grub_xhci_slot_command (cdata->slot, GRUB_XHCI_TRB_STOP_EP, 0,
+			      cdata->dci << GRUB_XHCI_TRB_EP_SHIFT);
+      if (!cdata->done || cdata->cc != GRUB_XHCI_CC_SUCCESS)
+	grub_xhci_slot_command (cdata->slot, GRUB_XHCI_TRB_RESET_EP, 0,
+				cdata->dci << GRUB_XHCI_TRB_EP_SHIFT);
+      grub_xhci_skip_ring (cdata->slot, cdata->dci);
+    }
+
+  grub_xhci_finish_transfer (x, transfer);
+  return GRUB_USB_ERR_NONE;
+}
+
+static void
+grub_xhci_free_slot (struct grub_xhci_slot *slot)
+{
+  unsigned i;
+
+  for (i = 0; i < ARRAY_SIZE (slot->rings); i++)
+    grub_xhci_ring_free (slot->rings[i]);
+  if (slot->in_chunk)
+    grub_dma_free (slot->in_chunk);
+  if (slot->out_chunk)
+    grub_dma_free (slot->out_chunk);
+  grub_free (slot);
+}
+
+static grub_usb_err_t
+grub_xhci_attach_dev (grub_usb_controller_t ctrl, grub_usb_device_t dev)
+{
+  struct grub_xhci *x = ctrl->data;
+  struct grub_xhci_slot *slot, *parent;
+  grub_usb_device_t child, hub;
+  volatile grub_uint32_t *ctx;
+  grub_uint32_t tt = 0;
+  unsigned id;
+
+  slot = grub_zalloc (sizeof (*slot));
+  if (!slot)
+    return GRUB_USB_ERR_INTERNAL;
+  slot->x = x;
+
+  if (dev->hub)
+    {
+      parent = dev->hub->hc_data;
+      if (!parent || !parent->id || parent->depth >= 5)
+	{
+	  grub_free (slot);
+	  return GRUB_USB_ERR_BADDEVICE;
+	}
+      slot->route = parent->route
+	| ((dev->port > 15 ? 15 : dev->port) << (parent->depth * 4));
+      slot->depth = parent->depth + 1;
+      slot->rootport = parent->rootport;
+      slot->speed = grub_xhci_speed_id (dev->speed);
+
+      /* Low and full speed devices behind a high speed hub go through
+	 its transaction translator.  */
+      if (dev->speed < GRUB_USB_SPEED_HIGH)
+	for (child = dev, hub = dev->hub; hub; child = hub, hub = hub->hub)
+	  if (hub->speed == GRUB_USB_SPEED_HIGH)
+	    {
+	      tt = ((struct grub_xhci_slot *) hub->hc_data)->id
+		| (child->port << GRUB_XHCI_SLOT_TT_PORT_SHIFT);
+	      break;
+	    }
+    }
+  else
+    {
+      slot->rootport = dev->port;
+      slot->speed = GRUB_XHCI_PORTSC_SPEED (grub_xhci_port_read (x,
+								 dev->port
+								 - 1));
+      if (!slot->speed)
+	slot->speed = GRUB_XHCI_SPEED_FULL;
+      dev->speed = grub_xhci_usb_speed (slot->speed);
+    }
+
+  switch (dev->speed)
+    {
+    case GRUB_USB_SPEED_HIGH:
+      slot->ep0_mps = 64;
+      break;
+    case GRUB_USB_SPEED_SUPER:
+      slot->ep0_mps = 512;
+      break;
+    default:
+      slot->ep0_mps = 8;
+      break;
+    }
+
+  slot->in_chunk = grub_memalign_dma32 (4096, 33 * x->ctxsize);
+  slot->out_chunk = grub_memalign_dma32 (4096, 32 * x->ctxsize);
+  slot->rings[1] = grub_xhci_ring_alloc ();
+  if (!slot->in_chunk || !slot->out_chunk || !slot->rings[1])
+    {
+      grub_xhci_free_slot (slot);
+      return GRUB_USB_ERR_INTERNAL;
+    }
+  slot->in = grub_dma_get_virt (slot->in_chunk);
+  slot->in_phys = grub_dma_get_phys (slot->in_chunk);
+  slot->out = grub_dma_get_virt (slot->out_chunk);
+  slot->out_phys = grub_dma_get_phys (slot->out_chunk);
+  grub_memset ((void *) slot->in, 0, 33 * x->ctxsize);
+  grub_memset ((void *) slot->out, 0, 32 * x->ctxsize);
+
+  if (grub_xhci_command (x, 0, GRUB_XHCI_TRB_ENABLE_SLOT
+			 << GRUB_XHCI_TRB_TYPE_SHIFT, &id)
+      != GRUB_XHCI_CC_SUCCESS || !id || id > x->maxslots)
+    {
+      grub_xhci_free_slot (slot);
+      return GRUB_USB_ERR_INTERNAL;
+    }
+  slot->id = id;
+  x->slots[id] = slot;
+  x->dcbaa[id] = grub_cpu_to_le64 (slot->out_phys);
+
+  /* Add flags: the slot and the control endpoint.  */
+  slot->in[1] = grub_cpu_to_le32 ((1 << 0) | (1 << 1));
+  ctx = grub_xhci_ctx (x, slot->in, 1);
+  ctx[0] = grub_cpu_to_le32 (slot->route
+			     | (slot->speed << GRUB_XHCI_SLOT_SPEED_SHIFT)
+			     | (1 << GRUB_XHCI_SLOT_ENTRIES_SHIFT));
+  ctx[1] = grub_cpu_to_le32 (slot->rootport << GRUB_XHCI_SLOT_ROOTPORT_SHIFT);
+  ctx[2] = grub_cpu_to_le32 (tt);
+  ctx = grub_xhci_ctx (x, slot->in, 2);
+  ctx[1] = grub_cpu_to_le32 ((3 << GRUB_XHCI_EP_CERR_SHIFT)
+			     | (GRUB_XHCI_EP_TYPE_CONTROL
+				<< GRUB_XHCI_EP_TYPE_SHIFT)
+			     | (slot->ep0_mps << GRUB_XHCI_EP_MPS_SHIFT));
+  ctx[2] = grub_cpu_to_le32 (slot->rings[1]->phys | slot->rings[1]->cycle);
+  ctx[3] = 0;
+  ctx[4] = grub_cpu_to_le32 (8);
+
+  if (grub_xhci_slot_command (slot, GRUB_XHCI_TRB_ADDRESS_DEVICE,
+			      slot->in_phys, 0) != GRUB_XHCI_CC_SUCCESS)
+    {
+      grub_xhci_slot_command (slot, GRUB_XHCI_TRB_DISABLE_SLOT, 0, 0);
+      x->dcbaa[id] = 0;
+      x->slots[id] = NULL;
+      grub_xhci_free_slot (slot);
+      return GRUB_USB_ERR_BADDEVICE;
+    }
+
+  grub_dprintf ("xhci", "slot %u: port %u route %05x speed %u\n",
+		id, slot->rootport, slot->route, slot->speed);
+  dev->hc_data = slot;
+  return GRUB_USB_ERR_NONE;
+}
+
+static void
+grub_xhci_detach_dev (grub_usb_controller_t ctrl, grub_usb_device_t dev)
+{
+  struct grub_xhci *x = ctrl->data;
+  struct grub_xhci_slot *slot = dev->hc_data;
+
+  if (!slot)
+    return;
+
+  if (slot->id)
+    {
+      grub_xhci_slot_command (slot, GRUB_XHCI_TRB_DISABLE_SLOT, 0, 0);
+      x->dcbaa[slot->id] = 0;
+      x->slots[slot->id] = NULL;
+    }
+  grub_xhci_free_slot (slot);
+  dev->hc_data = NULL;
+}
+
+static int
+grub_xhci_hubports (grub_usb_controller_t dev)
+{
+  struct grub_xhci *x = dev->data;
+
+  return x->nports;
+}
+
+static grub_usb_err_t
+grub_xhci_portstatus (grub_usb_controller_t dev,
+		      unsigned int port, unsigned int enable)
+{
+  struct grub_xhci *x = dev->data;
+  grub_uint32_t portsc;
+  grub_uint64_t endtime;
+
+  portsc = grub_xhci_port_read (x, port);
+  grub_dprintf ("xhci", "portstatus: port %u portsc %08x enable %u\n",
+		port, portsc, enable);
+
+  if (!enable)
+    {
+      /* PED is write-1-to-disable.  */
+      if (portsc & GRUB_XHCI_PORTSC_PED)
+	grub_xhci_port_write (x, port, portsc, GRUB_XHCI_PORTSC_PED);
+      return GRUB_USB_ERR_NONE;
+    }
+
+  if (!(portsc & GRUB_XHCI_PORTSC_CCS))
+    return GRUB_USB_ERR_BADDEVICE;
+
+  /* USB 3 ports are enabled as soon as the link is up.  */
+  if (portsc & GRUB_XHCI_PORTSC_PED)
+    return GRUB_USB_ERR_NONE;
+
+  grub_xhci_port_write (x, port, portsc, GRUB_XHCI_PORTSC_PR);
+  endtime = grub_get_time_ms () + GRUB_XHCI_TIMEOUT_MS;
+  while (!((portsc = grub_xhci_port_read (x, port)) & GRUB_XHCI_PORTSC_PRC))
+    if (grub_get_time_ms () > endtime)
+      return GRUB_USB_ERR_TIMEOUT;
+  grub_xhci_port_write (x, port, portsc,
+			GRUB_XHCI_PORTSC_PRC | GRUB_XHCI_PORTSC_PEC);
+
+  if (!(portsc & GRUB_XHCI_PORTSC_PED))
+    return GRUB_USB_ERR_BADDEVICE;
+
+  grub_dprintf ("xhci", "portstatus: port %u enabled, portsc %08x\n",
+		port, portsc);
+  return GRUB_USB_ERR_NONE;
+}
+
+static grub_usb_speed_t
+grub_xhci_detect_dev (grub_usb_controller_t dev, int port, int *changed)
+{
+  struct grub_xhci *x = dev->data;
+  grub_uint32_t portsc;
+
+  portsc = grub_xhci_port_read (x, port);
+  if (portsc & GRUB_XHCI_PORTSC_CSC)
+    {
+      *changed = 1;
+      grub_xhci_port_write (x, port, portsc, GRUB_XHCI_PORTSC_CSC);
+    }
+  if (x->port_lost[port])
+    {
+      *changed = 1;
+      x->port_lost[port] = 0;
+    }
+
+  if (!(portsc & GRUB_XHCI_PORTSC_CCS))
+    return GRUB_USB_SPEED_NONE;
+  return grub_xhci_usb_speed (GRUB_XHCI_PORTSC_SPEED (portsc));
+}
+
+static int
+grub_xhci_iterate (grub_usb_controller_iterate_hook_t hook, void *hook_data)
+{
+  struct grub_xhci *x;
+  struct grub_usb_controller dev;
+
+  for (x = xhci; x; x = x->next)
+    {
+      dev.data = x;
+      if (hook (&dev, hook_data))
+	return 1;
+    }
+
+  return 0;
+}
+
+static grub_err_t
+grub_xhci_wait_sts (struct grub_xhci *x, grub_uint32_t mask,
+		    grub_uint32_t value)
+{
+  grub_uint64_t endtime = grub_get_time_ms () + GRUB_XHCI_TIMEOUT_MS;
+
+  while ((grub_xhci_oper_read32 (x, GRUB_XHCI_OP_USBSTS) & mask) != value)
+    if (grub_get_time_ms () > endtime)
+      return grub_error (GRUB_ERR_IO, "xHCI status timeout");
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_xhci_halt_reset (struct grub_xhci *x)
+{
+  grub_uint64_t endtime;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OP_USBCMD,
+			  grub_xhci_oper_read32 (x, GRUB_XHCI_OP_USBCMD)
+			  & ~GRUB_XHCI_CMD_RS);
+  if (grub_xhci_wait_sts (x, GRUB_XHCI_STS_HCH, GRUB_XHCI_STS_HCH))
+    return grub_errno;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OP_USBCMD, GRUB_XHCI_CMD_HCRST);
+  endtime = grub_get_time_ms () + GRUB_XHCI_TIMEOUT_MS;
+  while (grub_xhci_oper_read32 (x, GRUB_XHCI_OP_USBCMD) & GRUB_XHCI_CMD_HCRST)
+    if (grub_get_time_ms () > endtime)
+      return grub_error (GRUB_ERR_IO, "xHCI reset timeout");
+  return grub_xhci_wait_sts (x, GRUB_XHCI_STS_CNR, 0);
+}
+
+static grub_err_t
+grub_xhci_start (struct grub_xhci *x)
+{
+  unsigned i;
+
+  if (grub_xhci_halt_reset (x))
+    return grub_errno;
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OP_CONFIG, x->maxslots);
+
+  grub_memset ((void *) x->dcbaa, 0, (x->maxslots + 1) * sizeof (x->dcbaa[0]));
+  if (x->nscratch)
+    x->dcbaa[0] = grub_cpu_to_le64 (grub_dma_get_phys (x->scratch_chunk));
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OP_DCBAAP_LO, x->dcbaa_phys);
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OP_DCBAAP_HI, 0);
+
+  grub_xhci_ring_reset (&x->cmd, 1);
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OP_CRCR_LO, x->cmd.phys | x->cmd.cycle);
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OP_CRCR_HI, 0);
+
+  grub_xhci_ring_reset (&x->event, 0);
+  x->erst->base = grub_cpu_to_le64 (x->event.phys);
+  x->erst->size = grub_cpu_to_le32 (GRUB_XHCI_RING_TRBS);
+  x->erst->reserved = 0;
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERSTSZ, 1);
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERDP_LO, x->event.phys);
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERDP_HI, 0);
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERSTBA_LO,
+			grub_dma_get_phys (x->erst_chunk));
+  grub_xhci_rt_write32 (x, GRUB_XHCI_IR_ERSTBA_HI, 0);
+
+  grub_xhci_oper_write32 (x, GRUB_XHCI_OP_USBCMD, GRUB_XHCI_CMD_RS);
+  if (grub_xhci_wait_sts (x, GRUB_XHCI_STS_HCH, 0))
+    return grub_errno;
+
+  if (x->hccparams1 & GRUB_XHCI_HCC1_PPC)
+    for (i = 0; i < x->nports; i++)
+      {
+	grub_uint32_t portsc = grub_xhci_port_read (x, i);
+
+	if (!(portsc & GRUB_XHCI_PORTSC_PP))
+	  grub_xhci_port_write (x, i, portsc, GRUB_XHCI_PORTSC_PP);
+      }
+
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_xhci_free (struct grub_xhci *x)
+{
+  unsigned i;
+
+  if (x->scratch_bufs)
+    for (i = 0; i < x->nscratch; i++)
+      if (x->scratch_bufs[i])
+	grub_dma_free (x->scratch_bufs[i]);
+  grub_free (x->scratch_bufs);
+  if (x->scratch_chunk)
+    grub_dma_free (x->scratch_chunk);
+  if (x->dcbaa_chunk)
+    grub_dma_free (x->dcbaa_chunk);
+  if (x->cmd.chunk)
+    grub_dma_free (x->cmd.chunk);
+  if (x->event.chunk)
+    grub_dma_free (x->event.chunk);
+  if (x->erst_chunk)
+    grub_dma_free (x->erst_chunk);
+  grub_free (x);
+}
+
+static grub_err_t
+grub_xhci_alloc (struct grub_xhci *x)
+{
+  grub_uint32_t pagesize;
+  volatile grub_uint64_t *scratch;
+  unsigned i;
+
+  x->dcbaa_chunk = grub_memalign_dma32 (4096, (x->maxslots + 1)
+					* sizeof (x->dcbaa[0]));
+  if (!x->dcbaa_chunk)
+    return grub_errno;
+  x->dcbaa = grub_dma_get_virt (x->dcbaa_chunk);
+  x->dcbaa_phys = grub_dma_get_phys (x->dcbaa_chunk);
+
+  /* PAGESIZE bit N means pages of 2^(N + 12) bytes.  */
+  pagesize = grub_xhci_oper_read32 (x, GRUB_XHCI_OP_PAGESIZE) & 0xffff;
+  pagesize = pagesize ? (pagesize & -pagesize) << 12 : 4096;
+
+  if (x->nscratch)
+    {
+      x->scratch_chunk = grub_memalign_dma32 (pagesize, x->nscratch
+					      * sizeof (grub_uint64_t));
+      x->scratch_bufs = grub_zalloc (x->nscratch
+				     * sizeof (x->scratch_bufs[0]));
+      if (!x->scratch_chunk || !x->scratch_bufs)
+	return grub_errno;
+      scratch = grub_dma_get_virt (x->scratch_chunk);
+      for (i = 0; i < x->nscratch; i++)
+	{
+	  x->scratch_bufs[i] = grub_memalign_dma32 (pagesize, pagesize);
+	  if (!x->scratch_bufs[i])
+	    return grub_errno;
+	  grub_memset ((void *) grub_dma_get_virt (x->scratch_bufs[i]), 0,
+		       pagesize);
+	  scratch[i] = grub_cpu_to_le64 (grub_dma_get_phys (x->scratch_bufs[i]));
+	}
+    }
+
+  if (grub_xhci_ring_init (&x->cmd, 1) || grub_xhci_ring_init (&x->event, 0))
+    return grub_errno;
+
+  x->erst_chunk = grub_memalign_dma32 (64, sizeof (*x->erst));
+  if (!x->erst_chunk)
+    return grub_errno;
+  x->erst = grub_dma_get_virt (x->erst_chunk);
+
+  return GRUB_ERR_NONE;
+}
+
+/* Take the controller away from the BIOS.  */
+static void
+grub_xhci_bios_handoff (struct grub_xhci *x)
+{
+  grub_uint32_t offset, cap;
+  volatile grub_uint32_t *legsup;
+  grub_uint64_t endtime;
+
+  offset = GRUB_XHCI_HCC1_XECP (x->hccparams1) * 4;
+  while (offset)
+    {
+      legsup = (volatile grub_uint32_t *) (x->cap + offset);
+      cap = grub_le_to_cpu32 (*legsup);
+      if (GRUB_XHCI_XECP_ID (cap) == GRUB_XHCI_XECP_LEGACY)
+	break;
+      if (!GRUB_XHCI_XECP_NEXT (cap))
+	return;
+      offset += GRUB_XHCI_XECP_NEXT (cap) * 4;
+    }
+  if (!offset)
+    return;
+
+  if (cap & GRUB_XHCI_LEGACY_BIOS_OWNED)
+    {
+      grub_boot_time ("Taking ownership of xHCI controller");
+      *legsup = grub_cpu_to_le32 (cap | GRUB_XHCI_LEGACY_OS_OWNED);
+      endtime = grub_get_time_ms () + 1000;
+      while ((grub_le_to_cpu32 (*legsup) & GRUB_XHCI_LEGACY_BIOS_OWNED)
+	     && grub_get_time_ms () < endtime);
+      if (grub_le_to_cpu32 (*legsup) & GRUB_XHCI_LEGACY_BIOS_OWNED)
+	{
+	  grub_dprintf ("xhci", "BIOS didn't release the controller\n");
+	  *legsup = grub_cpu_to_le32 (GRUB_XHCI_LEGACY_OS_OWNED);
+	}
+    }
+  else
+    *legsup = grub_cpu_to_le32 (cap | GRUB_XHCI_LEGACY_OS_OWNED);
+
+  /* Disable SMIs and acknowledge pending ones.  */
+  legsup[1] = grub_cpu_to_le32 ((grub_le_to_cpu32 (legsup[1])
+				 & GRUB_XHCI_LEGACY_SMI_KEEP)
+				| GRUB_XHCI_LEGACY_SMI_EVENTS);
+}
+
+static int
+grub_xhci_pci_iter (grub_pci_device_t dev,
+		    grub_pci_id_t pciid __attribute__ ((unused)),
+		    void *data __attribute__ ((unused)))
+{
+  struct grub_xhci *x;
+  grub_pci_address_t addr;
+  grub_uint32_t class, bar, base;
+  volatile grub_uint8_t *regs;
+  grub_uint32_t caplength, hcs1, hcs2, dboff, rtsoff, size;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
+  class = grub_pci_read (addr);
+
+  /* Serial bus controller, USB, xHCI.  */
+  if (class >> 8 != 0x0c0330)
+    return 0;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  bar = grub_pci_read (addr);
+  if ((bar & GRUB_PCI_ADDR_SPACE_MASK) != GRUB_PCI_ADDR_SPACE_MEMORY)
+    return 0;
+  if ((bar & GRUB_PCI_ADDR_MEM_TYPE_MASK) == GRUB_PCI_ADDR_MEM_TYPE_64)
+    {
+      addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG1);
+      if (grub_pci_read (addr))
+	{
+	  grub_dprintf ("xhci", "dev: %x:%x.%x: registers above 4GiB\n",
+			dev.bus, dev.device, dev.function);
+	  return 0;
+	}
+    }
+  base = bar & GRUB_PCI_ADDR_MEM_MASK;
+  if (!base)
+    return 0;
+
+  /* Set bus master - needed for coreboot, VMware, broken BIOSes etc. */
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, grub_pci_read_word (addr)
+		       | GRUB_PCI_COMMAND_MEM_ENABLED
+		       | GRUB_PCI_COMMAND_BUS_MASTER);
+
+  regs = grub_pci_device_map_range (dev, base, GRUB_XHCI_CAP_SIZE);
+  caplength = regs[GRUB_XHCI_CAP_CAPLENGTH];
+  hcs1 = grub_le_to_cpu32 (*(volatile grub_uint32_t *)
+			   (regs + GRUB_XHCI_CAP_HCSPARAMS1));
+  hcs2 = grub_le_to_cpu32 (*(volatile grub_uint32_t *)
+			   (regs + GRUB_XHCI_CAP_HCSPARAMS2));
+  dboff = grub_le_to_cpu32 (*(volatile grub_uint32_t *)
+			    (regs + GRUB_XHCI_CAP_DBOFF)) & ~3;
+  rtsoff = grub_le_to_cpu32 (*(volatile grub_uint32_t *)
+			     (regs + GRUB_XHCI_CAP_RTSOFF)) & ~0x1f;
+
+  size = caplength + GRUB_XHCI_OP_PORTSC
+    + 0x10 * GRUB_XHCI_HCS1_MAX_PORTS (hcs1);
+  if (size < rtsoff + GRUB_XHCI_IR_ERDP_HI + 4)
+    size = rtsoff + GRUB_XHCI_IR_ERDP_HI + 4;
+  if (size < dboff + 4 * (GRUB_XHCI_HCS1_MAX_SLOTS (hcs1) + 1))
+    size = dboff + 4 * (GRUB_XHCI_HCS1_MAX_SLOTS (hcs1) + 1);
+  regs = grub_pci_device_map_range (dev, base, size);
+
+  x = grub_zalloc (sizeof (*x));
+  if (!x)
+    return 1;
+  x->cap = regs;
+  x->oper = (volatile grub_uint32_t *) (regs + caplength);
+  x->runtime = regs + rtsoff;
+  x->db = (volatile grub_uint32_t *) (regs + dboff);
+  x->maxslots = GRUB_XHCI_HCS1_MAX_SLOTS (hcs1);
+  x->nports = GRUB_XHCI_HCS1_MAX_PORTS (hcs1);
+  x->nscratch = GRUB_XHCI_HCS2_MAX_SCRATCH (hcs2);
+  x->hccparams1 = grub_xhci_cap_read32 (x, GRUB_XHCI_CAP_HCCPARAMS1);
+  x->ctxsize = (x->hccparams1 & GRUB_XHCI_HCC1_CSZ) ? 64 : 32;
+
+  grub_dprintf ("xhci", "dev: %x:%x.%x, version %x, %u slots, %u ports,"
+		" %u scratchpads, %u byte contexts\n",
+		dev.bus, dev.device, dev.function,
+		grub_le_to_cpu16 (*(volatile grub_uint16_t *) (regs + 2)),
+		x->maxslots, x->nports, x->nscratch, x->ctxsize);
+
+  grub_xhci_bios_handoff (x);
+
+  if (grub_xhci_alloc (x) || grub_xhci_start (x))
+    {
+      grub_dprintf ("xhci", "couldn't start controller: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      grub_xhci_free (x);
+      return 0;
+    }
+
+  x->next = xhci;
+  xhci = x;
+
+  return 0;
+}
+
+static grub_err_t
+grub_xhci_fini_hw (int noreturn __attribute__ ((unused)))
+{
+  struct grub_xhci *x;
+
+  /* Stop all DMA before the OS takes over.  */
+  for (x = xhci; x; x = x->next)
+    {
+      grub_xhci_halt_reset (x);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_xhci_restore_hw (void)
+{
+  struct grub_xhci *x;
+  struct grub_xhci_transfer_controller_data *cdata;
+  unsigned i;
+
+  for (x = xhci; x; x = x->next)
+    {
+      if (grub_xhci_start (x))
+	grub_print_error ();
+
+      /* The reset disabled all device slots.  Fail what was in flight
+	 and have the ports enumerated again.  */
+      for (cdata = x->transfers; cdata; cdata = cdata->next)
+	{
+	  cdata->done = 1;
+	  cdata->cc = GRUB_XHCI_CC_INVALID;
+	}
+      for (i = 1; i <= x->maxslots; i++)
+	if (x->slots[i])
+	  {
+	    x->slots[i]->id = 0;
+	    x->slots[i] = NULL;
+	  }
+      for (i = 0; i < x->nports; i++)
+	x->port_lost[i] = 1;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static struct grub_usb_controller_dev usb_controller = {
+  .name = "xhci",
+  .iterate = grub_xhci_iterate,
+  .setup_transfer = grub_xhci_setup_transfer,
+  .check_transfer = grub_xhci_check_transfer,
+  .cancel_transfer = grub_xhci_cancel_transfer,
+  .hubports = grub_xhci_hubports,
+  .portstatus = grub_xhci_portstatus,
+  .detect_dev = grub_xhci_detect_dev,
+  .attach_dev = grub_xhci_attach_dev,
+  .detach_dev = grub_xhci_detach_dev,
+  /* One bulk transfer takes max_bulk_tds packets; 4MiB at SuperSpeed
+     still fits a transfer ring.  */
+  .max_bulk_tds = 4096
+};
+
+GRUB_MOD_INIT (xhci)
+{
+  COMPILE_TIME_ASSERT (sizeof (struct grub_xhci_trb) == 16);
+  COMPILE_TIME_ASSERT (sizeof (struct grub_xhci_erst_entry) == 16);
+
+  grub_stop_disk_firmware ();
+
+  grub_boot_time ("Initing xHCI hardware");
+  grub_pci_iterate (grub_xhci_pci_iter, NULL);
+  grub_boot_time ("Registering xHCI driver");
+  grub_usb_controller_dev_register (&usb_controller);
+  grub_boot_time ("xHCI driver registered");
+  grub_loader_register_preboot_hook (grub_xhci_fini_hw, grub_xhci_restore_hw,
+				     GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
+}
+
+GRUB_MOD_FINI (xhci)
+{
+  grub_xhci_fini_hw (0);
+  grub_usb_controller_dev_unregister (&usb_controller);
+}
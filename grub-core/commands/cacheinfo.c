@@ -30,33 +30,65 @@ grub_rescue_cmd_info (struct grub_command *cmd __attribute__ ((unused)),
     int argc __attribute__ ((unused)),
     char *argv[] __attribute__ ((unused)))
 {
-  unsigned long hits, misses;
+  unsigned long hits, misses, evictions;
 
-  grub_disk_cache_get_performance (&hits, &misses);
+  grub_disk_cache_get_performance (&hits, &misses, &evictions);
   if (hits + misses)
     {
       unsigned long ratio = hits * 10000 / (hits + misses);
-      grub_printf ("(%lu.%lu%%)\n", ratio / 100, ratio % 100);
       grub_printf_ (N_("Disk cache statistics: hits = %lu (%lu.%02lu%%),"
-		     " misses = %lu\n"), ratio / 100, ratio % 100,
-		    hits, misses);
+		     " misses = %lu, evictions = %lu\n"),
+		    hits, ratio / 100, ratio % 100, misses, evictions);
     }
   else
-    grub_printf ("%s\n", _("No disk cache statistics available\n"));    
+    grub_printf ("%s\n", _("No disk cache statistics available\n"));
+
+  if (grub_disk_cache_sets)
+    grub_printf_ (N_("Disk cache size: %u sets of %u entries (%u KiB)\n"),
+		  grub_disk_cache_sets, GRUB_DISK_CACHE_WAYS,
+		  (grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS)
+		  << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - 10));
 
  return 0;
 }
 
-static grub_command_t cmd_cacheinfo;
+static grub_err_t
+grub_rescue_cmd_readahead (struct grub_command *cmd __attribute__ ((unused)),
+			   int argc __attribute__ ((unused)),
+			   char *argv[] __attribute__ ((unused)))
+{
+  unsigned long requests, units, hits;
+
+  grub_disk_readahead_get_performance (&requests, &units, &hits);
+  if (units)
+    {
+      unsigned long ratio = hits * 10000 / units;
+      grub_printf_ (N_("Disk read-ahead statistics: requests = %lu,"
+		       " units = %lu (%lu KiB), used = %lu (%lu.%02lu%%)\n"),
+		    requests, units,
+		    units << (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - 10),
+		    hits, ratio / 100, ratio % 100);
+    }
+  else
+    grub_printf ("%s\n", _("No disk read-ahead statistics available"));
+
+  return 0;
+}
+
+static grub_command_t cmd_cacheinfo, cmd_readahead;
 
 GRUB_MOD_INIT(cacheinfo)
 {
   cmd_cacheinfo =
     grub_register_command ("cacheinfo", grub_rescue_cmd_info,
 			   0, N_("Get disk cache info."));
+  cmd_readahead =
+    grub_register_command ("disk_readahead", grub_rescue_cmd_readahead,
+			   0, N_("Get disk read-ahead info."));
 }
 
 GRUB_MOD_FINI(cacheinfo)
 {
   grub_unregister_command (cmd_cacheinfo);
+  grub_unregister_command (cmd_readahead);
 }
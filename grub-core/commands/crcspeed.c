@@ -0,0 +1,154 @@
+/* crcspeed.c - measure checksum throughput  */
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/misc.h>
+#include <grub/dl.h>
+#include <grub/extcmd.h>
+#include <grub/i18n.h>
+#include <grub/normal.h>
+#include <grub/crypto.h>
+#include <grub/lib/crc.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+#define DEFAULT_BLOCK_SIZE	65536
+/* Keep each checksum running at least this long so that the millisecond
+   timer gives a usable figure.  */
+#define MIN_DURATION_MS		500
+
+static const char *default_names[] = { "crc32c", "crc32", "crc64" };
+
+static const struct grub_arg_option options[] =
+  {
+    {"size", 's', 0, N_("Specify size for each checksum update"), 0,
+     ARG_TYPE_INT},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+static grub_err_t
+crcspeed_one (const char *name, const grub_uint8_t *buffer,
+	      grub_size_t block_size)
+{
+  const gcry_md_spec_t *hash = NULL;
+  const char *impl = NULL;
+  void *context = NULL;
+  grub_uint64_t start, elapsed, total_size = 0;
+  grub_uint32_t crc32c = 0;
+
+  if (grub_strcmp (name, "crc32c") == 0)
+    {
+      if (block_size > GRUB_INT_MAX)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+      impl = grub_getcrc32c_impl ();
+    }
+  else
+    {
+      hash = grub_crypto_lookup_md_by_name (name);
+      if (!hash)
+	return grub_error (GRUB_ERR_BAD_ARGUMENT,
+			   N_("unknown hash `%s'"), name);
+      context = grub_zalloc (hash->contextsize);
+      if (!context)
+	return grub_errno;
+      hash->init (context);
+    }
+
+  start = grub_get_time_ms ();
+  do
+    {
+      int i;
+
+      for (i = 0; i < 16; i++)
+	{
+	  if (hash)
+	    hash->write (context, buffer, block_size);
+	  else
+	    crc32c = grub_getcrc32c (crc32c, buffer, block_size);
+	}
+      total_size += 16 * block_size;
+      elapsed = grub_get_time_ms () - start;
+    }
+  while (elapsed < MIN_DURATION_MS);
+
+  if (hash)
+    {
+      hash->final (context);
+      grub_free (context);
+    }
+
+  if (impl)
+    grub_printf ("%s (%s): ", name, impl);
+  else
+    grub_printf ("%s: ", name);
+  grub_printf ("%s\n",
+	       grub_get_human_size (grub_divmod64 (total_size * 100ULL * 1000ULL,
+						   elapsed, 0),
+				    GRUB_HUMAN_SIZE_SPEED));
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_cmd_crcspeed (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  grub_ssize_t block_size;
+  grub_uint8_t *buffer;
+  grub_size_t i;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  block_size = (state[0].set) ?
+    grub_strtoul (state[0].arg, 0, 0) : DEFAULT_BLOCK_SIZE;
+
+  if (block_size <= 0)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+
+  buffer = grub_malloc (block_size);
+  if (buffer == NULL)
+    return grub_errno;
+  for (i = 0; i < (grub_size_t) block_size; i++)
+    buffer[i] = i * 0x9d + (i >> 8);
+
+  if (argc == 0)
+    for (i = 0; i < ARRAY_SIZE (default_names) && !err; i++)
+      err = crcspeed_one (default_names[i], buffer, block_size);
+  else
+    for (i = 0; i < (grub_size_t) argc && !err; i++)
+      err = crcspeed_one (args[i], buffer, block_size);
+
+  grub_free (buffer);
+
+  return err;
+}
+
+static grub_extcmd_t cmd;
+
+GRUB_MOD_INIT(crcspeed)
+{
+  cmd = grub_register_extcmd ("crcspeed", grub_cmd_crcspeed, 0,
+			      N_("[-s SIZE] [CHECKSUM...]"),
+			      N_("Measure checksum throughput."),
+			      options);
+}
+
+GRUB_MOD_FINI(crcspeed)
+{
+  grub_unregister_extcmd (cmd);
+}
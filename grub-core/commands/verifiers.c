@@ -21,33 +21,156 @@
 #include <grub/file.h>
 #include <grub/verify.h>
 #include <grub/dl.h>
+#include <grub/i18n.h>
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
 struct grub_file_verifier *grub_file_verifiers;
 
+/* A verifier that has been set up for one file.  */
+struct grub_verifier_ctx
+{
+  struct grub_file_verifier *ver;
+  void *context;
+  enum grub_verify_flags flags;
+};
+
 struct grub_verified
 {
   grub_file_t file;
+  /* The whole verified file, or NULL when streaming.  */
   void *buf;
+
+  /* Streaming: the verifiers still hashing the file as it is read, and
+     how much of it they have seen.  */
+  struct grub_verifier_ctx *vers;
+  unsigned nvers;
+  grub_off_t hashed;
 };
 typedef struct grub_verified *grub_verified_t;
 
+static void
+verifiers_close (struct grub_verifier_ctx *vers, unsigned nvers)
+{
+  unsigned i;
+
+  for (i = 0; i < nvers; i++)
+    if (vers[i].ver->close)
+      vers[i].ver->close (vers[i].context);
+  grub_free (vers);
+}
+
+static grub_err_t
+verifiers_write (struct grub_verifier_ctx *vers, unsigned nvers,
+		 void *buf, grub_size_t size)
+{
+  grub_err_t err;
+  unsigned i;
+
+  for (i = 0; i < nvers; i++)
+    {
+      err = vers[i].ver->write (vers[i].context, buf, size);
+      if (err)
+	return err;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+verifiers_fini (struct grub_verifier_ctx *vers, unsigned nvers)
+{
+  grub_err_t err;
+  unsigned i;
+
+  for (i = 0; i < nvers; i++)
+    {
+      err = vers[i].ver->fini ? vers[i].ver->fini (vers[i].context)
+	: GRUB_ERR_NONE;
+      if (err)
+	return err;
+    }
+  return GRUB_ERR_NONE;
+}
+
 static void
 verified_free (grub_verified_t verified)
 {
   if (verified)
     {
+      verifiers_close (verified->vers, verified->nvers);
       grub_free (verified->buf);
       grub_free (verified);
     }
 }
 
+/* Feed the verifiers LEN bytes read straight into the caller's BUF.  The
+   data is handed out before the file as a whole is verified; the read
+   that reaches the end of the file fails if verification does, so callers
+   must only open files this way if they read them in order and give up on
+   any error.  */
+static grub_ssize_t
+verified_stream_read (struct grub_file *file, char *buf, grub_size_t len)
+{
+  grub_verified_t verified = file->data;
+  grub_ssize_t r;
+  grub_err_t err;
+
+  if (!verified->vers)
+    {
+      grub_error (GRUB_ERR_ACCESS_DENIED,
+		  N_("verification of %s failed earlier"), file->name);
+      return -1;
+    }
+
+  if (file->offset != verified->hashed)
+    {
+      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		  N_("non-sequential read of streamed file %s"), file->name);
+      goto fail;
+    }
+
+  verified->file->offset = file->offset;
+  r = grub_file_read (verified->file, buf, len);
+  if (r != (grub_ssize_t) len)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+		    file->name);
+      goto fail;
+    }
+
+  err = verifiers_write (verified->vers, verified->nvers, buf, len);
+  if (err)
+    goto fail;
+  verified->hashed += len;
+
+  if (verified->hashed == file->size)
+    {
+      err = verifiers_fini (verified->vers, verified->nvers);
+      verifiers_close (verified->vers, verified->nvers);
+      verified->vers = NULL;
+      verified->nvers = 0;
+      if (err)
+	return -1;
+    }
+
+  return len;
+
+ fail:
+  verifiers_close (verified->vers, verified->nvers);
+  verified->vers = NULL;
+  verified->nvers = 0;
+  return -1;
+}
+
 static grub_ssize_t
 verified_read (struct grub_file *file, char *buf, grub_size_t len)
 {
   grub_verified_t verified = file->data;
 
+  if (!verified->buf)
+    return verified_stream_read (file, buf, len);
+
   grub_memcpy (buf, (char *) verified->buf + file->offset, len);
   return len;
 }
@@ -80,10 +203,14 @@ grub_verifiers_open (grub_file_t io, enum grub_file_type type)
 {
   grub_verified_t verified = NULL;
   struct grub_file_verifier *ver;
+  struct grub_verifier_ctx *vers = NULL;
+  unsigned nvers = 0, i;
   void *context;
   grub_file_t ret = 0;
   grub_err_t err;
   int defer = 0;
+  int stream;
+  enum grub_verify_flags flags = 0;
 
   grub_dprintf ("verify", "file: %s type: %d\n", io->name, type);
 
@@ -99,10 +226,10 @@ grub_verifiers_open (grub_file_t io, enum grub_file_type type)
 
   FOR_LIST_ELEMENTS(ver, grub_file_verifiers)
     {
-      enum grub_verify_flags flags = 0;
+      flags = 0;
       err = ver->init (io, type, &context, &flags);
       if (err)
-	goto fail_noclose;
+	goto fail;
       if (flags & GRUB_VERIFY_FLAGS_DEFER_AUTH)
 	{
 	  defer = 1;
@@ -118,13 +245,54 @@ grub_verifiers_open (grub_file_t io, enum grub_file_type type)
 	{
 	  grub_error (GRUB_ERR_ACCESS_DENIED,
 		      N_("verification requested but nobody cares: %s"), io->name);
-	  goto fail_noclose;
+	  goto fail;
 	}
 
       /* No verifiers wanted to verify. Just return underlying file. */
       return io;
     }
 
+  /* Set up every verifier that wants to see this file.  */
+  for (;;)
+    {
+      struct grub_verifier_ctx *nvers_buf;
+
+      nvers_buf = grub_realloc (vers, (nvers + 1) * sizeof (vers[0]));
+      if (!nvers_buf)
+	{
+	  if (ver->close)
+	    ver->close (context);
+	  goto fail;
+	}
+      vers = nvers_buf;
+      vers[nvers].ver = ver;
+      vers[nvers].context = context;
+      vers[nvers].flags = flags;
+      nvers++;
+
+      for (ver = ver->next; ver; ver = ver->next)
+	{
+	  flags = 0;
+	  err = ver->init (io, type, &context, &flags);
+	  if (err)
+	    goto fail;
+	  if (!(flags & GRUB_VERIFY_FLAGS_SKIP_VERIFICATION ||
+		/* Verification done earlier. So, we are happy here. */
+		flags & GRUB_VERIFY_FLAGS_DEFER_AUTH))
+	    break;
+	}
+      if (!ver)
+	break;
+    }
+
+  /* Hash the file as the caller reads it if it asked for that and none of
+     the verifiers needs the whole file at once.  */
+  stream = ((type & GRUB_FILE_TYPE_VERIFY_STREAM) && io->size != 0
+	    && io->size != GRUB_FILE_SIZE_UNKNOWN);
+  for (i = 0; i < nvers; i++)
+    if (vers[i].flags & GRUB_VERIFY_FLAGS_SINGLE_CHUNK)
+      stream = 0;
+
   ret = grub_malloc (sizeof (*ret));
   if (!ret)
     {
@@ -134,15 +302,27 @@ grub_verifiers_open (grub_file_t io, enum grub_file_type type)
 
   ret->fs = &verified_fs;
   ret->not_easily_seekable = 0;
-  if (ret->size >> (sizeof (grub_size_t) * GRUB_CHAR_BIT - 1))
+  verified = grub_zalloc (sizeof (*verified));
+  if (!verified)
     {
-      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
-		  N_("big file signature isn't implemented yet"));
       goto fail;
     }
-  verified = grub_malloc (sizeof (*verified));
-  if (!verified)
+
+  if (stream)
+    {
+      grub_dprintf ("verify", "streaming %s\n", io->name);
+      ret->not_easily_seekable = 1;
+      verified->vers = vers;
+      verified->nvers = nvers;
+      verified->file = io;
+      ret->data = verified;
+      return ret;
+    }
+
+  if (ret->size >> (sizeof (grub_size_t) * GRUB_CHAR_BIT - 1))
     {
+      grub_error (GRUB_ERR_NOT_IMPLEMENTED_YET,
+		  N_("big file signature isn't implemented yet"));
       goto fail;
     }
   verified->buf = grub_malloc (ret->size);
@@ -158,46 +338,24 @@ grub_verifiers_open (grub_file_t io, enum grub_file_type type)
       goto fail;
     }
 
-  err = ver->write (context, verified->buf, ret->size);
-  if (err)
-    goto fail;
-
-  err = ver->fini ? ver->fini (context) : GRUB_ERR_NONE;
-  if (err)
-    goto fail;
-
-  if (ver->close)
-    ver->close (context);
-
-  FOR_LIST_ELEMENTS_NEXT(ver, grub_file_verifiers)
+  for (i = 0; i < nvers; i++)
     {
-      enum grub_verify_flags flags = 0;
-      err = ver->init (io, type, &context, &flags);
-      if (err)
-	goto fail_noclose;
-      if (flags & GRUB_VERIFY_FLAGS_SKIP_VERIFICATION ||
-	  /* Verification done earlier. So, we are happy here. */
-	  flags & GRUB_VERIFY_FLAGS_DEFER_AUTH)
-	continue;
-      err = ver->write (context, verified->buf, ret->size);
+      err = verifiers_write (&vers[i], 1, verified->buf, ret->size);
       if (err)
 	goto fail;
 
-      err = ver->fini ? ver->fini (context) : GRUB_ERR_NONE;
+      err = verifiers_fini (&vers[i], 1);
       if (err)
 	goto fail;
-
-      if (ver->close)
-	ver->close (context);
     }
+  verifiers_close (vers, nvers);
 
   verified->file = io;
   ret->data = verified;
   return ret;
 
  fail:
-  ver->close (context);
- fail_noclose:
+  verifiers_close (vers, nvers);
   verified_free (verified);
   grub_free (ret);
   return NULL;
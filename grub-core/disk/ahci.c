@@ -44,12 +44,16 @@ struct grub_ahci_prdt_entry
   grub_uint32_t size;
 };
 
+/* A command of up to GRUB_AHCI_CMD_MAX_LENGTH bytes is described by at
+   most this many PRDT entries.  */
+#define GRUB_AHCI_MAX_PRDT 4
+
 struct grub_ahci_cmd_table
 {
   grub_uint8_t cfis[0x40];
   grub_uint8_t command[0x10];
   grub_uint8_t reserved[0x30];
-  struct grub_ahci_prdt_entry prdt[1];
+  struct grub_ahci_prdt_entry prdt[GRUB_AHCI_MAX_PRDT];
 };
 
 struct grub_ahci_hba_port
@@ -115,8 +119,13 @@ struct grub_ahci_received_fis
 
 enum
   {
-    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f
+    GRUB_AHCI_HBA_CAP_NPORTS_MASK = 0x1f,
+    GRUB_AHCI_HBA_CAP_NCS_MASK = 0x1f00,
+    GRUB_AHCI_HBA_CAP_SNCQ = 0x40000000,
+    GRUB_AHCI_HBA_CAP_S64A = 0x80000000,
   };
+#define GRUB_AHCI_HBA_CAP_NCS_SHIFT 8
+#define GRUB_AHCI_MAX_SLOTS 32
 
 enum
   {
@@ -148,6 +157,9 @@ struct grub_ahci_device
   struct grub_pci_dma_chunk *rfis;
   int present;
   int atapi;
+  unsigned nslots;
+  int ncq;
+  int s64a;
 };
 
 static grub_err_t 
@@ -175,6 +187,7 @@ enum
 #define GRUB_AHCI_INTERRUPT_ON_COMPLETE 0x80000000
 
 #define GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH 0x200000
+#define GRUB_AHCI_CMD_MAX_LENGTH (2 * GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH)
 
 static struct grub_ahci_device *grub_ahci_devices;
 static int numdevs;
@@ -363,6 +376,10 @@ grub_ahci_pciinit (grub_pci_device_t dev,
       adevs[i]->port = i;
       adevs[i]->present = 1;
       adevs[i]->num = numdevs++;
+      adevs[i]->nslots = ((hba->cap & GRUB_AHCI_HBA_CAP_NCS_MASK)
+			  >> GRUB_AHCI_HBA_CAP_NCS_SHIFT) + 1;
+      adevs[i]->ncq = !!(hba->cap & GRUB_AHCI_HBA_CAP_SNCQ);
+      adevs[i]->s64a = !!(hba->cap & GRUB_AHCI_HBA_CAP_S64A);
     }
 
   for (i = 0; i < nports; i++)
@@ -372,7 +389,7 @@ grub_ahci_pciinit (grub_pci_device_t dev,
 	grub_dprintf ("ahci", "port: %d, err: %x\n", adevs[i]->port,
 		      adevs[i]->hba->ports[adevs[i]->port].sata_error);
 
-	adevs[i]->command_list_chunk = grub_memalign_dma32 (1024, sizeof (struct grub_ahci_cmd_head) * 32);
+	adevs[i]->command_list_chunk = grub_memalign_dma32 (1024, sizeof (struct grub_ahci_cmd_head) * GRUB_AHCI_MAX_SLOTS);
 	if (!adevs[i]->command_list_chunk)
 	  {
 	    adevs[i] = 0;
@@ -380,7 +397,8 @@ grub_ahci_pciinit (grub_pci_device_t dev,
 	  }
 
 	adevs[i]->command_table_chunk = grub_memalign_dma32 (1024,
-							    sizeof (struct grub_ahci_cmd_table));
+							    sizeof (struct grub_ahci_cmd_table)
+							    * GRUB_AHCI_MAX_SLOTS);
 	if (!adevs[i]->command_table_chunk)
 	  {
 	    grub_dma_free (adevs[i]->command_list_chunk);
@@ -392,9 +410,9 @@ grub_ahci_pciinit (grub_pci_device_t dev,
 	adevs[i]->command_table = grub_dma_get_virt (adevs[i]->command_table_chunk);
 
 	grub_memset ((void *) adevs[i]->command_list, 0,
-		     sizeof (struct grub_ahci_cmd_table));
+		     sizeof (struct grub_ahci_cmd_head) * GRUB_AHCI_MAX_SLOTS);
 	grub_memset ((void *) adevs[i]->command_table, 0,
-		     sizeof (struct grub_ahci_cmd_head) * 32);
+		     sizeof (struct grub_ahci_cmd_table) * GRUB_AHCI_MAX_SLOTS);
 
 	adevs[i]->command_list->command_table_base
 	  = grub_dma_get_phys (adevs[i]->command_table_chunk);
@@ -462,9 +480,9 @@ grub_ahci_pciinit (grub_pci_device_t dev,
 	grub_memset ((char *) grub_dma_get_virt (adevs[i]->rfis), 0,
 		     sizeof (struct grub_ahci_received_fis));
 	grub_memset ((char *) grub_dma_get_virt (adevs[i]->command_list_chunk), 0,
-		     sizeof (struct grub_ahci_cmd_head));
+		     sizeof (struct grub_ahci_cmd_head) * GRUB_AHCI_MAX_SLOTS);
 	grub_memset ((char *) grub_dma_get_virt (adevs[i]->command_table_chunk), 0,
-		     sizeof (struct grub_ahci_cmd_table));
+		     sizeof (struct grub_ahci_cmd_table) * GRUB_AHCI_MAX_SLOTS);
 	adevs[i]->hba->ports[adevs[i]->port].fis_base = grub_dma_get_phys (adevs[i]->rfis);
 	adevs[i]->hba->ports[adevs[i]->port].command_list_base
 	  = grub_dma_get_phys (adevs[i]->command_list_chunk);
@@ -709,17 +727,23 @@ reinit_port (struct grub_ahci_device *dev)
   struct grub_pci_dma_chunk *command_table;
   grub_uint64_t endtime;
 
-  command_list = grub_memalign_dma32 (1024, sizeof (struct grub_ahci_cmd_head));
+  command_list = grub_memalign_dma32 (1024, sizeof (struct grub_ahci_cmd_head)
+				      * GRUB_AHCI_MAX_SLOTS);
   if (!command_list)
     return 1;
 
   command_table = grub_memalign_dma32 (1024,
-				       sizeof (struct grub_ahci_cmd_table));
+				       sizeof (struct grub_ahci_cmd_table)
+				       * GRUB_AHCI_MAX_SLOTS);
   if (!command_table)
     {
       grub_dma_free (command_list);
       return 1;
     }
+  grub_memset ((char *) grub_dma_get_virt (command_list), 0,
+	       sizeof (struct grub_ahci_cmd_head) * GRUB_AHCI_MAX_SLOTS);
+  grub_memset ((char *) grub_dma_get_virt (command_table), 0,
+	       sizeof (struct grub_ahci_cmd_table) * GRUB_AHCI_MAX_SLOTS);
 
   grub_dprintf ("ahci", "found device ahci%d (port %d)\n", dev->num, dev->port);
 
@@ -863,6 +887,103 @@ static const int register_map[11] = { 3 /* Features */,
 				      9 /* LBA48 mid */,
 				      10 /* LBA48 high */ }; 
 
+/* Describe SIZE bytes at PHYS in the PRDT of TABLE, which must not be
+   more than GRUB_AHCI_CMD_MAX_LENGTH.  Return the number of entries.  */
+static unsigned
+grub_ahci_fill_prdt (volatile struct grub_ahci_cmd_table *table,
+		     grub_uint64_t phys, grub_size_t size)
+{
+  unsigned n = 0;
+
+  while (size)
+    {
+      grub_size_t len = size;
+
+      if (len > GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH)
+	len = GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH;
+      table->prdt[n].data_base = phys;
+      table->prdt[n].unused = 0;
+      table->prdt[n].size = len - 1;
+      phys += len;
+      size -= len;
+      n++;
+    }
+  return n;
+}
+
+/* Whether the HBA can transfer to BUF directly instead of through a bounce
+   buffer.  Only where GRUB runs on physical addresses.  */
+static int
+grub_ahci_dma_direct (struct grub_ahci_device *dev __attribute__ ((unused)),
+		      const void *buf __attribute__ ((unused)),
+		      grub_size_t size __attribute__ ((unused)))
+{
+#if (defined (__i386__) || defined (__x86_64__)) \
+  && !defined (GRUB_MACHINE_EMU) && !defined (GRUB_MACHINE_XEN)
+  grub_uint64_t addr = (grub_addr_t) buf;
+
+  /* Data base addresses must be word aligned.  */
+  if (addr & 1)
+    return 0;
+  return dev->s64a || addr + size <= 0x100000000ULL;
+#else
+  return 0;
+#endif
+}
+
+static int
+grub_ahci_fpdma_convertible (grub_uint8_t cmd)
+{
+  return (cmd == GRUB_ATA_CMD_READ_SECTORS_DMA
+	  || cmd == GRUB_ATA_CMD_WRITE_SECTORS_DMA
+	  || cmd == GRUB_ATA_CMD_READ_SECTORS_DMA_EXT
+	  || cmd == GRUB_ATA_CMD_WRITE_SECTORS_DMA_EXT);
+}
+
+/* Build the FIS of the NCQ equivalent of the READ/WRITE DMA (EXT) command
+   in TF, using TAG.  */
+static void
+grub_ahci_set_fpdma (volatile grub_uint8_t *cfis, const grub_ata_regs_t *tf,
+		     unsigned tag)
+{
+  grub_uint64_t lba;
+  grub_uint32_t count;
+  int write;
+
+  lba = tf->lba_low | (tf->lba_mid << 8) | ((grub_uint32_t) tf->lba_high << 16);
+  if (tf->cmd == GRUB_ATA_CMD_READ_SECTORS_DMA_EXT
+      || tf->cmd == GRUB_ATA_CMD_WRITE_SECTORS_DMA_EXT)
+    {
+      lba |= ((grub_uint64_t) tf->lba48_low << 24)
+	| ((grub_uint64_t) tf->lba48_mid << 32)
+	| ((grub_uint64_t) tf->lba48_high << 40);
+      count = tf->sectors | (tf->sectors48 << 8);
+    }
+  else
+    {
+      lba |= (grub_uint64_t) (tf->disk & 0xf) << 24;
+      count = tf->sectors ? tf->sectors : 256;
+    }
+  write = (tf->cmd == GRUB_ATA_CMD_WRITE_SECTORS_DMA
+	   || tf->cmd == GRUB_ATA_CMD_WRITE_SECTORS_DMA_EXT);
+
+  /* The sector count moves to the features registers and the count
+     register carries the tag.  */
+  cfis[2] = write ? GRUB_ATA_CMD_WRITE_FPDMA_QUEUED
+    : GRUB_ATA_CMD_READ_FPDMA_QUEUED;
+  cfis[3] = count & 0xff;
+  cfis[4] = lba & 0xff;
+  cfis[5] = (lba >> 8) & 0xff;
+  cfis[6] = (lba >> 16) & 0xff;
+  cfis[7] = 0x40;
+  cfis[8] = (lba >> 24) & 0xff;
+  cfis[9] = (lba >> 32) & 0xff;
+  cfis[10] = (lba >> 40) & 0xff;
+  cfis[11] = (count >> 8) & 0xff;
+  cfis[12] = tag << 3;
+  cfis[13] = 0;
+}
+
 static grub_err_t
 grub_ahci_reset_port (struct grub_ahci_device *dev, int force)
 {
@@ -945,7 +1066,7 @@ grub_ahci_readwrite_real (struct grub_ahci_device *dev,
   if (parms->cmdsize != 0 && parms->cmdsize != 12 && parms->cmdsize != 16)
     return grub_error (GRUB_ERR_BUG, "incorrect ATAPI command size");
 
-  if (parms->size > GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH)
+  if (parms->size > GRUB_AHCI_CMD_MAX_LENGTH)
     return grub_error (GRUB_ERR_BUG, "too big data buffer");
 
   if (parms->size)
@@ -961,7 +1082,8 @@ grub_ahci_readwrite_real (struct grub_ahci_device *dev,
     = (5 << GRUB_AHCI_CONFIG_CFIS_LENGTH_SHIFT)
     //    | GRUB_AHCI_CONFIG_CLEAR_R_OK
     | (0 << GRUB_AHCI_CONFIG_PMP_SHIFT)
-    | ((parms->size ? 1 : 0) << GRUB_AHCI_CONFIG_PRDT_LENGTH_SHIFT)
+    | (ALIGN_UP (parms->size, GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH)
+       / GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH) << GRUB_AHCI_CONFIG_PRDT_LENGTH_SHIFT
     | (parms->cmdsize ? GRUB_AHCI_CONFIG_ATAPI : 0)
     | (parms->write ? GRUB_AHCI_CONFIG_WRITE : GRUB_AHCI_CONFIG_READ)
     | (parms->taskfile.cmd == 8 ? (1 << 8) : 0);
@@ -1003,9 +1125,8 @@ grub_ahci_readwrite_real (struct grub_ahci_device *dev,
 		dev->command_table[0].cfis[12], dev->command_table[0].cfis[13],
 		dev->command_table[0].cfis[14], dev->command_table[0].cfis[15]);
 
-  dev->command_table[0].prdt[0].data_base = grub_dma_get_phys (bufc);
-  dev->command_table[0].prdt[0].unused = 0;
-  dev->command_table[0].prdt[0].size = (parms->size - 1);
+  grub_ahci_fill_prdt (&dev->command_table[0], grub_dma_get_phys (bufc),
+		       parms->size);
 
   grub_dprintf ("ahci", "PRDT = %" PRIxGRUB_UINT64_T ", %x, %x (%"
 		PRIuGRUB_SIZE ")\n",
@@ -1094,6 +1215,119 @@ grub_ahci_readwrite_real (struct grub_ahci_device *dev,
   return err;
 }
 
+/* Issue COUNT commands at once, one per command slot, and wait for all of
+   them.  READ/WRITE DMA becomes READ/WRITE FPDMA QUEUED when both the HBA
+   and the device support NCQ.  */
+static grub_err_t
+grub_ahci_readwrite_queued (grub_ata_t disk,
+			    struct grub_disk_ata_pass_through_parms *parms,
+			    unsigned count)
+{
+  struct grub_ahci_device *dev = disk->data;
+  volatile struct grub_ahci_hba_port *port = &dev->hba->ports[dev->port];
+  struct grub_pci_dma_chunk *bounce[GRUB_AHCI_MAX_SLOTS];
+  grub_uint32_t mask;
+  grub_uint64_t endtime;
+  int ncq = disk->ncq;
+  unsigned i, j;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (count > dev->nslots)
+    return grub_error (GRUB_ERR_BUG, "too many queued AHCI commands");
+
+  for (i = 0; i < count; i++)
+    {
+      if (parms[i].cmdsize || !parms[i].size
+	  || parms[i].size > GRUB_AHCI_CMD_MAX_LENGTH)
+	return grub_error (GRUB_ERR_BUG, "invalid queued AHCI command");
+      if (!grub_ahci_fpdma_convertible (parms[i].taskfile.cmd))
+	ncq = 0;
+    }
+
+  grub_ahci_reset_port (dev, 0);
+  port->sata_error = port->sata_error;
+  port->intstatus = 0xffffffff;
+
+  for (i = 0; i < count; i++)
+    {
+      volatile struct grub_ahci_cmd_table *table = &dev->command_table[i];
+      grub_uint64_t phys;
+      unsigned nprdt;
+
+      if (grub_ahci_dma_direct (dev, parms[i].buffer, parms[i].size))
+	{
+	  bounce[i] = NULL;
+	  phys = (grub_addr_t) parms[i].buffer;
+	}
+      else
+	{
+	  bounce[i] = grub_memalign_dma32 (1024, parms[i].size);
+	  if (!bounce[i])
+	    {
+	      for (j = 0; j < i; j++)
+		if (bounce[j])
+		  grub_dma_free (bounce[j]);
+	      return grub_errno;
+	    }
+	  if (parms[i].write)
+	    grub_memcpy ((char *) grub_dma_get_virt (bounce[i]),
+			 parms[i].buffer, parms[i].size);
+	  phys = grub_dma_get_phys (bounce[i]);
+	}
+
+      grub_memset ((char *) table, 0, sizeof (*table));
+      table->cfis[0] = GRUB_AHCI_FIS_REG_H2D;
+      table->cfis[1] = 0x80;
+      if (ncq)
+	grub_ahci_set_fpdma (table->cfis, &parms[i].taskfile, i);
+      else
+	for (j = 0; j < sizeof (parms[i].taskfile.raw); j++)
+	  table->cfis[register_map[j]] = parms[i].taskfile.raw[j];
+      nprdt = grub_ahci_fill_prdt (table, phys, parms[i].size);
+
+      dev->command_list[i].config
+	= (5 << GRUB_AHCI_CONFIG_CFIS_LENGTH_SHIFT)
+	| (nprdt << GRUB_AHCI_CONFIG_PRDT_LENGTH_SHIFT)
+	| (parms[i].write ? GRUB_AHCI_CONFIG_WRITE : GRUB_AHCI_CONFIG_READ);
+      dev->command_list[i].transferred = 0;
+      dev->command_list[i].command_table_base
+	= grub_dma_get_phys (dev->command_table_chunk) + i * sizeof (*table);
+    }
+
+  mask = (grub_uint32_t) ((1ULL << count) - 1);
+  grub_dprintf ("ahci", "issuing %u commands%s\n", count, ncq ? " (NCQ)" : "");
+  if (ncq)
+    port->sata_active = mask;
+  port->command_issue = mask;
+
+  endtime = grub_get_time_ms () + 20000;
+  while ((port->command_issue & mask) || (ncq && (port->sata_active & mask)))
+    if (grub_get_time_ms () > endtime
+	|| (port->intstatus & GRUB_AHCI_HBA_PORT_IS_FATAL_MASK))
+      {
+	grub_dprintf ("ahci", "AHCI status <%x %x %x %x>\n",
+		      port->command_issue, port->sata_active,
+		      port->intstatus, port->task_file_data);
+	if (port->intstatus & GRUB_AHCI_HBA_PORT_IS_FATAL_MASK)
+	  err = grub_error (GRUB_ERR_IO, "AHCI transfer error");
+	else
+	  err = grub_error (GRUB_ERR_IO, "AHCI transfer timed out");
+	grub_ahci_reset_port (dev, 1);
+	break;
+      }
+
+  for (i = 0; i < count; i++)
+    if (bounce[i])
+      {
+	if (!err && !parms[i].write)
+	  grub_memcpy (parms[i].buffer,
+		       (char *) grub_dma_get_virt (bounce[i]), parms[i].size);
+	grub_dma_free (bounce[i]);
+      }
+
+  return err;
+}
+
 static grub_err_t 
 grub_ahci_readwrite (grub_ata_t disk,
 		     struct grub_disk_ata_pass_through_parms *parms,
@@ -1122,7 +1356,9 @@ grub_ahci_open (int id, int devnum, struct grub_ata *ata)
   ata->data = dev;
   ata->dma = 1;
   ata->atapi = dev->atapi;
-  ata->maxbuffer = GRUB_AHCI_PRDT_MAX_CHUNK_LENGTH;
+  ata->maxbuffer = GRUB_AHCI_CMD_MAX_LENGTH;
+  ata->queue_depth = dev->nslots;
+  ata->ncq = dev->ncq;
   ata->present = &dev->present;
 
   return GRUB_ERR_NONE;
@@ -1133,6 +1369,7 @@ static struct grub_ata_dev grub_ahci_dev =
     .iterate = grub_ahci_iterate,
     .open = grub_ahci_open,
     .readwrite = grub_ahci_readwrite,
+    .readwrite_queued = grub_ahci_readwrite_queued,
   };
 
 
@@ -168,6 +168,21 @@ grub_ata_identify (struct grub_ata *dev)
 	dev->addr = GRUB_ATA_LBA;
     }
 
+  /* NCQ commands use 48-bit addressing.  The queue depth is in word 75.  */
+  if (dev->ncq)
+    {
+      grub_uint16_t w76 = grub_le_to_cpu16 (info16[76]);
+
+      if (dev->addr == GRUB_ATA_LBA48 && w76 != 0xffff && (w76 & (1 << 8)))
+	{
+	  unsigned depth = (grub_le_to_cpu16 (info16[75]) & 0x1f) + 1;
+	  if (dev->queue_depth > depth)
+	    dev->queue_depth = depth;
+	}
+      else
+	dev->ncq = 0;
+    }
+
   /* Determine the amount of sectors.  */
   if (dev->addr != GRUB_ATA_LBA48)
     dev->size = grub_le_to_cpu32 (info32[30]);
@@ -278,6 +293,83 @@ grub_ata_setaddress (struct grub_ata *dev,
   return GRUB_ERR_NONE;
 }
 
+/* Maximum number of commands handed to readwrite_queued at once.  */
+#define GRUB_ATA_MAX_QUEUED 8
+
+static inline int
+grub_ata_can_queue (struct grub_ata *ata)
+{
+  return (ata->dev->readwrite_queued && ata->dma && ata->queue_depth > 1
+	  && ata->addr != GRUB_ATA_CHS);
+}
+
+/* Split the transfer into commands of up to ATA->maxbuffer bytes and let
+   the driver run several of them concurrently.  */
+static grub_err_t
+grub_ata_readwrite_queued (struct grub_ata *ata, grub_disk_addr_t sector,
+			   grub_size_t size, char *buf, int rw)
+{
+  struct grub_disk_ata_pass_through_parms parms[GRUB_ATA_MAX_QUEUED];
+  grub_size_t batch, max_batch;
+  unsigned depth, count;
+  int cmd;
+
+  if (ata->addr == GRUB_ATA_LBA48)
+    {
+      cmd = rw ? GRUB_ATA_CMD_WRITE_SECTORS_DMA_EXT
+	: GRUB_ATA_CMD_READ_SECTORS_DMA_EXT;
+      max_batch = 65536;
+    }
+  else
+    {
+      cmd = rw ? GRUB_ATA_CMD_WRITE_SECTORS_DMA
+	: GRUB_ATA_CMD_READ_SECTORS_DMA;
+      max_batch = 256;
+    }
+
+  batch = ata->maxbuffer >> ata->log_sector_size;
+  if (batch > max_batch)
+    batch = max_batch;
+  if (batch == 0)
+    batch = 1;
+
+  depth = ata->queue_depth;
+  if (depth > GRUB_ATA_MAX_QUEUED)
+    depth = GRUB_ATA_MAX_QUEUED;
+
+  grub_dprintf ("ata", "queued rw=%d, sector=%llu, size=%llu, depth=%u%s\n",
+		rw, (unsigned long long) sector, (unsigned long long) size,
+		depth, ata->ncq ? " (NCQ)" : "");
+
+  while (size)
+    {
+      grub_err_t err;
+
+      for (count = 0; count < depth && size; count++)
+	{
+	  grub_size_t n = size < batch ? size : batch;
+
+	  grub_memset (&parms[count], 0, sizeof (parms[count]));
+	  grub_ata_setaddress (ata, &parms[count], sector, n, ata->addr);
+	  parms[count].taskfile.cmd = cmd;
+	  parms[count].buffer = buf;
+	  parms[count].size = n << ata->log_sector_size;
+	  parms[count].write = rw;
+	  parms[count].dma = 1;
+
+	  buf += n << ata->log_sector_size;
+	  sector += n;
+	  size -= n;
+	}
+
+      err = ata->dev->readwrite_queued (ata, parms, count);
+      if (err)
+	return err;
+    }
+
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_ata_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf, int rw)
@@ -292,6 +384,9 @@ grub_ata_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
   grub_dprintf("ata", "grub_ata_readwrite (size=%llu, rw=%d)\n",
 	       (unsigned long long) size, rw);
 
+  if (grub_ata_can_queue (ata))
+    return grub_ata_readwrite_queued (ata, sector, size, buf, rw);
+
   if (addressing == GRUB_ATA_LBA48 && ((sector + size) >> 28) != 0)
     {
       if (ata->dma)
@@ -470,9 +565,23 @@ grub_ata_open (const char *name, grub_disk_t disk)
     return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an ATA harddisk");
 
   disk->total_sectors = ata->size;
-  disk->max_agglomerate = (ata->maxbuffer >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
-  if (disk->max_agglomerate > (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size)))
-    disk->max_agglomerate = (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size));
+  if (grub_ata_can_queue (ata))
+    {
+      unsigned depth = ata->queue_depth;
+
+      if (depth > GRUB_ATA_MAX_QUEUED)
+	depth = GRUB_ATA_MAX_QUEUED;
+      disk->max_agglomerate = ((ata->maxbuffer * depth)
+			       >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+      if (disk->max_agglomerate > GRUB_DISK_MAX_MAX_AGGLOMERATE)
+	disk->max_agglomerate = GRUB_DISK_MAX_MAX_AGGLOMERATE;
+    }
+  else
+    {
+      disk->max_agglomerate = (ata->maxbuffer >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS));
+      if (disk->max_agglomerate > (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size)))
+	disk->max_agglomerate = (256U >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS - ata->log_sector_size));
+    }
 
   disk->log_sector_size = ata->log_sector_size;
 
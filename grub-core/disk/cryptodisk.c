@@ -26,11 +26,18 @@
 #include <grub/file.h>
 #include <grub/procfs.h>
 #include <grub/partition.h>
+#include <grub/time.h>
 
 #ifdef GRUB_UTIL
 #include <grub/emu/hostdisk.h>
 #endif
 
+#if (defined (__i386__) || defined (__x86_64__)) && !defined (GRUB_UTIL) \
+  && !defined (GRUB_MACHINE_EMU)
+#include <grub/i386/cpuid.h>
+#define CRYPTODISK_AESNI 1
+#endif
+
 GRUB_MOD_LICENSE ("GPLv3+");
 
 grub_cryptodisk_dev_t grub_cryptodisk_list;
@@ -54,24 +61,6 @@ static inline int GF_PER_SECTOR (const struct grub_cryptodisk *dev)
 static grub_cryptodisk_t cryptodisk_list = NULL;
 static grub_uint8_t last_cryptodisk_id = 0;
 
-static void
-gf_mul_x (grub_uint8_t *g)
-{
-  int over = 0, over2 = 0;
-  unsigned j;
-
-  for (j = 0; j < GRUB_CRYPTODISK_GF_BYTES; j++)
-    {
-      over2 = !!(g[j] & 0x80);
-      g[j] <<= 1;
-      g[j] |= over;
-      over = over2;
-    }
-  if (over)
-    g[0] ^= GF_POLYNOM;
-}
-
-
 static void
 gf_mul_x_be (grub_uint8_t *g)
 {
@@ -221,6 +210,419 @@ lrw_xor (const struct lrw_sector *sec,
 		   dev->lrw_precalc, sec->low_byte * GRUB_CRYPTODISK_GF_BYTES);
 }
 
+/* Number of bytes of XTS tweaks generated at once.  */
+#define XTS_BATCH 256
+
+static inline void
+xts_next_tweak (grub_uint8_t *out, const grub_uint8_t *in)
+{
+  grub_uint64_t lo = grub_le_to_cpu64 (grub_get_unaligned64 (in));
+  grub_uint64_t hi = grub_le_to_cpu64 (grub_get_unaligned64 (in + 8));
+  grub_uint64_t carry = hi >> 63;
+
+  hi = (hi << 1) | (lo >> 63);
+  lo = (lo << 1) ^ (carry * GF_POLYNOM);
+  grub_set_unaligned64 (out, grub_cpu_to_le64 (lo));
+  grub_set_unaligned64 (out + 8, grub_cpu_to_le64 (hi));
+}
+
+#ifdef CRYPTODISK_AESNI
+
+/* Modules are built with -mno-sse, so the compiler never allocates %xmm
+   registers on its own.  Each asm statement below therefore keeps all of
+   its SSE state private: it loads from and stores to memory, wipes the
+   registers it used before returning and does not list them as clobbers
+   (which GCC refuses with SSE disabled).  */
+
+#define AESNI_MAX_ROUNDS 14
+
+#define CPUID_ECX_AES		(1 << 25)
+
+struct grub_cryptodisk_aesni
+{
+  grub_uint8_t enc[AESNI_MAX_ROUNDS + 1][16];
+  grub_uint8_t dec[AESNI_MAX_ROUNDS + 1][16];
+  grub_uint8_t tweak[AESNI_MAX_ROUNDS + 1][16];
+  unsigned long rounds;
+  unsigned long tweak_rounds;
+};
+
+/* Set by the benchmark to measure the generic code.  */
+static int aesni_disabled;
+
+static int
+aesni_supported (void)
+{
+  static int supported = -1;
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  if (supported >= 0)
+    return supported;
+
+  supported = 0;
+  if (grub_cpu_sse2_usable ())
+    {
+      grub_cpuid (1, eax, ebx, ecx, edx);
+      supported = !!(ecx & CPUID_ECX_AES);
+    }
+  return supported;
+}
+
+static grub_uint32_t
+aesni_subword (grub_uint32_t w)
+{
+  grub_uint32_t r;
+
+  asm volatile ("movd %1, %%xmm0\n\t"
+		"pshufd $0, %%xmm0, %%xmm0\n\t"
+		"aeskeygenassist $0, %%xmm0, %%xmm0\n\t"
+		"movd %%xmm0, %0\n\t"
+		"pxor %%xmm0, %%xmm0"
+		: "=r" (r) : "r" (w));
+  return r;
+}
+
+static void
+aesni_imc (grub_uint8_t *out, const grub_uint8_t *in)
+{
+  asm volatile ("movdqu (%1), %%xmm0\n\t"
+		"aesimc %%xmm0, %%xmm0\n\t"
+		"movdqu %%xmm0, (%0)\n\t"
+		"pxor %%xmm0, %%xmm0"
+		: : "r" (out), "r" (in) : "memory");
+}
+
+/* FIPS-197 key expansion, with SubWord done by AESKEYGENASSIST.  */
+static unsigned long
+aesni_expand_key (grub_uint8_t rk[][16], const grub_uint8_t *key,
+		  grub_size_t keysize)
+{
+  grub_uint32_t w[4 * (AESNI_MAX_ROUNDS + 1)];
+  grub_uint32_t t, rcon = 1;
+  unsigned nk = keysize / 4, nr = nk + 6, i;
+
+  for (i = 0; i < nk; i++)
+    w[i] = grub_le_to_cpu32 (grub_get_unaligned32 (key + 4 * i));
+  for (; i < 4 * (nr + 1); i++)
+    {
+      t = w[i - 1];
+      if (i % nk == 0)
+	{
+	  t = aesni_subword ((t >> 8) | (t << 24)) ^ rcon;
+	  rcon = (rcon << 1) ^ ((rcon & 0x80) ? 0x11b : 0);
+	}
+      else if (nk > 6 && i % nk == 4)
+	t = aesni_subword (t);
+      w[i] = w[i - nk] ^ t;
+    }
+  for (i = 0; i < 4 * (nr + 1); i++)
+    grub_set_unaligned32 (&rk[i / 4][4 * (i % 4)], grub_cpu_to_le32 (w[i]));
+  grub_memset (w, 0, sizeof (w));
+  return nr;
+}
+
+/* The round loop shared by all kernels: RK points to the first round key,
+   N holds the number of rounds minus one and the four blocks are in
+   %xmm0-%xmm3.  */
+#define AESNI_ROUNDS4(op)			\
+  "movdqu (%[rk]), %%xmm4\n\t"			\
+  "pxor %%xmm4, %%xmm0\n\t"			\
+  "pxor %%xmm4, %%xmm1\n\t"			\
+  "pxor %%xmm4, %%xmm2\n\t"			\
+  "pxor %%xmm4, %%xmm3\n\t"			\
+  "1:\n\t"					\
+  "add $16, %[rk]\n\t"				\
+  "movdqu (%[rk]), %%xmm4\n\t"			\
+  op " %%xmm4, %%xmm0\n\t"			\
+  op " %%xmm4, %%xmm1\n\t"			\
+  op " %%xmm4, %%xmm2\n\t"			\
+  op " %%xmm4, %%xmm3\n\t"			\
+  "dec %[n]\n\t"				\
+  "jnz 1b\n\t"					\
+  "movdqu 16(%[rk]), %%xmm4\n\t"		\
+  op "last %%xmm4, %%xmm0\n\t"			\
+  op "last %%xmm4, %%xmm1\n\t"			\
+  op "last %%xmm4, %%xmm2\n\t"			\
+  op "last %%xmm4, %%xmm3\n\t"
+
+#define AESNI_LOAD4(p)				\
+  "movdqu (%[" p "]), %%xmm0\n\t"		\
+  "movdqu 16(%[" p "]), %%xmm1\n\t"		\
+  "movdqu 32(%[" p "]), %%xmm2\n\t"		\
+  "movdqu 48(%[" p "]), %%xmm3\n\t"
+
+#define AESNI_STORE4(p)				\
+  "movdqu %%xmm0, (%[" p "])\n\t"		\
+  "movdqu %%xmm1, 16(%[" p "])\n\t"		\
+  "movdqu %%xmm2, 32(%[" p "])\n\t"		\
+  "movdqu %%xmm3, 48(%[" p "])\n\t"
+
+#define AESNI_XOR4(p)				\
+  "movdqu (%[" p "]), %%xmm5\n\t"		\
+  "pxor %%xmm5, %%xmm0\n\t"			\
+  "movdqu 16(%[" p "]), %%xmm5\n\t"		\
+  "pxor %%xmm5, %%xmm1\n\t"			\
+  "movdqu 32(%[" p "]), %%xmm5\n\t"		\
+  "pxor %%xmm5, %%xmm2\n\t"			\
+  "movdqu 48(%[" p "]), %%xmm5\n\t"		\
+  "pxor %%xmm5, %%xmm3\n\t"
+
+#define AESNI_WIPE				\
+  "pxor %%xmm0, %%xmm0\n\t"			\
+  "pxor %%xmm1, %%xmm1\n\t"			\
+  "pxor %%xmm2, %%xmm2\n\t"			\
+  "pxor %%xmm3, %%xmm3\n\t"			\
+  "pxor %%xmm4, %%xmm4\n\t"			\
+  "pxor %%xmm5, %%xmm5"
+
+/* XTS on four consecutive blocks of DATA in place, TWEAKS holding the
+   four tweaks.  */
+static void
+aesni_xts4 (const struct grub_cryptodisk_aesni *ctx, grub_uint8_t *data,
+	    const grub_uint8_t *tweaks, int do_encrypt)
+{
+  unsigned long n = ctx->rounds - 1;
+
+  if (do_encrypt)
+    {
+      const grub_uint8_t *rk = ctx->enc[0];
+      asm volatile (AESNI_LOAD4 ("d") AESNI_XOR4 ("t")
+		    AESNI_ROUNDS4 ("aesenc")
+		    AESNI_XOR4 ("t") AESNI_STORE4 ("d") AESNI_WIPE
+		    : [rk] "+r" (rk), [n] "+r" (n)
+		    : [d] "r" (data), [t] "r" (tweaks)
+		    : "memory", "cc");
+    }
+  else
+    {
+      const grub_uint8_t *rk = ctx->dec[0];
+      asm volatile (AESNI_LOAD4 ("d") AESNI_XOR4 ("t")
+		    AESNI_ROUNDS4 ("aesdec")
+		    AESNI_XOR4 ("t") AESNI_STORE4 ("d") AESNI_WIPE
+		    : [rk] "+r" (rk), [n] "+r" (n)
+		    : [d] "r" (data), [t] "r" (tweaks)
+		    : "memory", "cc");
+    }
+}
+
+/* CBC decryption of four consecutive blocks of DATA in place.  IV is
+   replaced by the last ciphertext block.  */
+static void
+aesni_cbc_dec4 (const struct grub_cryptodisk_aesni *ctx, grub_uint8_t *data,
+		grub_uint8_t *iv)
+{
+  const grub_uint8_t *rk = ctx->dec[0];
+  unsigned long n = ctx->rounds - 1;
+
+  asm volatile (AESNI_LOAD4 ("d")
+		AESNI_ROUNDS4 ("aesdec")
+		"movdqu (%[iv]), %%xmm5\n\t"
+		"pxor %%xmm5, %%xmm0\n\t"
+		"movdqu (%[d]), %%xmm5\n\t"
+		"pxor %%xmm5, %%xmm1\n\t"
+		"movdqu 16(%[d]), %%xmm5\n\t"
+		"pxor %%xmm5, %%xmm2\n\t"
+		"movdqu 32(%[d]), %%xmm5\n\t"
+		"pxor %%xmm5, %%xmm3\n\t"
+		"movdqu 48(%[d]), %%xmm5\n\t"
+		"movdqu %%xmm5, (%[iv])\n\t"
+		AESNI_STORE4 ("d") AESNI_WIPE
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [d] "r" (data), [iv] "r" (iv)
+		: "memory", "cc");
+}
+
+/* Single-block encryption with the XTS tweak key.  */
+static void
+aesni_encrypt_tweak (const struct grub_cryptodisk_aesni *ctx,
+		     grub_uint8_t *block)
+{
+  const grub_uint8_t *rk = ctx->tweak[0];
+  unsigned long n = ctx->tweak_rounds - 1;
+
+  asm volatile ("movdqu (%[b]), %%xmm0\n\t"
+		"movdqu (%[rk]), %%xmm4\n\t"
+		"pxor %%xmm4, %%xmm0\n\t"
+		"1:\n\t"
+		"add $16, %[rk]\n\t"
+		"movdqu (%[rk]), %%xmm4\n\t"
+		"aesenc %%xmm4, %%xmm0\n\t"
+		"dec %[n]\n\t"
+		"jnz 1b\n\t"
+		"movdqu 16(%[rk]), %%xmm4\n\t"
+		"aesenclast %%xmm4, %%xmm0\n\t"
+		"movdqu %%xmm0, (%[b])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm4, %%xmm4"
+		: [rk] "+r" (rk), [n] "+r" (n)
+		: [b] "r" (block)
+		: "memory", "cc");
+}
+
+/* Check the expanded keys against the generic cipher, so that a broken
+   CPU or emulator falls back rather than returning garbage.  */
+static int
+aesni_selftest (struct grub_cryptodisk *dev)
+{
+  grub_uint8_t ref[64], buf[64], zero[64];
+  unsigned i;
+
+  for (i = 0; i < sizeof (ref); i++)
+    ref[i] = i * 7 + 1;
+  grub_memcpy (buf, ref, sizeof (buf));
+  grub_memset (zero, 0, sizeof (zero));
+
+  if (grub_crypto_ecb_encrypt (dev->cipher, ref, ref, sizeof (ref)))
+    return 0;
+  aesni_xts4 (dev->aesni, buf, zero, 1);
+  if (grub_memcmp (ref, buf, sizeof (buf)) != 0)
+    return 0;
+  aesni_xts4 (dev->aesni, buf, zero, 0);
+  for (i = 0; i < sizeof (buf); i++)
+    if (buf[i] != (grub_uint8_t) (i * 7 + 1))
+      return 0;
+
+  if (dev->mode == GRUB_CRYPTODISK_MODE_XTS)
+    {
+      grub_memset (ref, 0, 16);
+      grub_memset (buf, 0, 16);
+      if (grub_crypto_ecb_encrypt (dev->secondary_cipher, ref, ref, 16))
+	return 0;
+      aesni_encrypt_tweak (dev->aesni, buf);
+      if (grub_memcmp (ref, buf, 16) != 0)
+	return 0;
+    }
+  return 1;
+}
+
+/* The key schedules are as secret as the key itself.  */
+static void
+cryptodisk_free_aesni (struct grub_cryptodisk *dev)
+{
+  if (!dev->aesni)
+    return;
+  grub_memset (dev->aesni, 0, sizeof (*dev->aesni));
+  grub_free (dev->aesni);
+  dev->aesni = NULL;
+}
+
+static void
+aesni_setkey (struct grub_cryptodisk *dev, const grub_uint8_t *key,
+	      grub_size_t keysize)
+{
+  struct grub_cryptodisk_aesni *ctx;
+  grub_size_t real_keysize = keysize;
+  unsigned i;
+
+  if (dev->mode == GRUB_CRYPTODISK_MODE_XTS)
+    real_keysize /= 2;
+
+  if ((dev->mode != GRUB_CRYPTODISK_MODE_XTS
+       && dev->mode != GRUB_CRYPTODISK_MODE_CBC)
+      || grub_strncmp (dev->cipher->cipher->name, "AES", 3) != 0
+      || (real_keysize != 16 && real_keysize != 24 && real_keysize != 32)
+      || (dev->mode == GRUB_CRYPTODISK_MODE_XTS
+	  && grub_strncmp (dev->secondary_cipher->cipher->name, "AES", 3) != 0)
+      || !aesni_supported ())
+    goto fail;
+
+  if (!dev->aesni)
+    dev->aesni = grub_malloc (sizeof (*dev->aesni));
+  ctx = dev->aesni;
+  if (!ctx)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  ctx->rounds = aesni_expand_key (ctx->enc, key, real_keysize);
+  grub_memcpy (ctx->dec[0], ctx->enc[ctx->rounds], 16);
+  for (i = 1; i < ctx->rounds; i++)
+    aesni_imc (ctx->dec[i], ctx->enc[ctx->rounds - i]);
+  grub_memcpy (ctx->dec[ctx->rounds], ctx->enc[0], 16);
+  if (dev->mode == GRUB_CRYPTODISK_MODE_XTS)
+    ctx->tweak_rounds = aesni_expand_key (ctx->tweak, key + real_keysize,
+					  real_keysize);
+
+  if (aesni_selftest (dev))
+    return;
+  grub_dprintf ("cryptodisk", "AES-NI self-test failed\n");
+
+ fail:
+  cryptodisk_free_aesni (dev);
+}
+
+#else
+
+static void
+cryptodisk_free_aesni (struct grub_cryptodisk *dev __attribute__ ((unused)))
+{
+}
+
+#endif
+
+static inline int
+use_aesni (const struct grub_cryptodisk *dev)
+{
+#ifdef CRYPTODISK_AESNI
+  return dev->aesni && !aesni_disabled;
+#else
+  (void) dev;
+  return 0;
+#endif
+}
+
+/* XTS on one sector.  IV holds the encrypted tweak of the first block.
+   Tweaks are generated XTS_BATCH bytes at a time so that the generic
+   path can hand the whole batch to the cipher in a single call.  */
+static gcry_err_code_t
+xts_sector (struct grub_cryptodisk *dev, grub_uint8_t *data,
+	    const grub_uint8_t *iv, int do_encrypt)
+{
+  grub_uint64_t tweaks[XTS_BATCH / sizeof (grub_uint64_t)];
+  grub_uint8_t *t = (grub_uint8_t *) tweaks;
+  grub_size_t sector_size = 1U << dev->log_sector_size;
+  grub_size_t off, j, chunk;
+  gcry_err_code_t err;
+
+  for (off = 0; off < sector_size; off += chunk)
+    {
+      chunk = sector_size - off;
+      if (chunk > XTS_BATCH)
+	chunk = XTS_BATCH;
+
+      if (off)
+	xts_next_tweak (t, t + XTS_BATCH - GRUB_CRYPTODISK_GF_BYTES);
+      else
+	grub_memcpy (t, iv, GRUB_CRYPTODISK_GF_BYTES);
+      for (j = GRUB_CRYPTODISK_GF_BYTES; j < chunk;
+	   j += GRUB_CRYPTODISK_GF_BYTES)
+	xts_next_tweak (t + j, t + j - GRUB_CRYPTODISK_GF_BYTES);
+
+#ifdef CRYPTODISK_AESNI
+      if (use_aesni (dev))
+	{
+	  for (j = 0; j < chunk; j += 4 * GRUB_CRYPTODISK_GF_BYTES)
+	    aesni_xts4 (dev->aesni, data + off + j, t + j, do_encrypt);
+	  continue;
+	}
+#endif
+
+      grub_crypto_xor (data + off, data + off, t, chunk);
+      if (do_encrypt)
+	err = grub_crypto_ecb_encrypt (dev->cipher, data + off, data + off,
+				       chunk);
+      else
+	err = grub_crypto_ecb_decrypt (dev->cipher, data + off, data + off,
+				       chunk);
+      if (err)
+	return err;
+      grub_crypto_xor (data + off, data + off, t, chunk);
+    }
+  grub_memset (tweaks, 0, sizeof (tweaks));
+  return GPG_ERR_NO_ERROR;
+}
+
 static gcry_err_code_t
 grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 			   grub_uint8_t * data, grub_size_t len,
@@ -309,6 +711,17 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
       switch (dev->mode)
 	{
 	case GRUB_CRYPTODISK_MODE_CBC:
+#ifdef CRYPTODISK_AESNI
+	  if (!do_encrypt && use_aesni (dev))
+	    {
+	      grub_size_t j;
+
+	      for (j = 0; j < (1U << dev->log_sector_size);
+		   j += 4 * GRUB_CRYPTODISK_GF_BYTES)
+		aesni_cbc_dec4 (dev->aesni, data + i + j, (grub_uint8_t *) iv);
+	      break;
+	    }
+#endif
 	  if (do_encrypt)
 	    err = grub_crypto_cbc_encrypt (dev->cipher, data + i, data + i,
 					   (1U << dev->log_sector_size), iv);
@@ -330,33 +743,22 @@ grub_cryptodisk_endecrypt (struct grub_cryptodisk *dev,
 	    return err;
 	  break;
 	case GRUB_CRYPTODISK_MODE_XTS:
-	  {
-	    unsigned j;
-	    err = grub_crypto_ecb_encrypt (dev->secondary_cipher, iv, iv,
-					   dev->cipher->cipher->blocksize);
-	    if (err)
-	      return err;
-	    
-	    for (j = 0; j < (1U << dev->log_sector_size);
-		 j += dev->cipher->cipher->blocksize)
-	      {
-		grub_crypto_xor (data + i + j, data + i + j, iv,
-				 dev->cipher->cipher->blocksize);
-		if (do_encrypt)
-		  err = grub_crypto_ecb_encrypt (dev->cipher, data + i + j, 
-						 data + i + j,
-						 dev->cipher->cipher->blocksize);
-		else
-		  err = grub_crypto_ecb_decrypt (dev->cipher, data + i + j, 
-						 data + i + j,
-						 dev->cipher->cipher->blocksize);
-		if (err)
-		  return err;
-		grub_crypto_xor (data + i + j, data + i + j, iv,
-				 dev->cipher->cipher->blocksize);
-		gf_mul_x ((grub_uint8_t *) iv);
-	      }
-	  }
+	  if (dev->cipher->cipher->blocksize != GRUB_CRYPTODISK_GF_BYTES)
+	    return GPG_ERR_INV_ARG;
+#ifdef CRYPTODISK_AESNI
+	  if (use_aesni (dev))
+	    aesni_encrypt_tweak (dev->aesni, (grub_uint8_t *) iv);
+	  else
+#endif
+	    {
+	      err = grub_crypto_ecb_encrypt (dev->secondary_cipher, iv, iv,
+					     dev->cipher->cipher->blocksize);
+	      if (err)
+		return err;
+	    }
+	  err = xts_sector (dev, data + i, (grub_uint8_t *) iv, do_encrypt);
+	  if (err)
+	    return err;
 	  break;
 	case GRUB_CRYPTODISK_MODE_LRW:
 	  {
@@ -465,6 +867,10 @@ grub_cryptodisk_setkey (grub_cryptodisk_t dev, grub_uint8_t *key, grub_size_t ke
 	  gf_mul_be (dev->lrw_precalc + i, idx, dev->lrw_key);
 	}
     }
+
+#ifdef CRYPTODISK_AESNI
+  aesni_setkey (dev, key, keysize);
+#endif
   return GPG_ERR_NO_ERROR;
 }
 
@@ -700,6 +1106,7 @@ cryptodisk_cleanup (void)
       grub_free (dev->secondary_cipher);
       grub_free (dev->essiv_cipher);
       tmp = dev->next;
+      cryptodisk_free_aesni (dev);
       grub_free (dev);
       dev = tmp;
     }
@@ -713,6 +1120,7 @@ grub_cryptodisk_insert (grub_cryptodisk_t newdev, const char *name,
   newdev->source = grub_strdup (name);
   if (!newdev->source)
     {
+      cryptodisk_free_aesni (newdev);
       grub_free (newdev);
       return grub_errno;
     }
@@ -816,6 +1224,7 @@ cryptodisk_close (grub_cryptodisk_t dev)
   grub_crypto_cipher_close (dev->cipher);
   grub_crypto_cipher_close (dev->secondary_cipher);
   grub_crypto_cipher_close (dev->essiv_cipher);
+  cryptodisk_free_aesni (dev);
   grub_free (dev);
 }
 
@@ -891,7 +1300,10 @@ grub_cryptodisk_cheat_mount (const char *sourcedev, const char *cheat)
     err = grub_cryptodisk_cheat_insert (dev, sourcedev, source, cheat);
     grub_disk_close (source);
     if (err)
-      grub_free (dev);
+      {
+	cryptodisk_free_aesni (dev);
+	grub_free (dev);
+      }
 
     return GRUB_ERR_NONE;
   }
@@ -1135,7 +1547,110 @@ struct grub_procfs_entry luks_script =
   .get_contents = luks_script_get
 };
 
+#define BENCH_DEFAULT_SIZE	(4 << 20)
+
+static const struct grub_arg_option bench_options[] =
+  {
+    {"size", 's', 0, N_("Amount of data to decrypt per run."), 0, ARG_TYPE_INT},
+    {0, 0, 0, 0, 0, 0}
+  };
+
+static grub_err_t
+bench_run (grub_cryptodisk_t dev, grub_uint8_t *buf, grub_size_t size,
+	   const char *label)
+{
+  grub_uint64_t start, end, total = 0, speed, frac;
+  gcry_err_code_t gcry_err;
+
+  start = grub_get_time_ms ();
+  do
+    {
+      gcry_err = grub_cryptodisk_endecrypt (dev, buf, size, 0, 0);
+      if (gcry_err)
+	return grub_crypto_gcry_error (gcry_err);
+      total += size;
+      end = grub_get_time_ms ();
+    }
+  while (end - start < 1000);
+
+  /* Hundredths of MiB/s.  */
+  speed = grub_divmod64 ((total * 100ULL * 1000ULL) >> 20, end - start, 0);
+  speed = grub_divmod64 (speed, 100, &frac);
+  grub_printf_ (N_("%s: %llu.%02u MiB/s\n"), label,
+		(unsigned long long) speed, (unsigned) frac);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_cmd_cryptodisk_bench (grub_extcmd_context_t ctxt, int argc, char **args)
+{
+  struct grub_arg_list *state = ctxt->state;
+  grub_cryptodisk_t dev;
+  grub_disk_t disk;
+  grub_uint8_t *buf;
+  grub_size_t size = BENCH_DEFAULT_SIZE, len;
+  grub_err_t err;
+  char *name;
+
+  if (argc < 1)
+    return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("one argument expected"));
+
+  if (state[0].set)
+    size = grub_strtoul (state[0].arg, 0, 0);
+
+  name = args[0];
+  len = grub_strlen (name);
+  if (len > 1 && name[0] == '(' && name[len - 1] == ')')
+    {
+      name = grub_strndup (name + 1, len - 2);
+      if (!name)
+	return grub_errno;
+    }
+  disk = grub_disk_open (name);
+  if (name != args[0])
+    grub_free (name);
+  if (!disk)
+    return grub_errno;
+  if (disk->dev->id != GRUB_DISK_DEVICE_CRYPTODISK_ID)
+    {
+      grub_disk_close (disk);
+      return grub_error (GRUB_ERR_BAD_DEVICE, "not a cryptodisk");
+    }
+  dev = disk->data;
+
+  size &= ~(grub_size_t) ((1U << dev->log_sector_size) - 1);
+  if (size == 0)
+    {
+      grub_disk_close (disk);
+      return grub_error (GRUB_ERR_BAD_ARGUMENT, N_("invalid block size"));
+    }
+
+  buf = grub_zalloc (size);
+  if (!buf)
+    {
+      grub_disk_close (disk);
+      return grub_errno;
+    }
+
+#ifdef CRYPTODISK_AESNI
+  aesni_disabled = 1;
+#endif
+  err = bench_run (dev, buf, size, "generic");
+#ifdef CRYPTODISK_AESNI
+  aesni_disabled = 0;
+  if (!err && dev->aesni)
+    err = bench_run (dev, buf, size, "aesni");
+#endif
+  if (!err && !use_aesni (dev))
+    grub_printf_ (N_("No accelerated implementation for this device\n"));
+
+  grub_free (buf);
+  grub_disk_close (disk);
+  return err;
+}
+
 static grub_extcmd_t cmd;
+static grub_extcmd_t cmd_bench;
 
 GRUB_MOD_INIT (cryptodisk)
 {
@@ -1143,6 +1658,11 @@ GRUB_MOD_INIT (cryptodisk)
   cmd = grub_register_extcmd ("cryptomount", grub_cmd_cryptomount, 0,
 			      N_("SOURCE|-u UUID|-a|-b"),
 			      N_("Mount a crypto device."), options);
+  cmd_bench = grub_register_extcmd ("cryptodisk_bench",
+				    grub_cmd_cryptodisk_bench, 0,
+				    N_("[-s SIZE] DEVICE"),
+				    N_("Measure decryption speed of a crypto"
+				       " device."), bench_options);
   grub_procfs_register ("luks_script", &luks_script);
 }
 
@@ -1150,5 +1670,6 @@ GRUB_MOD_FINI (cryptodisk)
 {
   grub_disk_dev_unregister (&grub_cryptodisk_dev);
   cryptodisk_cleanup ();
+  grub_unregister_extcmd (cmd_bench);
   grub_procfs_unregister (&luks_script);
 }
@@ -575,118 +575,286 @@ validate_segment (struct grub_diskfilter_segment *seg)
 
 }
 
+/* Read from a striped, mirrored or RAID10 segment one stripe at a time,
+   trying the other copies of a stripe on read errors.  */
 static grub_err_t
-read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
-	      grub_size_t size, char *buf)
+read_segment_stripes (struct grub_diskfilter_segment *seg,
+		      grub_disk_addr_t sector, grub_size_t size, char *buf)
 {
   grub_err_t err;
-  switch (seg->type)
+  grub_disk_addr_t read_sector, far_ofs;
+  grub_uint64_t disknr, b, near, far, ofs;
+  unsigned int i, j;
+
+  read_sector = grub_divmod64 (sector, seg->stripe_size, &b);
+  far = ofs = near = 1;
+  far_ofs = 0;
+
+  if (seg->type == 1)
+    near = seg->node_count;
+  else if (seg->type == 10)
     {
-    case GRUB_DISKFILTER_STRIPED:
-      if (seg->node_count == 1)
-	return grub_diskfilter_read_node (&seg->nodes[0],
-					  sector, size, buf);
-      /* Fallthrough.  */
-    case GRUB_DISKFILTER_MIRROR:
-    case GRUB_DISKFILTER_RAID10:
-      {
-	grub_disk_addr_t read_sector, far_ofs;
-	grub_uint64_t disknr, b, near, far, ofs;
-	unsigned int i, j;
-	    
-	read_sector = grub_divmod64 (sector, seg->stripe_size, &b);
-	far = ofs = near = 1;
-	far_ofs = 0;
+      near = seg->layout & 0xFF;
+      far = (seg->layout >> 8) & 0xFF;
+      if (seg->layout >> 16)
+	{
+	  ofs = far;
+	  far_ofs = 1;
+	}
+      else
+	far_ofs = grub_divmod64 (seg->raid_member_size,
+				 far * seg->stripe_size, 0);
 
-	if (seg->type == 1)
-	  near = seg->node_count;
-	else if (seg->type == 10)
-	  {
-	    near = seg->layout & 0xFF;
-	    far = (seg->layout >> 8) & 0xFF;
-	    if (seg->layout >> 16)
-	      {
-		ofs = far;
-		far_ofs = 1;
-	      }
-	    else
-	      far_ofs = grub_divmod64 (seg->raid_member_size,
-				       far * seg->stripe_size, 0);
-		
-	    far_ofs *= seg->stripe_size;
-	  }
+      far_ofs *= seg->stripe_size;
+    }
 
-	read_sector = grub_divmod64 (read_sector * near, 
-				     seg->node_count,
-				     &disknr);
+  read_sector = grub_divmod64 (read_sector * near, 
+			       seg->node_count,
+			       &disknr);
 
-	ofs *= seg->stripe_size;
-	read_sector *= ofs;
-	
-	while (1)
-	  {
-	    grub_size_t read_size;
+  ofs *= seg->stripe_size;
+  read_sector *= ofs;
 
-	    read_size = seg->stripe_size - b;
-	    if (read_size > size)
-	      read_size = size;
+  while (1)
+    {
+      grub_size_t read_size;
 
-	    err = 0;
-	    for (i = 0; i < near; i++)
-	      {
-		unsigned int k;
+      read_size = seg->stripe_size - b;
+      if (read_size > size)
+	read_size = size;
 
-		k = disknr;
-		err = 0;
-		for (j = 0; j < far; j++)
-		  {
-		    if (grub_errno == GRUB_ERR_READ_ERROR
-			|| grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
-		      grub_errno = GRUB_ERR_NONE;
-
-		    err = grub_diskfilter_read_node (&seg->nodes[k],
-						     read_sector
-						     + j * far_ofs + b,
-						     read_size,
-						     buf);
-		    if (! err)
-		      break;
-		    else if (err != GRUB_ERR_READ_ERROR
-			     && err != GRUB_ERR_UNKNOWN_DEVICE)
-		      return err;
-		    k++;
-		    if (k == seg->node_count)
-		      k = 0;
-		  }
+      err = 0;
+      for (i = 0; i < near; i++)
+	{
+	  unsigned int k;
 
-		if (! err)
-		  break;
+	  k = disknr;
+	  err = 0;
+	  for (j = 0; j < far; j++)
+	    {
+	      if (grub_errno == GRUB_ERR_READ_ERROR
+		  || grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
+		grub_errno = GRUB_ERR_NONE;
 
-		disknr++;
-		if (disknr == seg->node_count)
-		  {
-		    disknr = 0;
-		    read_sector += ofs;
-		  }
-	      }
+	      err = grub_diskfilter_read_node (&seg->nodes[k],
+					       read_sector
+					       + j * far_ofs + b,
+					       read_size,
+					       buf);
+	      if (! err)
+		break;
+	      else if (err != GRUB_ERR_READ_ERROR
+		       && err != GRUB_ERR_UNKNOWN_DEVICE)
+		return err;
+	      k++;
+	      if (k == seg->node_count)
+		k = 0;
+	    }
 
-	    if (err)
+	  if (! err)
+	    break;
+
+	  disknr++;
+	  if (disknr == seg->node_count)
+	    {
+	      disknr = 0;
+	      read_sector += ofs;
+	    }
+	}
+
+      if (err)
+	return err;
+
+      buf += read_size << GRUB_DISK_SECTOR_BITS;
+      size -= read_size;
+      if (! size)
+	return GRUB_ERR_NONE;
+
+      b = 0;
+      disknr += (near - i);
+      while (disknr >= seg->node_count)
+	{
+	  disknr -= seg->node_count;
+	  read_sector += ofs;
+	}
+    }
+}
+
+/* Upper bound on what a coalesced read fetches from one member at once.  */
+#define GRUB_DISKFILTER_COALESCE_SECTORS 2048
+
+/* Read from a RAID0 or striped LVM segment.  A request spanning more than
+   one row of stripes becomes a single read per member and batch, which is
+   then scattered into BUF, instead of one read per stripe.  */
+static grub_err_t
+read_segment_striped (struct grub_diskfilter_segment *seg,
+		      grub_disk_addr_t sector, grub_size_t size, char *buf)
+{
+  grub_uint64_t nodes = seg->node_count, stripe = seg->stripe_size;
+  grub_uint64_t rows, batch;
+  char *tmp;
+
+  if (size <= nodes * stripe)
+    return read_segment_stripes (seg, sector, size, buf);
+
+  rows = grub_divmod64 (GRUB_DISKFILTER_COALESCE_SECTORS, stripe, 0);
+  if (rows == 0)
+    rows = 1;
+  batch = rows * nodes * stripe;
+
+  /* A batch not aligned to a stripe touches one more row.  */
+  tmp = grub_malloc (((rows + 1) * stripe) << GRUB_DISK_SECTOR_BITS);
+  if (!tmp)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return read_segment_stripes (seg, sector, size, buf);
+    }
+
+  while (size)
+    {
+      grub_uint64_t len = (size < batch) ? size : batch;
+      grub_uint64_t end = sector + len;
+      grub_uint64_t first, last, r;
+      unsigned int d;
+
+      first = grub_divmod64 (sector, stripe, 0);
+      last = grub_divmod64 (end - 1, stripe, 0);
+      grub_divmod64 (first, nodes, &r);
+
+      for (d = 0; d < nodes; d++)
+	{
+	  grub_uint64_t c, cf, cl, row, mstart, mend;
+	  grub_err_t err;
+
+	  /* First and last stripe of the batch that live on member D.  */
+	  cf = first + ((d >= r) ? d - r : d + nodes - r);
+	  if (cf > last)
+	    continue;
+	  cl = cf + grub_divmod64 (last - cf, nodes, 0) * nodes;
+
+	  if (cf == cl)
+	    {
+	      grub_uint64_t lstart = (cf == first) ? sector : cf * stripe;
+	      grub_uint64_t lend = (cf == last) ? end : (cf + 1) * stripe;
+
+	      err = grub_diskfilter_read_node (&seg->nodes[d],
+					       grub_divmod64 (cf, nodes, 0)
+					       * stripe + lstart - cf * stripe,
+					       lend - lstart,
+					       buf + ((lstart - sector)
+						      << GRUB_DISK_SECTOR_BITS));
+	      if (err)
+		{
+		  grub_free (tmp);
+		  return err;
+		}
+	      continue;
+	    }
+
+	  row = grub_divmod64 (cf, nodes, 0);
+	  mstart = row * stripe + ((cf == first) ? sector - first * stripe : 0);
+	  mend = grub_divmod64 (cl, nodes, 0) * stripe
+	    + ((cl == last) ? end - last * stripe : stripe);
+
+	  err = grub_diskfilter_read_node (&seg->nodes[d], mstart,
+					   mend - mstart, tmp);
+	  if (err)
+	    {
+	      grub_free (tmp);
 	      return err;
+	    }
 
-	    buf += read_size << GRUB_DISK_SECTOR_BITS;
-	    size -= read_size;
-	    if (! size)
-	      return GRUB_ERR_NONE;
-	    
-	    b = 0;
-	    disknr += (near - i);
-	    while (disknr >= seg->node_count)
-	      {
-		disknr -= seg->node_count;
-		read_sector += ofs;
-	      }
-	  }
-      }
+	  for (c = cf; c <= cl; c += nodes, row++)
+	    {
+	      grub_uint64_t lstart = (c == first) ? sector : c * stripe;
+	      grub_uint64_t lend = (c == last) ? end : (c + 1) * stripe;
+
+	      grub_memcpy (buf + ((lstart - sector) << GRUB_DISK_SECTOR_BITS),
+			   tmp + ((row * stripe + lstart - c * stripe - mstart)
+				  << GRUB_DISK_SECTOR_BITS),
+			   (lend - lstart) << GRUB_DISK_SECTOR_BITS);
+	    }
+	}
+
+      buf += len << GRUB_DISK_SECTOR_BITS;
+      sector += len;
+      size -= len;
+    }
+
+  grub_free (tmp);
+  return GRUB_ERR_NONE;
+}
+
+/* Read from a mirror.  A large request is split evenly across the legs
+   in single reads.  A part that no leg can read whole is retried a stripe
+   at a time, so that different legs may cover different bad sectors.  */
+static grub_err_t
+read_segment_mirror (struct grub_diskfilter_segment *seg,
+		     grub_disk_addr_t sector, grub_size_t size, char *buf)
+{
+  grub_uint64_t parts, part, ofs, len;
+  unsigned int i, j, k;
+  grub_err_t err;
+
+  parts = grub_divmod64 (size, seg->stripe_size, 0);
+  if (parts > seg->node_count)
+    parts = seg->node_count;
+  if (parts == 0)
+    parts = 1;
+  part = grub_divmod64 (size, parts, 0);
+
+  for (i = 0, ofs = 0; i < parts; i++, ofs += len)
+    {
+      len = (i == parts - 1) ? size - ofs : part;
+
+      err = GRUB_ERR_NONE;
+      for (j = 0; j < seg->node_count; j++)
+	{
+	  k = (i + j) % seg->node_count;
+
+	  if (grub_errno == GRUB_ERR_READ_ERROR
+	      || grub_errno == GRUB_ERR_UNKNOWN_DEVICE)
+	    grub_errno = GRUB_ERR_NONE;
+
+	  err = grub_diskfilter_read_node (&seg->nodes[k], sector + ofs, len,
+					   buf + (ofs << GRUB_DISK_SECTOR_BITS));
+	  if (! err)
+	    break;
+	  if (err != GRUB_ERR_READ_ERROR && err != GRUB_ERR_UNKNOWN_DEVICE)
+	    return err;
+	}
+
+      if (err)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  err = read_segment_stripes (seg, sector + ofs, len,
+				      buf + (ofs << GRUB_DISK_SECTOR_BITS));
+	  if (err)
+	    return err;
+	}
+    }
+
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+read_segment (struct grub_diskfilter_segment *seg, grub_disk_addr_t sector,
+	      grub_size_t size, char *buf)
+{
+  grub_err_t err;
+  switch (seg->type)
+    {
+    case GRUB_DISKFILTER_STRIPED:
+      if (seg->node_count == 1)
+	return grub_diskfilter_read_node (&seg->nodes[0],
+					  sector, size, buf);
+      return read_segment_striped (seg, sector, size, buf);
+
+    case GRUB_DISKFILTER_MIRROR:
+      return read_segment_mirror (seg, sector, size, buf);
+
+    case GRUB_DISKFILTER_RAID10:
+      return read_segment_stripes (seg, sector, size, buf);
 
     case GRUB_DISKFILTER_RAID4:
     case GRUB_DISKFILTER_RAID5:
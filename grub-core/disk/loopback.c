@@ -27,12 +27,29 @@
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
+/* A run of loop sectors stored contiguously on the backing disk.  */
+struct grub_loopback_extent
+{
+  grub_disk_addr_t start;
+  grub_disk_addr_t count;
+  grub_disk_addr_t sector;
+};
+
+/* Give up mapping badly fragmented files beyond this many extents.  */
+#define GRUB_LOOPBACK_MAX_EXTENTS 65536
+
 struct grub_loopback
 {
   char *devname;
   grub_file_t file;
   struct grub_loopback *next;
   unsigned long id;
+  /* Block map of FILE, built lazily from fs_map, sorted by START.  */
+  struct grub_loopback_extent *extents;
+  grub_size_t nextents;
+  grub_size_t alloc_extents;
+  /* Set if FILE can only be accessed through grub_file_read.  */
+  int unmappable;
 };
 
 static struct grub_loopback *loopback_list;
@@ -46,6 +63,21 @@ static const struct grub_arg_option options[] =
     {0, 0, 0, 0, 0, 0}
   };
 
+static void
+loopback_set_file (struct grub_loopback *dev, grub_file_t file)
+{
+  dev->file = file;
+  grub_free (dev->extents);
+  dev->extents = NULL;
+  dev->nextents = 0;
+  dev->alloc_extents = 0;
+  /* Filters such as decompressors and verifiers install their own fs
+     without fs_map, so only files read straight from a disk qualify.  */
+  dev->unmappable = (!file->fs || !file->fs->fs_map
+		     || !file->device || !file->device->disk
+		     || file->size == GRUB_FILE_SIZE_UNKNOWN);
+}
+
 /* Delete the loopback device NAME.  */
 static grub_err_t
 delete_loopback (const char *name)
@@ -68,6 +100,7 @@ delete_loopback (const char *name)
 
   grub_free (dev->devname);
   grub_file_close (dev->file);
+  grub_free (dev->extents);
   grub_free (dev);
 
   return 0;
@@ -105,13 +138,16 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
   if (newdev)
     {
       grub_file_close (newdev->file);
-      newdev->file = file;
+      loopback_set_file (newdev, file);
+      /* A new id keeps cached sectors and mounts of the old file from
+	 being reused.  */
+      newdev->id = last_id++;
 
       return 0;
     }
 
   /* Unable to replace it, make a new entry.  */
-  newdev = grub_malloc (sizeof (struct grub_loopback));
+  newdev = grub_zalloc (sizeof (struct grub_loopback));
   if (! newdev)
     goto fail;
 
@@ -122,7 +158,7 @@ grub_cmd_loopback (grub_extcmd_context_t ctxt, int argc, char **args)
       goto fail;
     }
 
-  newdev->file = file;
+  loopback_set_file (newdev, file);
   newdev->id = last_id++;
 
   /* Add the new entry to the list.  */
@@ -182,27 +218,156 @@ grub_loopback_open (const char *name, grub_disk_t disk)
   return 0;
 }
 
+/* Return the index of the first extent of DEV ending after SECTOR.  */
+static grub_size_t
+loopback_find_extent (struct grub_loopback *dev, grub_disk_addr_t sector)
+{
+  grub_size_t lo = 0, hi = dev->nextents;
+
+  while (lo < hi)
+    {
+      grub_size_t mid = lo + (hi - lo) / 2;
+      if (dev->extents[mid].start + dev->extents[mid].count <= sector)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Ask the filesystem where SECTOR of the backing file lives and insert
+   the answer at index IDX.  Return 0 if it is not mapped.  */
+static int
+loopback_map_extent (struct grub_loopback *dev, grub_disk_addr_t sector,
+		     grub_size_t idx)
+{
+  grub_file_t file = dev->file;
+  grub_off_t off = sector << GRUB_DISK_SECTOR_BITS;
+  grub_off_t len, limit;
+  grub_disk_addr_t phys, count;
+  struct grub_loopback_extent *e;
+
+  if (dev->nextents >= GRUB_LOOPBACK_MAX_EXTENTS || off >= file->size)
+    return 0;
+
+  if (file->fs->fs_map (file, off, &phys, &len))
+    {
+      grub_dprintf ("loopback", "%s: sector %" PRIuGRUB_UINT64_T
+		    " not mapped: %s\n", dev->devname, sector, grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      return 0;
+    }
+
+  /* The tail of the last sector is zero-filled by the caller.  */
+  limit = file->size - off;
+  if (len >= limit)
+    count = ALIGN_UP (limit, GRUB_DISK_SECTOR_SIZE) >> GRUB_DISK_SECTOR_BITS;
+  else
+    count = len >> GRUB_DISK_SECTOR_BITS;
+  if (idx < dev->nextents && count > dev->extents[idx].start - sector)
+    count = dev->extents[idx].start - sector;
+  if (count == 0)
+    return 0;
+
+  /* Extend a physically adjacent predecessor instead of adding one.  */
+  if (idx > 0)
+    {
+      e = &dev->extents[idx - 1];
+      if (e->start + e->count == sector && e->sector + e->count == phys)
+	{
+	  e->count += count;
+	  return 1;
+	}
+    }
+
+  if (dev->nextents == dev->alloc_extents)
+    {
+      grub_size_t n = dev->alloc_extents ? dev->alloc_extents * 2 : 16;
+      e = grub_realloc (dev->extents, n * sizeof (*e));
+      if (!e)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  return 0;
+	}
+      dev->extents = e;
+      dev->alloc_extents = n;
+    }
+
+  grub_memmove (&dev->extents[idx + 1], &dev->extents[idx],
+		(dev->nextents - idx) * sizeof (dev->extents[0]));
+  dev->extents[idx].start = sector;
+  dev->extents[idx].count = count;
+  dev->extents[idx].sector = phys;
+  dev->nextents++;
+  return 1;
+}
+
 static grub_err_t
 grub_loopback_read (grub_disk_t disk, grub_disk_addr_t sector,
 		    grub_size_t size, char *buf)
 {
-  grub_file_t file = ((struct grub_loopback *) disk->data)->file;
+  struct grub_loopback *dev = disk->data;
+  grub_file_t file = dev->file;
+  grub_disk_addr_t start = sector;
+  grub_size_t total = size;
   grub_off_t pos;
 
-  grub_file_seek (file, sector << GRUB_DISK_SECTOR_BITS);
-
-  grub_file_read (file, buf, size << GRUB_DISK_SECTOR_BITS);
-  if (grub_errno)
-    return grub_errno;
+  /* Translate mapped parts straight to the backing disk, bypassing the
+     filesystem; anything else is read through the file.  */
+  while (size > 0)
+    {
+      grub_size_t idx = 0, n = size;
+      struct grub_loopback_extent *e = NULL;
+
+      if (!dev->unmappable)
+	{
+	  idx = loopback_find_extent (dev, sector);
+	  if ((idx == dev->nextents || dev->extents[idx].start > sector)
+	      && loopback_map_extent (dev, sector, idx))
+	    idx = loopback_find_extent (dev, sector);
+	  if (idx < dev->nextents)
+	    {
+	      e = &dev->extents[idx];
+	      if (e->start > sector)
+		{
+		  if (n > e->start - sector)
+		    n = e->start - sector;
+		  e = NULL;
+		}
+	      else if (n > e->start + e->count - sector)
+		n = e->start + e->count - sector;
+	    }
+	}
+
+      if (e)
+	{
+	  if (grub_disk_read (file->device->disk,
+			      e->sector + (sector - e->start), 0,
+			      n << GRUB_DISK_SECTOR_BITS, buf))
+	    return grub_errno;
+	}
+      else
+	{
+	  grub_file_seek (file, sector << GRUB_DISK_SECTOR_BITS);
+	  grub_file_read (file, buf, n << GRUB_DISK_SECTOR_BITS);
+	  if (grub_errno)
+	    return grub_errno;
+	}
+
+      sector += n;
+      size -= n;
+      buf += n << GRUB_DISK_SECTOR_BITS;
+    }
+  buf -= total << GRUB_DISK_SECTOR_BITS;
 
   /* In case there is more data read than there is available, in case
      of files that are not a multiple of GRUB_DISK_SECTOR_SIZE, fill
      the rest with zeros.  */
-  pos = (sector + size) << GRUB_DISK_SECTOR_BITS;
+  pos = (start + total) << GRUB_DISK_SECTOR_BITS;
   if (pos > file->size)
     {
       grub_size_t amount = pos - file->size;
-      grub_memset (buf + (size << GRUB_DISK_SECTOR_BITS) - amount, 0, amount);
+      grub_memset (buf + (total << GRUB_DISK_SECTOR_BITS) - amount, 0, amount);
     }
 
   return 0;
@@ -0,0 +1,897 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026  Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grub/dl.h>
+#include <grub/disk.h>
+#include <grub/mm.h>
+#include <grub/time.h>
+#include <grub/pci.h>
+#include <grub/misc.h>
+#include <grub/list.h>
+#include <grub/loader.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* Controller registers, as 32-bit word offsets into BAR0.  */
+enum
+  {
+    GRUB_NVME_REG_CAP_LO = 0x00 / 4,
+    GRUB_NVME_REG_CAP_HI = 0x04 / 4,
+    GRUB_NVME_REG_VS = 0x08 / 4,
+    GRUB_NVME_REG_INTMS = 0x0c / 4,
+    GRUB_NVME_REG_CC = 0x14 / 4,
+    GRUB_NVME_REG_CSTS = 0x1c / 4,
+    GRUB_NVME_REG_AQA = 0x24 / 4,
+    GRUB_NVME_REG_ASQ_LO = 0x28 / 4,
+    GRUB_NVME_REG_ASQ_HI = 0x2c / 4,
+    GRUB_NVME_REG_ACQ_LO = 0x30 / 4,
+    GRUB_NVME_REG_ACQ_HI = 0x34 / 4,
+  };
+
+#define GRUB_NVME_DOORBELL_BASE 0x1000
+
+enum
+  {
+    GRUB_NVME_CAP_LO_MQES_MASK = 0xffff,
+    GRUB_NVME_CAP_LO_TO_SHIFT = 24,
+    GRUB_NVME_CAP_HI_DSTRD_MASK = 0xf,
+    GRUB_NVME_CAP_HI_CSS_NVM = 0x20,
+    GRUB_NVME_CAP_HI_MPSMIN_SHIFT = 16,
+    GRUB_NVME_CAP_HI_MPSMIN_MASK = 0xf,
+  };
+
+enum
+  {
+    GRUB_NVME_CC_EN = 0x1,
+    GRUB_NVME_CC_IOSQES = 6 << 16,
+    GRUB_NVME_CC_IOCQES = 4 << 20,
+  };
+
+enum
+  {
+    GRUB_NVME_CSTS_RDY = 0x1,
+    GRUB_NVME_CSTS_CFS = 0x2,
+  };
+
+enum
+  {
+    GRUB_NVME_ADMIN_DELETE_SQ = 0x00,
+    GRUB_NVME_ADMIN_CREATE_SQ = 0x01,
+    GRUB_NVME_ADMIN_DELETE_CQ = 0x04,
+    GRUB_NVME_ADMIN_CREATE_CQ = 0x05,
+    GRUB_NVME_ADMIN_IDENTIFY = 0x06,
+  };
+
+enum
+  {
+    GRUB_NVME_CMD_WRITE = 0x01,
+    GRUB_NVME_CMD_READ = 0x02,
+  };
+
+enum
+  {
+    GRUB_NVME_IDENTIFY_NAMESPACE = 0,
+    GRUB_NVME_IDENTIFY_CONTROLLER = 1,
+  };
+
+/* Offsets into the identify data structures.  */
+#define GRUB_NVME_ID_CTRL_MDTS 77
+#define GRUB_NVME_ID_CTRL_NN 516
+#define GRUB_NVME_ID_NS_NSZE 0
+#define GRUB_NVME_ID_NS_FLBAS 26
+#define GRUB_NVME_ID_NS_LBAF 128
+
+#define GRUB_NVME_PAGE_SHIFT 12
+#define GRUB_NVME_PAGE_SIZE (1 << GRUB_NVME_PAGE_SHIFT)
+
+#define GRUB_NVME_ADMIN_QUEUE_SIZE 8
+#define GRUB_NVME_IO_QUEUE_SIZE 32
+
+/* Number of I/O commands kept in flight for a single disk read and the
+   size of each of them.  A transfer of this size is described by one PRP
+   list page, so the lists never need chaining.  */
+#define GRUB_NVME_NUM_SLOTS 4
+#define GRUB_NVME_MAX_TRANSFER (1 << 20)
+
+#define GRUB_NVME_MAX_NAMESPACES 16
+#define GRUB_NVME_ADMIN_TIMEOUT 5000
+
+struct grub_nvme_sqe
+{
+  grub_uint32_t cdw0;
+  grub_uint32_t nsid;
+  grub_uint32_t cdw2;
+  grub_uint32_t cdw3;
+  grub_uint64_t mptr;
+  grub_uint64_t prp1;
+  grub_uint64_t prp2;
+  grub_uint32_t cdw10;
+  grub_uint32_t cdw11;
+  grub_uint32_t cdw12;
+  grub_uint32_t cdw13;
+  grub_uint32_t cdw14;
+  grub_uint32_t cdw15;
+};
+
+struct grub_nvme_cqe
+{
+  grub_uint32_t result;
+  grub_uint32_t reserved;
+  grub_uint16_t sq_head;
+  grub_uint16_t sq_id;
+  grub_uint16_t cid;
+  grub_uint16_t status;
+};
+
+#define GRUB_NVME_CQE_PHASE 1
+#define GRUB_NVME_CQE_STATUS(s) ((s) >> 1)
+
+struct grub_nvme_queue
+{
+  struct grub_pci_dma_chunk *sq_chunk;
+  volatile struct grub_nvme_sqe *sq;
+  struct grub_pci_dma_chunk *cq_chunk;
+  volatile struct grub_nvme_cqe *cq;
+  volatile grub_uint32_t *sq_doorbell;
+  volatile grub_uint32_t *cq_doorbell;
+  grub_uint16_t size;
+  grub_uint16_t sq_tail;
+  grub_uint16_t cq_head;
+  grub_uint16_t phase;
+};
+
+/* A bounce buffer together with a PRP list describing it.  The buffer is
+   physically contiguous, so the list is filled once at allocation.  */
+struct grub_nvme_slot
+{
+  struct grub_pci_dma_chunk *buf;
+  struct grub_pci_dma_chunk *prp_list;
+  char *dest;
+  grub_size_t size;
+  int busy;
+};
+
+struct grub_nvme_controller
+{
+  struct grub_nvme_controller *next;
+  struct grub_nvme_controller **prev;
+  volatile grub_uint32_t *regs;
+  int num;
+  int alive;
+  unsigned doorbell_stride;
+  grub_uint32_t timeout;
+  grub_uint32_t max_queue_size;
+  grub_size_t max_transfer;
+  grub_uint32_t nn;
+  grub_uint16_t admin_cid;
+  struct grub_nvme_queue admin;
+  struct grub_nvme_queue io;
+  struct grub_nvme_slot slots[GRUB_NVME_NUM_SLOTS];
+};
+
+struct grub_nvme_namespace
+{
+  struct grub_nvme_namespace *next;
+  struct grub_nvme_namespace **prev;
+  struct grub_nvme_controller *ctrl;
+  grub_uint32_t nsid;
+  grub_uint64_t total_sectors;
+  unsigned log_sector_size;
+};
+
+static struct grub_nvme_controller *grub_nvme_controllers;
+static struct grub_nvme_namespace *grub_nvme_namespaces;
+static int numctrls;
+
+static grub_err_t
+grub_nvme_alloc_queue (struct grub_nvme_controller *ctrl,
+		       struct grub_nvme_queue *q, unsigned qid,
+		       grub_uint16_t size)
+{
+  q->sq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_sqe));
+  if (!q->sq_chunk)
+    return grub_errno;
+  q->cq_chunk = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				     size * sizeof (struct grub_nvme_cqe));
+  if (!q->cq_chunk)
+    {
+      grub_dma_free (q->sq_chunk);
+      q->sq_chunk = NULL;
+      return grub_errno;
+    }
+  q->sq = grub_dma_get_virt (q->sq_chunk);
+  q->cq = grub_dma_get_virt (q->cq_chunk);
+  grub_memset ((void *) q->sq, 0, size * sizeof (struct grub_nvme_sqe));
+  grub_memset ((void *) q->cq, 0, size * sizeof (struct grub_nvme_cqe));
+
+  q->sq_doorbell = ctrl->regs + (GRUB_NVME_DOORBELL_BASE
+				 + 2 * qid * ctrl->doorbell_stride) / 4;
+  q->cq_doorbell = ctrl->regs + (GRUB_NVME_DOORBELL_BASE
+				 + (2 * qid + 1) * ctrl->doorbell_stride) / 4;
+  q->size = size;
+  q->sq_tail = 0;
+  q->cq_head = 0;
+  q->phase = GRUB_NVME_CQE_PHASE;
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_nvme_free_queue (struct grub_nvme_queue *q)
+{
+  if (q->sq_chunk)
+    grub_dma_free (q->sq_chunk);
+  if (q->cq_chunk)
+    grub_dma_free (q->cq_chunk);
+  q->sq_chunk = NULL;
+  q->cq_chunk = NULL;
+}
+
+static void
+grub_nvme_free_slots (struct grub_nvme_controller *ctrl)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_NVME_NUM_SLOTS; i++)
+    {
+      if (ctrl->slots[i].buf)
+	grub_dma_free (ctrl->slots[i].buf);
+      if (ctrl->slots[i].prp_list)
+	grub_dma_free (ctrl->slots[i].prp_list);
+      ctrl->slots[i].buf = NULL;
+      ctrl->slots[i].prp_list = NULL;
+      ctrl->slots[i].busy = 0;
+    }
+}
+
+static grub_err_t
+grub_nvme_alloc_slots (struct grub_nvme_controller *ctrl)
+{
+  unsigned i, j;
+
+  for (i = 0; i < GRUB_NVME_NUM_SLOTS; i++)
+    {
+      struct grub_nvme_slot *slot = &ctrl->slots[i];
+      volatile grub_uint64_t *list;
+      grub_uint32_t phys;
+
+      slot->buf = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+				       GRUB_NVME_MAX_TRANSFER);
+      slot->prp_list = grub_memalign_dma32 (GRUB_NVME_PAGE_SIZE,
+					    GRUB_NVME_PAGE_SIZE);
+      if (!slot->buf || !slot->prp_list)
+	{
+	  grub_nvme_free_slots (ctrl);
+	  return grub_errno;
+	}
+
+      /* The first page goes into PRP1, so the list starts at page 1.  */
+      phys = grub_dma_get_phys (slot->buf);
+      list = grub_dma_get_virt (slot->prp_list);
+      for (j = 1; j < GRUB_NVME_MAX_TRANSFER / GRUB_NVME_PAGE_SIZE; j++)
+	list[j - 1] = grub_cpu_to_le64 ((grub_uint64_t) phys
+					+ (j << GRUB_NVME_PAGE_SHIFT));
+      slot->busy = 0;
+    }
+  return GRUB_ERR_NONE;
+}
+
+static void
+grub_nvme_submit (struct grub_nvme_queue *q, const struct grub_nvme_sqe *cmd)
+{
+  grub_memcpy ((void *) &q->sq[q->sq_tail], cmd, sizeof (*cmd));
+  if (++q->sq_tail == q->size)
+    q->sq_tail = 0;
+}
+
+static void
+grub_nvme_ring (struct grub_nvme_queue *q)
+{
+  *q->sq_doorbell = q->sq_tail;
+}
+
+/* Return the next posted completion or NULL.  The entry stays owned by us
+   until grub_nvme_consume.  */
+static volatile struct grub_nvme_cqe *
+grub_nvme_poll (struct grub_nvme_queue *q)
+{
+  volatile struct grub_nvme_cqe *cqe = &q->cq[q->cq_head];
+
+  if ((grub_le_to_cpu16 (cqe->status) & GRUB_NVME_CQE_PHASE) != q->phase)
+    return NULL;
+  return cqe;
+}
+
+static void
+grub_nvme_consume (struct grub_nvme_queue *q)
+{
+  if (++q->cq_head == q->size)
+    {
+      q->cq_head = 0;
+      q->phase ^= GRUB_NVME_CQE_PHASE;
+    }
+}
+
+static grub_err_t
+grub_nvme_admin (struct grub_nvme_controller *ctrl, struct grub_nvme_sqe *cmd)
+{
+  volatile struct grub_nvme_cqe *cqe;
+  grub_uint64_t endtime;
+  grub_uint16_t cid, status;
+
+  cid = ctrl->admin_cid++;
+  cmd->cdw0 = grub_cpu_to_le32 (grub_le_to_cpu32 (cmd->cdw0)
+				| ((grub_uint32_t) cid << 16));
+  grub_nvme_submit (&ctrl->admin, cmd);
+  grub_nvme_ring (&ctrl->admin);
+
+  endtime = grub_get_time_ms () + GRUB_NVME_ADMIN_TIMEOUT;
+  while (1)
+    {
+      cqe = grub_nvme_poll (&ctrl->admin);
+      if (cqe)
+	{
+	  status = GRUB_NVME_CQE_STATUS (grub_le_to_cpu16 (cqe->status));
+	  grub_nvme_consume (&ctrl->admin);
+	  *ctrl->admin.cq_doorbell = ctrl->admin.cq_head;
+	  if (grub_le_to_cpu16 (cqe->cid) == cid)
+	    break;
+	  continue;
+	}
+      if (grub_get_time_ms () > endtime)
+	return grub_error (GRUB_ERR_IO, "NVMe admin command timed out");
+    }
+
+  if (status)
+    return grub_error (GRUB_ERR_IO, "NVMe admin command 0x%x failed "
+		       "with status 0x%x", grub_le_to_cpu32 (cmd->cdw0) & 0xff,
+		       status);
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_identify (struct grub_nvme_controller *ctrl, grub_uint32_t cns,
+		    grub_uint32_t nsid, struct grub_pci_dma_chunk *buf)
+{
+  struct grub_nvme_sqe cmd;
+
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = grub_cpu_to_le32 (GRUB_NVME_ADMIN_IDENTIFY);
+  cmd.nsid = grub_cpu_to_le32 (nsid);
+  cmd.prp1 = grub_cpu_to_le64 (grub_dma_get_phys (buf));
+  cmd.cdw10 = grub_cpu_to_le32 (cns);
+  return grub_nvme_admin (ctrl, &cmd);
+}
+
+static grub_err_t
+grub_nvme_wait_ready (struct grub_nvme_controller *ctrl, grub_uint32_t ready)
+{
+  grub_uint64_t endtime;
+
+  endtime = grub_get_time_ms () + ctrl->timeout;
+  while ((ctrl->regs[GRUB_NVME_REG_CSTS] & GRUB_NVME_CSTS_RDY) != ready)
+    {
+      if (ready && (ctrl->regs[GRUB_NVME_REG_CSTS] & GRUB_NVME_CSTS_CFS))
+	return grub_error (GRUB_ERR_IO, "NVMe controller fatal status");
+      if (grub_get_time_ms () > endtime)
+	return grub_error (GRUB_ERR_IO, "NVMe controller didn't %s",
+			   ready ? "become ready" : "stop");
+    }
+  return GRUB_ERR_NONE;
+}
+
+/* Disabling the controller drops all of its queues.  */
+static void
+grub_nvme_stop (struct grub_nvme_controller *ctrl)
+{
+  ctrl->regs[GRUB_NVME_REG_CC] &= ~GRUB_NVME_CC_EN;
+  if (grub_nvme_wait_ready (ctrl, 0))
+    {
+      grub_dprintf ("nvme", "nvme%d: %s\n", ctrl->num, grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+    }
+
+  grub_nvme_free_slots (ctrl);
+  grub_nvme_free_queue (&ctrl->io);
+  grub_nvme_free_queue (&ctrl->admin);
+}
+
+/* Bring the controller up with an admin queue and one I/O queue pair.  */
+static grub_err_t
+grub_nvme_start (struct grub_nvme_controller *ctrl)
+{
+  struct grub_nvme_sqe cmd;
+  volatile grub_uint8_t *id;
+  grub_uint32_t phys;
+  grub_uint16_t qsize;
+  grub_uint8_t mdts;
+
+  ctrl->regs[GRUB_NVME_REG_CC] &= ~GRUB_NVME_CC_EN;
+  if (grub_nvme_wait_ready (ctrl, 0))
+    return grub_errno;
+
+  if (grub_nvme_alloc_queue (ctrl, &ctrl->admin, 0,
+			     GRUB_NVME_ADMIN_QUEUE_SIZE))
+    return grub_errno;
+
+  qsize = GRUB_NVME_IO_QUEUE_SIZE;
+  if (qsize > ctrl->max_queue_size)
+    qsize = ctrl->max_queue_size;
+  if (grub_nvme_alloc_queue (ctrl, &ctrl->io, 1, qsize))
+    goto fail;
+  if (grub_nvme_alloc_slots (ctrl))
+    goto fail;
+
+  ctrl->regs[GRUB_NVME_REG_INTMS] = 0xffffffff;
+  ctrl->regs[GRUB_NVME_REG_AQA] = ((GRUB_NVME_ADMIN_QUEUE_SIZE - 1) << 16)
+    | (GRUB_NVME_ADMIN_QUEUE_SIZE - 1);
+  ctrl->regs[GRUB_NVME_REG_ASQ_LO] = grub_dma_get_phys (ctrl->admin.sq_chunk);
+  ctrl->regs[GRUB_NVME_REG_ASQ_HI] = 0;
+  ctrl->regs[GRUB_NVME_REG_ACQ_LO] = grub_dma_get_phys (ctrl->admin.cq_chunk);
+  ctrl->regs[GRUB_NVME_REG_ACQ_HI] = 0;
+  ctrl->regs[GRUB_NVME_REG_CC] = GRUB_NVME_CC_IOSQES | GRUB_NVME_CC_IOCQES
+    | GRUB_NVME_CC_EN;
+  if (grub_nvme_wait_ready (ctrl, GRUB_NVME_CSTS_RDY))
+    goto fail;
+
+  /* The first slot buffer doubles as the identify buffer.  */
+  if (grub_nvme_identify (ctrl, GRUB_NVME_IDENTIFY_CONTROLLER, 0,
+			  ctrl->slots[0].buf))
+    goto fail;
+  id = grub_dma_get_virt (ctrl->slots[0].buf);
+  mdts = id[GRUB_NVME_ID_CTRL_MDTS];
+  ctrl->nn = grub_le_to_cpu32 (*(volatile grub_uint32_t *)
+			       (id + GRUB_NVME_ID_CTRL_NN));
+  ctrl->max_transfer = GRUB_NVME_MAX_TRANSFER;
+  if (mdts && mdts < 20 && (1U << (GRUB_NVME_PAGE_SHIFT + mdts))
+      < ctrl->max_transfer)
+    ctrl->max_transfer = 1U << (GRUB_NVME_PAGE_SHIFT + mdts);
+
+  phys = grub_dma_get_phys (ctrl->io.cq_chunk);
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = grub_cpu_to_le32 (GRUB_NVME_ADMIN_CREATE_CQ);
+  cmd.prp1 = grub_cpu_to_le64 (phys);
+  cmd.cdw10 = grub_cpu_to_le32 (((grub_uint32_t) (qsize - 1) << 16) | 1);
+  /* Physically contiguous, interrupts disabled.  */
+  cmd.cdw11 = grub_cpu_to_le32 (1);
+  if (grub_nvme_admin (ctrl, &cmd))
+    goto fail;
+
+  phys = grub_dma_get_phys (ctrl->io.sq_chunk);
+  grub_memset (&cmd, 0, sizeof (cmd));
+  cmd.cdw0 = grub_cpu_to_le32 (GRUB_NVME_ADMIN_CREATE_SQ);
+  cmd.prp1 = grub_cpu_to_le64 (phys);
+  cmd.cdw10 = grub_cpu_to_le32 (((grub_uint32_t) (qsize - 1) << 16) | 1);
+  /* Completions go to queue 1, physically contiguous.  */
+  cmd.cdw11 = grub_cpu_to_le32 ((1 << 16) | 1);
+  if (grub_nvme_admin (ctrl, &cmd))
+    goto fail;
+
+  grub_dprintf ("nvme", "nvme%d: %u namespaces, queue size %u, "
+		"max transfer %" PRIuGRUB_SIZE "\n", ctrl->num, ctrl->nn,
+		qsize, ctrl->max_transfer);
+  ctrl->alive = 1;
+  return GRUB_ERR_NONE;
+
+ fail:
+  ctrl->alive = 0;
+  grub_nvme_stop (ctrl);
+  return grub_errno;
+}
+
+static void
+grub_nvme_scan_namespaces (struct grub_nvme_controller *ctrl)
+{
+  volatile grub_uint8_t *id = grub_dma_get_virt (ctrl->slots[0].buf);
+  grub_uint32_t nsid, nn;
+
+  nn = ctrl->nn;
+  if (nn > GRUB_NVME_MAX_NAMESPACES)
+    nn = GRUB_NVME_MAX_NAMESPACES;
+
+  for (nsid = 1; nsid <= nn; nsid++)
+    {
+      struct grub_nvme_namespace *ns;
+      grub_uint64_t nsze;
+      grub_uint32_t lbaf;
+      grub_uint8_t flbas;
+
+      if (grub_nvme_identify (ctrl, GRUB_NVME_IDENTIFY_NAMESPACE, nsid,
+			      ctrl->slots[0].buf))
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  continue;
+	}
+
+      nsze = grub_le_to_cpu64 (*(volatile grub_uint64_t *)
+			       (id + GRUB_NVME_ID_NS_NSZE));
+      if (!nsze)
+	continue;
+
+      flbas = id[GRUB_NVME_ID_NS_FLBAS];
+      lbaf = grub_le_to_cpu32 (*(volatile grub_uint32_t *)
+			       (id + GRUB_NVME_ID_NS_LBAF + 4 * (flbas & 0xf)));
+      /* Metadata would need a separate buffer or interleaving.  */
+      if (lbaf & 0xffff)
+	{
+	  grub_dprintf ("nvme", "nvme%dn%u: metadata not supported\n",
+			ctrl->num, nsid);
+	  continue;
+	}
+      if (((lbaf >> 16) & 0xff) < GRUB_DISK_SECTOR_BITS
+	  || (1ULL << ((lbaf >> 16) & 0xff)) > ctrl->max_transfer)
+	{
+	  grub_dprintf ("nvme", "nvme%dn%u: unsupported sector size\n",
+			ctrl->num, nsid);
+	  continue;
+	}
+
+      ns = grub_zalloc (sizeof (*ns));
+      if (!ns)
+	return;
+      ns->ctrl = ctrl;
+      ns->nsid = nsid;
+      ns->total_sectors = nsze;
+      ns->log_sector_size = (lbaf >> 16) & 0xff;
+
+      grub_dprintf ("nvme", "found nvme%dn%u: %llu sectors of %u bytes\n",
+		    ctrl->num, nsid, (unsigned long long) nsze,
+		    1U << ns->log_sector_size);
+
+      grub_list_push (GRUB_AS_LIST_P (&grub_nvme_namespaces),
+		      GRUB_AS_LIST (ns));
+    }
+}
+
+static int
+grub_nvme_pciinit (grub_pci_device_t dev,
+		   grub_pci_id_t pciid __attribute__ ((unused)),
+		   void *data __attribute__ ((unused)))
+{
+  struct grub_nvme_controller *ctrl;
+  grub_pci_address_t addr;
+  grub_uint32_t class, bar, cap_lo, cap_hi;
+  volatile grub_uint32_t *regs;
+  unsigned stride;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_CLASS);
+  class = grub_pci_read (addr);
+
+  /* Mass storage, non-volatile memory, NVM Express.  */
+  if (class >> 8 != 0x010802)
+    return 0;
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG0);
+  bar = grub_pci_read (addr);
+  if ((bar & GRUB_PCI_ADDR_SPACE_MASK) != GRUB_PCI_ADDR_SPACE_MEMORY)
+    return 0;
+  if ((bar & GRUB_PCI_ADDR_MEM_TYPE_MASK) == GRUB_PCI_ADDR_MEM_TYPE_64)
+    {
+      addr = grub_pci_make_address (dev, GRUB_PCI_REG_ADDRESS_REG1);
+      if (grub_pci_read (addr))
+	{
+	  grub_dprintf ("nvme", "dev: %x:%x.%x: BAR above 4GiB\n",
+			dev.bus, dev.device, dev.function);
+	  return 0;
+	}
+    }
+
+  addr = grub_pci_make_address (dev, GRUB_PCI_REG_COMMAND);
+  grub_pci_write_word (addr, grub_pci_read_word (addr)
+		       | GRUB_PCI_COMMAND_MEM_ENABLED
+		       | GRUB_PCI_COMMAND_BUS_MASTER);
+
+  regs = grub_pci_device_map_range (dev, bar & GRUB_PCI_ADDR_MEM_MASK,
+				    GRUB_NVME_DOORBELL_BASE);
+  cap_lo = regs[GRUB_NVME_REG_CAP_LO];
+  cap_hi = regs[GRUB_NVME_REG_CAP_HI];
+
+  grub_dprintf ("nvme", "dev: %x:%x.%x, version %x, cap %08x%08x\n",
+		dev.bus, dev.device, dev.function, regs[GRUB_NVME_REG_VS],
+		cap_hi, cap_lo);
+
+  if (!(cap_hi & GRUB_NVME_CAP_HI_CSS_NVM)
+      || ((cap_hi >> GRUB_NVME_CAP_HI_MPSMIN_SHIFT)
+	  & GRUB_NVME_CAP_HI_MPSMIN_MASK) != 0)
+    {
+      grub_dprintf ("nvme", "unsupported controller\n");
+      return 0;
+    }
+
+  /* Doorbells for the admin queue and one I/O queue pair.  */
+  stride = 4 << (cap_hi & GRUB_NVME_CAP_HI_DSTRD_MASK);
+  regs = grub_pci_device_map_range (dev, bar & GRUB_PCI_ADDR_MEM_MASK,
+				    GRUB_NVME_DOORBELL_BASE + 4 * stride);
+
+  ctrl = grub_zalloc (sizeof (*ctrl));
+  if (!ctrl)
+    return 1;
+  ctrl->regs = regs;
+  ctrl->num = numctrls;
+  ctrl->doorbell_stride = stride;
+  /* CAP.TO is in 500ms units.  */
+  ctrl->timeout = ((cap_lo >> GRUB_NVME_CAP_LO_TO_SHIFT) + 1) * 500;
+  ctrl->max_queue_size = (cap_lo & GRUB_NVME_CAP_LO_MQES_MASK) + 1;
+
+  if (grub_nvme_start (ctrl))
+    {
+      grub_dprintf ("nvme", "couldn't start controller: %s\n", grub_errmsg);
+      grub_errno = GRUB_ERR_NONE;
+      grub_free (ctrl);
+      return 0;
+    }
+
+  numctrls++;
+  grub_list_push (GRUB_AS_LIST_P (&grub_nvme_controllers),
+		  GRUB_AS_LIST (ctrl));
+  grub_nvme_scan_namespaces (ctrl);
+  return 0;
+}
+
+static grub_err_t
+grub_nvme_fini_hw (int noreturn __attribute__ ((unused)))
+{
+  struct grub_nvme_controller *ctrl;
+
+  FOR_LIST_ELEMENTS (ctrl, grub_nvme_controllers)
+    if (ctrl->alive)
+      {
+	grub_nvme_stop (ctrl);
+	ctrl->alive = 0;
+      }
+  return GRUB_ERR_NONE;
+}
+
+static grub_err_t
+grub_nvme_restore_hw (void)
+{
+  struct grub_nvme_controller *ctrl;
+
+  FOR_LIST_ELEMENTS (ctrl, grub_nvme_controllers)
+    if (grub_nvme_start (ctrl))
+      {
+	grub_dprintf ("nvme", "couldn't restart nvme%d: %s\n", ctrl->num,
+		      grub_errmsg);
+	grub_errno = GRUB_ERR_NONE;
+      }
+  return GRUB_ERR_NONE;
+}
+
+static int
+grub_nvme_iterate (grub_disk_dev_iterate_hook_t hook, void *hook_data,
+		   grub_disk_pull_t pull)
+{
+  struct grub_nvme_namespace *ns;
+  char devname[40];
+
+  if (pull != GRUB_DISK_PULL_NONE)
+    return 0;
+
+  FOR_LIST_ELEMENTS (ns, grub_nvme_namespaces)
+    {
+      if (!ns->ctrl->alive)
+	continue;
+      grub_snprintf (devname, sizeof (devname), "nvme%dn%u",
+		     ns->ctrl->num, ns->nsid);
+      if (hook (devname, hook_data))
+	return 1;
+    }
+
+  return 0;
+}
+
+static grub_err_t
+grub_nvme_open (const char *name, grub_disk_t disk)
+{
+  struct grub_nvme_namespace *ns;
+  unsigned long num, nsid;
+  char *end;
+
+  if (grub_strncmp (name, "nvme", sizeof ("nvme") - 1) != 0
+      || !grub_isdigit (name[sizeof ("nvme") - 1]))
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an NVMe disk");
+
+  num = grub_strtoul (name + sizeof ("nvme") - 1, &end, 10);
+  if (*end != 'n' || !grub_isdigit (end[1]))
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an NVMe disk");
+  nsid = grub_strtoul (end + 1, &end, 10);
+  if (*end)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "not an NVMe disk");
+
+  FOR_LIST_ELEMENTS (ns, grub_nvme_namespaces)
+    if ((unsigned long) ns->ctrl->num == num && ns->nsid == nsid)
+      break;
+
+  if (!ns || !ns->ctrl->alive)
+    return grub_error (GRUB_ERR_UNKNOWN_DEVICE, "no such NVMe disk");
+
+  disk->total_sectors = ns->total_sectors;
+  disk->log_sector_size = ns->log_sector_size;
+  disk->max_agglomerate = (ns->ctrl->max_transfer * GRUB_NVME_NUM_SLOTS)
+    >> (GRUB_DISK_CACHE_BITS + GRUB_DISK_SECTOR_BITS);
+  if (disk->max_agglomerate > GRUB_DISK_MAX_MAX_AGGLOMERATE)
+    disk->max_agglomerate = GRUB_DISK_MAX_MAX_AGGLOMERATE;
+  disk->id = (num << 16) | nsid;
+  disk->data = ns;
+
+  return GRUB_ERR_NONE;
+}
+
+/* Split the request into up to GRUB_NVME_NUM_SLOTS commands, submit all
+   of them with one doorbell write and refill slots as completions arrive,
+   so the device always has several commands to work on.  */
+static grub_err_t
+grub_nvme_readwrite (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_size_t size, char *buf, int write)
+{
+  struct grub_nvme_namespace *ns = disk->data;
+  struct grub_nvme_controller *ctrl = ns->ctrl;
+  volatile struct grub_nvme_cqe *cqe;
+  grub_size_t max_sectors;
+  unsigned inflight = 0, i;
+  grub_uint64_t endtime;
+  grub_err_t err = GRUB_ERR_NONE;
+
+  if (!ctrl->alive)
+    return grub_error (GRUB_ERR_IO, "NVMe controller nvme%d is down",
+		       ctrl->num);
+
+  max_sectors = ctrl->max_transfer >> ns->log_sector_size;
+
+  while (size || inflight)
+    {
+      int submitted = 0;
+
+      for (i = 0; i < GRUB_NVME_NUM_SLOTS && size && !err; i++)
+	{
+	  struct grub_nvme_slot *slot = &ctrl->slots[i];
+	  struct grub_nvme_sqe cmd;
+	  grub_size_t n, bytes, pages;
+	  grub_uint32_t phys;
+
+	  if (slot->busy)
+	    continue;
+
+	  n = size < max_sectors ? size : max_sectors;
+	  bytes = n << ns->log_sector_size;
+	  pages = ALIGN_UP (bytes, GRUB_NVME_PAGE_SIZE) >> GRUB_NVME_PAGE_SHIFT;
+	  phys = grub_dma_get_phys (slot->buf);
+
+	  if (write)
+	    grub_memcpy ((void *) grub_dma_get_virt (slot->buf), buf, bytes);
+
+	  grub_memset (&cmd, 0, sizeof (cmd));
+	  cmd.cdw0 = grub_cpu_to_le32 ((write ? GRUB_NVME_CMD_WRITE
+					: GRUB_NVME_CMD_READ) | (i << 16));
+	  cmd.nsid = grub_cpu_to_le32 (ns->nsid);
+	  cmd.prp1 = grub_cpu_to_le64 (phys);
+	  if (pages == 2)
+	    cmd.prp2 = grub_cpu_to_le64 ((grub_uint64_t) phys
+					 + GRUB_NVME_PAGE_SIZE);
+	  else if (pages > 2)
+	    cmd.prp2 = grub_cpu_to_le64 (grub_dma_get_phys (slot->prp_list));
+	  cmd.cdw10 = grub_cpu_to_le32 (sector & 0xffffffff);
+	  cmd.cdw11 = grub_cpu_to_le32 (sector >> 32);
+	  cmd.cdw12 = grub_cpu_to_le32 (n - 1);
+	  grub_nvme_submit (&ctrl->io, &cmd);
+
+	  slot->busy = 1;
+	  slot->dest = buf;
+	  slot->size = bytes;
+	  sector += n;
+	  buf += bytes;
+	  size -= n;
+	  inflight++;
+	  submitted = 1;
+	}
+      if (submitted)
+	grub_nvme_ring (&ctrl->io);
+
+      if (!inflight)
+	break;
+
+      endtime = grub_get_time_ms () + ctrl->timeout;
+      while (!(cqe = grub_nvme_poll (&ctrl->io)))
+	if (grub_get_time_ms () > endtime)
+	  {
+	    /* Outstanding commands can't be reclaimed; start over.  */
+	    grub_nvme_stop (ctrl);
+	    if (grub_nvme_start (ctrl))
+	      grub_errno = GRUB_ERR_NONE;
+	    return grub_error (GRUB_ERR_IO, "NVMe command timed out");
+	  }
+
+      do
+	{
+	  grub_uint16_t cid = grub_le_to_cpu16 (cqe->cid);
+	  grub_uint16_t status
+	    = GRUB_NVME_CQE_STATUS (grub_le_to_cpu16 (cqe->status));
+
+	  grub_nvme_consume (&ctrl->io);
+
+	  if (cid >= GRUB_NVME_NUM_SLOTS || !ctrl->slots[cid].busy)
+	    {
+	      grub_dprintf ("nvme", "spurious completion %x\n", cid);
+	      continue;
+	    }
+
+	  if (status && !err)
+	    err = grub_error (write ? GRUB_ERR_WRITE_ERROR : GRUB_ERR_READ_ERROR,
+			      "NVMe command failed with status 0x%x", status);
+	  else if (!write && !err)
+	    grub_memcpy (ctrl->slots[cid].dest,
+			 (void *) grub_dma_get_virt (ctrl->slots[cid].buf),
+			 ctrl->slots[cid].size);
+	  ctrl->slots[cid].busy = 0;
+	  inflight--;
+	}
+      while ((cqe = grub_nvme_poll (&ctrl->io)));
+
+      *ctrl->io.cq_doorbell = ctrl->io.cq_head;
+    }
+
+  return err;
+}
+
+static grub_err_t
+grub_nvme_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_size_t size, char *buf)
+{
+  return grub_nvme_readwrite (disk, sector, size, buf, 0);
+}
+
+static grub_err_t
+grub_nvme_write (grub_disk_t disk, grub_disk_addr_t sector,
+		 grub_size_t size, const char *buf)
+{
+  return grub_nvme_readwrite (disk, sector, size, (char *) buf, 1);
+}
+
+static struct grub_disk_dev grub_nvme_dev =
+  {
+    .name = "nvme",
+    .id = GRUB_DISK_DEVICE_NVME_ID,
+    .disk_iterate = grub_nvme_iterate,
+    .disk_open = grub_nvme_open,
+    .disk_read = grub_nvme_read,
+    .disk_write = grub_nvme_write,
+    .next = 0
+  };
+
+static struct grub_preboot *fini_hnd;
+
+GRUB_MOD_INIT(nvme)
+{
+  grub_stop_disk_firmware ();
+
+  grub_pci_iterate (grub_nvme_pciinit, NULL);
+
+  grub_disk_dev_register (&grub_nvme_dev);
+
+  fini_hnd = grub_loader_register_preboot_hook (grub_nvme_fini_hw,
+						grub_nvme_restore_hw,
+						GRUB_LOADER_PREBOOT_HOOK_PRIO_DISK);
+}
+
+GRUB_MOD_FINI(nvme)
+{
+  grub_nvme_fini_hw (0);
+  grub_loader_unregister_preboot_hook (fini_hnd);
+
+  grub_disk_dev_unregister (&grub_nvme_dev);
+}
@@ -527,6 +527,7 @@ grub_scsi_open (const char *name, grub_disk_t disk)
 
   for (p = grub_scsi_dev_list; p; p = p->next)
     {
+      scsi->max_transfer = 0;
       if (p->open (id, bus, scsi))
 	{
 	  grub_errno = GRUB_ERR_NONE;
@@ -607,11 +608,10 @@ grub_scsi_open (const char *name, grub_disk_t disk)
 
       disk->total_sectors = scsi->last_block + 1;
       /* PATA doesn't support more than 32K reads.
-	 Not sure about AHCI and USB. If it's confirmed that either of
-	 them can do bigger reads reliably this value can be moved to 'scsi'
-	 structure.  */
-      disk->max_agglomerate = 32768 >> (GRUB_DISK_SECTOR_BITS
-					+ GRUB_DISK_CACHE_BITS);
+	 Not sure about AHCI and USB. Transports known to do bigger reads
+	 reliably say so in max_transfer.  */
+      disk->max_agglomerate = (scsi->max_transfer ? : 32768)
+	>> (GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS);
 
       if (scsi->blocksize & (scsi->blocksize - 1) || !scsi->blocksize)
 	{
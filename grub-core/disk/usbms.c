@@ -621,6 +621,9 @@ grub_usbms_open (int id, int devnum, struct grub_scsi *scsi)
 
   scsi->data = grub_usbms_devices[devnum];
   scsi->luns = grub_usbms_devices[devnum]->luns;
+  /* Like other systems, trust USB 3 devices with 1MiB commands.  */
+  if (grub_usbms_devices[devnum]->dev->speed == GRUB_USB_SPEED_SUPER)
+    scsi->max_transfer = 1024 * 1024;
 
   return GRUB_ERR_NONE;
 }
@@ -293,6 +293,9 @@ struct grub_ext3_journal_sblock
 };
 
 #define EXT4_EXT_MAGIC		0xf30a
+/* Extents longer than this are unwritten (preallocated) ones, whose real
+   length is LEN - EXT_INIT_MAX_LEN.  */
+#define EXT_INIT_MAX_LEN	32768
 
 struct grub_ext4_extent_header
 {
@@ -335,9 +338,15 @@ struct grub_ext2_data
   grub_disk_t disk;
   struct grub_ext2_inode *inode;
   struct grub_fshelp_node diropen;
+  /* Root inode, to reset DIROPEN when the mount is reused.  */
+  struct grub_ext2_inode root_inode;
+  /* Path lookups done on this mount, NULL if out of memory.  */
+  struct grub_fshelp_dcache *dcache;
 };
 
 static grub_dl_t my_mod;
+static struct grub_fs grub_ext2_fs;
+
 
 
 
@@ -454,8 +463,11 @@ grub_ext4_find_leaf (struct grub_ext2_data *data,
   return 0;
 }
 
+/* Map FILEBLOCK to a disk block and store in *RUN how many file blocks
+   starting at FILEBLOCK are contiguous on disk.  */
 static grub_disk_addr_t
-grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
+grub_ext2_read_extent (grub_fshelp_node_t node, grub_disk_addr_t fileblock,
+		       grub_disk_addr_t *run)
 {
   struct grub_ext2_data *data = node->data;
   struct grub_ext2_inode *inode = &node->inode;
@@ -466,6 +478,8 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
   grub_uint32_t indir;
   int shift;
 
+  *run = 1;
+
   if (inode->flags & grub_cpu_to_le32_compile_time (EXT4_EXTENTS_FLAG))
     {
       struct grub_ext4_extent_header *leaf;
@@ -489,9 +503,26 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
 
       if (--i >= 0)
         {
-          fileblock -= grub_le_to_cpu32 (ext[i].block);
-          if (fileblock >= grub_le_to_cpu16 (ext[i].len))
-	    ret = 0;
+          grub_disk_addr_t off = fileblock - grub_le_to_cpu32 (ext[i].block);
+	  grub_uint16_t len = grub_le_to_cpu16 (ext[i].len);
+	  int unwritten = (len > EXT_INIT_MAX_LEN);
+
+	  if (unwritten)
+	    len -= EXT_INIT_MAX_LEN;
+
+          if (off >= len)
+	    {
+	      /* Hole up to the next extent of this leaf.  */
+	      if (i + 1 < grub_le_to_cpu16 (leaf->entries))
+		*run = grub_le_to_cpu32 (ext[i + 1].block) - fileblock;
+	      ret = 0;
+	    }
+	  else if (unwritten)
+	    {
+	      /* Allocated but never written: reads as zeros.  */
+	      *run = len - off;
+	      ret = 0;
+	    }
           else
             {
               grub_disk_addr_t start;
@@ -499,7 +530,8 @@ grub_ext2_read_block (grub_fshelp_node_t node, grub_disk_addr_t fileblock)
               start = grub_le_to_cpu16 (ext[i].start_hi);
               start = (start << 32) + grub_le_to_cpu32 (ext[i].start);
 
-              ret = fileblock + start;
+              *run = len - off;
+              ret = off + start;
             }
         }
       else
@@ -571,12 +603,12 @@ grub_ext2_read_file (grub_fshelp_node_t node,
 		     grub_disk_read_hook_t read_hook, void *read_hook_data,
 		     grub_off_t pos, grub_size_t len, char *buf)
 {
-  return grub_fshelp_read_file (node->data->disk, node,
-				read_hook, read_hook_data,
-				pos, len, buf, grub_ext2_read_block,
-				grub_cpu_to_le32 (node->inode.size)
-				| (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
-				LOG2_EXT2_BLOCK_SIZE (node->data), 0);
+  return grub_fshelp_read_file_extent (node->data->disk, node,
+				       read_hook, read_hook_data,
+				       pos, len, buf, grub_ext2_read_extent,
+				       grub_cpu_to_le32 (node->inode.size)
+				       | (((grub_off_t) grub_cpu_to_le32 (node->inode.size_high)) << 32),
+				       LOG2_EXT2_BLOCK_SIZE (node->data), 0);
 
 }
 
@@ -628,6 +660,16 @@ grub_ext2_mount (grub_disk_t disk)
 {
   struct grub_ext2_data *data;
 
+  data = grub_fs_mount_cache_get (&grub_ext2_fs, disk);
+  if (data)
+    {
+      data->disk = disk;
+      data->diropen.ino = 2;
+      data->diropen.inode_read = 1;
+      grub_memcpy (data->inode, &data->root_inode, sizeof (*data->inode));
+      return data;
+    }
+
   data = grub_malloc (sizeof (struct grub_ext2_data));
   if (!data)
     return 0;
@@ -687,6 +729,11 @@ grub_ext2_mount (grub_disk_t disk)
   grub_ext2_read_inode (data, 2, data->inode);
   if (grub_errno)
     goto fail;
+  grub_memcpy (&data->root_inode, data->inode, sizeof (data->root_inode));
+
+  data->dcache = grub_fshelp_dcache_new (NULL,
+					  sizeof (struct grub_fshelp_node));
+  grub_errno = GRUB_ERR_NONE;
 
   return data;
 
@@ -697,6 +744,22 @@ grub_ext2_mount (grub_disk_t disk)
   grub_free (data);
   return 0;
 }
+/* Keep DATA in the mount cache for the next mount of its disk.  */
+static void
+grub_ext2_release (struct grub_ext2_data *data)
+{
+  if (data)
+    grub_fs_mount_cache_put (&grub_ext2_fs, data->disk, data);
+}
+
+static void
+grub_ext2_unmount (void *mount)
+{
+  struct grub_ext2_data *data = mount;
+
+  grub_fshelp_dcache_free (data->dcache);
+  grub_free (data);
+}
 
 static char *
 grub_ext2_read_symlink (grub_fshelp_node_t node)
@@ -861,9 +924,10 @@ grub_ext2_open (struct grub_file *file, const char *name)
       goto fail;
     }
 
-  err = grub_fshelp_find_file (name, &data->diropen, &fdiro,
-			       grub_ext2_iterate_dir,
-			       grub_ext2_read_symlink, GRUB_FSHELP_REG);
+  err = grub_fshelp_find_file_cached (name, &data->diropen, &fdiro,
+				      grub_ext2_iterate_dir,
+				      grub_ext2_read_symlink, GRUB_FSHELP_REG,
+				      data->dcache);
   if (err)
     goto fail;
 
@@ -893,7 +957,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
  fail:
   if (fdiro != &data->diropen)
     grub_free (fdiro);
-  grub_free (data);
+  grub_ext2_release (data);
 
   grub_dl_unref (my_mod);
 
@@ -903,7 +967,7 @@ grub_ext2_open (struct grub_file *file, const char *name)
 static grub_err_t
 grub_ext2_close (grub_file_t file)
 {
-  grub_free (file->data);
+  grub_ext2_release (file->data);
 
   grub_dl_unref (my_mod);
 
@@ -921,6 +985,36 @@ grub_ext2_read (grub_file_t file, char *buf, grub_size_t len)
 			      file->offset, len, buf);
 }
 
+static grub_err_t
+grub_ext2_map (grub_file_t file, grub_off_t offset,
+	       grub_disk_addr_t *sector, grub_off_t *len)
+{
+  struct grub_ext2_data *data = (struct grub_ext2_data *) file->data;
+  int log2_blksz = LOG2_EXT2_BLOCK_SIZE (data);
+  grub_off_t boff;
+  grub_disk_addr_t blk, run;
+
+  if (offset >= file->size)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "map out of range");
+
+  boff = offset & ((EXT2_BLOCK_SIZE (data)) - 1);
+  blk = grub_ext2_read_extent (&data->diropen,
+			       offset >> (log2_blksz + GRUB_DISK_SECTOR_BITS),
+			       &run);
+  if (grub_errno)
+    return grub_errno;
+  /* Holes and unwritten extents have nothing on disk worth mapping; the
+     caller reads them through the file, which yields zeros.  RUN already
+     stops at the end of the written part of the extent.  */
+  if (blk == 0)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE,
+		       "sparse file or unwritten extent");
+
+  *sector = (blk << log2_blksz) + (boff >> GRUB_DISK_SECTOR_BITS);
+  *len = (run << (log2_blksz + GRUB_DISK_SECTOR_BITS)) - boff;
+  return GRUB_ERR_NONE;
+}
+
 
 /* Context for grub_ext2_dir.  */
 struct grub_ext2_dir_ctx
@@ -973,9 +1067,9 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
   if (! ctx.data)
     goto fail;
 
-  grub_fshelp_find_file (path, &ctx.data->diropen, &fdiro,
-			 grub_ext2_iterate_dir, grub_ext2_read_symlink,
-			 GRUB_FSHELP_DIR);
+  grub_fshelp_find_file_cached (path, &ctx.data->diropen, &fdiro,
+				grub_ext2_iterate_dir, grub_ext2_read_symlink,
+				GRUB_FSHELP_DIR, ctx.data->dcache);
   if (grub_errno)
     goto fail;
 
@@ -984,7 +1078,7 @@ grub_ext2_dir (grub_device_t device, const char *path, grub_fs_dir_hook_t hook,
  fail:
   if (fdiro != &ctx.data->diropen)
     grub_free (fdiro);
-  grub_free (ctx.data);
+  grub_ext2_release (ctx.data);
 
   grub_dl_unref (my_mod);
 
@@ -1008,7 +1102,7 @@ grub_ext2_label (grub_device_t device, char **label)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_ext2_release (data);
 
   return grub_errno;
 }
@@ -1039,7 +1133,7 @@ grub_ext2_uuid (grub_device_t device, char **uuid)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_ext2_release (data);
 
   return grub_errno;
 }
@@ -1061,7 +1155,7 @@ grub_ext2_mtime (grub_device_t device, grub_int32_t *tm)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_ext2_release (data);
 
   return grub_errno;
 
@@ -1079,6 +1173,8 @@ static struct grub_fs grub_ext2_fs =
     .fs_label = grub_ext2_label,
     .fs_uuid = grub_ext2_uuid,
     .fs_mtime = grub_ext2_mtime,
+    .fs_map = grub_ext2_map,
+    .fs_unmount = grub_ext2_unmount,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
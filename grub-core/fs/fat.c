@@ -201,6 +201,22 @@ struct grub_fshelp_node {
 #ifdef MODE_EXFAT
   int is_contiguous;
 #endif
+
+  /* Runs of contiguous clusters of an open file, built lazily while the
+     chain is walked.  The last run ends at the walk cursor above.  NULL
+     for directories, which only keep the cursor.  */
+  struct grub_fat_cluster_run *runs;
+  grub_uint32_t nruns;
+  grub_uint32_t alloc_runs;
+};
+
+/* Logical clusters LOGICAL .. LOGICAL + COUNT - 1 are stored at clusters
+   CLUSTER .. CLUSTER + COUNT - 1.  */
+struct grub_fat_cluster_run
+{
+  grub_uint32_t logical;
+  grub_uint32_t cluster;
+  grub_uint32_t count;
 };
 
 static grub_dl_t my_mod;
@@ -448,6 +464,210 @@ grub_fat_mount (grub_disk_t disk)
   return 0;
 }
 
+/* Read the FAT entry of CLUSTER into *NEXT.  Return 1 at the end of the
+   chain, 0 on success and -1 on error.  */
+static int
+grub_fat_next_cluster (grub_disk_t disk, struct grub_fat_data *data,
+		       grub_uint32_t cluster, grub_uint32_t *next)
+{
+  grub_uint32_t next_cluster;
+  grub_uint32_t fat_offset;
+
+  switch (data->fat_size)
+    {
+    case 32:
+      fat_offset = cluster << 2;
+      break;
+    case 16:
+      fat_offset = cluster << 1;
+      break;
+    default:
+      /* case 12: */
+      fat_offset = cluster + (cluster >> 1);
+      break;
+    }
+
+  /* Read the FAT.  */
+  if (grub_disk_read (disk, data->fat_sector, fat_offset,
+		      (data->fat_size + 7) >> 3,
+		      (char *) &next_cluster))
+    return -1;
+
+  next_cluster = grub_le_to_cpu32 (next_cluster);
+  switch (data->fat_size)
+    {
+    case 16:
+      next_cluster &= 0xFFFF;
+      break;
+    case 12:
+      if (cluster & 1)
+	next_cluster >>= 4;
+
+      next_cluster &= 0x0FFF;
+      break;
+    }
+
+  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
+		data->fat_size, next_cluster);
+
+  /* Check the end.  */
+  if (next_cluster >= data->cluster_eof_mark)
+    return 1;
+
+  if (next_cluster < 2 || next_cluster >= data->num_clusters)
+    {
+      grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u", next_cluster);
+      return -1;
+    }
+
+  *next = next_cluster;
+  return 0;
+}
+
+/* Record that logical cluster NUM of NODE is stored at CLUSTER.  */
+static void
+grub_fat_add_run (grub_fshelp_node_t node, grub_uint32_t num,
+		  grub_uint32_t cluster)
+{
+  struct grub_fat_cluster_run *run;
+
+  if (node->nruns)
+    {
+      run = &node->runs[node->nruns - 1];
+      if (run->logical + run->count == num
+	  && run->cluster + run->count == cluster)
+	{
+	  run->count++;
+	  return;
+	}
+    }
+
+  if (node->nruns == node->alloc_runs)
+    {
+      run = grub_realloc (node->runs,
+			  2 * node->alloc_runs * sizeof (node->runs[0]));
+      if (!run)
+	{
+	  /* Carry on with the plain cursor.  */
+	  grub_errno = GRUB_ERR_NONE;
+	  grub_free (node->runs);
+	  node->runs = NULL;
+	  node->nruns = 0;
+	  return;
+	}
+      node->runs = run;
+      node->alloc_runs *= 2;
+    }
+
+  run = &node->runs[node->nruns++];
+  run->logical = num;
+  run->cluster = cluster;
+  run->count = 1;
+}
+
+/* Find the cluster holding logical cluster LOGICAL of NODE and store it in
+   *CLUSTER, with the number of clusters from there on that are contiguous
+   on disk in *COUNT.  The chain is followed up to WANT clusters past
+   LOGICAL while it stays contiguous.  Return 1 if the chain ends before
+   LOGICAL, 0 on success and -1 on error.  */
+static int
+grub_fat_find_cluster (grub_disk_t disk, grub_fshelp_node_t node,
+		       grub_uint32_t logical, grub_uint32_t want,
+		       grub_uint32_t *cluster, grub_uint32_t *count)
+{
+  grub_uint32_t target, run_num, run_cluster;
+
+#ifdef MODE_EXFAT
+  if (node->is_contiguous)
+    {
+      *cluster = node->file_cluster + logical;
+      *count = want;
+      return 0;
+    }
+#endif
+
+  target = logical + want - 1;
+  if (target < logical)
+    target = ~0U;
+
+  if (node->nruns)
+    {
+      grub_uint32_t lo = 0, hi = node->nruns;
+      struct grub_fat_cluster_run *run;
+
+      while (hi - lo > 1)
+	{
+	  grub_uint32_t mid = lo + (hi - lo) / 2;
+	  if (node->runs[mid].logical <= logical)
+	    lo = mid;
+	  else
+	    hi = mid;
+	}
+      run = &node->runs[lo];
+      /* Runs before the last one are complete; the last one may still
+	 grow past the cursor.  */
+      if (logical < run->logical + run->count
+	  && (lo + 1 < node->nruns || target < run->logical + run->count))
+	{
+	  *cluster = run->cluster + (logical - run->logical);
+	  *count = run->count - (logical - run->logical);
+	  return 0;
+	}
+    }
+
+  if (node->cur_cluster_num == ~0U
+      || (!node->runs && logical < node->cur_cluster_num))
+    {
+      node->cur_cluster_num = 0;
+      node->cur_cluster = node->file_cluster;
+      if (node->runs)
+	grub_fat_add_run (node, 0, node->file_cluster);
+    }
+
+  if (node->nruns)
+    {
+      run_num = node->runs[node->nruns - 1].logical;
+      run_cluster = node->runs[node->nruns - 1].cluster;
+    }
+  else
+    {
+      run_num = node->cur_cluster_num;
+      run_cluster = node->cur_cluster;
+    }
+
+  while (node->cur_cluster_num < target)
+    {
+      grub_uint32_t next;
+      int r;
+
+      r = grub_fat_next_cluster (disk, node->data, node->cur_cluster, &next);
+      if (r < 0)
+	return -1;
+      if (r > 0)
+	{
+	  if (node->cur_cluster_num < logical)
+	    return 1;
+	  break;
+	}
+      /* Past LOGICAL only follow the chain while it stays contiguous.  */
+      if (next != node->cur_cluster + 1)
+	{
+	  if (node->cur_cluster_num >= logical)
+	    break;
+	  run_num = node->cur_cluster_num + 1;
+	  run_cluster = next;
+	}
+      node->cur_cluster = next;
+      node->cur_cluster_num++;
+      if (node->runs)
+	grub_fat_add_run (node, node->cur_cluster_num, next);
+    }
+
+  *cluster = run_cluster + (logical - run_num);
+  *count = node->cur_cluster_num - logical + 1;
+  return 0;
+}
+
 static grub_ssize_t
 grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
 		    grub_disk_read_hook_t read_hook, void *read_hook_data,
@@ -501,79 +721,30 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
   logical_cluster = offset >> logical_cluster_bits;
   offset &= (1ULL << logical_cluster_bits) - 1;
 
-  if (logical_cluster < node->cur_cluster_num)
-    {
-      node->cur_cluster_num = 0;
-      node->cur_cluster = node->file_cluster;
-    }
-
+  /* Read one contiguous run of clusters at a time.  */
   while (len)
     {
-      while (logical_cluster > node->cur_cluster_num)
-	{
-	  /* Find next cluster.  */
-	  grub_uint32_t next_cluster;
-	  grub_uint32_t fat_offset;
-
-	  switch (node->data->fat_size)
-	    {
-	    case 32:
-	      fat_offset = node->cur_cluster << 2;
-	      break;
-	    case 16:
-	      fat_offset = node->cur_cluster << 1;
-	      break;
-	    default:
-	      /* case 12: */
-	      fat_offset = node->cur_cluster + (node->cur_cluster >> 1);
-	      break;
-	    }
-
-	  /* Read the FAT.  */
-	  if (grub_disk_read (disk, node->data->fat_sector, fat_offset,
-			      (node->data->fat_size + 7) >> 3,
-			      (char *) &next_cluster))
-	    return -1;
-
-	  next_cluster = grub_le_to_cpu32 (next_cluster);
-	  switch (node->data->fat_size)
-	    {
-	    case 16:
-	      next_cluster &= 0xFFFF;
-	      break;
-	    case 12:
-	      if (node->cur_cluster & 1)
-		next_cluster >>= 4;
-
-	      next_cluster &= 0x0FFF;
-	      break;
-	    }
-
-	  grub_dprintf ("fat", "fat_size=%d, next_cluster=%u\n",
-			node->data->fat_size, next_cluster);
-
-	  /* Check the end.  */
-	  if (next_cluster >= node->data->cluster_eof_mark)
-	    return ret;
-
-	  if (next_cluster < 2 || next_cluster >= node->data->num_clusters)
-	    {
-	      grub_error (GRUB_ERR_BAD_FS, "invalid cluster %u",
-			  next_cluster);
-	      return -1;
-	    }
-
-	  node->cur_cluster = next_cluster;
-	  node->cur_cluster_num++;
-	}
+      grub_uint32_t cluster, count, want;
+      grub_uint64_t run_size;
+      int r;
+
+      want = ((offset + len + (1ULL << logical_cluster_bits) - 1)
+	      >> logical_cluster_bits);
+      r = grub_fat_find_cluster (disk, node, logical_cluster, want,
+				 &cluster, &count);
+      if (r < 0)
+	return -1;
+      if (r > 0)
+	return ret;
 
       /* Read the data here.  */
       sector = (node->data->cluster_sector
-		+ ((node->cur_cluster - 2)
+		+ ((cluster - 2)
 		   << node->data->cluster_bits));
-      size = (1 << logical_cluster_bits) - offset;
-      if (size > len)
-	size = len;
+      run_size = ((grub_uint64_t) count << logical_cluster_bits) - offset;
+      size = len;
+      if (size > run_size)
+	size = run_size;
 
       disk->read_hook = read_hook;
       disk->read_hook_data = read_hook_data;
@@ -585,8 +756,9 @@ grub_fat_read_data (grub_disk_t disk, grub_fshelp_node_t node,
       len -= size;
       buf += size;
       ret += size;
-      logical_cluster++;
-      offset = 0;
+      offset += size;
+      logical_cluster += offset >> logical_cluster_bits;
+      offset &= (1ULL << logical_cluster_bits) - 1;
     }
 
   return ret;
@@ -900,6 +1072,9 @@ static grub_err_t lookup_file (grub_fshelp_node_t node,
 	    (*foundnode)->file_cluster = node->data->root_cluster;
 #endif
 	  (*foundnode)->cur_cluster_num = ~0U;
+	  (*foundnode)->runs = NULL;
+	  (*foundnode)->nruns = 0;
+	  (*foundnode)->alloc_runs = 0;
 	  (*foundnode)->data = node->data;
 	  (*foundnode)->disk = node->disk;
 
@@ -1022,6 +1197,16 @@ grub_fat_open (grub_file_t file, const char *name)
   file->data = found;
   file->size = found->file_size;
 
+  /* Index the cluster chain of the file as it gets read.  Without the
+     index reads still work, seeking back just restarts the walk.  */
+  found->alloc_runs = 8;
+  found->runs = grub_malloc (found->alloc_runs * sizeof (found->runs[0]));
+  if (!found->runs)
+    {
+      found->alloc_runs = 0;
+      grub_errno = GRUB_ERR_NONE;
+    }
+
   return GRUB_ERR_NONE;
 
  fail:
@@ -1044,11 +1229,61 @@ grub_fat_read (grub_file_t file, char *buf, grub_size_t len)
 			     file->offset, len, buf);
 }
 
+static grub_err_t
+grub_fat_map (grub_file_t file, grub_off_t offset,
+	      grub_disk_addr_t *sector, grub_off_t *len)
+{
+  grub_fshelp_node_t node = file->data;
+  unsigned logical_cluster_bits;
+  grub_off_t cluster_offset;
+  grub_uint32_t cluster, count;
+  int r;
+
+  if (offset >= file->size)
+    return grub_error (GRUB_ERR_OUT_OF_RANGE, "map out of range");
+
+#ifndef MODE_EXFAT
+  if (node->file_cluster == ~0U)
+    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "not a regular file");
+#else
+  if (node->is_contiguous)
+    {
+      *sector = (node->data->cluster_sector
+		 + ((grub_disk_addr_t) (node->file_cluster - 2)
+		    << node->data->cluster_bits)
+		 + (offset >> GRUB_DISK_SECTOR_BITS));
+      *len = file->size - offset;
+      return GRUB_ERR_NONE;
+    }
+#endif
+
+  logical_cluster_bits = node->data->cluster_bits + GRUB_DISK_SECTOR_BITS;
+  cluster_offset = offset & ((1ULL << logical_cluster_bits) - 1);
+
+  r = grub_fat_find_cluster (file->device->disk, node,
+			     offset >> logical_cluster_bits,
+			     ((file->size - offset + cluster_offset
+			       + (1ULL << logical_cluster_bits) - 1)
+			      >> logical_cluster_bits),
+			     &cluster, &count);
+  if (r < 0)
+    return grub_errno;
+  if (r > 0)
+    return grub_error (GRUB_ERR_BAD_FS, "cluster chain too short");
+
+  *sector = (node->data->cluster_sector
+	     + ((grub_disk_addr_t) (cluster - 2) << node->data->cluster_bits)
+	     + (cluster_offset >> GRUB_DISK_SECTOR_BITS));
+  *len = ((grub_off_t) count << logical_cluster_bits) - cluster_offset;
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t
 grub_fat_close (grub_file_t file)
 {
   grub_fshelp_node_t node = file->data;
 
+  grub_free (node->runs);
   grub_free (node->data);
   grub_free (node);
 
@@ -1233,6 +1468,7 @@ static struct grub_fs grub_fat_fs =
     .fs_open = grub_fat_open,
     .fs_read = grub_fat_read,
     .fs_close = grub_fat_close,
+    .fs_map = grub_fat_map,
     .fs_label = grub_fat_label,
     .fs_uuid = grub_fat_uuid,
 #ifdef GRUB_UTIL
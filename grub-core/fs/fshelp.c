@@ -40,6 +40,31 @@ struct stack_element {
   struct stack_element *parent;
   grub_fshelp_node_t node;
   enum grub_fshelp_filetype type;
+  /* Path of NODE from the root, only tracked for the dentry cache.  */
+  char *path;
+};
+
+#define GRUB_FSHELP_DCACHE_SIZE 64
+
+struct grub_fshelp_dcache_entry
+{
+  char *path;
+  grub_uint32_t hash;
+  /* NULL for a negative entry.  */
+  grub_fshelp_node_t node;
+  enum grub_fshelp_filetype type;
+  grub_uint64_t last_use;
+};
+
+struct grub_fshelp_dcache
+{
+  grub_fshelp_node_t (*dup_node) (grub_fshelp_node_t node);
+  grub_size_t node_size;
+  struct grub_fshelp_dcache_entry entries[GRUB_FSHELP_DCACHE_SIZE];
+  grub_uint64_t clock;
+  unsigned long hits;
+  unsigned long negative_hits;
+  unsigned long misses;
 };
 
 /* Context for grub_fshelp_find_file.  */
@@ -48,6 +73,7 @@ struct grub_fshelp_find_file_ctx
   /* Inputs.  */
   const char *path;
   grub_fshelp_node_t rootnode;
+  struct grub_fshelp_dcache *dcache;
 
   /* Global options. */
   int symlinknest;
@@ -56,6 +82,145 @@ struct grub_fshelp_find_file_ctx
   struct stack_element *currnode;
 };
 
+struct grub_fshelp_dcache *
+grub_fshelp_dcache_new (grub_fshelp_node_t (*dup_node) (grub_fshelp_node_t node),
+			grub_size_t node_size)
+{
+  struct grub_fshelp_dcache *dcache;
+
+  dcache = grub_zalloc (sizeof (*dcache));
+  if (!dcache)
+    return NULL;
+  dcache->dup_node = dup_node;
+  dcache->node_size = node_size;
+  return dcache;
+}
+
+void
+grub_fshelp_dcache_free (struct grub_fshelp_dcache *dcache)
+{
+  unsigned i;
+
+  if (!dcache)
+    return;
+
+  grub_dprintf ("fshelp", "dentry cache: %lu hits, %lu negative hits, "
+		"%lu misses\n", dcache->hits, dcache->negative_hits,
+		dcache->misses);
+
+  for (i = 0; i < GRUB_FSHELP_DCACHE_SIZE; i++)
+    {
+      grub_free (dcache->entries[i].path);
+      grub_free (dcache->entries[i].node);
+    }
+  grub_free (dcache);
+}
+
+static grub_fshelp_node_t
+dcache_dup_node (struct grub_fshelp_dcache *dcache, grub_fshelp_node_t node)
+{
+  grub_fshelp_node_t copy;
+
+  if (dcache->dup_node)
+    return dcache->dup_node (node);
+
+  copy = grub_malloc (dcache->node_size);
+  if (copy)
+    grub_memcpy (copy, node, dcache->node_size);
+  return copy;
+}
+
+static grub_uint32_t
+dcache_hash (const char *path)
+{
+  grub_uint32_t hash = 2166136261U;
+
+  for (; *path; path++)
+    hash = (hash ^ (grub_uint8_t) *path) * 16777619U;
+  return hash;
+}
+
+/* Look PATH up in DCACHE.  On a hit return 1 and store a copy of the node
+   (NULL if PATH is known not to exist) in *FOUNDNODE.  */
+static int
+dcache_lookup (struct grub_fshelp_dcache *dcache, const char *path,
+	       grub_fshelp_node_t *foundnode,
+	       enum grub_fshelp_filetype *foundtype)
+{
+  grub_uint32_t hash = dcache_hash (path);
+  unsigned i;
+
+  for (i = 0; i < GRUB_FSHELP_DCACHE_SIZE; i++)
+    {
+      struct grub_fshelp_dcache_entry *e = &dcache->entries[i];
+
+      if (!e->path || e->hash != hash || grub_strcmp (e->path, path) != 0)
+	continue;
+
+      if (e->node)
+	{
+	  *foundnode = dcache_dup_node (dcache, e->node);
+	  if (!*foundnode)
+	    {
+	      grub_errno = GRUB_ERR_NONE;
+	      break;
+	    }
+	  dcache->hits++;
+	}
+      else
+	{
+	  *foundnode = NULL;
+	  dcache->negative_hits++;
+	}
+      *foundtype = e->type;
+      e->last_use = ++dcache->clock;
+      return 1;
+    }
+
+  dcache->misses++;
+  return 0;
+}
+
+static void
+dcache_insert (struct grub_fshelp_dcache *dcache, const char *path,
+	       grub_fshelp_node_t node, enum grub_fshelp_filetype type)
+{
+  struct grub_fshelp_dcache_entry *victim = &dcache->entries[0];
+  grub_fshelp_node_t copy = NULL;
+  char *pathcopy;
+  unsigned i;
+
+  for (i = 0; i < GRUB_FSHELP_DCACHE_SIZE; i++)
+    {
+      if (!dcache->entries[i].path)
+	{
+	  victim = &dcache->entries[i];
+	  break;
+	}
+      if (dcache->entries[i].last_use < victim->last_use)
+	victim = &dcache->entries[i];
+    }
+
+  pathcopy = grub_strdup (path);
+  if (node)
+    copy = dcache_dup_node (dcache, node);
+  if (!pathcopy || (node && !copy))
+    {
+      grub_free (pathcopy);
+      grub_free (copy);
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  grub_free (victim->path);
+  grub_free (victim->node);
+  victim->path = pathcopy;
+  victim->hash = dcache_hash (path);
+  victim->node = copy;
+  victim->type = type;
+  victim->last_use = ++dcache->clock;
+}
+
 /* Helper for find_file_iter.  */
 static void
 free_node (grub_fshelp_node_t node, struct grub_fshelp_find_file_ctx *ctx)
@@ -71,6 +236,7 @@ pop_element (struct grub_fshelp_find_file_ctx *ctx)
   el = ctx->currnode;
   ctx->currnode = el->parent;
   free_node (el->node, ctx);
+  grub_free (el->path);
   grub_free (el);
 }
 
@@ -89,15 +255,21 @@ go_up_a_level (struct grub_fshelp_find_file_ctx *ctx)
   pop_element (ctx);
 }
 
+/* Push NODE.  PATH, if not NULL, is taken over by the stack.  */
 static grub_err_t
-push_node (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t node, enum grub_fshelp_filetype filetype)
+push_node (struct grub_fshelp_find_file_ctx *ctx, grub_fshelp_node_t node,
+	   enum grub_fshelp_filetype filetype, char *path)
 {
   struct stack_element *nst;
   nst = grub_malloc (sizeof (*nst));
   if (!nst)
-    return grub_errno;
+    {
+      grub_free (path);
+      return grub_errno;
+    }
   nst->node = node;
   nst->type = filetype & ~GRUB_FSHELP_CASE_INSENSITIVE;
+  nst->path = path;
   nst->parent = ctx->currnode;
   ctx->currnode = nst;
   return GRUB_ERR_NONE;
@@ -107,7 +279,8 @@ static grub_err_t
 go_to_root (struct grub_fshelp_find_file_ctx *ctx)
 {
   free_stack (ctx);
-  return push_node (ctx, ctx->rootnode, GRUB_FSHELP_DIR);
+  return push_node (ctx, ctx->rootnode, GRUB_FSHELP_DIR,
+		    ctx->dcache ? grub_strdup ("") : NULL);
 }
 
 struct grub_fshelp_find_file_iter_ctx
@@ -164,7 +337,7 @@ find_file (char *currpath,
 	   read_symlink_func read_symlink,
 	   struct grub_fshelp_find_file_ctx *ctx)
 {
-  char *name, *next;
+  char *name, *next, *key;
   grub_err_t err;
   for (name = currpath; ; name = next)
     {
@@ -202,19 +375,44 @@ find_file (char *currpath,
       /* Iterate over the directory.  */
       c = *next;
       *next = '\0';
-      if (lookup_file)
-	err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
+      key = NULL;
+      if (ctx->dcache && ctx->currnode->path)
+	{
+	  grub_size_t plen = grub_strlen (ctx->currnode->path);
+
+	  key = grub_malloc (plen + (next - name) + 2);
+	  if (key)
+	    {
+	      grub_memcpy (key, ctx->currnode->path, plen);
+	      key[plen] = '/';
+	      grub_memcpy (key + plen + 1, name, (next - name) + 1);
+	    }
+	  else
+	    grub_errno = GRUB_ERR_NONE;
+	}
+      if (key && dcache_lookup (ctx->dcache, key, &foundnode, &foundtype))
+	err = GRUB_ERR_NONE;
       else
-	err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+	{
+	  if (lookup_file)
+	    err = lookup_file (ctx->currnode->node, name, &foundnode, &foundtype);
+	  else
+	    err = directory_find_file (ctx->currnode->node, name, &foundnode, &foundtype, iterate_dir);
+	  if (!err && key)
+	    dcache_insert (ctx->dcache, key, foundnode, foundtype);
+	}
       *next = c;
 
+      if (err || !foundnode)
+	grub_free (key);
+
       if (err)
 	return err;
 
       if (!foundnode)
 	break;
 
-      push_node (ctx, foundnode, foundtype);
+      push_node (ctx, foundnode, foundtype, key);
  
       /* Read in the symlink and follow it.  */
       if (ctx->currnode->type == GRUB_FSHELP_SYMLINK)
@@ -264,11 +462,13 @@ grub_fshelp_find_file_real (const char *path, grub_fshelp_node_t rootnode,
 			    iterate_dir_func iterate_dir,
 			    lookup_file_func lookup_file,
 			    read_symlink_func read_symlink,
-			    enum grub_fshelp_filetype expecttype)
+			    enum grub_fshelp_filetype expecttype,
+			    struct grub_fshelp_dcache *dcache)
 {
   struct grub_fshelp_find_file_ctx ctx = {
     .path = path,
     .rootnode = rootnode,
+    .dcache = dcache,
     .symlinknest = 0,
     .currnode = 0
   };
@@ -327,10 +527,25 @@ grub_fshelp_find_file (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     iterate_dir, NULL, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL);
 
 }
 
+/* Same as grub_fshelp_find_file, but resolve path components through
+   DCACHE first and remember the results there.  DCACHE may be NULL.  */
+grub_err_t
+grub_fshelp_find_file_cached (const char *path, grub_fshelp_node_t rootnode,
+			      grub_fshelp_node_t *foundnode,
+			      iterate_dir_func iterate_dir,
+			      read_symlink_func read_symlink,
+			      enum grub_fshelp_filetype expecttype,
+			      struct grub_fshelp_dcache *dcache)
+{
+  return grub_fshelp_find_file_real (path, rootnode, foundnode,
+				     iterate_dir, NULL,
+				     read_symlink, expecttype, dcache);
+}
+
 grub_err_t
 grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 			      grub_fshelp_node_t *foundnode,
@@ -340,7 +555,7 @@ grub_fshelp_find_file_lookup (const char *path, grub_fshelp_node_t rootnode,
 {
   return grub_fshelp_find_file_real (path, rootnode, foundnode,
 				     NULL, lookup_file, 
-				     read_symlink, expecttype);
+				     read_symlink, expecttype, NULL);
 
 }
 
@@ -427,3 +642,115 @@ grub_fshelp_read_file (grub_disk_t disk, grub_fshelp_node_t node,
 
   return len;
 }
+
+/* Like grub_fshelp_read_file, but GET_EXTENT translates a file block
+   into the disk block it starts at and stores in *RUN the number of
+   file blocks, starting with BLOCK, that follow it contiguously on
+   disk.  A disk block of 0 describes a hole of *RUN blocks.  Runs that
+   are physically adjacent are merged, so that every contiguous part of
+   the requested range is fetched with a single grub_disk_read.  */
+grub_ssize_t
+grub_fshelp_read_file_extent (grub_disk_t disk, grub_fshelp_node_t node,
+			      grub_disk_read_hook_t read_hook,
+			      void *read_hook_data,
+			      grub_off_t pos, grub_size_t len, char *buf,
+			      grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+							      grub_disk_addr_t block,
+							      grub_disk_addr_t *run),
+			      grub_off_t filesize, int log2blocksize,
+			      grub_disk_addr_t blocks_start)
+{
+  int log2bytes = log2blocksize + GRUB_DISK_SECTOR_BITS;
+  grub_disk_addr_t blk, blockcnt;
+  grub_disk_addr_t start = 0, run = 0, next = 0, nextrun = 0;
+  grub_size_t skipfirst, remaining;
+  int have_next = 0;
+
+  if (pos > filesize)
+    {
+      grub_error (GRUB_ERR_OUT_OF_RANGE,
+		  N_("attempt to read past the end of file"));
+      return -1;
+    }
+
+  /* Adjust LEN so it we can't read past the end of the file.  */
+  if (pos + len > filesize)
+    len = filesize - pos;
+
+  blk = pos >> log2bytes;
+  blockcnt = (len + pos + (1ULL << log2bytes) - 1) >> log2bytes;
+  skipfirst = pos & ((1ULL << log2bytes) - 1);
+  remaining = len;
+
+  while (blk < blockcnt)
+    {
+      grub_size_t toread;
+
+      if (have_next)
+	{
+	  start = next;
+	  run = nextrun;
+	  have_next = 0;
+	}
+      else
+	{
+	  start = get_extent (node, blk, &run);
+	  if (grub_errno)
+	    return -1;
+	}
+
+      if (run == 0)
+	run = 1;
+      if (run > blockcnt - blk)
+	run = blockcnt - blk;
+
+      /* Extend the run as long as the next extent continues it on disk
+	 (or continues a hole).  */
+      while (blk + run < blockcnt)
+	{
+	  next = get_extent (node, blk + run, &nextrun);
+	  if (grub_errno)
+	    return -1;
+	  if (nextrun == 0)
+	    nextrun = 1;
+	  if (nextrun > blockcnt - blk - run)
+	    nextrun = blockcnt - blk - run;
+
+	  if ((start == 0 && next == 0)
+	      || (start != 0 && next == start + run))
+	    {
+	      run += nextrun;
+	      continue;
+	    }
+	  have_next = 1;
+	  break;
+	}
+
+      toread = (run << log2bytes) - skipfirst;
+      if (toread > remaining)
+	toread = remaining;
+
+      /* If the block number is 0 this run is not stored on disk but
+	 is zero filled instead.  */
+      if (start)
+	{
+	  disk->read_hook = read_hook;
+	  disk->read_hook_data = read_hook_data;
+
+	  grub_disk_read (disk, (start << log2blocksize) + blocks_start,
+			  skipfirst, toread, buf);
+	  disk->read_hook = 0;
+	  if (grub_errno)
+	    return -1;
+	}
+      else
+	grub_memset (buf, 0, toread);
+
+      buf += toread;
+      remaining -= toread;
+      skipfirst = 0;
+      blk += run;
+    }
+
+  return len;
+}
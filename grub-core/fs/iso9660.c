@@ -154,6 +154,8 @@ struct grub_iso9660_data
   int susp_skip;
   int joliet;
   struct grub_fshelp_node *node;
+  /* Path lookups done on this mount, NULL if out of memory.  */
+  struct grub_fshelp_dcache *dcache;
 };
 
 struct grub_fshelp_node
@@ -174,6 +176,9 @@ enum
   };
 
 static grub_dl_t my_mod;
+static struct grub_fs grub_iso9660_fs;
+
+static grub_fshelp_node_t grub_iso9660_dup_node (grub_fshelp_node_t node);
 
 
 static grub_err_t
@@ -436,6 +441,13 @@ grub_iso9660_mount (grub_disk_t disk)
   struct grub_iso9660_primary_voldesc voldesc;
   int block;
 
+  data = grub_fs_mount_cache_get (&grub_iso9660_fs, disk);
+  if (data)
+    {
+      data->disk = disk;
+      return data;
+    }
+
   data = grub_zalloc (sizeof (struct grub_iso9660_data));
   if (! data)
     return 0;
@@ -487,6 +499,9 @@ grub_iso9660_mount (grub_disk_t disk)
       block++;
     } while (voldesc.voldesc.type != GRUB_ISO9660_VOLDESC_END);
 
+  data->dcache = grub_fshelp_dcache_new (grub_iso9660_dup_node, 0);
+  grub_errno = GRUB_ERR_NONE;
+
   return data;
 
  fail:
@@ -494,6 +509,53 @@ grub_iso9660_mount (grub_disk_t disk)
   return 0;
 }
 
+/* Keep DATA in the mount cache for the next mount of its disk.  */
+static void
+grub_iso9660_release (struct grub_iso9660_data *data)
+{
+  if (!data)
+    return;
+  data->node = NULL;
+  grub_fs_mount_cache_put (&grub_iso9660_fs, data->disk, data);
+}
+
+static void
+grub_iso9660_unmount (void *mount)
+{
+  struct grub_iso9660_data *data = mount;
+
+  grub_fshelp_dcache_free (data->dcache);
+  grub_free (data);
+}
+
+/* Nodes carry extra dirents and the symlink target past their end.  */
+static grub_fshelp_node_t
+grub_iso9660_dup_node (grub_fshelp_node_t node)
+{
+  grub_fshelp_node_t copy;
+  grub_size_t size = sizeof (*node);
+
+  if (node->alloc_dirents > ARRAY_SIZE (node->dirents))
+    size += ((node->alloc_dirents - ARRAY_SIZE (node->dirents))
+	     * sizeof (node->dirents[0]));
+  if (node->have_symlink)
+    {
+      const char *symlink = node->symlink
+	+ node->have_dirents * sizeof (node->dirents[0])
+	- sizeof (node->dirents);
+      grub_size_t end = symlink + grub_strlen (symlink) + 1
+	- (const char *) node;
+
+      if (end > size)
+	size = end;
+    }
+
+  copy = grub_malloc (size);
+  if (copy)
+    grub_memcpy (copy, node, size);
+  return copy;
+}
+
 
 static char *
 grub_iso9660_read_symlink (grub_fshelp_node_t node)
@@ -884,11 +946,11 @@ grub_iso9660_dir (grub_device_t device, const char *path,
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (path, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_DIR))
+  if (grub_fshelp_find_file_cached (path, &rootnode,
+				    &foundnode,
+				    grub_iso9660_iterate_dir,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_DIR, data->dcache))
     goto fail;
 
   /* List the files in the directory.  */
@@ -898,7 +960,7 @@ grub_iso9660_dir (grub_device_t device, const char *path,
     grub_free (foundnode);
 
  fail:
-  grub_free (data);
+  grub_iso9660_release (data);
 
   grub_dl_unref (my_mod);
 
@@ -927,11 +989,11 @@ grub_iso9660_open (struct grub_file *file, const char *name)
   rootnode.dirents[0] = data->voldesc.rootdir;
 
   /* Use the fshelp function to traverse the path.  */
-  if (grub_fshelp_find_file (name, &rootnode,
-			     &foundnode,
-			     grub_iso9660_iterate_dir,
-			     grub_iso9660_read_symlink,
-			     GRUB_FSHELP_REG))
+  if (grub_fshelp_find_file_cached (name, &rootnode,
+				    &foundnode,
+				    grub_iso9660_iterate_dir,
+				    grub_iso9660_read_symlink,
+				    GRUB_FSHELP_REG, data->dcache))
     goto fail;
 
   data->node = foundnode;
@@ -944,7 +1006,7 @@ grub_iso9660_open (struct grub_file *file, const char *name)
  fail:
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_iso9660_release (data);
 
   return grub_errno;
 }
@@ -969,6 +1031,36 @@ grub_iso9660_read (grub_file_t file, char *buf, grub_size_t len)
   return len;
 }
 
+static grub_err_t
+grub_iso9660_map (grub_file_t file, grub_off_t offset,
+		  grub_disk_addr_t *sector, grub_off_t *len)
+{
+  struct grub_iso9660_data *data =
+    (struct grub_iso9660_data *) file->data;
+  grub_fshelp_node_t node = data->node;
+  grub_size_t i;
+
+  for (i = 0; i < node->have_dirents; i++)
+    {
+      grub_off_t size = grub_le_to_cpu32 (node->dirents[i].size);
+
+      if (offset < size)
+	{
+	  if (offset & (GRUB_DISK_SECTOR_SIZE - 1))
+	    return grub_error (GRUB_ERR_BAD_FILE_TYPE, "unaligned extent");
+	  *sector = ((((grub_disk_addr_t)
+		       grub_le_to_cpu32 (node->dirents[i].first_sector))
+		      << GRUB_ISO9660_LOG2_BLKSZ)
+		     + (offset >> GRUB_DISK_SECTOR_BITS));
+	  *len = size - offset;
+	  return GRUB_ERR_NONE;
+	}
+      offset -= size;
+    }
+
+  return grub_error (GRUB_ERR_OUT_OF_RANGE, "map out of range");
+}
+
 
 static grub_err_t
 grub_iso9660_close (grub_file_t file)
@@ -976,7 +1068,7 @@ grub_iso9660_close (grub_file_t file)
   struct grub_iso9660_data *data =
     (struct grub_iso9660_data *) file->data;
   grub_free (data->node);
-  grub_free (data);
+  grub_iso9660_release (data);
 
   grub_dl_unref (my_mod);
 
@@ -1005,7 +1097,7 @@ grub_iso9660_label (grub_device_t device, char **label)
 	    *ptr-- = 0;
 	}
 
-      grub_free (data);
+      grub_iso9660_release (data);
     }
   else
     *label = 0;
@@ -1063,7 +1155,7 @@ grub_iso9660_uuid (grub_device_t device, char **uuid)
 
 	grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_iso9660_release (data);
 
   return grub_errno;
 }
@@ -1088,7 +1180,7 @@ grub_iso9660_mtime (grub_device_t device, grub_int32_t *timebuf)
 
   grub_dl_unref (my_mod);
 
-  grub_free (data);
+  grub_iso9660_release (data);
 
   return err;
 }
@@ -1106,6 +1198,8 @@ static struct grub_fs grub_iso9660_fs =
     .fs_label = grub_iso9660_label,
     .fs_uuid = grub_iso9660_uuid,
     .fs_mtime = grub_iso9660_mtime,
+    .fs_map = grub_iso9660_map,
+    .fs_unmount = grub_iso9660_unmount,
 #ifdef GRUB_UTIL
     .reserved_first_sector = 1,
     .blocklist_install = 1,
@@ -17,16 +17,25 @@
  *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+/*
+ * zstd's custom allocator interface is only exposed with
+ * ZSTD_STATIC_LINKING_ONLY; we use the vendored copy, see btrfs.c.
+ */
+#define ZSTD_STATIC_LINKING_ONLY
+
 #include <grub/err.h>
 #include <grub/file.h>
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/disk.h>
+#include <grub/partition.h>
 #include <grub/dl.h>
 #include <grub/types.h>
 #include <grub/fshelp.h>
 #include <grub/deflate.h>
+#include <grub/lz4.h>
 #include <minilzo.h>
+#include <zstd.h>
 
 #include "xz.h"
 #include "xz_stream.h"
@@ -183,6 +192,8 @@ enum
     COMPRESSION_ZLIB = 1,
     COMPRESSION_LZO = 3,
     COMPRESSION_XZ = 4,
+    COMPRESSION_LZ4 = 5,
+    COMPRESSION_ZSTD = 6,
   };
 
 
@@ -202,6 +213,10 @@ struct grub_squash_data
 			      struct grub_squash_data *data);
   struct xz_dec *xzdec;
   char *xzbuf;
+  ZSTD_DCtx *zstd_dctx;
+  /* Whole-block scratch buffer for the LZ4 and zstd decoders.  */
+  char *ubuf;
+  grub_size_t ubufsz;
 };
 
 struct grub_fshelp_node
@@ -216,6 +231,158 @@ struct grub_fshelp_node
   } stack[1];
 };
 
+/* Decompressed blocks are kept in a small LRU cache shared by all mounts,
+   so that reopening files and walking directories on the same image does
+   not decompress the same block over and over.  Entries are keyed by the
+   disk, the image and the on-disk offset of the compressed block.  */
+#define SQUASH_CACHE_SLOTS 64
+#define SQUASH_CACHE_MAX_BYTES (8 << 20)
+
+enum
+  {
+    SQUASH_CACHE_DATA,
+    SQUASH_CACHE_FRAG,
+    SQUASH_CACHE_META,
+    SQUASH_CACHE_KINDS
+  };
+
+struct grub_squash_cache_entry
+{
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  grub_uint32_t creation_time;
+  grub_uint64_t total_size;
+  grub_uint64_t offset;
+  char *buf;
+  grub_size_t size;
+  grub_size_t alloc;
+  grub_uint64_t last_use;
+};
+
+static struct grub_squash_cache_entry squash_cache[SQUASH_CACHE_SLOTS];
+static grub_size_t squash_cache_bytes;
+static grub_uint64_t squash_cache_clock;
+static unsigned long squash_cache_hits[SQUASH_CACHE_KINDS];
+static unsigned long squash_cache_misses[SQUASH_CACHE_KINDS];
+
+static int
+squash_cache_match (struct grub_squash_cache_entry *e,
+		    struct grub_squash_data *data, grub_uint64_t offset)
+{
+  return (e->buf && e->offset == offset
+	  && e->dev_id == data->disk->dev->id
+	  && e->disk_id == data->disk->id
+	  && e->part_start == grub_partition_get_start (data->disk->partition)
+	  && e->creation_time == data->sb.creation_time
+	  && e->total_size == data->sb.total_size);
+}
+
+static void
+squash_cache_drop (struct grub_squash_cache_entry *e)
+{
+  squash_cache_bytes -= e->alloc;
+  grub_free (e->buf);
+  e->buf = NULL;
+  e->alloc = 0;
+}
+
+/* Return the decompressed contents of the block stored as CSIZE bytes at
+   OFFSET, which unpacks to at most MAXSIZE bytes.  The returned buffer
+   stays valid until the next call.  */
+static const char *
+squash_cache_get (struct grub_squash_data *data, int kind,
+		  grub_uint64_t offset, grub_size_t csize,
+		  grub_size_t maxsize, grub_size_t *size)
+{
+  struct grub_squash_cache_entry *e, *victim = NULL;
+  char *cbuf;
+  grub_ssize_t usize;
+  unsigned i;
+
+  for (i = 0; i < SQUASH_CACHE_SLOTS; i++)
+    {
+      e = &squash_cache[i];
+      if (squash_cache_match (e, data, offset))
+	{
+	  squash_cache_hits[kind]++;
+	  e->last_use = ++squash_cache_clock;
+	  *size = e->size;
+	  return e->buf;
+	}
+      if (!victim || !e->buf
+	  || (victim->buf && e->last_use < victim->last_use))
+	victim = e;
+    }
+  squash_cache_misses[kind]++;
+
+  if (victim->buf && victim->alloc < maxsize)
+    squash_cache_drop (victim);
+
+  /* Stay within the byte budget by evicting the oldest entries.  */
+  while (!victim->buf && squash_cache_bytes + maxsize > SQUASH_CACHE_MAX_BYTES)
+    {
+      struct grub_squash_cache_entry *oldest = NULL;
+      for (i = 0; i < SQUASH_CACHE_SLOTS; i++)
+	if (squash_cache[i].buf
+	    && (!oldest || squash_cache[i].last_use < oldest->last_use))
+	  oldest = &squash_cache[i];
+      if (!oldest)
+	break;
+      squash_cache_drop (oldest);
+    }
+
+  if (!victim->buf)
+    {
+      victim->buf = grub_malloc (maxsize);
+      if (!victim->buf)
+	return NULL;
+      victim->alloc = maxsize;
+      squash_cache_bytes += maxsize;
+    }
+  /* Invalidate the slot until it is successfully refilled.  */
+  victim->offset = ~(grub_uint64_t) 0;
+
+  cbuf = grub_malloc (csize);
+  if (!cbuf)
+    return NULL;
+  if (grub_disk_read (data->disk, offset >> GRUB_DISK_SECTOR_BITS,
+		      offset & (GRUB_DISK_SECTOR_SIZE - 1), csize, cbuf))
+    {
+      grub_free (cbuf);
+      return NULL;
+    }
+  usize = data->decompress (cbuf, csize, 0, victim->buf, maxsize, data);
+  grub_free (cbuf);
+  if (usize < 0)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+      return NULL;
+    }
+
+  victim->dev_id = data->disk->dev->id;
+  victim->disk_id = data->disk->id;
+  victim->part_start = grub_partition_get_start (data->disk->partition);
+  victim->creation_time = data->sb.creation_time;
+  victim->total_size = data->sb.total_size;
+  victim->offset = offset;
+  victim->size = usize;
+  victim->last_use = ++squash_cache_clock;
+  *size = usize;
+  return victim->buf;
+}
+
+static void
+squash_cache_free (void)
+{
+  unsigned i;
+
+  for (i = 0; i < SQUASH_CACHE_SLOTS; i++)
+    if (squash_cache[i].buf)
+      squash_cache_drop (&squash_cache[i]);
+}
+
 static grub_err_t
 read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	    grub_uint64_t chunk_start, grub_off_t offset)
@@ -254,29 +421,17 @@ read_chunk (struct grub_squash_data *data, void *buf, grub_size_t len,
 	}
       else
 	{
-	  char *tmp;
+	  const char *ubuf;
+	  grub_size_t usize;
 	  grub_size_t bsize = grub_le_to_cpu16 (d) & ~SQUASH_CHUNK_FLAGS; 
-	  grub_disk_addr_t a = chunk_start + 2;
-	  tmp = grub_malloc (bsize);
-	  if (!tmp)
-	    return grub_errno;
-	  /* FIXME: buffer uncompressed data.  */
-	  err = grub_disk_read (data->disk, (a >> GRUB_DISK_SECTOR_BITS),
-				a & (GRUB_DISK_SECTOR_SIZE - 1),
-				bsize, tmp);
-	  if (err)
-	    {
-	      grub_free (tmp);
-	      return err;
-	    }
 
-	  if (data->decompress (tmp, bsize, offset,
-				buf, csize, data) < 0)
-	    {
-	      grub_free (tmp);
-	      return grub_errno;
-	    }
-	  grub_free (tmp);
+	  ubuf = squash_cache_get (data, SQUASH_CACHE_META, chunk_start + 2,
+				   bsize, SQUASH_CHUNK_SIZE, &usize);
+	  if (!ubuf)
+	    return grub_errno;
+	  if (offset + csize > usize)
+	    return grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	  grub_memcpy (buf, ubuf + offset, csize);
 	}
       len -= csize;
       offset += csize;
@@ -314,6 +469,10 @@ lzo_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
       grub_free (udata);
       return -1;
     }
+  if (off > usize)
+    off = usize;
+  if (len > usize - off)
+    len = usize - off;
   grub_memcpy (outbuf, udata + off, len);
   grub_free (udata);
   return len;
@@ -377,6 +536,77 @@ xz_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
   return ret;
 }
 
+static grub_ssize_t
+lz4_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_ssize_t usize;
+
+  /* Whole blocks can be decoded in place.  */
+  if (off == 0)
+    {
+      usize = grub_lz4_decompress (inbuf, insize, outbuf, len);
+      if (usize < 0)
+	grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid lz4 chunk");
+      return usize;
+    }
+
+  usize = grub_lz4_decompress (inbuf, insize, data->ubuf, data->ubufsz);
+  if (usize < 0 || (grub_size_t) usize < off)
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid lz4 chunk");
+      return -1;
+    }
+  if (len > usize - off)
+    len = usize - off;
+  grub_memcpy (outbuf, data->ubuf + off, len);
+  return len;
+}
+
+static void *
+grub_zstd_malloc (void *state __attribute__ ((unused)), size_t size)
+{
+  return grub_malloc (size);
+}
+
+static void
+grub_zstd_free (void *state __attribute__ ((unused)), void *address)
+{
+  grub_free (address);
+}
+
+static grub_ssize_t
+zstd_decompress (char *inbuf, grub_size_t insize, grub_off_t off,
+		 char *outbuf, grub_size_t len, struct grub_squash_data *data)
+{
+  grub_size_t usize;
+
+  /* Each block is a single frame.  */
+  if (off == 0)
+    {
+      usize = ZSTD_decompressDCtx (data->zstd_dctx, outbuf, len,
+				   inbuf, insize);
+      if (ZSTD_isError (usize))
+	{
+	  grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid zstd chunk");
+	  return -1;
+	}
+      return usize;
+    }
+
+  usize = ZSTD_decompressDCtx (data->zstd_dctx, data->ubuf, data->ubufsz,
+			       inbuf, insize);
+  if (ZSTD_isError (usize) || usize < off)
+    {
+      grub_error (GRUB_ERR_BAD_COMPRESSED_DATA, "invalid zstd chunk");
+      return -1;
+    }
+  if (len > usize - off)
+    len = usize - off;
+  grub_memcpy (outbuf, data->ubuf + off, len);
+  return len;
+}
+
 static struct grub_squash_data *
 squash_mount (grub_disk_t disk)
 {
@@ -439,6 +669,39 @@ squash_mount (grub_disk_t disk)
 	  return NULL;
 	}
       break;
+    case grub_cpu_to_le16_compile_time (COMPRESSION_LZ4):
+    case grub_cpu_to_le16_compile_time (COMPRESSION_ZSTD):
+      data->ubufsz = grub_le_to_cpu32 (sb.block_size);
+      if (data->ubufsz < SQUASH_CHUNK_SIZE)
+	data->ubufsz = SQUASH_CHUNK_SIZE;
+      data->ubuf = grub_malloc (data->ubufsz);
+      if (!data->ubuf)
+	{
+	  grub_free (data);
+	  return NULL;
+	}
+      if (sb.compression == grub_cpu_to_le16_compile_time (COMPRESSION_LZ4))
+	{
+	  data->decompress = lz4_decompress;
+	  break;
+	}
+      data->decompress = zstd_decompress;
+      {
+	ZSTD_customMem allocator;
+
+	allocator.customAlloc = &grub_zstd_malloc;
+	allocator.customFree = &grub_zstd_free;
+	allocator.opaque = NULL;
+	data->zstd_dctx = ZSTD_createDCtx_advanced (allocator);
+      }
+      if (!data->zstd_dctx)
+	{
+	  grub_error (GRUB_ERR_OUT_OF_MEMORY, "failed to allocate a zstd context");
+	  grub_free (data->ubuf);
+	  grub_free (data);
+	  return NULL;
+	}
+      break;
     default:
       grub_free (data);
       grub_error (GRUB_ERR_BAD_FS, "unsupported compression %d",
@@ -628,9 +891,20 @@ make_root_node (struct grub_squash_data *data, struct grub_fshelp_node *root)
 static void
 squash_unmount (struct grub_squash_data *data)
 {
+  grub_dprintf ("squash4", "cache hits/misses: data %lu/%lu, "
+		"fragment %lu/%lu, metadata %lu/%lu\n",
+		squash_cache_hits[SQUASH_CACHE_DATA],
+		squash_cache_misses[SQUASH_CACHE_DATA],
+		squash_cache_hits[SQUASH_CACHE_FRAG],
+		squash_cache_misses[SQUASH_CACHE_FRAG],
+		squash_cache_hits[SQUASH_CACHE_META],
+		squash_cache_misses[SQUASH_CACHE_META]);
   if (data->xzdec)
     xz_dec_end (data->xzdec);
   grub_free (data->xzbuf);
+  if (data->zstd_dctx)
+    ZSTD_freeDCtx (data->zstd_dctx);
+  grub_free (data->ubuf);
   grub_free (data->ino.cumulated_block_sizes);
   grub_free (data->ino.block_sizes);
   grub_free (data);
@@ -746,7 +1020,7 @@ direct_read (struct grub_squash_data *data,
 	     struct grub_squash_cache_inode *ino,
 	     grub_off_t off, char *buf, grub_size_t len)
 {
-  grub_err_t err;
+  grub_err_t err = GRUB_ERR_NONE;
   grub_off_t cumulated_uncompressed_size = 0;
   grub_uint64_t a = 0;
   grub_size_t i;
@@ -831,32 +1105,20 @@ direct_read (struct grub_squash_data *data,
       else if (!(ino->block_sizes[i]
 	    & grub_cpu_to_le32_compile_time (SQUASH_BLOCK_UNCOMPRESSED)))
 	{
-	  char *block;
-	  grub_size_t csize;
+	  const char *block;
+	  grub_size_t csize, usize;
 	  csize = grub_le_to_cpu32 (ino->block_sizes[i]) & ~SQUASH_BLOCK_FLAGS;
-	  block = grub_malloc (csize);
+	  block = squash_cache_get (data, SQUASH_CACHE_DATA,
+				    ino->cumulated_block_sizes[i] + a,
+				    csize, data->blksz, &usize);
 	  if (!block)
 	    return -1;
-	  err = grub_disk_read (data->disk,
-				(ino->cumulated_block_sizes[i] + a)
-				>> GRUB_DISK_SECTOR_BITS,
-				(ino->cumulated_block_sizes[i] + a)
-				& (GRUB_DISK_SECTOR_SIZE - 1),
-				csize, block);
-	  if (err)
+	  if (boff + curread > usize)
 	    {
-	      grub_free (block);
+	      grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	      return -1;
 	    }
-	  if (data->decompress (block, csize, boff, buf, curread, data)
-	      != (grub_ssize_t) curread)
-	    {
-	      grub_free (block);
-	      if (!grub_errno)
-		grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
-	      return -1;
-	    }
-	  grub_free (block);
+	  grub_memcpy (buf, block + boff, curread);
 	}
       else
 	err = grub_disk_read (data->disk, 
@@ -935,32 +1197,21 @@ grub_squash_read (grub_file_t file, char *buf, grub_size_t len)
   else
     b = grub_le_to_cpu32 (ino->ino.file.offset) + off;
   
-  /* FIXME: cache uncompressed chunks.  */
   if (compressed)
     {
-      char *block;
-      block = grub_malloc (grub_le_to_cpu32 (frag.size));
+      const char *block;
+      grub_size_t usize;
+      block = squash_cache_get (data, SQUASH_CACHE_FRAG, a,
+				grub_le_to_cpu32 (frag.size), data->blksz,
+				&usize);
       if (!block)
 	return -1;
-      err = grub_disk_read (data->disk,
-			    a >> GRUB_DISK_SECTOR_BITS,
-			    a & (GRUB_DISK_SECTOR_SIZE - 1),
-			    grub_le_to_cpu32 (frag.size), block);
-      if (err)
-	{
-	  grub_free (block);
-	  return -1;
-	}
-      if (data->decompress (block, grub_le_to_cpu32 (frag.size),
-			    b, buf, len, data)
-	  != (grub_ssize_t) len)
+      if (b + len > usize)
 	{
-	  grub_free (block);
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
+	  grub_error (GRUB_ERR_BAD_FS, "incorrect compressed chunk");
 	  return -1;
 	}
-      grub_free (block);
+      grub_memcpy (buf, block + b, len);
     }
   else
     {
@@ -1015,5 +1266,6 @@ GRUB_MOD_INIT(squash4)
 GRUB_MOD_FINI(squash4)
 {
   grub_fs_unregister (&grub_squash_fs);
+  squash_cache_free ();
 }
 
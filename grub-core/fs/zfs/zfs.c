@@ -30,6 +30,12 @@
  *
  */
 
+/*
+ * zstd's custom allocator interface is only exposed with
+ * ZSTD_STATIC_LINKING_ONLY; we use the vendored copy, see btrfs.c.
+ */
+#define ZSTD_STATIC_LINKING_ONLY
+
 #include <grub/err.h>
 #include <grub/file.h>
 #include <grub/mm.h>
@@ -53,6 +59,8 @@
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
 #include <grub/deflate.h>
+#include <grub/lz4.h>
+#include <zstd.h>
 #include <grub/crypto.h>
 #include <grub/i18n.h>
 
@@ -159,8 +167,6 @@ ZAP_LEAF_ENTRY(zap_leaf_phys_t *l, int bs, int idx)
 
 extern grub_err_t lzjb_decompress (void *, void *, grub_size_t, grub_size_t);
 
-extern grub_err_t lz4_decompress (void *, void *, grub_size_t, grub_size_t);
-
 typedef grub_err_t zfs_decomp_func_t (void *s_start, void *d_start,
 				      grub_size_t s_len, grub_size_t d_len);
 typedef struct decomp_entry
@@ -285,6 +291,7 @@ static const char *spa_feature_names[] = {
   "com.delphix:embedded_data",
   "com.delphix:extensible_dataset",
   "org.open-zfs:large_blocks",
+  "org.freebsd:zstd_compress",
   NULL
 };
 
@@ -306,6 +313,75 @@ zlib_decompress (void *s, void *d,
   return grub_errno;
 }
 
+/* ZFS prefixes the LZ4 block with its big-endian length.  */
+static grub_err_t
+lz4_decompress (void *s, void *d,
+		grub_size_t slen, grub_size_t dlen)
+{
+  const grub_uint8_t *src = s;
+  grub_uint32_t bufsiz;
+
+  if (slen < 4)
+    return grub_error (GRUB_ERR_BAD_FS, "lz4 decompression failed.");
+  bufsiz = grub_be_to_cpu32 (grub_get_unaligned32 (src));
+
+  /* invalid compressed buffer size encoded at start */
+  if (bufsiz > slen - 4
+      || grub_lz4_decompress (src + 4, bufsiz, d, dlen) < 0)
+    return grub_error (GRUB_ERR_BAD_FS, "lz4 decompression failed.");
+  return GRUB_ERR_NONE;
+}
+
+static ZSTD_DCtx *zstd_dctx;
+
+static void *
+grub_zstd_malloc (void *state __attribute__ ((unused)), size_t size)
+{
+  return grub_malloc (size);
+}
+
+static void
+grub_zstd_free (void *state __attribute__ ((unused)), void *address)
+{
+  grub_free (address);
+}
+
+/* OpenZFS prefixes the zstd frame with its big-endian length and a word
+   holding the zstd version and level.  */
+static grub_err_t
+zstd_decompress (void *s, void *d,
+		 grub_size_t slen, grub_size_t dlen)
+{
+  const grub_uint8_t *src = s;
+  grub_uint32_t bufsiz;
+  grub_size_t ret;
+
+  if (slen < 8)
+    return grub_error (GRUB_ERR_BAD_FS, "zstd decompression failed.");
+  bufsiz = grub_be_to_cpu32 (grub_get_unaligned32 (src));
+  if (bufsiz > slen - 8)
+    return grub_error (GRUB_ERR_BAD_FS, "zstd decompression failed.");
+
+  /* The context is kept for the next block.  */
+  if (!zstd_dctx)
+    {
+      ZSTD_customMem allocator;
+
+      allocator.customAlloc = &grub_zstd_malloc;
+      allocator.customFree = &grub_zstd_free;
+      allocator.opaque = NULL;
+      zstd_dctx = ZSTD_createDCtx_advanced (allocator);
+      if (!zstd_dctx)
+	return grub_error (GRUB_ERR_OUT_OF_MEMORY,
+			   "failed to create a zstd context");
+    }
+
+  ret = ZSTD_decompressDCtx (zstd_dctx, d, dlen, src + 8, bufsiz);
+  if (ZSTD_isError (ret) || ret != dlen)
+    return grub_error (GRUB_ERR_BAD_FS, "zstd decompression failed.");
+  return GRUB_ERR_NONE;
+}
+
 static grub_err_t 
 zle_decompress (void *s, void *d,
 		grub_size_t slen, grub_size_t dlen)
@@ -356,6 +432,7 @@ static decomp_entry_t decomp_table[ZIO_COMPRESS_FUNCTIONS] = {
   {"gzip-9", zlib_decompress},  /* ZIO_COMPRESS_GZIP9 */
   {"zle", zle_decompress},      /* ZIO_COMPRESS_ZLE   */
   {"lz4", lz4_decompress},      /* ZIO_COMPRESS_LZ4   */
+  {"zstd", zstd_decompress},    /* ZIO_COMPRESS_ZSTD  */
 };
 
 static grub_err_t zio_read_data (blkptr_t * bp, grub_zfs_endian_t endian,
@@ -1843,8 +1920,8 @@ decode_embedded_bp_compressed(const blkptr_t *bp, void *buf)
  * and put the uncompressed data in buf.
  */
 static grub_err_t
-zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf, 
-	  grub_size_t *size, struct grub_zfs_data *data)
+zio_read_uncached (blkptr_t *bp, grub_zfs_endian_t endian, void **buf, 
+		   grub_size_t *size, struct grub_zfs_data *data)
 {
   grub_size_t lsize, psize;
   unsigned int comp, encrypted;
@@ -1995,6 +2072,193 @@ zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf,
   return GRUB_ERR_NONE;
 }
 
+/*
+ * Cache of verified, decompressed metadata blocks (indirect blocks, dnode
+ * blocks, ZAP and the rest of what isn't file contents), shared by all
+ * pools and opens.  Blocks are identified by the pool, their first DVA,
+ * birth txg and checksum.  Eviction takes the least recently used block
+ * that was never hit again first, so one large scan can't flush the
+ * directory and dnode blocks that keep getting reused.
+ */
+#define ZFS_BCACHE_ENTRIES	256
+#define ZFS_BCACHE_MAX_BYTES	(8 << 20)
+#define ZFS_BCACHE_MAX_BLOCK	(1 << 20)
+
+struct zfs_bcache_entry
+{
+  grub_uint64_t guid;
+  dva_t dva;
+  grub_uint64_t birth;
+  grub_uint64_t cksum;
+  unsigned long generation;
+  void *buf;
+  grub_size_t size;
+  grub_uint64_t last_use;
+  int reused;
+};
+
+static struct zfs_bcache_entry zfs_bcache[ZFS_BCACHE_ENTRIES];
+static grub_size_t zfs_bcache_bytes;
+static grub_uint64_t zfs_bcache_clock;
+static grub_uint64_t zfs_bcache_hits, zfs_bcache_misses;
+
+void
+grub_zfs_cache_stats (grub_uint64_t *hits, grub_uint64_t *misses,
+		      grub_size_t *bytes)
+{
+  *hits = zfs_bcache_hits;
+  *misses = zfs_bcache_misses;
+  *bytes = zfs_bcache_bytes;
+}
+
+static void
+zfs_bcache_drop (struct zfs_bcache_entry *e)
+{
+  zfs_bcache_bytes -= e->size;
+  grub_free (e->buf);
+  e->buf = NULL;
+  e->size = 0;
+}
+
+static void
+zfs_bcache_free (void)
+{
+  unsigned i;
+
+  for (i = 0; i < ZFS_BCACHE_ENTRIES; i++)
+    if (zfs_bcache[i].buf)
+      zfs_bcache_drop (&zfs_bcache[i]);
+}
+
+static int
+zfs_bcache_match (const struct zfs_bcache_entry *e, const blkptr_t *bp,
+		  const struct grub_zfs_data *data)
+{
+  return e->buf && e->guid == data->guid
+    && e->dva.dva_word[0] == bp->blk_dva[0].dva_word[0]
+    && e->dva.dva_word[1] == bp->blk_dva[0].dva_word[1]
+    && e->birth == bp->blk_birth
+    && e->cksum == bp->blk_cksum.zc_word[0];
+}
+
+static int
+zfs_bcache_wanted (const blkptr_t *bp, grub_zfs_endian_t endian,
+		   const struct grub_zfs_data *data)
+{
+  grub_uint64_t prop = grub_zfs_to_cpu64 (bp->blk_prop, endian);
+
+  if (!data->guid || BP_IS_EMBEDDED (bp) || BP_IS_HOLE (bp)
+      || ((prop >> 60) & 3))
+    return 0;
+  /* Level 0 file data is only read once per open.  */
+  if (((prop >> 56) & 0x1f) == 0
+      && ((prop >> 48) & 0xff) == DMU_OT_PLAIN_FILE_CONTENTS)
+    return 0;
+  return ((prop & 0xffff) + 1) << SPA_MINBLOCKSHIFT <= ZFS_BCACHE_MAX_BLOCK;
+}
+
+static void
+zfs_bcache_insert (const blkptr_t *bp, const struct grub_zfs_data *data,
+		   const void *buf, grub_size_t size)
+{
+  struct zfs_bcache_entry *victim;
+  void *copy;
+  unsigned i;
+
+  copy = grub_malloc (size);
+  if (!copy)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_memcpy (copy, buf, size);
+
+  for (;;)
+    {
+      struct zfs_bcache_entry *cold = NULL, *any = NULL, *empty = NULL;
+
+      for (i = 0; i < ZFS_BCACHE_ENTRIES; i++)
+	{
+	  struct zfs_bcache_entry *e = &zfs_bcache[i];
+
+	  if (!e->buf)
+	    {
+	      if (!empty)
+		empty = e;
+	      continue;
+	    }
+	  if (!any || e->last_use < any->last_use)
+	    any = e;
+	  if (!e->reused && (!cold || e->last_use < cold->last_use))
+	    cold = e;
+	}
+
+      if (empty && zfs_bcache_bytes + size <= ZFS_BCACHE_MAX_BYTES)
+	{
+	  victim = empty;
+	  break;
+	}
+      zfs_bcache_drop (cold ? cold : any);
+    }
+
+  victim->guid = data->guid;
+  victim->dva = bp->blk_dva[0];
+  victim->birth = bp->blk_birth;
+  victim->cksum = bp->blk_cksum.zc_word[0];
+  victim->generation = grub_disk_write_generation;
+  victim->buf = copy;
+  victim->size = size;
+  victim->last_use = ++zfs_bcache_clock;
+  victim->reused = 0;
+  zfs_bcache_bytes += size;
+}
+
+/*
+ * Read in a block through the metadata cache.
+ */
+static grub_err_t
+zio_read (blkptr_t *bp, grub_zfs_endian_t endian, void **buf, 
+	  grub_size_t *size, struct grub_zfs_data *data)
+{
+  grub_size_t lsize;
+  grub_err_t err;
+  unsigned i;
+
+  if (!zfs_bcache_wanted (bp, endian, data))
+    return zio_read_uncached (bp, endian, buf, size, data);
+
+  for (i = 0; i < ZFS_BCACHE_ENTRIES; i++)
+    {
+      struct zfs_bcache_entry *e = &zfs_bcache[i];
+
+      if (!zfs_bcache_match (e, bp, data))
+	continue;
+      if (e->generation != grub_disk_write_generation)
+	{
+	  zfs_bcache_drop (e);
+	  break;
+	}
+      *buf = grub_malloc (e->size);
+      if (!*buf)
+	return grub_errno;
+      grub_memcpy (*buf, e->buf, e->size);
+      if (size)
+	*size = e->size;
+      e->last_use = ++zfs_bcache_clock;
+      e->reused = 1;
+      zfs_bcache_hits++;
+      return GRUB_ERR_NONE;
+    }
+
+  zfs_bcache_misses++;
+  err = zio_read_uncached (bp, endian, buf, &lsize, data);
+  if (size)
+    *size = lsize;
+  if (!err)
+    zfs_bcache_insert (bp, data, *buf, lsize);
+  return err;
+}
+
 /*
  * Get the block from a block id.
  * push the block onto the stack.
@@ -4375,4 +4639,8 @@ GRUB_MOD_INIT (zfs)
 GRUB_MOD_FINI (zfs)
 {
   grub_fs_unregister (&grub_zfs_fs);
+  zfs_bcache_free ();
+  if (zstd_dctx)
+    ZSTD_freeDCtx (zstd_dctx);
+  zstd_dctx = NULL;
 }
@@ -38,6 +38,11 @@
 #include <grub/zfs/dsl_dir.h>
 #include <grub/zfs/dsl_dataset.h>
 
+#if defined (__i386__) || defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#define FLETCHER_4_SSE2 1
+#endif
+
 void
 fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
 	   zio_cksum_t *zcp)
@@ -60,25 +65,136 @@ fletcher_2(const void *buf, grub_uint64_t size, grub_zfs_endian_t endian,
   zcp->zc_word[3] = grub_cpu_to_zfs64 (b1, endian);
 }
 
+/* Run four interleaved Fletcher-4 streams over every fourth word, so that
+   consecutive additions don't depend on each other, in A..D[0..3].  */
+#define FLETCHER_4_LANES(conv)						\
+  for (; ip < ip4end; ip += 4)						\
+    for (j = 0; j < 4; j++)						\
+      {									\
+	a[j] += conv (ip[j]);						\
+	b[j] += a[j];							\
+	c[j] += b[j];							\
+	d[j] += c[j];							\
+      }
+
+#ifdef FLETCHER_4_SSE2
+
+static int
+fletcher_4_sse2_supported (void)
+{
+  static int supported = -1;
+
+  if (supported < 0)
+    supported = grub_cpu_sse2_usable ();
+  return supported;
+}
+
+/* Two Fletcher-4 streams, one over the even and one over the odd
+   little-endian words, kept in the 64-bit halves of %xmm0-%xmm3, for N
+   groups of four words.  ST holds { a0, a1, b0, b1, c0, c1, d0, d1 }.
+   Like the RAID6 kernels, the asm only touches %xmm0-%xmm5 and wipes them
+   before returning.  */
+static void
+fletcher_4_sse2 (const grub_uint32_t *ip, grub_size_t n, grub_uint64_t *st)
+{
+  asm volatile ("movdqu (%[st]), %%xmm0\n\t"
+		"movdqu 16(%[st]), %%xmm1\n\t"
+		"movdqu 32(%[st]), %%xmm2\n\t"
+		"movdqu 48(%[st]), %%xmm3\n\t"
+		"1:\n\t"
+		/* Zero-extend words 0, 1 into %xmm4 and 2, 3 into %xmm5.  */
+		"movdqu (%[ip]), %%xmm4\n\t"
+		"pshufd $0xd8, %%xmm4, %%xmm4\n\t"
+		"movdqa %%xmm4, %%xmm5\n\t"
+		"psllq $32, %%xmm4\n\t"
+		"psrlq $32, %%xmm4\n\t"
+		"psrlq $32, %%xmm5\n\t"
+		"paddq %%xmm4, %%xmm0\n\t"
+		"paddq %%xmm0, %%xmm1\n\t"
+		"paddq %%xmm1, %%xmm2\n\t"
+		"paddq %%xmm2, %%xmm3\n\t"
+		"paddq %%xmm5, %%xmm0\n\t"
+		"paddq %%xmm0, %%xmm1\n\t"
+		"paddq %%xmm1, %%xmm2\n\t"
+		"paddq %%xmm2, %%xmm3\n\t"
+		"add $16, %[ip]\n\t"
+		"sub $1, %[n]\n\t"
+		"jnz 1b\n\t"
+		"movdqu %%xmm0, (%[st])\n\t"
+		"movdqu %%xmm1, 16(%[st])\n\t"
+		"movdqu %%xmm2, 32(%[st])\n\t"
+		"movdqu %%xmm3, 48(%[st])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n\t"
+		"pxor %%xmm5, %%xmm5\n\t"
+		: [ip] "+r" (ip), [n] "+r" (n)
+		: [st] "r" (st)
+		: GRUB_CPU_SSE_CLOBBERS "memory", "cc");
+}
+
+#endif
+
 void
 fletcher_4 (const void *buf, grub_uint64_t size, grub_zfs_endian_t endian, 
 	    zio_cksum_t *zcp)
 {
   const grub_uint32_t *ip = buf;
   const grub_uint32_t *ipend = ip + (size / sizeof (grub_uint32_t));
-  grub_uint64_t a, b, c, d;
-  
-  for (a = b = c = d = 0; ip < ipend; ip++) 
+  const grub_uint32_t *ip4end = ip + ((size / sizeof (grub_uint32_t)) & ~3);
+  grub_uint64_t a[4] = { 0 }, b[4] = { 0 }, c[4] = { 0 }, d[4] = { 0 };
+  grub_uint64_t sa, sb, sc, sd;
+  unsigned j;
+
+#ifdef FLETCHER_4_SSE2
+  if (endian == GRUB_ZFS_LITTLE_ENDIAN && ip4end > ip
+      && fletcher_4_sse2_supported ())
     {
-      a += grub_zfs_to_cpu32 (ip[0], endian);;
-      b += a;
-      c += b;
-      d += c;
+      grub_uint64_t st[8] = { 0 };
+
+      fletcher_4_sse2 (ip, (ip4end - ip) / 4, st);
+      ip = ip4end;
+
+      /* Fold the two streams back into the sums of a serial pass.  */
+      sa = st[0] + st[1];
+      sb = 2 * (st[2] + st[3]) - st[1];
+      sc = 4 * (st[4] + st[5]) - st[2] - 3 * st[3];
+      sd = 8 * (st[6] + st[7]) - 4 * st[4] - 8 * st[5] + st[3];
     }
+  else
+#endif
+    {
+      if (endian == GRUB_ZFS_BIG_ENDIAN)
+	{
+	  FLETCHER_4_LANES (grub_be_to_cpu32);
+	}
+      else
+	{
+	  FLETCHER_4_LANES (grub_le_to_cpu32);
+	}
 
-  zcp->zc_word[0] = grub_cpu_to_zfs64 (a, endian);
-  zcp->zc_word[1] = grub_cpu_to_zfs64 (b, endian);
-  zcp->zc_word[2] = grub_cpu_to_zfs64 (c, endian);
-  zcp->zc_word[3] = grub_cpu_to_zfs64 (d, endian);
-}
+      /* Fold the streams back into the sums of a single serial pass.  */
+      sa = a[0] + a[1] + a[2] + a[3];
+      sb = 4 * (b[0] + b[1] + b[2] + b[3]) - a[1] - 2 * a[2] - 3 * a[3];
+      sc = 16 * (c[0] + c[1] + c[2] + c[3])
+	- 6 * b[0] - 10 * b[1] - 14 * b[2] - 18 * b[3] + a[2] + 3 * a[3];
+      sd = 64 * (d[0] + d[1] + d[2] + d[3])
+	- 48 * c[0] - 64 * c[1] - 80 * c[2] - 96 * c[3]
+	+ 4 * b[0] + 10 * b[1] + 20 * b[2] + 34 * b[3] - a[3];
+    }
 
+  for (; ip < ipend; ip++) 
+    {
+      sa += grub_zfs_to_cpu32 (ip[0], endian);
+      sb += sa;
+      sc += sb;
+      sd += sc;
+    }
+
+  zcp->zc_word[0] = grub_cpu_to_zfs64 (sa, endian);
+  zcp->zc_word[1] = grub_cpu_to_zfs64 (sb, endian);
+  zcp->zc_word[2] = grub_cpu_to_zfs64 (sc, endian);
+  zcp->zc_word[3] = grub_cpu_to_zfs64 (sd, endian);
+}
@@ -336,6 +336,20 @@ grub_cmd_zfsinfo (grub_command_t cmd __attribute__ ((unused)), int argc,
   grub_free (nv);
   grub_free (nvlist);
 
+  {
+    grub_uint64_t hits, misses;
+    grub_size_t bytes;
+
+    grub_zfs_cache_stats (&hits, &misses, &bytes);
+    grub_printf_ (N_("Metadata cache: %llu hits, %llu misses (%llu%% hit rate), %llu KiB\n"),
+		  (unsigned long long) hits, (unsigned long long) misses,
+		  (unsigned long long) (hits + misses
+					? grub_divmod64 (hits * 100,
+							 hits + misses, 0)
+					: 0),
+		  (unsigned long long) (bytes >> 10));
+  }
+
   return GRUB_ERR_NONE;
 }
 
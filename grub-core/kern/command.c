@@ -22,6 +22,74 @@
 
 grub_command_t grub_command_list;
 
+/* The size of the command name hash, must be a power of two.  */
+#define GRUB_COMMAND_HASH_SIZE	256
+
+/* All registered commands by name.  Commands sharing a name keep the
+   order they have in grub_command_list, so the active one comes first.  */
+static grub_command_t grub_command_hash[GRUB_COMMAND_HASH_SIZE];
+
+/* FNV-1a.  */
+static unsigned
+grub_command_hash_name (const char *name)
+{
+  grub_uint32_t key = 2166136261U;
+
+  while (*name)
+    key = (key ^ (grub_uint8_t) *name++) * 16777619U;
+
+  return key & (GRUB_COMMAND_HASH_SIZE - 1);
+}
+
+/* Add CMD to the hash, in front of BEFORE if it has the same name or
+   else after all the commands of that name.  */
+static void
+grub_command_hash_insert (grub_command_t cmd, grub_command_t before)
+{
+  grub_command_t *p, *last = 0;
+
+  for (p = &grub_command_hash[grub_command_hash_name (cmd->name)]; *p;
+       p = &(*p)->hash_next)
+    {
+      if (*p == before)
+	break;
+      if (grub_strcmp ((*p)->name, cmd->name) == 0)
+	last = &(*p)->hash_next;
+    }
+
+  if (! *p && last)
+    p = last;
+  cmd->hash_next = *p;
+  *p = cmd;
+}
+
+static void
+grub_command_hash_remove (grub_command_t cmd)
+{
+  grub_command_t *p;
+
+  for (p = &grub_command_hash[grub_command_hash_name (cmd->name)]; *p;
+       p = &(*p)->hash_next)
+    if (*p == cmd)
+      {
+	*p = cmd->hash_next;
+	return;
+      }
+}
+
+grub_command_t
+grub_command_find (const char *name)
+{
+  grub_command_t cmd;
+
+  for (cmd = grub_command_hash[grub_command_hash_name (name)]; cmd;
+       cmd = cmd->hash_next)
+    if (grub_strcmp (cmd->name, name) == 0)
+      return cmd;
+
+  return 0;
+}
+
 grub_command_t
 grub_register_command_prio (const char *name,
 			    grub_command_func_t func,
@@ -74,6 +142,9 @@ grub_register_command_prio (const char *name,
   if (! inactive)
     cmd->prio |= GRUB_COMMAND_FLAG_ACTIVE;
 
+  grub_command_hash_insert (cmd, (q && grub_strcmp (q->name, cmd->name) == 0)
+			    ? q : 0);
+
   return cmd;
 }
 
@@ -83,5 +154,6 @@ grub_unregister_command (grub_command_t cmd)
   if ((cmd->prio & GRUB_COMMAND_FLAG_ACTIVE) && (cmd->next))
     cmd->next->prio |= GRUB_COMMAND_FLAG_ACTIVE;
   grub_list_remove (GRUB_AS_LIST (cmd));
+  grub_command_hash_remove (cmd);
   grub_free (cmd);
 }
@@ -31,7 +31,13 @@
 /* The last time the disk was used.  */
 static grub_uint64_t grub_last_time = 0;
 
-struct grub_disk_cache grub_disk_cache_table[GRUB_DISK_CACHE_NUM];
+struct grub_disk_cache *grub_disk_cache_table;
+unsigned grub_disk_cache_sets;
+
+/* Monotonic access counter used for LRU replacement.  */
+static grub_uint64_t grub_disk_cache_clock;
+
+unsigned long grub_disk_write_generation;
 
 void (*grub_disk_firmware_fini) (void);
 int grub_disk_firmware_is_tainted;
@@ -39,12 +45,28 @@ int grub_disk_firmware_is_tainted;
 #if DISK_CACHE_STATS
 static unsigned long grub_disk_cache_hits;
 static unsigned long grub_disk_cache_misses;
+static unsigned long grub_disk_cache_evictions;
+static unsigned long grub_disk_readahead_requests;
+static unsigned long grub_disk_readahead_units;
+static unsigned long grub_disk_readahead_hits;
 
 void
-grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses)
+grub_disk_cache_get_performance (unsigned long *hits, unsigned long *misses,
+				 unsigned long *evictions)
 {
   *hits = grub_disk_cache_hits;
   *misses = grub_disk_cache_misses;
+  *evictions = grub_disk_cache_evictions;
+}
+
+void
+grub_disk_readahead_get_performance (unsigned long *requests,
+				     unsigned long *units,
+				     unsigned long *hits)
+{
+  *requests = grub_disk_readahead_requests;
+  *units = grub_disk_readahead_units;
+  *hits = grub_disk_readahead_hits;
 }
 #endif
 
@@ -55,12 +77,52 @@ grub_err_t (*grub_disk_write_weak) (grub_disk_t disk,
 				    const void *buf);
 #include "disk_common.c"
 
+/* Size the cache to an eighth of the free heap, within sane bounds.  */
+static void
+grub_disk_cache_init (void)
+{
+  grub_size_t budget;
+  unsigned sets;
+
+  budget = grub_mm_get_free () / 8;
+  if (budget)
+    {
+      budget >>= GRUB_DISK_SECTOR_BITS + GRUB_DISK_CACHE_BITS;
+      budget /= GRUB_DISK_CACHE_WAYS;
+      if (budget < GRUB_DISK_CACHE_MIN_SETS)
+	budget = GRUB_DISK_CACHE_MIN_SETS;
+      if (budget > GRUB_DISK_CACHE_MAX_SETS)
+	budget = GRUB_DISK_CACHE_MAX_SETS;
+      sets = budget;
+    }
+  else
+    sets = GRUB_DISK_CACHE_DEFAULT_SETS;
+
+  grub_disk_cache_table = grub_zalloc (sets * GRUB_DISK_CACHE_WAYS
+				       * sizeof (grub_disk_cache_table[0]));
+  if (! grub_disk_cache_table)
+    {
+      /* Run uncached and retry later.  */
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+  grub_disk_cache_sets = sets;
+
+  grub_dprintf ("disk", "cache: %u sets of %u entries\n", sets,
+		GRUB_DISK_CACHE_WAYS);
+}
+
 void
 grub_disk_cache_invalidate_all (void)
 {
   unsigned i;
 
-  for (i = 0; i < GRUB_DISK_CACHE_NUM; i++)
+  grub_fs_mount_cache_invalidate_all ();
+
+  if (! grub_disk_cache_table)
+    return;
+
+  for (i = 0; i < grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS; i++)
     {
       struct grub_disk_cache *cache = grub_disk_cache_table + i;
 
@@ -77,18 +139,18 @@ grub_disk_cache_fetch (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
-
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_find (dev_id, disk_id, sector);
+  if (cache)
     {
       cache->lock = 1;
+      cache->last_use = ++grub_disk_cache_clock;
 #if DISK_CACHE_STATS
       grub_disk_cache_hits++;
+      if (cache->readahead)
+	grub_disk_readahead_hits++;
 #endif
+      cache->readahead = 0;
       return cache->data;
     }
 
@@ -104,45 +166,94 @@ grub_disk_cache_unlock (unsigned long dev_id, unsigned long disk_id,
 			grub_disk_addr_t sector)
 {
   struct grub_disk_cache *cache;
-  unsigned cache_index;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
-
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector)
+  cache = grub_disk_cache_find (dev_id, disk_id, sector);
+  if (cache)
     cache->lock = 0;
 }
 
+/* Pick the entry of SET that a new unit of DEV_ID/DISK_ID replaces:
+   a free entry if any, otherwise the least recently used one.  Once
+   the disk fills its quota of the set it only replaces its own
+   entries.  */
+static struct grub_disk_cache *
+grub_disk_cache_victim (struct grub_disk_cache *set,
+			unsigned long dev_id, unsigned long disk_id)
+{
+  struct grub_disk_cache *lru = 0, *own_lru = 0;
+  unsigned i, own = 0;
+
+  for (i = 0; i < GRUB_DISK_CACHE_WAYS; i++)
+    {
+      struct grub_disk_cache *cache = set + i;
+
+      if (! cache->data)
+	return cache;
+      if (cache->lock)
+	continue;
+      if (cache->dev_id == dev_id && cache->disk_id == disk_id)
+	{
+	  own++;
+	  if (! own_lru || cache->last_use < own_lru->last_use)
+	    own_lru = cache;
+	}
+      if (! lru || cache->last_use < lru->last_use)
+	lru = cache;
+    }
+
+  if (own >= GRUB_DISK_CACHE_QUOTA_WAYS && own_lru)
+    return own_lru;
+  return lru;
+}
+
 static grub_err_t
 grub_disk_cache_store (unsigned long dev_id, unsigned long disk_id,
 		       grub_disk_addr_t sector, const char *data)
 {
-  unsigned cache_index;
   struct grub_disk_cache *cache;
 
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  if (! grub_disk_cache_table)
+    grub_disk_cache_init ();
+  if (! grub_disk_cache_table)
+    return GRUB_ERR_NONE;
 
-  cache->lock = 1;
-  grub_free (cache->data);
-  cache->data = 0;
-  cache->lock = 0;
+  cache = grub_disk_cache_find (dev_id, disk_id, sector);
+  if (! cache)
+    {
+      cache = grub_disk_cache_victim (grub_disk_cache_table
+				      + grub_disk_cache_get_index (dev_id,
+								   disk_id,
+								   sector),
+				      dev_id, disk_id);
+      /* Every entry of the set is in use.  */
+      if (! cache)
+	return GRUB_ERR_NONE;
+#if DISK_CACHE_STATS
+      if (cache->data)
+	grub_disk_cache_evictions++;
+#endif
+    }
 
-  cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+  /* All units have the same size, so reuse the buffer if there is one.  */
   if (! cache->data)
-    return grub_errno;
+    {
+      cache->data = grub_malloc (GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
+      if (! cache->data)
+	return grub_errno;
+    }
 
   grub_memcpy (cache->data, data,
 	       GRUB_DISK_SECTOR_SIZE << GRUB_DISK_CACHE_BITS);
   cache->dev_id = dev_id;
   cache->disk_id = disk_id;
   cache->sector = sector;
+  cache->last_use = ++grub_disk_cache_clock;
+  cache->readahead = 0;
 
   return GRUB_ERR_NONE;
 }
 
-
+
 
 grub_disk_dev_t grub_disk_dev_list;
 
@@ -408,21 +519,134 @@ grub_disk_read_small (grub_disk_t disk, grub_disk_addr_t sector,
   return GRUB_ERR_NONE;
 }
 
-/* Read data from the disk.  */
-grub_err_t
-grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
-		grub_off_t offset, grub_size_t size, void *buf)
+/* Update the sequential stream detector of DISK for a read of SIZE
+   bytes at SECTOR/OFFSET.  A read that continues the previous one grows
+   the read-ahead window, up to max_agglomerate, anything else resets
+   it.  */
+static void
+grub_disk_readahead_detect (grub_disk_t disk, grub_disk_addr_t sector,
+			    grub_off_t offset, grub_size_t size)
 {
-  /* First of all, check if the region is within the disk.  */
-  if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+  grub_disk_addr_t end;
+
+  end = sector + ((offset + size + GRUB_DISK_SECTOR_SIZE - 1)
+		  >> GRUB_DISK_SECTOR_BITS);
+
+  if (disk->ra_next && sector <= disk->ra_next
+      && sector + GRUB_DISK_CACHE_SIZE >= disk->ra_next
+      && end > disk->ra_next)
     {
-      grub_error_push ();
-      grub_dprintf ("disk", "Read out of range: sector 0x%llx (%s).\n",
-		    (unsigned long long) sector, grub_errmsg);
-      grub_error_pop ();
-      return grub_errno;
+      unsigned int max = disk->max_agglomerate;
+
+      if (max > GRUB_DISK_READAHEAD_MAX)
+	max = GRUB_DISK_READAHEAD_MAX;
+      if (max == 0)
+	max = 1;
+
+      if (disk->ra_window == 0)
+	disk->ra_window = 1;
+      else if (disk->ra_window < max)
+	disk->ra_window *= 2;
+      if (disk->ra_window > max)
+	disk->ra_window = max;
+    }
+  else
+    {
+      disk->ra_window = 0;
+      disk->ra_end = 0;
     }
 
+  disk->ra_next = end;
+}
+
+/* Read the current window past the end of the last read into the disk
+   cache, so that the next sequential reads are served without going to
+   the device.  The window is refilled once half of it was consumed.
+   Errors are not reported, the data is simply read again on demand.  */
+static void
+grub_disk_readahead (grub_disk_t disk)
+{
+  grub_disk_addr_t start, from, total;
+  grub_size_t count, i;
+  char *tmp_buf;
+
+  if (! disk->ra_window)
+    return;
+
+  start = ALIGN_UP (disk->ra_next, GRUB_DISK_CACHE_SIZE);
+  if (disk->ra_end > start
+      && disk->ra_end - start > ((grub_disk_addr_t) disk->ra_window
+				 << (GRUB_DISK_CACHE_BITS - 1)))
+    return;
+
+  from = disk->ra_end > start ? disk->ra_end : start;
+  count = disk->ra_window;
+
+  if (disk->total_sectors != GRUB_DISK_SIZE_UNKNOWN)
+    {
+      total = disk->total_sectors << (disk->log_sector_size
+				      - GRUB_DISK_SECTOR_BITS);
+      if (from >= total)
+	return;
+      if (count > ((total - from) >> GRUB_DISK_CACHE_BITS))
+	count = (total - from) >> GRUB_DISK_CACHE_BITS;
+    }
+
+  /* Don't read again what the cache already holds.  */
+  while (count && grub_disk_cache_find (disk->dev->id, disk->id, from))
+    {
+      from += GRUB_DISK_CACHE_SIZE;
+      count--;
+    }
+  if (! count)
+    return;
+
+  tmp_buf = grub_malloc (count << (GRUB_DISK_CACHE_BITS
+				   + GRUB_DISK_SECTOR_BITS));
+  if (! tmp_buf)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
+
+  if ((disk->dev->disk_read) (disk, transform_sector (disk, from),
+			      count << (GRUB_DISK_CACHE_BITS
+					+ GRUB_DISK_SECTOR_BITS
+					- disk->log_sector_size), tmp_buf))
+    {
+      grub_dprintf ("disk", "%s read-ahead failed\n", disk->name);
+      grub_free (tmp_buf);
+      grub_errno = GRUB_ERR_NONE;
+      disk->ra_window = 0;
+      return;
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      struct grub_disk_cache *cache;
+      grub_disk_addr_t sector = from + (i << GRUB_DISK_CACHE_BITS);
+
+      grub_disk_cache_store (disk->dev->id, disk->id, sector,
+			     tmp_buf + (i << (GRUB_DISK_CACHE_BITS
+					      + GRUB_DISK_SECTOR_BITS)));
+      cache = grub_disk_cache_find (disk->dev->id, disk->id, sector);
+      if (cache)
+	cache->readahead = 1;
+    }
+  grub_free (tmp_buf);
+  grub_errno = GRUB_ERR_NONE;
+
+  disk->ra_end = from + (count << GRUB_DISK_CACHE_BITS);
+#if DISK_CACHE_STATS
+  grub_disk_readahead_requests++;
+  grub_disk_readahead_units += count;
+#endif
+}
+
+static grub_err_t
+grub_disk_read_real (grub_disk_t disk, grub_disk_addr_t sector,
+		     grub_off_t offset, grub_size_t size, void *buf)
+{
   /* First read until first cache boundary.   */
   if (offset || (sector & (GRUB_DISK_CACHE_SIZE - 1)))
     {
@@ -532,6 +756,34 @@ grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
   return grub_errno;
 }
 
+/* Read data from the disk.  */
+grub_err_t
+grub_disk_read (grub_disk_t disk, grub_disk_addr_t sector,
+		grub_off_t offset, grub_size_t size, void *buf)
+{
+  grub_err_t err;
+
+  /* First of all, check if the region is within the disk.  */
+  if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
+    {
+      grub_error_push ();
+      grub_dprintf ("disk", "Read out of range: sector 0x%llx (%s).\n",
+		    (unsigned long long) sector, grub_errmsg);
+      grub_error_pop ();
+      return grub_errno;
+    }
+
+  grub_disk_readahead_detect (disk, sector, offset, size);
+
+  err = grub_disk_read_real (disk, sector, offset, size, buf);
+  if (err)
+    return err;
+
+  grub_disk_readahead (disk);
+
+  return GRUB_ERR_NONE;
+}
+
 grub_uint64_t
 grub_disk_get_size (grub_disk_t disk)
 {
@@ -80,25 +80,68 @@ struct grub_symbol
   void *addr;
   int isfunc;
   grub_dl_t mod;	/* The module to which this symbol belongs.  */
+  grub_uint32_t hash;
 };
 typedef struct grub_symbol *grub_symbol_t;
 
-/* The size of the symbol table.  */
-#define GRUB_SYMTAB_SIZE	509
+/* The initial size of the symbol table, must be a power of two.  */
+#define GRUB_SYMTAB_INITIAL_SIZE	512
 
-/* The symbol table (using an open-hash).  */
-static struct grub_symbol *grub_symtab[GRUB_SYMTAB_SIZE];
+/* The symbol table (using an open-hash).  It starts in a static array so
+   that the core symbols can be registered early, and doubles whenever it
+   holds twice as many symbols as buckets.  */
+static struct grub_symbol *grub_symtab_initial[GRUB_SYMTAB_INITIAL_SIZE];
+static struct grub_symbol **grub_symtab = grub_symtab_initial;
+static unsigned grub_symtab_size = GRUB_SYMTAB_INITIAL_SIZE;
+static unsigned grub_symtab_count;
 
-/* Simple hash function.  */
-static unsigned
+/* Lookup statistics, reported on the "dl" debug channel.  */
+static unsigned long grub_symtab_lookups;
+static unsigned long grub_symtab_probes;
+
+/* FNV-1a.  */
+static grub_uint32_t
 grub_symbol_hash (const char *s)
 {
-  unsigned key = 0;
+  grub_uint32_t key = 2166136261U;
 
   while (*s)
-    key = key * 65599 + *s++;
+    key = (key ^ (grub_uint8_t) *s++) * 16777619U;
+
+  return key;
+}
+
+static void
+grub_symtab_grow (void)
+{
+  struct grub_symbol **ntab;
+  unsigned nsize = grub_symtab_size * 2;
+  unsigned i;
+
+  ntab = grub_zalloc (nsize * sizeof (ntab[0]));
+  if (! ntab)
+    {
+      /* Keep using the current table, only longer chains.  */
+      grub_errno = GRUB_ERR_NONE;
+      return;
+    }
 
-  return (key + (key >> 5)) % GRUB_SYMTAB_SIZE;
+  for (i = 0; i < grub_symtab_size; i++)
+    {
+      grub_symbol_t sym, q;
+
+      for (sym = grub_symtab[i]; sym; sym = q)
+	{
+	  q = sym->next;
+	  sym->next = ntab[sym->hash & (nsize - 1)];
+	  ntab[sym->hash & (nsize - 1)] = sym;
+	}
+    }
+
+  if (grub_symtab != grub_symtab_initial)
+    grub_free (grub_symtab);
+  grub_symtab = ntab;
+  grub_symtab_size = nsize;
 }
 
 /* Resolve the symbol name NAME and return the address.
@@ -107,10 +150,15 @@ static grub_symbol_t
 grub_dl_resolve_symbol (const char *name)
 {
   grub_symbol_t sym;
+  grub_uint32_t hash = grub_symbol_hash (name);
 
-  for (sym = grub_symtab[grub_symbol_hash (name)]; sym; sym = sym->next)
-    if (grub_strcmp (sym->name, name) == 0)
-      return sym;
+  grub_symtab_lookups++;
+  for (sym = grub_symtab[hash & (grub_symtab_size - 1)]; sym; sym = sym->next)
+    {
+      grub_symtab_probes++;
+      if (sym->hash == hash && grub_strcmp (sym->name, name) == 0)
+	return sym;
+    }
 
   return 0;
 }
@@ -142,10 +190,15 @@ grub_dl_register_symbol (const char *name, void *addr, int isfunc,
   sym->addr = addr;
   sym->mod = mod;
   sym->isfunc = isfunc;
+  sym->hash = grub_symbol_hash (name);
+
+  if (grub_symtab_count >= 2 * grub_symtab_size)
+    grub_symtab_grow ();
 
-  k = grub_symbol_hash (name);
+  k = sym->hash & (grub_symtab_size - 1);
   sym->next = grub_symtab[k];
   grub_symtab[k] = sym;
+  grub_symtab_count++;
 
   return GRUB_ERR_NONE;
 }
@@ -159,7 +212,7 @@ grub_dl_unregister_symbols (grub_dl_t mod)
   if (! mod)
     grub_fatal ("core symbols cannot be unregistered");
 
-  for (i = 0; i < GRUB_SYMTAB_SIZE; i++)
+  for (i = 0; i < grub_symtab_size; i++)
     {
       grub_symbol_t sym, *p, q;
 
@@ -171,6 +224,7 @@ grub_dl_unregister_symbols (grub_dl_t mod)
 	      *p = q;
 	      grub_free ((void *) sym->name);
 	      grub_free (sym);
+	      grub_symtab_count--;
 	    }
 	  else
 	    p = &sym->next;
@@ -648,6 +702,9 @@ grub_dl_load_core_noinit (void *addr, grub_size_t size)
 
   grub_dprintf ("modules", "module name: %s\n", mod->name);
   grub_dprintf ("modules", "init function: %p\n", mod->init);
+  grub_dprintf ("dl", "symbol table: %u symbols in %u buckets, "
+		"%lu lookups, %lu probes\n", grub_symtab_count,
+		grub_symtab_size, grub_symtab_lookups, grub_symtab_probes);
 
   if (grub_dl_add (mod))
     {
@@ -62,3 +62,10 @@ grub_realloc (void *ptr, grub_size_t size)
     grub_error (GRUB_ERR_OUT_OF_MEMORY, N_("out of memory"));
   return ret;
 }
+
+grub_size_t
+grub_mm_get_free (void)
+{
+  /* The host allocator isn't bounded by a GRUB heap.  */
+  return 0;
+}
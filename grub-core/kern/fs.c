@@ -20,6 +20,7 @@
 #include <grub/disk.h>
 #include <grub/net.h>
 #include <grub/fs.h>
+#include <grub/partition.h>
 #include <grub/file.h>
 #include <grub/err.h>
 #include <grub/misc.h>
@@ -122,6 +123,117 @@ grub_fs_probe (grub_device_t device)
 }
 
 
+/* Mount cache.  */
+
+#define GRUB_FS_MOUNT_CACHE_SIZE	8
+
+struct grub_fs_mount_cache
+{
+  grub_fs_t fs;
+  enum grub_disk_dev_id dev_id;
+  unsigned long disk_id;
+  grub_disk_addr_t part_start;
+  unsigned long generation;
+  grub_uint64_t last_use;
+  void *mount;
+};
+
+static struct grub_fs_mount_cache grub_fs_mount_cache[GRUB_FS_MOUNT_CACHE_SIZE];
+static grub_uint64_t grub_fs_mount_cache_clock;
+
+static void
+grub_fs_mount_cache_drop (struct grub_fs_mount_cache *entry)
+{
+  void *mount = entry->mount;
+
+  entry->mount = NULL;
+  if (mount)
+    entry->fs->fs_unmount (mount);
+}
+
+void *
+grub_fs_mount_cache_get (grub_fs_t fs, grub_disk_t disk)
+{
+  grub_disk_addr_t part_start = grub_partition_get_start (disk->partition);
+  unsigned i;
+
+  for (i = 0; i < GRUB_FS_MOUNT_CACHE_SIZE; i++)
+    {
+      struct grub_fs_mount_cache *entry = &grub_fs_mount_cache[i];
+      void *mount;
+
+      if (!entry->mount || entry->fs != fs
+	  || entry->dev_id != disk->dev->id || entry->disk_id != disk->id
+	  || entry->part_start != part_start)
+	continue;
+
+      if (entry->generation != grub_disk_write_generation)
+	{
+	  grub_fs_mount_cache_drop (entry);
+	  continue;
+	}
+
+      /* The caller owns it until it is put back.  */
+      mount = entry->mount;
+      entry->mount = NULL;
+      grub_dprintf ("fs", "%s: reusing mount of %s\n", fs->name, disk->name);
+      return mount;
+    }
+
+  return NULL;
+}
+
+void
+grub_fs_mount_cache_put (grub_fs_t fs, grub_disk_t disk, void *mount)
+{
+  struct grub_fs_mount_cache *victim = NULL;
+  unsigned i;
+
+  if (!fs->fs_unmount)
+    return;
+
+  for (i = 0; i < GRUB_FS_MOUNT_CACHE_SIZE; i++)
+    {
+      struct grub_fs_mount_cache *entry = &grub_fs_mount_cache[i];
+
+      if (!entry->mount)
+	{
+	  victim = entry;
+	  break;
+	}
+      if (!victim || entry->last_use < victim->last_use)
+	victim = entry;
+    }
+
+  grub_fs_mount_cache_drop (victim);
+  victim->fs = fs;
+  victim->dev_id = disk->dev->id;
+  victim->disk_id = disk->id;
+  victim->part_start = grub_partition_get_start (disk->partition);
+  victim->generation = grub_disk_write_generation;
+  victim->last_use = ++grub_fs_mount_cache_clock;
+  victim->mount = mount;
+}
+
+void
+grub_fs_mount_cache_flush (grub_fs_t fs)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_FS_MOUNT_CACHE_SIZE; i++)
+    if (grub_fs_mount_cache[i].mount && grub_fs_mount_cache[i].fs == fs)
+      grub_fs_mount_cache_drop (&grub_fs_mount_cache[i]);
+}
+
+void
+grub_fs_mount_cache_invalidate_all (void)
+{
+  unsigned i;
+
+  for (i = 0; i < GRUB_FS_MOUNT_CACHE_SIZE; i++)
+    grub_fs_mount_cache_drop (&grub_fs_mount_cache[i]);
+}
+
 
 /* Block list support routines.  */
 
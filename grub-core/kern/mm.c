@@ -501,6 +501,30 @@ grub_realloc (void *ptr, grub_size_t size)
   return q;
 }
 
+grub_size_t
+grub_mm_get_free (void)
+{
+  grub_mm_region_t r;
+  grub_size_t total = 0;
+
+  for (r = grub_mm_base; r; r = r->next)
+    {
+      grub_mm_header_t p;
+
+      p = r->first;
+      if (!p)
+	continue;
+      do
+	{
+	  total += p->size << GRUB_MM_ALIGN_LOG2;
+	  p = p->next;
+	}
+      while (p != r->first);
+    }
+
+  return total;
+}
+
 #ifdef MM_DEBUG
 int grub_mm_debug = 0;
 
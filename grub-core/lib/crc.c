@@ -18,9 +18,24 @@
  */
 
 #include <grub/types.h>
+#include <grub/dl.h>
 #include <grub/lib/crc.h>
 
-static grub_uint32_t crc32c_table [256];
+#if defined (__i386__) || defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#endif
+
+GRUB_MOD_LICENSE ("GPLv3+");
+
+/* crc32c_table[k][i] is the CRC of byte I followed by K zero bytes, which
+   lets the slicing loop below fold 8 bytes per step.  */
+static grub_uint32_t crc32c_table[8][256];
+
+#if defined (__i386__) || defined (__x86_64__)
+#define CPUID_ECX_SSE42 (1 << 20)
+
+static int crc32c_hw = -1;
+#endif
 
 /* Helper for init_crc32c_table.  */
 static grub_uint32_t
@@ -47,30 +62,125 @@ init_crc32c_table (void)
 
   for(i = 0; i < 256; i++)
     {
-      crc32c_table[i] = reflect(i, 8) << 24;
+      crc32c_table[0][i] = reflect(i, 8) << 24;
       for (j = 0; j < 8; j++)
-        crc32c_table[i] = (crc32c_table[i] << 1) ^
-            (crc32c_table[i] & (1 << 31) ? polynomial : 0);
-      crc32c_table[i] = reflect(crc32c_table[i], 32);
+        crc32c_table[0][i] = (crc32c_table[0][i] << 1) ^
+            (crc32c_table[0][i] & (1 << 31) ? polynomial : 0);
+      crc32c_table[0][i] = reflect(crc32c_table[0][i], 32);
+    }
+
+  for (j = 1; j < 8; j++)
+    for (i = 0; i < 256; i++)
+      crc32c_table[j][i] = (crc32c_table[j - 1][i] >> 8)
+	^ crc32c_table[0][crc32c_table[j - 1][i] & 0xff];
+}
+
+#if defined (__i386__) || defined (__x86_64__)
+/* The SSE4.2 crc32 instruction works on general purpose registers, so
+   unlike the vector extensions it needs no FPU state set up by firmware.  */
+static int
+crc32c_hw_supported (void)
+{
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  if (!grub_cpu_is_cpuid_supported ())
+    return 0;
+  grub_cpuid (0, eax, ebx, ecx, edx);
+  if (eax < 1)
+    return 0;
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  return !!(ecx & CPUID_ECX_SSE42);
+}
+
+static grub_uint32_t
+crc32c_hw_update (grub_uint32_t crc, const grub_uint8_t *data,
+		  grub_size_t size)
+{
+  for (; size && ((grub_addr_t) data & 7); size--, data++)
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*data));
+
+#ifdef __x86_64__
+  {
+    grub_uint64_t crc64 = crc;
+
+    for (; size >= 8; size -= 8, data += 8)
+      asm ("crc32q %1, %0" : "+r" (crc64)
+	   : "rm" (*(const grub_uint64_t *) data));
+    crc = crc64;
+  }
+#else
+  for (; size >= 4; size -= 4, data += 4)
+    asm ("crc32l %1, %0" : "+r" (crc)
+	 : "rm" (*(const grub_uint32_t *) data));
+#endif
+
+  for (; size; size--, data++)
+    asm ("crc32b %1, %0" : "+r" (crc) : "rm" (*data));
+
+  return crc;
+}
+#endif
+
+static grub_uint32_t
+crc32c_sw_update (grub_uint32_t crc, const grub_uint8_t *data,
+		  grub_size_t size)
+{
+  for (; size && ((grub_addr_t) data & 3); size--, data++)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc & 0xFF) ^ *data];
+
+  for (; size >= 8; size -= 8, data += 8)
+    {
+      grub_uint32_t lo, hi;
+
+      lo = crc ^ grub_le_to_cpu32 (((const grub_uint32_t *) data)[0]);
+      hi = grub_le_to_cpu32 (((const grub_uint32_t *) data)[1]);
+      crc = crc32c_table[7][lo & 0xff]
+	^ crc32c_table[6][(lo >> 8) & 0xff]
+	^ crc32c_table[5][(lo >> 16) & 0xff]
+	^ crc32c_table[4][lo >> 24]
+	^ crc32c_table[3][hi & 0xff]
+	^ crc32c_table[2][(hi >> 8) & 0xff]
+	^ crc32c_table[1][(hi >> 16) & 0xff]
+	^ crc32c_table[0][hi >> 24];
     }
+
+  for (; size; size--, data++)
+    crc = (crc >> 8) ^ crc32c_table[0][(crc & 0xFF) ^ *data];
+
+  return crc;
+}
+
+const char *
+grub_getcrc32c_impl (void)
+{
+#if defined (__i386__) || defined (__x86_64__)
+  if (crc32c_hw < 0)
+    crc32c_hw = crc32c_hw_supported ();
+  if (crc32c_hw)
+    return "sse4.2";
+#endif
+  return "slice-by-8";
 }
 
 grub_uint32_t
 grub_getcrc32c (grub_uint32_t crc, const void *buf, int size)
 {
-  int i;
   const grub_uint8_t *data = buf;
 
-  if (! crc32c_table[1])
-    init_crc32c_table ();
+  if (size <= 0)
+    return crc;
 
   crc^= 0xffffffff;
 
-  for (i = 0; i < size; i++)
-    {
-      crc = (crc >> 8) ^ crc32c_table[(crc & 0xFF) ^ *data];
-      data++;
-    }
+#if defined (__i386__) || defined (__x86_64__)
+  if (crc32c_hw < 0)
+    crc32c_hw = crc32c_hw_supported ();
+  if (crc32c_hw)
+    return crc32c_hw_update (crc, data, size) ^ 0xffffffff;
+#endif
+
+  if (! crc32c_table[0][1])
+    init_crc32c_table ();
 
-  return crc ^ 0xffffffff;
+  return crc32c_sw_update (crc, data, size) ^ 0xffffffff;
 }
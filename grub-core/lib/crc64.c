@@ -20,10 +20,17 @@
 #include <grub/types.h>
 #include <grub/dl.h>
 #include <grub/crypto.h>
+#include <grub/misc.h>
+
+#if defined (__i386__) || defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#define CRC64_PCLMUL 1
+#endif
 
 GRUB_MOD_LICENSE ("GPLv3+");
 
-static grub_uint64_t crc64_table [256];
+/* crc64_table[k][i] is the CRC of byte I followed by K zero bytes.  */
+static grub_uint64_t crc64_table[8][256];
 
 /* Helper for init_crc64_table.  */
 static grub_uint64_t
@@ -50,36 +57,136 @@ init_crc64_table (void)
 
   for(i = 0; i < 256; i++)
     {
-      crc64_table[i] = reflect(i, 8) << 56;
+      crc64_table[0][i] = reflect(i, 8) << 56;
       for (j = 0; j < 8; j++)
 	{
-	  crc64_table[i] = (crc64_table[i] << 1) ^
-            (crc64_table[i] & (1ULL << 63) ? polynomial : 0);
+	  crc64_table[0][i] = (crc64_table[0][i] << 1) ^
+            (crc64_table[0][i] & (1ULL << 63) ? polynomial : 0);
 	}
-      crc64_table[i] = reflect(crc64_table[i], 64);
+      crc64_table[0][i] = reflect(crc64_table[0][i], 64);
     }
+
+  for (j = 1; j < 8; j++)
+    for (i = 0; i < 256; i++)
+      crc64_table[j][i] = (crc64_table[j - 1][i] >> 8)
+	^ crc64_table[0][crc64_table[j - 1][i] & 0xff];
 }
 
 static void
 crc64_init (void *context)
 {
-  if (! crc64_table[1])
+  if (! crc64_table[0][1])
     init_crc64_table ();
   *(grub_uint64_t *) context = 0;
 }
 
+static grub_uint64_t
+crc64_update (grub_uint64_t crc, const grub_uint8_t *data, grub_size_t size)
+{
+  for (; size && ((grub_addr_t) data & 7); size--, data++)
+    crc = (crc >> 8) ^ crc64_table[0][(crc & 0xFF) ^ *data];
+
+  /* Slice by 8: fold a whole word into the CRC per step.  */
+  for (; size >= 8; size -= 8, data += 8)
+    {
+      crc ^= grub_le_to_cpu64 (*(const grub_uint64_t *) data);
+      crc = crc64_table[7][crc & 0xff]
+	^ crc64_table[6][(crc >> 8) & 0xff]
+	^ crc64_table[5][(crc >> 16) & 0xff]
+	^ crc64_table[4][(crc >> 24) & 0xff]
+	^ crc64_table[3][(crc >> 32) & 0xff]
+	^ crc64_table[2][(crc >> 40) & 0xff]
+	^ crc64_table[1][(crc >> 48) & 0xff]
+	^ crc64_table[0][crc >> 56];
+    }
+
+  for (; size; size--, data++)
+    crc = (crc >> 8) ^ crc64_table[0][(crc & 0xFF) ^ *data];
+
+  return crc;
+}
+
+#ifdef CRC64_PCLMUL
+
+#define CPUID_ECX_PCLMULQDQ	(1 << 1)
+
+/* Multipliers that carry the low and the high half of a 128-bit block
+   forward by 128 bits, modulo the reflected polynomial.  */
+static const grub_uint64_t crc64_fold_k[2] =
+  { 0xe05dd497ca393ae4ULL, 0xdabe95afc7875f40ULL };
+
+static int
+crc64_pclmul_supported (void)
+{
+  static int supported = -1;
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  if (supported >= 0)
+    return supported;
+
+  supported = 0;
+  if (grub_cpu_sse2_usable ())
+    {
+      grub_cpuid (1, eax, ebx, ecx, edx);
+      supported = !!(ecx & CPUID_ECX_PCLMULQDQ);
+    }
+  return supported;
+}
+
+/* Fold the N 16-byte blocks at DATA into the running remainder X, one
+   carry-less multiply per half and block.  Like the RAID6 kernels, the
+   asm only touches %xmm0-%xmm5 and wipes them before returning.  */
+static void
+crc64_pclmul_fold (grub_uint64_t *x, const grub_uint8_t *data, grub_size_t n)
+{
+  asm volatile ("movdqu (%[x]), %%xmm0\n\t"
+		"movdqu (%[k]), %%xmm2\n\t"
+		"1:\n\t"
+		"movdqa %%xmm0, %%xmm1\n\t"
+		"pclmulqdq $0x00, %%xmm2, %%xmm0\n\t"
+		"pclmulqdq $0x11, %%xmm2, %%xmm1\n\t"
+		"pxor %%xmm1, %%xmm0\n\t"
+		"movdqu (%[d]), %%xmm1\n\t"
+		"pxor %%xmm1, %%xmm0\n\t"
+		"add $16, %[d]\n\t"
+		"sub $1, %[n]\n\t"
+		"jnz 1b\n\t"
+		"movdqu %%xmm0, (%[x])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		: [d] "+r" (data), [n] "+r" (n)
+		: [x] "r" (x), [k] "r" (crc64_fold_k)
+		: GRUB_CPU_SSE_CLOBBERS "memory", "cc");
+}
+
+#endif
+
 static void
 crc64_write (void *context, const void *buf, grub_size_t size)
 {
-  unsigned i;
   const grub_uint8_t *data = buf;
   grub_uint64_t crc = ~grub_le_to_cpu64 (*(grub_uint64_t *) context);
 
-  for (i = 0; i < size; i++)
+#ifdef CRC64_PCLMUL
+  if (size >= 32 && crc64_pclmul_supported ())
     {
-      crc = (crc >> 8) ^ crc64_table[(crc & 0xFF) ^ *data];
-      data++;
+      grub_uint64_t x[2];
+      grub_size_t n = size / 16;
+
+      /* The running CRC enters as an XOR into the first 8 bytes.  What's
+	 left after folding is a 16-byte message with the same CRC as
+	 everything folded into it.  */
+      grub_memcpy (x, data, 16);
+      x[0] ^= crc;
+      crc64_pclmul_fold (x, data + 16, n - 1);
+      crc = crc64_update (0, (const grub_uint8_t *) x, 16);
+      data += n * 16;
+      size -= n * 16;
     }
+#endif
+
+  crc = crc64_update (crc, data, size);
 
   *(grub_uint64_t *) context = grub_cpu_to_le64 (~crc);
 }
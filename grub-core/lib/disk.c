@@ -34,15 +34,12 @@ static void
 grub_disk_cache_invalidate (unsigned long dev_id, unsigned long disk_id,
 			    grub_disk_addr_t sector)
 {
-  unsigned cache_index;
   struct grub_disk_cache *cache;
 
   sector &= ~((grub_disk_addr_t) GRUB_DISK_CACHE_SIZE - 1);
-  cache_index = grub_disk_cache_get_index (dev_id, disk_id, sector);
-  cache = grub_disk_cache_table + cache_index;
+  cache = grub_disk_cache_find (dev_id, disk_id, sector);
 
-  if (cache->dev_id == dev_id && cache->disk_id == disk_id
-      && cache->sector == sector && cache->data)
+  if (cache)
     {
       cache->lock = 1;
       grub_free (cache->data);
@@ -60,6 +57,8 @@ grub_disk_write (grub_disk_t disk, grub_disk_addr_t sector,
 
   grub_dprintf ("disk", "Writing `%s'...\n", disk->name);
 
+  grub_disk_write_generation++;
+
   if (grub_disk_adjust_range (disk, &sector, &offset, size) != GRUB_ERR_NONE)
     return -1;
 
@@ -36,6 +36,10 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/types.h>
+#include <grub/dl.h>
+#include <grub/lz4.h>
+
+GRUB_MOD_LICENSE ("GPLv3+");
 
 static int LZ4_uncompress_unknownOutputSize(const char *source, char *dest,
 					    int isize, int maxOutputSize);
@@ -131,26 +135,18 @@ typedef struct _U64_S {
 #define	LZ4_WILDCOPY(s, d, e) do { LZ4_COPYPACKET(s, d) } while (d < e);
 
 /* Decompression functions */
-grub_err_t
-lz4_decompress(void *s_start, void *d_start, grub_size_t s_len, grub_size_t d_len);
-
-grub_err_t
-lz4_decompress(void *s_start, void *d_start, grub_size_t s_len, grub_size_t d_len)
+grub_ssize_t
+grub_lz4_decompress (const void *src, grub_size_t srclen, void *dst,
+		     grub_size_t dstlen)
 {
-	const BYTE *src = s_start;
-	U32 bufsiz = (src[0] << 24) | (src[1] << 16) | (src[2] << 8) |
-	    src[3];
-
-	/* invalid compressed buffer size encoded at start */
-	if (bufsiz + 4 > s_len)
-		return grub_error(GRUB_ERR_BAD_FS,"lz4 decompression failed.");
+	if (srclen > GRUB_INT_MAX || dstlen > GRUB_INT_MAX)
+		return -1;
 
 	/*
-	 * Returns 0 on success (decompression function returned non-negative)
-	 * and appropriate error on failure (decompression function returned negative).
+	 * Returns the number of bytes produced, or negative on a malformed
+	 * or truncated block.
 	 */
-	return (LZ4_uncompress_unknownOutputSize((char*)s_start + 4, d_start, bufsiz,
-	    d_len) < 0)?grub_error(GRUB_ERR_BAD_FS,"lz4 decompression failed."):0;
+	return LZ4_uncompress_unknownOutputSize(src, dst, srclen, dstlen);
 }
 
 static int
@@ -22,6 +22,9 @@
 #include <grub/mm.h>
 #include <grub/misc.h>
 #include <grub/dl.h>
+#if defined (__i386__) || defined (__x86_64__)
+#include <grub/i386/cpuid.h>
+#endif
 
 GRUB_MOD_LICENSE ("GPLv2+");
 
@@ -32,6 +35,538 @@ GRUB_MOD_LICENSE ("GPLv2+");
    must have room for at least DKLEN octets.  The output buffer will
    be filled with the derived data.  */
 
+/* Each PBKDF2 iteration is one HMAC over the previous output.  The key
+   never changes, so hash the inner and outer pads once and start every
+   iteration from copies of those two contexts instead of going through
+   grub_crypto_hmac_buffer, which would allocate and rehash the pads.  */
+
+struct pbkdf2_hmac
+{
+  const struct gcry_md_spec *md;
+  void *ipad_ctx;
+  void *opad_ctx;
+  void *ctx;
+};
+
+static gcry_err_code_t
+pbkdf2_hmac_init (struct pbkdf2_hmac *h, const struct gcry_md_spec *md,
+		  const grub_uint8_t *P, grub_size_t Plen)
+{
+  grub_uint8_t *pad;
+  grub_uint8_t key[GRUB_CRYPTO_MAX_MDLEN];
+  unsigned int i;
+
+  if (md->mdlen > md->blocksize)
+    return GPG_ERR_INV_ARG;
+
+  h->md = md;
+  h->ipad_ctx = grub_malloc (3 * md->contextsize + md->blocksize);
+  if (!h->ipad_ctx)
+    return GPG_ERR_OUT_OF_MEMORY;
+  h->opad_ctx = (grub_uint8_t *) h->ipad_ctx + md->contextsize;
+  h->ctx = (grub_uint8_t *) h->opad_ctx + md->contextsize;
+  pad = (grub_uint8_t *) h->ctx + md->contextsize;
+
+  if (Plen > md->blocksize)
+    {
+      grub_crypto_hash (md, key, P, Plen);
+      P = key;
+      Plen = md->mdlen;
+    }
+
+  grub_memset (pad, 0, md->blocksize);
+  grub_memcpy (pad, P, Plen);
+  for (i = 0; i < md->blocksize; i++)
+    pad[i] ^= 0x36;
+  md->init (h->ipad_ctx);
+  md->write (h->ipad_ctx, pad, md->blocksize);
+
+  for (i = 0; i < md->blocksize; i++)
+    pad[i] ^= 0x36 ^ 0x5c;
+  md->init (h->opad_ctx);
+  md->write (h->opad_ctx, pad, md->blocksize);
+
+  grub_memset (pad, 0, md->blocksize);
+  grub_memset (key, 0, sizeof (key));
+  return GPG_ERR_NO_ERROR;
+}
+
+/* OUT = HMAC (P, IN), OUT may alias IN.  */
+static void
+pbkdf2_hmac (struct pbkdf2_hmac *h, const grub_uint8_t *in, grub_size_t inlen,
+	     grub_uint8_t *out)
+{
+  const struct gcry_md_spec *md = h->md;
+
+  grub_memcpy (h->ctx, h->ipad_ctx, md->contextsize);
+  md->write (h->ctx, in, inlen);
+  md->final (h->ctx);
+  grub_memcpy (out, md->read (h->ctx), md->mdlen);
+
+  grub_memcpy (h->ctx, h->opad_ctx, md->contextsize);
+  md->write (h->ctx, out, md->mdlen);
+  md->final (h->ctx);
+  grub_memcpy (out, md->read (h->ctx), md->mdlen);
+}
+
+static void
+pbkdf2_hmac_fini (struct pbkdf2_hmac *h)
+{
+  grub_memset (h->ipad_ctx, 0, 3 * h->md->contextsize + h->md->blocksize);
+  grub_free (h->ipad_ctx);
+}
+
+/* For HMAC-SHA1 and HMAC-SHA256 every iteration after the first hashes
+   exactly one block on top of each pad state: the previous digest plus
+   fixed padding.  Run those compressions directly on 32-bit words, with
+   the SHA extensions when the CPU has them, and carry up to
+   PBKDF2_SHA_LANES output blocks of one derivation through the
+   iterations side by side, so that their independent compressions
+   overlap in the CPU.  */
+
+#define PBKDF2_SHA_LANES 4
+
+#define ROTL32(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
+#define ROTR32(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+typedef void (*sha_compress_func) (grub_uint32_t *state,
+				   const grub_uint32_t *block,
+				   grub_uint32_t *w);
+
+struct pbkdf2_sha
+{
+  const char *name;
+  /* Digest size in 32-bit words.  */
+  unsigned int words;
+  const grub_uint32_t *iv;
+  sha_compress_func compress;
+#if defined (__i386__) || defined (__x86_64__)
+  sha_compress_func compress_ni;
+#endif
+};
+
+static const grub_uint32_t sha1_iv[5] =
+  {
+    0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0
+  };
+
+static const grub_uint32_t sha256_iv[8] =
+  {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+/* Aligned for the SHA extension code, which adds them from memory.  */
+static const grub_uint32_t sha256_k[64] __attribute__ ((aligned (16))) =
+  {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
+    0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
+    0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
+    0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
+    0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+    0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
+    0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
+    0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
+    0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+  };
+
+#define SHA1_ROUND(f, k)				\
+  do {							\
+    t = ROTL32 (a, 5) + (f) + e + (k) + w[i];		\
+    e = d;						\
+    d = c;						\
+    c = ROTL32 (b, 30);					\
+    b = a;						\
+    a = t;						\
+  } while (0)
+
+/* W receives the 80-word message schedule.  */
+static void
+sha1_compress (grub_uint32_t *state, const grub_uint32_t *block,
+	       grub_uint32_t *w)
+{
+  grub_uint32_t a, b, c, d, e, t;
+  unsigned int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = block[i];
+  for (; i < 80; i++)
+    w[i] = ROTL32 (w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  for (i = 0; i < 20; i++)
+    SHA1_ROUND ((b & c) | (~b & d), 0x5a827999);
+  for (; i < 40; i++)
+    SHA1_ROUND (b ^ c ^ d, 0x6ed9eba1);
+  for (; i < 60; i++)
+    SHA1_ROUND ((b & c) | (b & d) | (c & d), 0x8f1bbcdc);
+  for (; i < 80; i++)
+    SHA1_ROUND (b ^ c ^ d, 0xca62c1d6);
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+}
+
+/* W receives the 64-word message schedule.  */
+static void
+sha256_compress (grub_uint32_t *state, const grub_uint32_t *block,
+		 grub_uint32_t *w)
+{
+  grub_uint32_t a, b, c, d, e, f, g, h, t1, t2;
+  unsigned int i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = block[i];
+  for (; i < 64; i++)
+    w[i] = (ROTR32 (w[i - 2], 17) ^ ROTR32 (w[i - 2], 19) ^ (w[i - 2] >> 10))
+      + w[i - 7]
+      + (ROTR32 (w[i - 15], 7) ^ ROTR32 (w[i - 15], 18) ^ (w[i - 15] >> 3))
+      + w[i - 16];
+
+  a = state[0];
+  b = state[1];
+  c = state[2];
+  d = state[3];
+  e = state[4];
+  f = state[5];
+  g = state[6];
+  h = state[7];
+  for (i = 0; i < 64; i++)
+    {
+      t1 = h + (ROTR32 (e, 6) ^ ROTR32 (e, 11) ^ ROTR32 (e, 25))
+	+ ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+      t2 = (ROTR32 (a, 2) ^ ROTR32 (a, 13) ^ ROTR32 (a, 22))
+	+ ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+  state[4] += e;
+  state[5] += f;
+  state[6] += g;
+  state[7] += h;
+}
+
+#if defined (__i386__) || defined (__x86_64__)
+
+#define CPUID_EBX7_SHA		(1 << 29)
+#define CPUID_ECX_SSSE3		(1 << 9)
+#define CPUID_ECX_SSE41		(1 << 19)
+
+/* The SHA extensions, and the SSSE3 and SSE4.1 shuffles used around
+   them.  Every CPU with the former has the latter, but ask anyway.  */
+static int
+sha_ni_supported (void)
+{
+  static int supported = -1;
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  if (supported >= 0)
+    return supported;
+
+  supported = 0;
+  if (!grub_cpu_sse2_usable ())
+    return supported;
+  grub_cpuid (0, eax, ebx, ecx, edx);
+  if (eax < 7)
+    return supported;
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  if (!(ecx & CPUID_ECX_SSSE3) || !(ecx & CPUID_ECX_SSE41))
+    return supported;
+  grub_cpuid_count (7, 0, eax, ebx, ecx, edx);
+  supported = !!(ebx & CPUID_EBX7_SHA);
+  return supported;
+}
+
+/* Same as sha1_compress.  W must be 16-byte aligned; the schedule is
+   kept there in groups of four words in reverse order, which is how
+   the SHA1 instructions hold them.  Only %xmm0-%xmm5 are used, and they
+   are cleared again since they held key material.  */
+#define SHA1_NI_ROUNDS(off, f, e_in, e_out)		\
+  "sha1nexte " off "(%[w]), %%xmm" e_in "\n\t"		\
+  "movdqa %%xmm1, %%xmm" e_out "\n\t"			\
+  "sha1rnds4 $" f ", %%xmm" e_in ", %%xmm1\n\t"
+
+static void
+sha1_compress_ni (grub_uint32_t *state, const grub_uint32_t *block,
+		  grub_uint32_t *w)
+{
+  grub_addr_t i;
+
+  for (i = 0; i < 16; i++)
+    w[(i & ~3) + 3 - (i & 3)] = block[i];
+
+  asm volatile (/* Message schedule, W[16..79].  */
+		"xor %[i], %[i]\n\t"
+		"1:\n\t"
+		"movdqa (%[w],%[i]), %%xmm0\n\t"
+		"sha1msg1 16(%[w],%[i]), %%xmm0\n\t"
+		"pxor 32(%[w],%[i]), %%xmm0\n\t"
+		"sha1msg2 48(%[w],%[i]), %%xmm0\n\t"
+		"movdqa %%xmm0, 64(%[w],%[i])\n\t"
+		"add $16, %[i]\n\t"
+		"cmp $256, %[i]\n\t"
+		"jne 1b\n\t"
+		/* A in the top lane, E alone in the top lane.  */
+		"movdqu (%[state]), %%xmm1\n\t"
+		"pshufd $0x1b, %%xmm1, %%xmm1\n\t"
+		"movd 16(%[state]), %%xmm2\n\t"
+		"pslldq $12, %%xmm2\n\t"
+		"movdqa %%xmm1, %%xmm4\n\t"
+		"movdqa %%xmm2, %%xmm5\n\t"
+		/* Rounds 0-79, four per step.  */
+		"paddd (%[w]), %%xmm2\n\t"
+		"movdqa %%xmm1, %%xmm3\n\t"
+		"sha1rnds4 $0, %%xmm2, %%xmm1\n\t"
+		SHA1_NI_ROUNDS ("16", "0", "3", "2")
+		SHA1_NI_ROUNDS ("32", "0", "2", "3")
+		SHA1_NI_ROUNDS ("48", "0", "3", "2")
+		SHA1_NI_ROUNDS ("64", "0", "2", "3")
+		SHA1_NI_ROUNDS ("80", "1", "3", "2")
+		SHA1_NI_ROUNDS ("96", "1", "2", "3")
+		SHA1_NI_ROUNDS ("112", "1", "3", "2")
+		SHA1_NI_ROUNDS ("128", "1", "2", "3")
+		SHA1_NI_ROUNDS ("144", "1", "3", "2")
+		SHA1_NI_ROUNDS ("160", "2", "2", "3")
+		SHA1_NI_ROUNDS ("176", "2", "3", "2")
+		SHA1_NI_ROUNDS ("192", "2", "2", "3")
+		SHA1_NI_ROUNDS ("208", "2", "3", "2")
+		SHA1_NI_ROUNDS ("224", "2", "2", "3")
+		SHA1_NI_ROUNDS ("240", "3", "3", "2")
+		SHA1_NI_ROUNDS ("256", "3", "2", "3")
+		SHA1_NI_ROUNDS ("272", "3", "3", "2")
+		SHA1_NI_ROUNDS ("288", "3", "2", "3")
+		SHA1_NI_ROUNDS ("304", "3", "3", "2")
+		"sha1nexte %%xmm5, %%xmm2\n\t"
+		"paddd %%xmm4, %%xmm1\n\t"
+		"pshufd $0x1b, %%xmm1, %%xmm1\n\t"
+		"movdqu %%xmm1, (%[state])\n\t"
+		"psrldq $12, %%xmm2\n\t"
+		"movd %%xmm2, 16(%[state])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n\t"
+		"pxor %%xmm5, %%xmm5\n\t"
+		: [i] "=&r" (i)
+		: [w] "r" (w), [state] "r" (state)
+		: GRUB_CPU_SSE_CLOBBERS "memory", "cc");
+}
+
+/* Same as sha256_compress.  W must be 16-byte aligned.  Only
+   %xmm0-%xmm5 are used, and they are cleared again.  */
+static void
+sha256_compress_ni (grub_uint32_t *state, const grub_uint32_t *block,
+		    grub_uint32_t *w)
+{
+  grub_addr_t i;
+
+  for (i = 0; i < 16; i++)
+    w[i] = block[i];
+
+  asm volatile (/* Message schedule, W[16..63].  */
+		"xor %[i], %[i]\n\t"
+		"1:\n\t"
+		"movdqa (%[w],%[i]), %%xmm3\n\t"
+		"sha256msg1 16(%[w],%[i]), %%xmm3\n\t"
+		"movdqa 48(%[w],%[i]), %%xmm5\n\t"
+		"movdqa %%xmm5, %%xmm4\n\t"
+		"palignr $4, 32(%[w],%[i]), %%xmm4\n\t"
+		"paddd %%xmm4, %%xmm3\n\t"
+		"sha256msg2 %%xmm5, %%xmm3\n\t"
+		"movdqa %%xmm3, 64(%[w],%[i])\n\t"
+		"add $16, %[i]\n\t"
+		"cmp $192, %[i]\n\t"
+		"jne 1b\n\t"
+		/* State as ABEF in %xmm1 and CDGH in %xmm2.  */
+		"movdqu (%[state]), %%xmm3\n\t"
+		"movdqu 16(%[state]), %%xmm2\n\t"
+		"pshufd $0xb1, %%xmm3, %%xmm3\n\t"
+		"pshufd $0x1b, %%xmm2, %%xmm2\n\t"
+		"movdqa %%xmm3, %%xmm1\n\t"
+		"palignr $8, %%xmm2, %%xmm1\n\t"
+		"pblendw $0xf0, %%xmm3, %%xmm2\n\t"
+		"movdqa %%xmm1, %%xmm4\n\t"
+		"movdqa %%xmm2, %%xmm5\n\t"
+		/* Rounds 0-63, four per step.  */
+		"xor %[i], %[i]\n\t"
+		"2:\n\t"
+		"movdqa (%[w],%[i]), %%xmm0\n\t"
+		"paddd (%[k],%[i]), %%xmm0\n\t"
+		"sha256rnds2 %%xmm0, %%xmm1, %%xmm2\n\t"
+		"pshufd $0x0e, %%xmm0, %%xmm0\n\t"
+		"sha256rnds2 %%xmm0, %%xmm2, %%xmm1\n\t"
+		"add $16, %[i]\n\t"
+		"cmp $256, %[i]\n\t"
+		"jne 2b\n\t"
+		"paddd %%xmm4, %%xmm1\n\t"
+		"paddd %%xmm5, %%xmm2\n\t"
+		"pshufd $0x1b, %%xmm1, %%xmm3\n\t"
+		"pshufd $0xb1, %%xmm2, %%xmm2\n\t"
+		"movdqa %%xmm3, %%xmm1\n\t"
+		"pblendw $0xf0, %%xmm2, %%xmm1\n\t"
+		"palignr $8, %%xmm3, %%xmm2\n\t"
+		"movdqu %%xmm1, (%[state])\n\t"
+		"movdqu %%xmm2, 16(%[state])\n\t"
+		"pxor %%xmm0, %%xmm0\n\t"
+		"pxor %%xmm1, %%xmm1\n\t"
+		"pxor %%xmm2, %%xmm2\n\t"
+		"pxor %%xmm3, %%xmm3\n\t"
+		"pxor %%xmm4, %%xmm4\n\t"
+		"pxor %%xmm5, %%xmm5\n\t"
+		: [i] "=&r" (i)
+		: [w] "r" (w), [state] "r" (state), [k] "r" (sha256_k)
+		: GRUB_CPU_SSE_CLOBBERS "memory", "cc");
+}
+
+#endif
+
+static const struct pbkdf2_sha pbkdf2_shas[] =
+  {
+#if defined (__i386__) || defined (__x86_64__)
+    { "SHA1", 5, sha1_iv, sha1_compress, sha1_compress_ni },
+    { "SHA256", 8, sha256_iv, sha256_compress, sha256_compress_ni }
+#else
+    { "SHA1", 5, sha1_iv, sha1_compress },
+    { "SHA256", 8, sha256_iv, sha256_compress }
+#endif
+  };
+
+static const struct pbkdf2_sha *
+pbkdf2_sha_find (const struct gcry_md_spec *md)
+{
+  unsigned int i;
+
+  for (i = 0; i < ARRAY_SIZE (pbkdf2_shas); i++)
+    if (grub_strcmp (md->name, pbkdf2_shas[i].name) == 0
+	&& md->mdlen == pbkdf2_shas[i].words * 4 && md->blocksize == 64)
+      return &pbkdf2_shas[i];
+  return NULL;
+}
+
+struct pbkdf2_sha_lanes
+{
+  /* Message blocks: the digest being hashed, then fixed padding.  */
+  grub_uint32_t inner[PBKDF2_SHA_LANES][16];
+  grub_uint32_t outer[PBKDF2_SHA_LANES][16];
+  grub_uint32_t state[PBKDF2_SHA_LANES][8];
+  grub_uint32_t t[PBKDF2_SHA_LANES][8];
+  grub_uint32_t ipad[8];
+  grub_uint32_t opad[8];
+  /* Message schedules.  */
+  grub_uint32_t w[PBKDF2_SHA_LANES][80] __attribute__ ((aligned (16)));
+};
+
+/* STATE = IV compressed with the key XOR PAD.  */
+static void
+pbkdf2_sha_pad (const struct pbkdf2_sha *sha, sha_compress_func compress,
+		const grub_uint8_t *key, grub_size_t keylen, grub_uint8_t pad,
+		grub_uint32_t *state, grub_uint32_t *block, grub_uint32_t *w)
+{
+  grub_uint8_t bytes[64];
+  unsigned int i;
+
+  grub_memset (bytes, 0, sizeof (bytes));
+  grub_memcpy (bytes, key, keylen);
+  for (i = 0; i < 16; i++)
+    block[i] = (grub_be_to_cpu32 (grub_get_unaligned32 (bytes + 4 * i))
+		^ (pad * 0x01010101U));
+  grub_memcpy (state, sha->iv, sha->words * 4);
+  compress (state, block, w);
+  grub_memset (bytes, 0, sizeof (bytes));
+}
+
+/* Run iterations 2 to C of N output blocks at once.  U holds the first
+   HMAC of each block, T receives the XOR of all of them.  Both are N
+   consecutive digests in byte order.  */
+static void
+pbkdf2_sha_iterate (const struct pbkdf2_sha *sha, struct pbkdf2_sha_lanes *l,
+		    const grub_uint8_t *key, grub_size_t keylen,
+		    const grub_uint8_t *U, grub_uint8_t *T, unsigned int n,
+		    unsigned int c)
+{
+  sha_compress_func compress = sha->compress;
+  unsigned int words = sha->words;
+  unsigned int lane, j, u;
+
+#if defined (__i386__) || defined (__x86_64__)
+  if (sha_ni_supported ())
+    compress = sha->compress_ni;
+#endif
+
+  pbkdf2_sha_pad (sha, compress, key, keylen, 0x36, l->ipad, l->inner[0],
+		  l->w[0]);
+  pbkdf2_sha_pad (sha, compress, key, keylen, 0x5c, l->opad, l->inner[0],
+		  l->w[0]);
+
+  for (lane = 0; lane < n; lane++)
+    {
+      for (j = 0; j < words; j++)
+	{
+	  l->inner[lane][j]
+	    = grub_be_to_cpu32 (grub_get_unaligned32 (U + 4 * (lane * words
+							       + j)));
+	  l->t[lane][j] = l->inner[lane][j];
+	}
+      /* Padding of a one-block message following the pad block.  */
+      for (j = words; j < 16; j++)
+	l->inner[lane][j] = 0;
+      l->inner[lane][words] = 0x80000000;
+      l->inner[lane][15] = (64 + words * 4) * 8;
+      grub_memcpy (l->outer[lane], l->inner[lane], sizeof (l->outer[lane]));
+    }
+
+  for (u = 1; u < c; u++)
+    {
+      for (lane = 0; lane < n; lane++)
+	{
+	  grub_memcpy (l->state[lane], l->ipad, words * 4);
+	  compress (l->state[lane], l->inner[lane], l->w[lane]);
+	}
+      for (lane = 0; lane < n; lane++)
+	{
+	  grub_memcpy (l->outer[lane], l->state[lane], words * 4);
+	  grub_memcpy (l->state[lane], l->opad, words * 4);
+	  compress (l->state[lane], l->outer[lane], l->w[lane]);
+	}
+      for (lane = 0; lane < n; lane++)
+	for (j = 0; j < words; j++)
+	  {
+	    l->inner[lane][j] = l->state[lane][j];
+	    l->t[lane][j] ^= l->state[lane][j];
+	  }
+    }
+
+  for (lane = 0; lane < n; lane++)
+    for (j = 0; j < words; j++)
+      grub_set_unaligned32 (T + 4 * (lane * words + j),
+			    grub_cpu_to_be32 (l->t[lane][j]));
+}
+
 gcry_err_code_t
 grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
 		    const grub_uint8_t *P, grub_size_t Plen,
@@ -40,16 +575,26 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
 		    grub_uint8_t *DK, grub_size_t dkLen)
 {
   unsigned int hLen = md->mdlen;
-  grub_uint8_t U[GRUB_CRYPTO_MAX_MDLEN];
-  grub_uint8_t T[GRUB_CRYPTO_MAX_MDLEN];
+  grub_uint64_t Ubuf[PBKDF2_SHA_LANES * GRUB_CRYPTO_MAX_MDLEN
+		     / sizeof (grub_uint64_t)];
+  grub_uint64_t Tbuf[PBKDF2_SHA_LANES * GRUB_CRYPTO_MAX_MDLEN
+		     / sizeof (grub_uint64_t)];
+  grub_uint8_t *U = (grub_uint8_t *) Ubuf;
+  grub_uint8_t *T = (grub_uint8_t *) Tbuf;
+  grub_uint8_t key[GRUB_CRYPTO_MAX_MDLEN];
+  const struct pbkdf2_sha *sha;
+  struct pbkdf2_sha_lanes *lanes = NULL;
+  unsigned int nlanes = 1;
   unsigned int u;
   unsigned int l;
   unsigned int r;
   unsigned int i;
-  unsigned int k;
+  unsigned int j;
+  unsigned int n;
   gcry_err_code_t rc;
   grub_uint8_t *tmp;
   grub_size_t tmplen = Slen + 4;
+  struct pbkdf2_hmac hmac;
 
   if (md->mdlen > GRUB_CRYPTO_MAX_MDLEN || md->mdlen == 0)
     return GPG_ERR_INV_ARG;
@@ -70,39 +615,74 @@ grub_crypto_pbkdf2 (const struct gcry_md_spec *md,
   if (tmp == NULL)
     return GPG_ERR_OUT_OF_MEMORY;
 
+  rc = pbkdf2_hmac_init (&hmac, md, P, Plen);
+  if (rc != GPG_ERR_NO_ERROR)
+    {
+      grub_free (tmp);
+      return rc;
+    }
+
+  sha = pbkdf2_sha_find (md);
+  if (sha && c > 1)
+    {
+      lanes = grub_malloc (sizeof (*lanes));
+      /* Without memory for the lanes the generic loop still works.  */
+      grub_errno = GRUB_ERR_NONE;
+    }
+  if (lanes)
+    {
+      nlanes = PBKDF2_SHA_LANES;
+      if (Plen > md->blocksize)
+	{
+	  grub_crypto_hash (md, key, P, Plen);
+	  P = key;
+	  Plen = md->mdlen;
+	}
+    }
+
   grub_memcpy (tmp, S, Slen);
 
-  for (i = 1; i - 1 < l; i++)
+  for (i = 1; i - 1 < l; i += n)
     {
-      grub_memset (T, 0, hLen);
+      n = l - (i - 1) < nlanes ? l - (i - 1) : nlanes;
 
-      for (u = 0; u < c; u++)
+      for (j = 0; j < n; j++)
 	{
-	  if (u == 0)
-	    {
-	      tmp[Slen + 0] = (i & 0xff000000) >> 24;
-	      tmp[Slen + 1] = (i & 0x00ff0000) >> 16;
-	      tmp[Slen + 2] = (i & 0x0000ff00) >> 8;
-	      tmp[Slen + 3] = (i & 0x000000ff) >> 0;
+	  tmp[Slen + 0] = ((i + j) & 0xff000000) >> 24;
+	  tmp[Slen + 1] = ((i + j) & 0x00ff0000) >> 16;
+	  tmp[Slen + 2] = ((i + j) & 0x0000ff00) >> 8;
+	  tmp[Slen + 3] = ((i + j) & 0x000000ff) >> 0;
 
-	      rc = grub_crypto_hmac_buffer (md, P, Plen, tmp, tmplen, U);
-	    }
-	  else
-	    rc = grub_crypto_hmac_buffer (md, P, Plen, U, hLen, U);
+	  pbkdf2_hmac (&hmac, tmp, tmplen, U + j * hLen);
+	}
+
+      if (lanes)
+	pbkdf2_sha_iterate (sha, lanes, P, Plen, U, T, n, c);
+      else
+	{
+	  grub_memcpy (T, U, hLen);
 
-	  if (rc != GPG_ERR_NO_ERROR)
+	  for (u = 1; u < c; u++)
 	    {
-	      grub_free (tmp);
-	      return rc;
+	      pbkdf2_hmac (&hmac, U, hLen, U);
+	      grub_crypto_xor (T, T, U, hLen);
 	    }
-
-	  for (k = 0; k < hLen; k++)
-	    T[k] ^= U[k];
 	}
 
-      grub_memcpy (DK + (i - 1) * hLen, T, i == l ? r : hLen);
+      for (j = 0; j < n; j++)
+	grub_memcpy (DK + (i - 1 + j) * hLen, T + j * hLen,
+		     i + j == l ? r : hLen);
     }
 
+  if (lanes)
+    {
+      grub_memset (lanes, 0, sizeof (*lanes));
+      grub_free (lanes);
+    }
+  pbkdf2_hmac_fini (&hmac);
+  grub_memset (Ubuf, 0, sizeof (Ubuf));
+  grub_memset (Tbuf, 0, sizeof (Tbuf));
+  grub_memset (key, 0, sizeof (key));
   grub_free (tmp);
 
   return GPG_ERR_NO_ERROR;
@@ -4,6 +4,7 @@
 #include <grub/misc.h>
 #include <grub/file.h>
 #include <grub/mm.h>
+#include <grub/time.h>
 
 struct newc_head
 {
@@ -28,6 +29,8 @@ struct grub_linux_initrd_component
   grub_file_t file;
   char *newc_name;
   grub_off_t size;
+  /* Where the file contents start in the assembled initrd.  */
+  grub_size_t data_offset;
 };
 
 struct dir
@@ -199,7 +202,8 @@ grub_initrd_init (int argc, char *argv[],
 	}
       initrd_ctx->components[i].file = grub_file_open (fname,
 						       GRUB_FILE_TYPE_LINUX_INITRD
-						       | GRUB_FILE_TYPE_NO_DECOMPRESS);
+						       | GRUB_FILE_TYPE_NO_DECOMPRESS
+						       | GRUB_FILE_TYPE_VERIFY_STREAM);
       if (!initrd_ctx->components[i].file)
 	{
 	  grub_initrd_close (initrd_ctx);
@@ -208,6 +212,7 @@ grub_initrd_init (int argc, char *argv[],
       initrd_ctx->nfiles++;
       initrd_ctx->components[i].size
 	= grub_file_size (initrd_ctx->components[i].file);
+      initrd_ctx->components[i].data_offset = initrd_ctx->size;
       initrd_ctx->size += initrd_ctx->components[i].size;
     }
 
@@ -244,6 +249,34 @@ grub_initrd_close (struct grub_linux_initrd_context *initrd_ctx)
   initrd_ctx->components = 0;
 }
 
+/* Read one component straight into its place in the target buffer.  The
+   files are opened with GRUB_FILE_TYPE_NO_DECOMPRESS, so this is a single
+   read that the filesystem turns into as few disk requests as it can; no
+   intermediate buffer is involved.  */
+static grub_err_t
+load_component (struct grub_linux_initrd_component *comp, const char *name,
+		grub_uint8_t *ptr)
+{
+  grub_uint64_t start, elapsed;
+
+  start = grub_get_time_ms ();
+  if (grub_file_read (comp->file, ptr, comp->size) != (grub_ssize_t) comp->size)
+    {
+      if (!grub_errno)
+	grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
+		    name);
+      return grub_errno;
+    }
+  elapsed = grub_get_time_ms () - start;
+
+  grub_dprintf ("linux", "initrd component %s: %" PRIuGRUB_UINT64_T
+		" bytes in %" PRIuGRUB_UINT64_T " ms (%" PRIuGRUB_UINT64_T
+		" KiB/s)\n", name, (grub_uint64_t) comp->size, elapsed,
+		elapsed ? grub_divmod64 (comp->size, elapsed, 0) * 1000 / 1024
+		: 0);
+  return GRUB_ERR_NONE;
+}
+
 grub_err_t
 grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 		  char *argv[], void *target)
@@ -253,9 +286,12 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
   int newc = 0;
   struct dir *root = 0;
   grub_ssize_t cursize = 0;
+  grub_uint64_t start = grub_get_time_ms ();
 
   for (i = 0; i < initrd_ctx->nfiles; i++)
     {
+      /* Only the few bytes of alignment padding need clearing; the
+	 component itself is overwritten by the read below.  */
       grub_memset (ptr, 0, ALIGN_UP_OVERHEAD (cursize, 4));
       ptr += ALIGN_UP_OVERHEAD (cursize, 4);
 
@@ -278,13 +314,20 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
 	  newc = 0;
 	}
 
+      /* The layout was computed by grub_initrd_init and the caller sized
+	 the target from it.  Never write past it.  */
+      if ((grub_size_t) (ptr - (grub_uint8_t *) target)
+	  != initrd_ctx->components[i].data_offset)
+	{
+	  free_dir (root);
+	  grub_initrd_close (initrd_ctx);
+	  return grub_error (GRUB_ERR_BUG, "initrd layout mismatch");
+	}
+
       cursize = initrd_ctx->components[i].size;
-      if (grub_file_read (initrd_ctx->components[i].file, ptr, cursize)
-	  != cursize)
+      if (load_component (&initrd_ctx->components[i], argv[i], ptr))
 	{
-	  if (!grub_errno)
-	    grub_error (GRUB_ERR_FILE_READ_ERROR, N_("premature end of file %s"),
-			argv[i]);
+	  free_dir (root);
 	  grub_initrd_close (initrd_ctx);
 	  return grub_errno;
 	}
@@ -298,5 +341,9 @@ grub_initrd_load (struct grub_linux_initrd_context *initrd_ctx,
     }
   free_dir (root);
   root = 0;
+
+  grub_dprintf ("linux", "initrd: %" PRIuGRUB_SIZE " bytes in %"
+		PRIuGRUB_UINT64_T " ms\n", initrd_ctx->size,
+		grub_get_time_ms () - start);
   return GRUB_ERR_NONE;
 }
@@ -21,6 +21,7 @@
 #include <grub/net/tcp.h>
 #include <grub/net/netbuff.h>
 #include <grub/time.h>
+#include <grub/env.h>
 #include <grub/priority_queue.h>
 
 #define TCP_SYN_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
@@ -28,6 +29,17 @@
 #define TCP_RETRANSMISSION_TIMEOUT GRUB_NET_INTERVAL
 #define TCP_RETRANSMISSION_COUNT GRUB_NET_TRIES
 
+/* Receive window, can be overridden with the net_tcp_window variable.
+   Windows above 64KiB are advertised with RFC 7323 window scaling.  */
+#define TCP_DEFAULT_WINDOW (4 << 20)
+#define TCP_MIN_WINDOW 8192
+#define TCP_MAX_WINDOW (1 << 30)
+#define TCP_MAX_WSCALE 14
+
+/* Without timestamps four SACK blocks fit into the option space.  */
+#define TCP_MAX_SACK_BLOCKS 4
+#define TCP_MAX_OPTIONS_SIZE 40
+
 struct unacked
 {
   struct unacked *next;
@@ -35,6 +47,8 @@ struct unacked
   struct grub_net_buff *nb;
   grub_uint64_t last_try;
   int try_count;
+  /* The peer reported this segment as received out of order.  */
+  int sacked;
 };
 
 enum
@@ -47,6 +61,31 @@ enum
     TCP_URG = 0x20,
   };
 
+enum
+  {
+    TCP_OPT_END = 0,
+    TCP_OPT_NOP = 1,
+    TCP_OPT_MSS = 2,
+    TCP_OPT_WSCALE = 3,
+    TCP_OPT_SACK_PERMITTED = 4,
+    TCP_OPT_SACK = 5,
+  };
+
+struct tcp_sack_block
+{
+  grub_uint32_t start;
+  grub_uint32_t end;
+};
+
+struct tcp_options
+{
+  /* -1 if the option wasn't present.  */
+  int wscale;
+  int sack_permitted;
+  int sack_count;
+  struct tcp_sack_block sack[TCP_MAX_SACK_BLOCKS];
+};
+
 struct grub_net_tcp_socket
 {
   struct grub_net_tcp_socket *next;
@@ -65,7 +104,13 @@ struct grub_net_tcp_socket
   grub_uint32_t my_cur_seq;
   grub_uint32_t their_start_seq;
   grub_uint32_t their_cur_seq;
-  grub_uint16_t my_window;
+  /* Receive window in bytes and the shift applied when advertising it.  */
+  grub_uint32_t my_window;
+  int my_wscale;
+  /* SACK was negotiated; out-of-order data we hold, most recent first.  */
+  int sack_ok;
+  int sack_count;
+  struct tcp_sack_block sack[TCP_MAX_SACK_BLOCKS];
   struct unacked *unack_first;
   struct unacked *unack_last;
   grub_err_t (*recv_hook) (grub_net_tcp_socket_t sock, struct grub_net_buff *nb,
@@ -130,6 +175,219 @@ static struct grub_net_tcp_listen *tcp_listens;
 #define FOR_TCP_SOCKETS(var) FOR_LIST_ELEMENTS (var, tcp_sockets)
 #define FOR_TCP_LISTENS(var) FOR_LIST_ELEMENTS (var, tcp_listens)
 
+/* Sequence number comparison modulo 2^32.  */
+static inline int
+seq_lt (grub_uint32_t a, grub_uint32_t b)
+{
+  return (grub_int32_t) (a - b) < 0;
+}
+
+static void
+init_window (grub_net_tcp_socket_t sock)
+{
+  const char *val;
+  unsigned long window = TCP_DEFAULT_WINDOW;
+
+  val = grub_env_get ("net_tcp_window");
+  if (val)
+    {
+      window = grub_strtoul (val, 0, 0);
+      if (grub_errno)
+	{
+	  grub_errno = GRUB_ERR_NONE;
+	  window = TCP_DEFAULT_WINDOW;
+	}
+    }
+  if (window < TCP_MIN_WINDOW)
+    window = TCP_MIN_WINDOW;
+  if (window > TCP_MAX_WINDOW)
+    window = TCP_MAX_WINDOW;
+
+  sock->my_window = window;
+  sock->my_wscale = 0;
+  while ((sock->my_window >> sock->my_wscale) > 0xffff
+	 && sock->my_wscale < TCP_MAX_WSCALE)
+    sock->my_wscale++;
+}
+
+/* Window field for a non-SYN segment, in network byte order.  */
+static grub_uint16_t
+window_field (grub_net_tcp_socket_t sock)
+{
+  grub_uint32_t window;
+
+  if (sock->i_stall)
+    return 0;
+  window = sock->my_window >> sock->my_wscale;
+  if (window > 0xffff)
+    window = 0xffff;
+  return grub_cpu_to_be16 (window);
+}
+
+/* Window field of SYN segments, which is never scaled.  */
+static grub_uint16_t
+syn_window_field (grub_net_tcp_socket_t sock)
+{
+  return grub_cpu_to_be16 (sock->my_window > 0xffff ? 0xffff
+			   : sock->my_window);
+}
+
+/* Write the options of our SYN to OPT and return their size.  When
+   replying to a SYN only the options the peer offered are included.  */
+static grub_size_t
+put_syn_options (grub_net_tcp_socket_t sock, grub_uint8_t *opt, int reply)
+{
+  grub_size_t mss, len = 0;
+
+  if (sock->out_nla.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV4)
+    mss = (sock->inf->card->mtu - GRUB_NET_OUR_IPV4_HEADER_SIZE
+	   - GRUB_NET_TCP_HEADER_SIZE);
+  else
+    mss = (sock->inf->card->mtu - GRUB_NET_OUR_IPV6_HEADER_SIZE
+	   - GRUB_NET_TCP_HEADER_SIZE);
+  if (mss > 0xffff)
+    mss = 0xffff;
+
+  opt[len++] = TCP_OPT_MSS;
+  opt[len++] = 4;
+  opt[len++] = mss >> 8;
+  opt[len++] = mss & 0xff;
+
+  if (!reply || sock->my_wscale)
+    {
+      opt[len++] = TCP_OPT_NOP;
+      opt[len++] = TCP_OPT_WSCALE;
+      opt[len++] = 3;
+      opt[len++] = sock->my_wscale;
+    }
+
+  if (!reply || sock->sack_ok)
+    {
+      opt[len++] = TCP_OPT_NOP;
+      opt[len++] = TCP_OPT_NOP;
+      opt[len++] = TCP_OPT_SACK_PERMITTED;
+      opt[len++] = 2;
+    }
+
+  return len;
+}
+
+static void
+parse_options (const struct tcphdr *tcph, struct tcp_options *opts)
+{
+  const grub_uint8_t *ptr = (const grub_uint8_t *) (tcph + 1);
+  const grub_uint8_t *end = (const grub_uint8_t *) tcph
+    + (grub_be_to_cpu16 (tcph->flags) >> 12) * 4;
+
+  opts->wscale = -1;
+  opts->sack_permitted = 0;
+  opts->sack_count = 0;
+
+  while (ptr < end)
+    {
+      grub_uint8_t len;
+
+      if (*ptr == TCP_OPT_END)
+	break;
+      if (*ptr == TCP_OPT_NOP)
+	{
+	  ptr++;
+	  continue;
+	}
+      if (end - ptr < 2)
+	break;
+      len = ptr[1];
+      if (len < 2 || len > end - ptr)
+	break;
+
+      switch (ptr[0])
+	{
+	case TCP_OPT_WSCALE:
+	  if (len == 3)
+	    opts->wscale = ptr[2] > TCP_MAX_WSCALE ? TCP_MAX_WSCALE : ptr[2];
+	  break;
+	case TCP_OPT_SACK_PERMITTED:
+	  if (len == 2)
+	    opts->sack_permitted = 1;
+	  break;
+	case TCP_OPT_SACK:
+	  {
+	    const grub_uint8_t *blk;
+	    for (blk = ptr + 2; blk + 8 <= ptr + len
+		   && opts->sack_count < TCP_MAX_SACK_BLOCKS; blk += 8)
+	      {
+		opts->sack[opts->sack_count].start
+		  = grub_get_unaligned32 (blk);
+		opts->sack[opts->sack_count].end
+		  = grub_get_unaligned32 (blk + 4);
+		opts->sack[opts->sack_count].start
+		  = grub_be_to_cpu32 (opts->sack[opts->sack_count].start);
+		opts->sack[opts->sack_count].end
+		  = grub_be_to_cpu32 (opts->sack[opts->sack_count].end);
+		opts->sack_count++;
+	      }
+	    break;
+	  }
+	}
+      ptr += len;
+    }
+}
+
+/* Remember that [START, END) was received out of order.  Blocks that
+   overlap or touch it are merged and the result is reported first, as
+   RFC 2018 asks.  */
+static void
+sack_add (grub_net_tcp_socket_t sock, grub_uint32_t start, grub_uint32_t end)
+{
+  int i;
+
+  for (i = 0; i < sock->sack_count; )
+    {
+      if (!seq_lt (end, sock->sack[i].start)
+	  && !seq_lt (sock->sack[i].end, start))
+	{
+	  if (seq_lt (sock->sack[i].start, start))
+	    start = sock->sack[i].start;
+	  if (seq_lt (end, sock->sack[i].end))
+	    end = sock->sack[i].end;
+	  grub_memmove (&sock->sack[i], &sock->sack[i + 1],
+			(sock->sack_count - i - 1) * sizeof (sock->sack[0]));
+	  sock->sack_count--;
+	  continue;
+	}
+      i++;
+    }
+
+  if (sock->sack_count == TCP_MAX_SACK_BLOCKS)
+    sock->sack_count--;
+  grub_memmove (&sock->sack[1], &sock->sack[0],
+		sock->sack_count * sizeof (sock->sack[0]));
+  sock->sack[0].start = start;
+  sock->sack[0].end = end;
+  sock->sack_count++;
+}
+
+/* Drop the blocks that the cumulative ACK now covers.  */
+static void
+sack_trim (grub_net_tcp_socket_t sock)
+{
+  int i;
+
+  for (i = 0; i < sock->sack_count; )
+    {
+      if (!seq_lt (sock->their_cur_seq, sock->sack[i].end))
+	{
+	  grub_memmove (&sock->sack[i], &sock->sack[i + 1],
+			(sock->sack_count - i - 1) * sizeof (sock->sack[0]));
+	  sock->sack_count--;
+	  continue;
+	}
+      if (seq_lt (sock->sack[i].start, sock->their_cur_seq))
+	sock->sack[i].start = sock->their_cur_seq;
+      i++;
+    }
+}
+
 grub_net_tcp_listen_t
 grub_net_tcp_listen (grub_uint16_t port,
 		     const struct grub_net_network_level_interface *inf,
@@ -301,7 +559,8 @@ ack_real (grub_net_tcp_socket_t sock, int res)
   struct tcphdr *tcph_ack;
   grub_err_t err;
 
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + 128);
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph_ack) + TCP_MAX_OPTIONS_SIZE
+				+ 128);
   if (!nb_ack)
     return;
   err = grub_netbuff_reserve (nb_ack, 128);
@@ -332,8 +591,37 @@ ack_real (grub_net_tcp_socket_t sock, int res)
     {
       tcph_ack->ack = grub_cpu_to_be32 (sock->their_cur_seq);
       tcph_ack->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph_ack->window = !sock->i_stall ? grub_cpu_to_be16 (sock->my_window)
-	: 0;
+      tcph_ack->window = window_field (sock);
+
+      /* Tell the peer which out-of-order data we already have.  */
+      if (sock->sack_ok && sock->sack_count)
+	{
+	  grub_uint8_t *opt;
+	  int i;
+
+	  err = grub_netbuff_put (nb_ack, 4 + 8 * sock->sack_count);
+	  if (err)
+	    {
+	      grub_netbuff_free (nb_ack);
+	      grub_errno = GRUB_ERR_NONE;
+	      return;
+	    }
+	  tcph_ack = (void *) nb_ack->data;
+	  opt = (grub_uint8_t *) (tcph_ack + 1);
+	  opt[0] = TCP_OPT_NOP;
+	  opt[1] = TCP_OPT_NOP;
+	  opt[2] = TCP_OPT_SACK;
+	  opt[3] = 2 + 8 * sock->sack_count;
+	  for (i = 0; i < sock->sack_count; i++)
+	    {
+	      grub_set_unaligned32 (opt + 4 + 8 * i,
+				    grub_cpu_to_be32 (sock->sack[i].start));
+	      grub_set_unaligned32 (opt + 8 + 8 * i,
+				    grub_cpu_to_be32 (sock->sack[i].end));
+	    }
+	  tcph_ack->flags = grub_cpu_to_be16 (((6 + 2 * sock->sack_count) << 12)
+					      | TCP_ACK);
+	}
     }
   tcph_ack->urgent = 0;
   tcph_ack->src = grub_cpu_to_be16 (sock->in_port);
@@ -368,6 +656,25 @@ grub_net_tcp_retransmit (void)
   FOR_TCP_SOCKETS (sock)
   {
     struct unacked *unack;
+
+    for (unack = sock->unack_first; unack; unack = unack->next)
+      if (unack->last_try <= limit_time)
+	break;
+    if (!unack)
+      continue;
+
+    /* The timer fired: the peer may have discarded what it selectively
+       acknowledged (RFC 2018 section 8), so forget it.  Expired segments
+       that were reported get one more timeout before being resent, in
+       which the ACK for the retransmitted hole normally covers them.  */
+    for (unack = sock->unack_first; unack; unack = unack->next)
+      if (unack->sacked)
+	{
+	  unack->sacked = 0;
+	  if (unack->last_try <= limit_time)
+	    unack->last_try = ctime;
+	}
+
     for (unack = sock->unack_first; unack; unack = unack->next)
       {
 	struct tcphdr *tcph;
@@ -455,7 +762,6 @@ grub_net_ip_transport_checksum (struct grub_net_buff *nb,
   return grub_cpu_to_be16 (~c);
 }
 
-/* FIXME: overflow. */
 static int
 cmp (const void *a__, const void *b__)
 {
@@ -464,9 +770,9 @@ cmp (const void *a__, const void *b__)
   struct tcphdr *a = (struct tcphdr *) a_->data;
   struct tcphdr *b = (struct tcphdr *) b_->data;
   /* We want the first elements to be on top.  */
-  if (grub_be_to_cpu32 (a->seqnr) < grub_be_to_cpu32 (b->seqnr))
+  if (seq_lt (grub_be_to_cpu32 (a->seqnr), grub_be_to_cpu32 (b->seqnr)))
     return +1;
-  if (grub_be_to_cpu32 (a->seqnr) > grub_be_to_cpu32 (b->seqnr))
+  if (seq_lt (grub_be_to_cpu32 (b->seqnr), grub_be_to_cpu32 (a->seqnr)))
     return -1;
   return 0;
 }
@@ -500,6 +806,7 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
   grub_err_t err;
   grub_net_network_level_address_t gateway;
   struct grub_net_network_level_interface *inf;
+  grub_size_t optlen;
 
   sock->recv_hook = recv_hook;
   sock->error_hook = error_hook;
@@ -514,7 +821,7 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
   if (err)
     return err;
 
-  nb_ack = grub_netbuff_alloc (sizeof (*tcph)
+  nb_ack = grub_netbuff_alloc (sizeof (*tcph) + TCP_MAX_OPTIONS_SIZE
 			       + GRUB_NET_OUR_MAX_IP_HEADER_SIZE
 			       + GRUB_NET_MAX_LINK_HEADER_SIZE);
   if (!nb_ack)
@@ -527,16 +834,19 @@ grub_net_tcp_accept (grub_net_tcp_socket_t sock,
       return err;
     }
 
-  err = grub_netbuff_put (nb_ack, sizeof (*tcph));
+  err = grub_netbuff_put (nb_ack, sizeof (*tcph) + TCP_MAX_OPTIONS_SIZE);
   if (err)
     {
       grub_netbuff_free (nb_ack);
       return err;
     }
   tcph = (void *) nb_ack->data;
+  optlen = put_syn_options (sock, (grub_uint8_t *) (tcph + 1), 1);
+  grub_netbuff_unput (nb_ack, TCP_MAX_OPTIONS_SIZE - optlen);
   tcph->ack = grub_cpu_to_be32 (sock->their_cur_seq);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN | TCP_ACK);
-  tcph->window = grub_cpu_to_be16 (sock->my_window);
+  tcph->flags = grub_cpu_to_be16 (((5 + optlen / 4) << 12)
+				  | TCP_SYN | TCP_ACK);
+  tcph->window = syn_window_field (sock);
   tcph->urgent = 0;
   sock->established = 1;
   tcp_socket_register (sock);
@@ -570,6 +880,7 @@ grub_net_tcp_open (char *server,
   int i;
   grub_uint8_t *nbd;
   grub_net_link_level_address_t ll_target_addr;
+  grub_size_t optlen;
 
   err = grub_net_resolve_address (server, &addr);
   if (err)
@@ -604,7 +915,7 @@ grub_net_tcp_open (char *server,
   socket->fin_hook = fin_hook;
   socket->hook_data = hook_data;
 
-  nb = grub_netbuff_alloc (sizeof (*tcph) + 128);
+  nb = grub_netbuff_alloc (sizeof (*tcph) + TCP_MAX_OPTIONS_SIZE + 128);
   if (!nb)
     {
       grub_free (socket);
@@ -619,7 +930,7 @@ grub_net_tcp_open (char *server,
       return NULL;
     }
 
-  err = grub_netbuff_put (nb, sizeof (*tcph));
+  err = grub_netbuff_put (nb, sizeof (*tcph) + TCP_MAX_OPTIONS_SIZE);
   if (err)
     {
       grub_free (socket);
@@ -637,11 +948,13 @@ grub_net_tcp_open (char *server,
   tcph = (void *) nb->data;
   socket->my_start_seq = grub_get_time_ms ();
   socket->my_cur_seq = socket->my_start_seq + 1;
-  socket->my_window = 8192;
+  init_window (socket);
+  optlen = put_syn_options (socket, (grub_uint8_t *) (tcph + 1), 0);
+  grub_netbuff_unput (nb, TCP_MAX_OPTIONS_SIZE - optlen);
   tcph->seqnr = grub_cpu_to_be32 (socket->my_start_seq);
   tcph->ack = grub_cpu_to_be32_compile_time (0);
-  tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_SYN);
-  tcph->window = grub_cpu_to_be16 (socket->my_window);
+  tcph->flags = grub_cpu_to_be16 (((5 + optlen / 4) << 12) | TCP_SYN);
+  tcph->window = syn_window_field (socket);
   tcph->urgent = 0;
   tcph->src = grub_cpu_to_be16 (socket->in_port);
   tcph->dst = grub_cpu_to_be16 (socket->out_port);
@@ -727,8 +1040,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
       tcph = (struct tcphdr *) nb2->data;
       tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
       tcph->flags = grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK);
-      tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window)
-	: 0;
+      tcph->window = window_field (socket);
       tcph->urgent = 0;
       err = grub_netbuff_put (nb2, fraglen);
       if (err)
@@ -751,7 +1063,7 @@ grub_net_send_tcp_packet (const grub_net_tcp_socket_t socket,
   tcph->ack = grub_cpu_to_be32 (socket->their_cur_seq);
   tcph->flags = (grub_cpu_to_be16_compile_time ((5 << 12) | TCP_ACK)
 		 | (push ? grub_cpu_to_be16_compile_time (TCP_PUSH) : 0));
-  tcph->window = !socket->i_stall ? grub_cpu_to_be16 (socket->my_window) : 0;
+  tcph->window = window_field (socket);
   tcph->urgent = 0;
   return tcp_send (nb, socket);
 }
@@ -764,6 +1076,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
   struct tcphdr *tcph;
   grub_net_tcp_socket_t sock;
   grub_err_t err;
+  struct tcp_options opts;
 
   /* Ignore broadcast.  */
   if (!inf)
@@ -816,6 +1129,8 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	tcph->checksum = chk;
       }
 
+    parse_options (tcph, &opts);
+
     if ((grub_be_to_cpu16 (tcph->flags) & TCP_SYN)
 	&& (grub_be_to_cpu16 (tcph->flags) & TCP_ACK)
 	&& !sock->established)
@@ -823,6 +1138,10 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->established = 1;
+	/* Scaling is only in effect if both sides asked for it.  */
+	if (opts.wscale < 0)
+	  sock->my_wscale = 0;
+	sock->sack_ok = opts.sack_permitted;
       }
 
     if (grub_be_to_cpu16 (tcph->flags) & TCP_RST)
@@ -853,7 +1172,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	    if (grub_be_to_cpu16 (unack_tcph->flags) & TCP_FIN)
 	      seqnr++;
 
-	    if (seqnr > acked)
+	    if (seq_lt (acked, seqnr))
 	      break;
 	    grub_netbuff_free (unack->nb);
 	    grub_free (unack);
@@ -861,9 +1180,25 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->unack_first = unack;
 	if (!sock->unack_first)
 	  sock->unack_last = NULL;
+
+	/* Segments the peer holds out of order needn't be resent.  */
+	for (; unack && opts.sack_count; unack = unack->next)
+	  {
+	    struct tcphdr *unack_tcph = (struct tcphdr *) unack->nb->data;
+	    grub_uint32_t start, end;
+	    int i;
+
+	    start = grub_be_to_cpu32 (unack_tcph->seqnr);
+	    end = start + (unack->nb->tail - unack->nb->data
+			   - (grub_be_to_cpu16 (unack_tcph->flags) >> 12) * 4);
+	    for (i = 0; i < opts.sack_count; i++)
+	      if (!seq_lt (start, opts.sack[i].start)
+		  && !seq_lt (opts.sack[i].end, end))
+		unack->sacked = 1;
+	  }
       }
 
-    if (grub_be_to_cpu32 (tcph->seqnr) < sock->their_cur_seq)
+    if (seq_lt (grub_be_to_cpu32 (tcph->seqnr), sock->their_cur_seq))
       {
 	ack (sock);
 	grub_netbuff_free (nb);
@@ -876,6 +1211,16 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	reset (sock);
       }
 
+    if (sock->sack_ok && seq_lt (sock->their_cur_seq,
+				 grub_be_to_cpu32 (tcph->seqnr)))
+      {
+	grub_size_t len = (nb->tail - nb->data
+			   - (grub_be_to_cpu16 (tcph->flags) >> 12) * 4);
+	if (len)
+	  sack_add (sock, grub_be_to_cpu32 (tcph->seqnr),
+		    grub_be_to_cpu32 (tcph->seqnr) + len);
+      }
+
     err = grub_priority_queue_push (sock->pq, &nb);
     if (err)
       {
@@ -894,7 +1239,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	    return GRUB_ERR_NONE;
 	  nb_top = *nb_top_p;
 	  tcph = (struct tcphdr *) nb_top->data;
-	  if (grub_be_to_cpu32 (tcph->seqnr) >= sock->their_cur_seq)
+	  if (!seq_lt (grub_be_to_cpu32 (tcph->seqnr), sock->their_cur_seq))
 	    break;
 	  grub_netbuff_free (nb_top);
 	  grub_priority_queue_pop (sock->pq);
@@ -941,6 +1286,7 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	  else
 	    grub_netbuff_free (nb_top);
 	}
+      sack_trim (sock);
       if (do_ack)
 	ack (sock);
       while (sock->packs.first)
@@ -979,7 +1325,11 @@ grub_net_recv_tcp_packet (struct grub_net_buff *nb,
 	sock->their_start_seq = grub_be_to_cpu32 (tcph->seqnr);
 	sock->their_cur_seq = sock->their_start_seq + 1;
 	sock->my_cur_seq = sock->my_start_seq = grub_get_time_ms ();
-	sock->my_window = 8192;
+	init_window (sock);
+	parse_options (tcph, &opts);
+	if (opts.wscale < 0)
+	  sock->my_wscale = 0;
+	sock->sack_ok = opts.sack_permitted;
 
 	sock->pq = grub_priority_queue_new (sizeof (struct grub_net_buff *),
 					    cmp);
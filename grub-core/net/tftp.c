@@ -25,6 +25,9 @@
 #include <grub/mm.h>
 #include <grub/dl.h>
 #include <grub/file.h>
+#include <grub/env.h>
+#include <grub/time.h>
+#include <grub/command.h>
 #include <grub/priority_queue.h>
 #include <grub/i18n.h>
 
@@ -42,6 +45,11 @@ enum
 enum
   {
     TFTP_DEFAULTSIZE_PACKET = 512,
+    /* RFC 2348.  */
+    TFTP_MAX_BLKSIZE = 65464,
+    /* RFC 7440, overridable with net_tftp_windowsize.  */
+    TFTP_DEFAULT_WINDOWSIZE = 16,
+    TFTP_MAX_WINDOWSIZE = 64,
   };
 
 enum
@@ -102,13 +110,30 @@ typedef struct tftp_data
   grub_uint64_t file_size;
   grub_uint64_t block;
   grub_uint32_t block_size;
+  grub_uint32_t window_size;
   grub_uint64_t ack_sent;
+  /* An ACK was held back because the reader is stalled.  */
+  int ack_pending;
+  /* Last block we re-acknowledged because of a gap or a duplicate.  */
+  grub_uint64_t resync_ack;
+  grub_uint64_t received;
+  grub_uint64_t start_time;
   int have_oack;
   struct grub_error_saved save_err;
   grub_net_udp_socket_t sock;
   grub_priority_queue_t pq;
 } *tftp_data_t;
 
+/* Statistics of the last transfer, shown by net_tftp_stats.  */
+static struct
+{
+  grub_uint64_t bytes;
+  grub_uint64_t time_ms;
+  grub_uint32_t block_size;
+  grub_uint32_t window_size;
+  int valid;
+} last_transfer;
+
 static int
 cmp_block (grub_uint16_t a, grub_uint16_t b)
 {
@@ -156,9 +181,40 @@ ack (tftp_data_t data, grub_uint64_t block)
   if (err)
     return err;
   data->ack_sent = block;
+  data->ack_pending = 0;
   return GRUB_ERR_NONE;
 }
 
+/* Tell the server that everything up to the current block arrived so
+   that it restarts the window after it.  Sent once per block, and not at
+   all if the current block was already acknowledged, to avoid provoking
+   a retransmission storm.  Held back like any other ACK while the reader
+   is stalled.  */
+static grub_err_t
+resync (grub_file_t file, tftp_data_t data)
+{
+  if (data->ack_sent == data->block || data->resync_ack == data->block)
+    return GRUB_ERR_NONE;
+  data->resync_ack = data->block;
+  if (file->device->net->packs.count >= 50)
+    {
+      file->device->net->stall = 1;
+      data->ack_pending = 1;
+      return GRUB_ERR_NONE;
+    }
+  return ack (data, data->block);
+}
+
+static void
+transfer_done (tftp_data_t data)
+{
+  last_transfer.bytes = data->received;
+  last_transfer.time_ms = grub_get_time_ms () - data->start_time;
+  last_transfer.block_size = data->block_size;
+  last_transfer.window_size = data->window_size;
+  last_transfer.valid = 1;
+}
+
 static grub_err_t
 tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	      struct grub_net_buff *nb,
@@ -181,7 +237,8 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
     {
     case TFTP_OACK:
       data->block_size = TFTP_DEFAULTSIZE_PACKET;
-      data->have_oack = 1; 
+      data->window_size = 1;
+      data->have_oack = 1;
       for (ptr = nb->data + sizeof (tftph->opcode); ptr < nb->tail;)
 	{
 	  if (grub_memcmp (ptr, "tsize\0", sizeof ("tsize\0") - 1) == 0)
@@ -190,10 +247,16 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  if (grub_memcmp (ptr, "blksize\0", sizeof ("blksize\0") - 1) == 0)
 	    data->block_size = grub_strtoul ((char *) ptr + sizeof ("blksize\0")
 					     - 1, 0, 0);
+	  if (grub_memcmp (ptr, "windowsize\0", sizeof ("windowsize\0") - 1) == 0)
+	    data->window_size = grub_strtoul ((char *) ptr
+					      + sizeof ("windowsize\0") - 1,
+					      0, 0);
 	  while (ptr < nb->tail && *ptr)
 	    ptr++;
 	  ptr++;
 	}
+      if (data->window_size == 0 || data->window_size > TFTP_MAX_WINDOWSIZE)
+	data->window_size = 1;
       data->block = 0;
       grub_netbuff_free (nb);
       err = ack (data, 0);
@@ -207,6 +270,9 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	  return GRUB_ERR_NONE;
 	}
 
+      /* The server ignored our options.  */
+      data->have_oack = 1;
+
       err = grub_priority_queue_push (data->pq, &nb);
       if (err)
 	return err;
@@ -222,26 +288,20 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	    tftph = (struct tftphdr *) nb_top->data;
 	    if (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) >= 0)
 	      break;
-	    ack (data, grub_be_to_cpu16 (tftph->u.data.block));
+	    /* A duplicate, the server missed our last ACK.  */
+	    resync (file, data);
 	    grub_netbuff_free (nb_top);
 	    grub_priority_queue_pop (data->pq);
 	  }
+	/* A block of the window was lost, ask for the rest again.  */
+	if (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) > 0)
+	  resync (file, data);
 	while (cmp_block (grub_be_to_cpu16 (tftph->u.data.block), data->block + 1) == 0)
 	  {
 	    unsigned size;
 
 	    grub_priority_queue_pop (data->pq);
 
-	    if (file->device->net->packs.count < 50)
-	      err = ack (data, data->block + 1);
-	    else
-	      {
-		file->device->net->stall = 1;
-		err = 0;
-	      }
-	    if (err)
-	      return err;
-
 	    err = grub_netbuff_pull (nb_top, sizeof (tftph->opcode) +
 				     sizeof (tftph->u.data.block));
 	    if (err)
@@ -249,10 +309,28 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	    size = nb_top->tail - nb_top->data;
 
 	    data->block++;
+	    data->received += size < data->block_size ? size : data->block_size;
+
+	    /* Acknowledge the last block of every window.  */
+	    if (data->block - data->ack_sent >= data->window_size)
+	      {
+		if (file->device->net->packs.count < 50)
+		  err = ack (data, data->block);
+		else
+		  {
+		    file->device->net->stall = 1;
+		    data->ack_pending = 1;
+		    err = 0;
+		  }
+		if (err)
+		  return err;
+	      }
+
 	    if (size < data->block_size)
 	      {
 		if (data->ack_sent < data->block)
 		  ack (data, data->block);
+		transfer_done (data);
 		file->device->net->eof = 1;
 		file->device->net->stall = 1;
 		grub_net_udp_close (data->sock);
@@ -272,6 +350,14 @@ tftp_receive (grub_net_udp_socket_t sock __attribute__ ((unused)),
 	      grub_net_put_packet (&file->device->net->packs, nb_top);
 	    else
 	      grub_netbuff_free (nb_top);
+
+	    if (file->device->net->eof)
+	      break;
+	    nb_top_p = grub_priority_queue_top (data->pq);
+	    if (!nb_top_p)
+	      break;
+	    nb_top = *nb_top_p;
+	    tftph = (struct tftphdr *) nb_top->data;
 	  }
       }
       return GRUB_ERR_NONE;
@@ -300,6 +386,66 @@ destroy_pq (tftp_data_t data)
   grub_priority_queue_destroy (data->pq);
 }
 
+/* Append the NUL-terminated string STR to the request at *RRQ.  */
+static void
+put_string (char **rrq, int *rrqlen, const char *str)
+{
+  grub_strcpy (*rrq, str);
+  *rrqlen += grub_strlen (str) + 1;
+  *rrq += grub_strlen (str) + 1;
+}
+
+/* The largest block that fits into one frame of the interface used to
+   reach ADDR, so that large blocks don't get fragmented.  */
+static grub_uint32_t
+probe_blksize (grub_net_network_level_address_t addr)
+{
+  struct grub_net_network_level_interface *inf;
+  grub_net_network_level_address_t gateway;
+  grub_uint32_t blksize;
+
+  if (grub_net_route_address (addr, &gateway, &inf) != GRUB_ERR_NONE
+      || !inf->card->mtu)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return 1024;
+    }
+
+  blksize = inf->card->mtu - sizeof (struct udphdr) - 4;
+  if (addr.type == GRUB_NET_NETWORK_LEVEL_PROTOCOL_IPV6)
+    blksize -= GRUB_NET_OUR_IPV6_HEADER_SIZE;
+  else
+    blksize -= GRUB_NET_OUR_IPV4_HEADER_SIZE;
+
+  if (blksize < TFTP_DEFAULTSIZE_PACKET)
+    blksize = TFTP_DEFAULTSIZE_PACKET;
+  if (blksize > TFTP_MAX_BLKSIZE)
+    blksize = TFTP_MAX_BLKSIZE;
+  return blksize;
+}
+
+static grub_uint32_t
+requested_windowsize (void)
+{
+  const char *val;
+  unsigned long windowsize;
+
+  val = grub_env_get ("net_tftp_windowsize");
+  if (!val)
+    return TFTP_DEFAULT_WINDOWSIZE;
+  windowsize = grub_strtoul (val, 0, 0);
+  if (grub_errno)
+    {
+      grub_errno = GRUB_ERR_NONE;
+      return TFTP_DEFAULT_WINDOWSIZE;
+    }
+  if (windowsize < 1)
+    windowsize = 1;
+  if (windowsize > TFTP_MAX_WINDOWSIZE)
+    windowsize = TFTP_MAX_WINDOWSIZE;
+  return windowsize;
+}
+
 static grub_err_t
 tftp_open (struct grub_file *file, const char *filename)
 {
@@ -314,11 +460,24 @@ tftp_open (struct grub_file *file, const char *filename)
   grub_err_t err;
   grub_uint8_t *nbd;
   grub_net_network_level_address_t addr;
+  char blksize[sizeof ("65535")];
+  char windowsize[sizeof ("65535")];
+
+  /* Leave room for the mode and the options.  */
+  if (grub_strlen (filename) > sizeof (tftph->u.rrq) - 64)
+    return grub_error (GRUB_ERR_BAD_FILENAME, N_("filename is too long"));
+
+  err = grub_net_resolve_address (file->device->net->server, &addr);
+  if (err)
+    return err;
 
   data = grub_zalloc (sizeof (*data));
   if (!data)
     return grub_errno;
 
+  data->block_size = TFTP_DEFAULTSIZE_PACKET;
+  data->window_size = 1;
+
   nb.head = open_data;
   nb.end = open_data + sizeof (open_data);
   grub_netbuff_clear (&nb);
@@ -336,30 +495,19 @@ tftp_open (struct grub_file *file, const char *filename)
   rrq = (char *) tftph->u.rrq;
   rrqlen = 0;
 
-  tftph->opcode = grub_cpu_to_be16_compile_time (TFTP_RRQ);
-  grub_strcpy (rrq, filename);
-  rrqlen += grub_strlen (filename) + 1;
-  rrq += grub_strlen (filename) + 1;
-
-  grub_strcpy (rrq, "octet");
-  rrqlen += grub_strlen ("octet") + 1;
-  rrq += grub_strlen ("octet") + 1;
-
-  grub_strcpy (rrq, "blksize");
-  rrqlen += grub_strlen ("blksize") + 1;
-  rrq += grub_strlen ("blksize") + 1;
+  grub_snprintf (blksize, sizeof (blksize), "%u", probe_blksize (addr));
+  grub_snprintf (windowsize, sizeof (windowsize), "%u",
+		 requested_windowsize ());
 
-  grub_strcpy (rrq, "1024");
-  rrqlen += grub_strlen ("1024") + 1;
-  rrq += grub_strlen ("1024") + 1;
-
-  grub_strcpy (rrq, "tsize");
-  rrqlen += grub_strlen ("tsize") + 1;
-  rrq += grub_strlen ("tsize") + 1;
-
-  grub_strcpy (rrq, "0");
-  rrqlen += grub_strlen ("0") + 1;
-  rrq += grub_strlen ("0") + 1;
+  tftph->opcode = grub_cpu_to_be16_compile_time (TFTP_RRQ);
+  put_string (&rrq, &rrqlen, filename);
+  put_string (&rrq, &rrqlen, "octet");
+  put_string (&rrq, &rrqlen, "blksize");
+  put_string (&rrq, &rrqlen, blksize);
+  put_string (&rrq, &rrqlen, "tsize");
+  put_string (&rrq, &rrqlen, "0");
+  put_string (&rrq, &rrqlen, "windowsize");
+  put_string (&rrq, &rrqlen, windowsize);
   hdrlen = sizeof (tftph->opcode) + rrqlen;
 
   err = grub_netbuff_unput (&nb, nb.tail - (nb.data + hdrlen));
@@ -379,14 +527,7 @@ tftp_open (struct grub_file *file, const char *filename)
       return grub_errno;
     }
 
-  err = grub_net_resolve_address (file->device->net->server, &addr);
-  if (err)
-    {
-      destroy_pq (data);
-      grub_free (data);
-      return err;
-    }
-
+  data->start_time = grub_get_time_ms ();
   data->sock = grub_net_udp_open (addr,
 				  TFTP_SERVER_PORT, tftp_receive,
 				  file);
@@ -480,7 +621,7 @@ tftp_packets_pulled (struct grub_file *file)
 
   if (!file->device->net->eof)
     file->device->net->stall = 0;
-  if (data->ack_sent >= data->block)
+  if (!data->ack_pending)
     return 0;
   return ack (data, data->block);
 }
@@ -493,12 +634,43 @@ static struct grub_net_app_protocol grub_tftp_protocol =
     .packets_pulled = tftp_packets_pulled
   };
 
+static grub_err_t
+grub_cmd_tftp_stats (struct grub_command *cmd __attribute__ ((unused)),
+		     int argc __attribute__ ((unused)),
+		     char **args __attribute__ ((unused)))
+{
+  grub_uint64_t rate;
+
+  if (!last_transfer.valid)
+    {
+      grub_printf ("%s\n", _("No TFTP transfer completed yet"));
+      return GRUB_ERR_NONE;
+    }
+
+  rate = grub_divmod64 (last_transfer.bytes * 1000,
+			last_transfer.time_ms ? last_transfer.time_ms : 1, 0) >> 10;
+  grub_printf_ (N_("Last TFTP transfer: %llu bytes in %llu ms (%llu KiB/s),"
+		   " blksize %u, windowsize %u\n"),
+		(unsigned long long) last_transfer.bytes,
+		(unsigned long long) last_transfer.time_ms,
+		(unsigned long long) rate,
+		last_transfer.block_size, last_transfer.window_size);
+  return GRUB_ERR_NONE;
+}
+
+static grub_command_t cmd_stats;
+
 GRUB_MOD_INIT (tftp)
 {
   grub_net_app_level_register (&grub_tftp_protocol);
+  cmd_stats = grub_register_command ("net_tftp_stats", grub_cmd_tftp_stats,
+				     "",
+				     N_("Show statistics of the last TFTP"
+					" transfer."));
 }
 
 GRUB_MOD_FINI (tftp)
 {
+  grub_unregister_command (cmd_stats);
   grub_net_app_level_unregister (&grub_tftp_protocol);
 }
@@ -25,6 +25,7 @@ GRUB_MOD_LICENSE ("GPLv3+");
 
 static struct
 {
+  const gcry_md_spec_t *md;
   const char *P;
   grub_size_t Plen;
   const char *S;
@@ -35,6 +36,7 @@ static struct
 } vectors[] = {
   /* RFC6070. */
   {
+    GRUB_MD_SHA1,
     "password", 8,
     "salt", 4,
     1, 20,
@@ -42,6 +44,7 @@ static struct
     "\x06\x2f\xe0\x37\xa6"
   },
   {
+    GRUB_MD_SHA1,
     "password", 8,
     "salt", 4,
     2, 20,
@@ -50,6 +53,7 @@ static struct
     "\xd8\xde\x89\x57"
   },
   {
+    GRUB_MD_SHA1,
     "password", 8,
     "salt", 4,
     4096, 20,
@@ -57,6 +61,7 @@ static struct
     "\x21\xd0\x65\xa4\x29\xc1"
   },
   {
+    GRUB_MD_SHA1,
     "passwordPASSWORDpassword", 24,
     "saltSALTsaltSALTsaltSALTsaltSALTsalt", 36,
     4096, 25,
@@ -64,10 +69,49 @@ static struct
     "\xe4\x4a\x8b\x29\x1a\x96\x4c\xf2\xf0\x70\x38"
   },
   {
+    GRUB_MD_SHA1,
     "pass\0word", 9,
     "sa\0lt", 5,
     4096, 16,
     "\x56\xfa\x6a\xa7\x55\x48\x09\x9d\xcc\x37\xd7\xf0\x34\x25\xe0\xc3"
+  },
+  /* More output blocks than are derived side by side.  */
+  {
+    GRUB_MD_SHA1,
+    "password", 8,
+    "salt", 4,
+    4096, 100,
+    "\x4b\x00\x79\x01\xb7\x65\x48\x9a\xbe\xad\x49\xd9\x26\xf7"
+    "\x21\xd0\x65\xa4\x29\xc1\x2e\x46\x3f\x6c\x4c\xd7\x94\x01"
+    "\x08\x5b\x03\xdb\xc7\xe8\xb8\x8f\x14\x47\xf8\xc3\x3c\x8e"
+    "\x08\x7a\x29\xa3\xbf\xcd\x89\x5e\xb6\xfb\xf3\x81\xdc\xd9"
+    "\x2c\xaf\x12\x19\x9a\x34\x03\x7f\xc7\x83\x40\x95\xdd\xfa"
+    "\xe0\xbc\xa2\x2a\x12\xc3\x5d\xdb\xb6\x72\xed\xad\x29\x63"
+    "\x4d\x66\xf8\xf9\xac\xcb\xf9\xb2\x67\xf9\x69\xa3\x4e\x7e"
+    "\xa3\x02"
+  },
+  /* RFC7914.  */
+  {
+    GRUB_MD_SHA256,
+    "passwd", 6,
+    "salt", 4,
+    1, 64,
+    "\x55\xac\x04\x6e\x56\xe3\x08\x9f\xec\x16\x91\xc2\x25\x44"
+    "\xb6\x05\xf9\x41\x85\x21\x6d\xde\x04\x65\xe6\x8b\x9d\x57"
+    "\xc2\x0d\xac\xbc\x49\xca\x9c\xcc\xf1\x79\xb6\x45\x99\x16"
+    "\x64\xb3\x9d\x77\xef\x31\x7c\x71\xb8\x45\xb1\xe3\x0b\xd5"
+    "\x09\x11\x20\x41\xd3\xa1\x97\x83"
+  },
+  {
+    GRUB_MD_SHA256,
+    "Password", 8,
+    "NaCl", 4,
+    80000, 64,
+    "\x4d\xdc\xd8\xf6\x0b\x98\xbe\x21\x83\x0c\xee\x5e\xf2\x27"
+    "\x01\xf9\x64\x1a\x44\x18\xd0\x4c\x04\x14\xae\xff\x08\x87"
+    "\x6b\x34\xab\x56\xa1\xd4\x25\xa1\x22\x58\x33\x54\x9a\xdb"
+    "\x84\x1b\x51\xc9\xb3\x17\x6a\x27\x2b\xde\xbb\xa1\xd0\x78"
+    "\x47\x8f\x62\xb3\x97\xf3\x3c\x8d"
   }
 };
 
@@ -79,8 +123,8 @@ pbkdf2_test (void)
   for (i = 0; i < ARRAY_SIZE (vectors); i++)
     {
       gcry_err_code_t err;
-      grub_uint8_t DK[32];
-      err = grub_crypto_pbkdf2 (GRUB_MD_SHA1,
+      grub_uint8_t DK[128];
+      err = grub_crypto_pbkdf2 (vectors[i].md,
 				(const grub_uint8_t *) vectors[i].P,
 				vectors[i].Plen,
 				(const grub_uint8_t *) vectors[i].S,
@@ -31,6 +31,7 @@
 #include "efi.h"
 #include "efipath.h"
 #include "efiboot.h"
+#include "wim.h"
 
 #if 0
 /** Original OpenProtocol() method */
@@ -86,6 +87,10 @@ efi_open_protocol_wrapper ( grub_efi_handle_t handle, grub_efi_guid_t *protocol,
 
 static void pause (void)
 {
+    printf ( "WIM chunk cache: %lu hits, %lu misses, %lu prefetched\n",
+             wim_cache_stats.hits, wim_cache_stats.misses,
+             wim_cache_stats.prefetches );
+
     /* Wait for keypress, prompting unless inhibited */
     printf ( "Press any key to continue booting..." );
     grub_getkey();
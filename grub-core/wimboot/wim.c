@@ -32,17 +32,45 @@
 #include "wimboot.h"
 #include "vdisk.h"
 #include "lzx.h"
+#include "xca.h"
 #include "wim.h"
 
+/** A cached decompressed WIM chunk */
+struct wim_cached_chunk {
+    /** Virtual file, or NULL if this entry is unused */
+    struct vdisk_file *file;
+    /** Offset of the resource within the file */
+    size_t resource_offset;
+    /** Chunk number */
+    unsigned int chunk;
+    /** Time of last use */
+    unsigned long last_use;
+    /** Decompressed data */
+    struct wim_chunk_buffer buf;
+};
+
 /**
- * WIM chunk buffer
+ * Fallback single-entry chunk cache
  *
- * We place this in the .stack section to avoid crossing the Forbidden
- * Threshold at 0x30000.  (See comments in script.lds.)
+ * Used if the configured cache cannot be allocated.  We place this in
+ * the .stack section to avoid crossing the Forbidden Threshold at
+ * 0x30000.  (See comments in script.lds.)
  */
-static struct wim_chunk_buffer wim_chunk_buffer
+static struct wim_cached_chunk wim_chunk_single
     __attribute__ (( section ( ".stack" ) ));
 
+/** Chunk cache entries */
+static struct wim_cached_chunk *wim_cache = &wim_chunk_single;
+
+/** Number of chunk cache entries */
+static unsigned int wim_cache_count = 1;
+
+/** Chunk cache LRU clock */
+static unsigned long wim_cache_clock;
+
+/** Chunk cache statistics */
+struct wim_cache_stats wim_cache_stats;
+
 /**
  * Get WIM header
  *
@@ -182,6 +210,12 @@ static int wim_chunk ( struct vdisk_file *file, struct wim_header *header,
         /* Identify decompressor */
         if ( header->flags & WIM_HDR_LZX ) {
             decompress = lzx_decompress;
+        } else if ( header->flags & WIM_HDR_XPRESS ) {
+            decompress = xca_decompress;
+        } else if ( header->flags & WIM_HDR_LZMS ) {
+            DBG ( "Can't handle LZMS compression for 0x%llx chunk %d\n",
+                  resource->offset, chunk );
+            return -1;
         } else {
             DBG ( "Can't handle unknown compression scheme 0x%08x "
                   "for 0x%llx chunk %d at [0x%llx+0x%llx)\n",
@@ -206,6 +240,141 @@ static int wim_chunk ( struct vdisk_file *file, struct wim_header *header,
     return 0;
 }
 
+/**
+ * Resize chunk cache
+ *
+ * @v count        Number of chunks to cache
+ *
+ * Any cached data is discarded.  If the cache cannot be allocated, a
+ * single chunk is cached.
+ */
+void wim_cache_resize ( unsigned int count ) {
+    struct wim_cached_chunk *cache = NULL;
+
+    if ( count > 1 )
+        cache = calloc ( count, sizeof ( *cache ) );
+    if ( wim_cache != &wim_chunk_single )
+        free ( wim_cache );
+    if ( cache ) {
+        wim_cache = cache;
+        wim_cache_count = count;
+    } else {
+        wim_cache = &wim_chunk_single;
+        wim_cache_count = 1;
+    }
+    memset ( &wim_chunk_single, 0, sizeof ( wim_chunk_single ) );
+    memset ( &wim_cache_stats, 0, sizeof ( wim_cache_stats ) );
+}
+
+/**
+ * Find chunk in cache
+ *
+ * @v file        Virtual file
+ * @v resource        Resource
+ * @v chunk        Chunk number
+ * @ret cached        Cached chunk, or NULL
+ */
+static struct wim_cached_chunk *
+wim_cache_find ( struct vdisk_file *file,
+         struct wim_resource_header *resource, unsigned int chunk ) {
+    struct wim_cached_chunk *cached;
+    unsigned int i;
+
+    for ( i = 0 ; i < wim_cache_count ; i++ ) {
+        cached = &wim_cache[i];
+        if ( ( cached->file == file ) &&
+             ( cached->resource_offset == resource->offset ) &&
+             ( cached->chunk == chunk ) )
+            return cached;
+    }
+    return NULL;
+}
+
+/**
+ * Decompress chunk into the least recently used cache entry
+ *
+ * @v file        Virtual file
+ * @v header        WIM header
+ * @v resource        Resource
+ * @v chunk        Chunk number
+ * @ret cached        Cached chunk, or NULL on error
+ */
+static struct wim_cached_chunk *
+wim_cache_fill ( struct vdisk_file *file, struct wim_header *header,
+         struct wim_resource_header *resource, unsigned int chunk ) {
+    struct wim_cached_chunk *cached = &wim_cache[0];
+    unsigned int i;
+
+    /* Pick an unused entry, or the least recently used one */
+    for ( i = 0 ; i < wim_cache_count ; i++ ) {
+        if ( ! wim_cache[i].file ) {
+            cached = &wim_cache[i];
+            break;
+        }
+        if ( wim_cache[i].last_use < cached->last_use )
+            cached = &wim_cache[i];
+    }
+
+    /* Decompress chunk */
+    cached->file = NULL;
+    if ( wim_chunk ( file, header, resource, chunk, &cached->buf ) != 0 )
+        return NULL;
+    cached->file = file;
+    cached->resource_offset = resource->offset;
+    cached->chunk = chunk;
+    cached->last_use = ++wim_cache_clock;
+    return cached;
+}
+
+/**
+ * Get decompressed chunk, using the cache
+ *
+ * @v file        Virtual file
+ * @v header        WIM header
+ * @v resource        Resource
+ * @v chunk        Chunk number
+ * @v cached        Cached chunk to fill in
+ * @ret rc        Return status code
+ *
+ * On a miss, the following chunk of the same resource is decompressed
+ * as well, since the boot loader reads most files sequentially.
+ */
+static int wim_cache_get ( struct vdisk_file *file, struct wim_header *header,
+               struct wim_resource_header *resource,
+               unsigned int chunk, struct wim_cached_chunk **cached ) {
+    struct wim_cached_chunk *next;
+    unsigned int chunks;
+
+    /* Use cached chunk, if available */
+    *cached = wim_cache_find ( file, resource, chunk );
+    if ( *cached ) {
+        (*cached)->last_use = ++wim_cache_clock;
+        wim_cache_stats.hits++;
+        return 0;
+    }
+
+    /* Decompress chunk */
+    wim_cache_stats.misses++;
+    *cached = wim_cache_fill ( file, header, resource, chunk );
+    if ( ! *cached )
+        return -1;
+
+    /* Prefetch next chunk.  The entry just filled is the most
+     * recently used, so it cannot be the victim.
+     */
+    chunks = ( ( resource->len + WIM_CHUNK_LEN - 1 ) / WIM_CHUNK_LEN );
+    if ( ( wim_cache_count > 1 ) && ( ( chunk + 1 ) < chunks ) &&
+         ( ! wim_cache_find ( file, resource, ( chunk + 1 ) ) ) ) {
+        next = wim_cache_fill ( file, header, resource, ( chunk + 1 ) );
+        if ( next ) {
+            /* Rank below the requested chunk */
+            next->last_use = ( (*cached)->last_use - 1 );
+            wim_cache_stats.prefetches++;
+        }
+    }
+    return 0;
+}
+
 /**
  * Read from a (possibly compressed) resource
  *
@@ -220,9 +389,7 @@ static int wim_chunk ( struct vdisk_file *file, struct wim_header *header,
 int wim_read ( struct vdisk_file *file, struct wim_header *header,
            struct wim_resource_header *resource, void *data,
            size_t offset, size_t len ) {
-    static struct vdisk_file *cached_file;
-    static size_t cached_resource_offset;
-    static unsigned int cached_chunk;
+    struct wim_cached_chunk *cached;
     size_t zlen = ( resource->zlen__flags & WIM_RESHDR_ZLEN_MASK );
     unsigned int chunk;
     size_t skip_len;
@@ -253,28 +420,17 @@ int wim_read ( struct vdisk_file *file, struct wim_header *header,
         /* Calculate chunk number */
         chunk = ( offset / WIM_CHUNK_LEN );
 
-        /* Read chunk, if not already cached */
-        if ( ( file != cached_file ) ||
-             ( resource->offset != cached_resource_offset ) ||
-             ( chunk != cached_chunk ) ) {
-
-            /* Read chunk */
-            if ( ( rc = wim_chunk ( file, header, resource, chunk,
-                        &wim_chunk_buffer ) ) != 0 )
-                return rc;
-
-            /* Update cache */
-            cached_file = file;
-            cached_resource_offset = resource->offset;
-            cached_chunk = chunk;
-        }
+        /* Get decompressed chunk */
+        if ( ( rc = wim_cache_get ( file, header, resource, chunk,
+                        &cached ) ) != 0 )
+            return rc;
 
         /* Copy fragment from this chunk */
         skip_len = ( offset % WIM_CHUNK_LEN );
         frag_len = ( WIM_CHUNK_LEN - skip_len );
         if ( frag_len > len )
             frag_len = len;
-        memcpy ( data, ( wim_chunk_buffer.data + skip_len ), frag_len );
+        memcpy ( data, ( cached->buf.data + skip_len ), frag_len );
 
         /* Move to next chunk */
         data = (char *) data + frag_len;
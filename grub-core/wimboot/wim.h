@@ -99,6 +99,8 @@ enum wim_header_flags {
     WIM_HDR_XPRESS = 0x00020000,
     /** WIM uses LZX compression */
     WIM_HDR_LZX = 0x00040000,
+    /** WIM uses LZMS compression */
+    WIM_HDR_LZMS = 0x00080000,
 };
 
 /** A WIM file hash */
@@ -128,6 +130,19 @@ struct wim_chunk_buffer {
     uint8_t data[WIM_CHUNK_LEN];
 };
 
+/** WIM chunk cache statistics */
+struct wim_cache_stats {
+    /** Chunks found in the cache */
+    unsigned long hits;
+    /** Chunks that had to be decompressed */
+    unsigned long misses;
+    /** Chunks decompressed ahead of use */
+    unsigned long prefetches;
+};
+
+/** Default number of cached WIM chunks */
+#define WIM_CACHE_DEFAULT_CHUNKS 64
+
 /** Security data */
 struct wim_security_header {
     /** Length */
@@ -175,6 +190,9 @@ struct wim_directory_entry {
 /** Windows complains if the time fields are left at zero */
 #define WIM_MAGIC_TIME 0x1a7b83d2ad93000ULL
 
+extern struct wim_cache_stats wim_cache_stats;
+
+extern void wim_cache_resize ( unsigned int count );
 extern int wim_header ( struct vdisk_file *file, struct wim_header *header );
 extern int wim_count ( struct vdisk_file *file, struct wim_header *header,
                unsigned int *count );
@@ -34,6 +34,8 @@
 #include "efifile.h"
 #include "efiblock.h"
 #include "efiboot.h"
+#include "vdisk.h"
+#include "wim.h"
 #include "stdio.h"
 
 GRUB_MOD_LICENSE ("GPLv3+");
@@ -55,6 +57,7 @@ static const struct grub_arg_option options_wimboot[] = {
   {"pause", 'p', 0, N_("Show info and wait for keypress."), 0, 0},
   {"inject", 'j', 0, N_("Set inject dir."), N_("PATH"), ARG_TYPE_STRING},
   {"mem", 'm', 0, N_("Copy files to RAM."), 0, 0},
+  {"cache", 'c', 0, N_("Cache n decompressed WIM chunks."), N_("n"), ARG_TYPE_INT},
   {0, 0, 0, 0, 0, 0}
 };
 
@@ -66,7 +69,8 @@ enum options_wimboot
   WIMBOOT_INDEX,
   WIMBOOT_PAUSE,
   WIMBOOT_INJECT,
-  WIMBOOT_MEM
+  WIMBOOT_MEM,
+  WIMBOOT_CACHE
 };
 
 /** Use raw (unpatched) BCD files */
@@ -295,6 +299,10 @@ grub_cmd_wimboot (grub_extcmd_context_t ctxt,
     cmdline_index = 0;
   if (state[WIMBOOT_INJECT].set)
     grub_strcpy (cmdline_inject_dir, state[WIMBOOT_INJECT].arg);
+  if (state[WIMBOOT_CACHE].set)
+    wim_cache_resize (grub_strtoul (state[WIMBOOT_CACHE].arg, NULL, 10));
+  else
+    wim_cache_resize (WIM_CACHE_DEFAULT_CHUNKS);
 
   wimboot_nfiles = wimboot_ctx.nfiles;
   DBG ( "Extract files\n" );
@@ -0,0 +1,232 @@
+/*
+ * Copyright (C) 2012 Michael Brown <mbrown@fensystems.co.uk>.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation; either version 2 of the
+ * License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+/**
+ * @file
+ *
+ * Xpress Compression Algorithm (MS-XCA) decompression
+ *
+ * This is the "LZ77+Huffman" variant described in section 2.2 of
+ * "[MS-XCA]: Xpress Compression Algorithm", as used for
+ * XPRESS-compressed WIM resources.
+ *
+ * The bit stream is consumed exactly as in the reference decoder: 32
+ * bits are always prefetched, and extended match lengths are read as
+ * whole bytes from the position following the prefetched bits.
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdio.h>
+#include "wimboot.h"
+#include "huffman.h"
+#include "xca.h"
+
+/** An XCA input stream */
+struct xca_input {
+    /** Data */
+    const uint8_t *data;
+    /** Length */
+    size_t len;
+    /** Offset within stream */
+    size_t offset;
+    /** Prefetched bits (MSB first) */
+    uint32_t next_bits;
+    /** Number of valid bits in next_bits beyond the first 16 */
+    int extra_bits;
+};
+
+/**
+ * Read little-endian word from XCA input stream
+ *
+ * @v in        Input stream
+ * @v value        Value to fill in
+ * @ret rc        Return status code
+ */
+static int xca_get16 ( struct xca_input *in, unsigned int *value ) {
+
+    if ( ( in->offset + 2 ) > in->len ) {
+        DBG ( "XCA input overrun at 0x%lx/0x%lx\n", in->offset, in->len );
+        return -1;
+    }
+    *value = ( in->data[ in->offset ] |
+           ( in->data[ in->offset + 1 ] << 8 ) );
+    in->offset += 2;
+    return 0;
+}
+
+/**
+ * Consume bits from XCA input stream
+ *
+ * @v in        Input stream
+ * @v bits        Number of bits to consume
+ * @ret rc        Return status code
+ */
+static int xca_consume ( struct xca_input *in, unsigned int bits ) {
+    unsigned int word;
+    int rc;
+
+    in->next_bits <<= bits;
+    in->extra_bits -= bits;
+    if ( in->extra_bits < 0 ) {
+        /* The final word of the stream may legitimately be
+         * prefetched without being present; treat it as zero.
+         */
+        if ( in->offset < in->len ) {
+            if ( ( rc = xca_get16 ( in, &word ) ) != 0 )
+                return rc;
+        } else {
+            word = 0;
+        }
+        in->next_bits |= ( word << ( - in->extra_bits ) );
+        in->extra_bits += 16;
+    }
+    return 0;
+}
+
+/**
+ * Decompress XCA-compressed data
+ *
+ * @v data        Compressed data
+ * @v len        Length of compressed data
+ * @v buf        Decompression buffer, or NULL
+ * @ret out_len        Length of decompressed data, or negative error
+ */
+ssize_t xca_decompress ( const void *data, size_t len, void *buf ) {
+    const struct xca_huf_len *lengths;
+    struct xca xca;
+    struct xca_input in;
+    struct huffman_symbols *sym;
+    uint8_t *out = buf;
+    size_t out_len = 0;
+    unsigned int huf;
+    unsigned int raw;
+    unsigned int match_len;
+    unsigned int match_offset_bits;
+    unsigned int match_offset;
+    unsigned int word;
+    unsigned int i;
+    int rc;
+
+    memset ( &in, 0, sizeof ( in ) );
+    in.data = data;
+    in.len = len;
+
+    /* Construct Huffman alphabet from the lengths table.  A WIM
+     * chunk is never larger than one XCA block, so there is exactly
+     * one table.
+     */
+    if ( ( in.offset + sizeof ( *lengths ) ) > in.len ) {
+        DBG ( "XCA input too short for Huffman lengths\n" );
+        return -1;
+    }
+    lengths = ( const void * ) ( in.data + in.offset );
+    in.offset += sizeof ( *lengths );
+    for ( i = 0 ; i < XCA_CODES ; i++ )
+        xca.lengths[i] = xca_huf_len ( lengths, i );
+    if ( ( rc = huffman_alphabet ( &xca.alphabet, xca.lengths,
+                       XCA_CODES ) ) != 0 )
+        return rc;
+
+    /* Prefetch 32 bits */
+    if ( ( rc = xca_get16 ( &in, &word ) ) != 0 )
+        return rc;
+    in.next_bits = ( word << 16 );
+    if ( ( rc = xca_get16 ( &in, &word ) ) != 0 )
+        return rc;
+    in.next_bits |= word;
+    in.extra_bits = 16;
+
+    /* Process symbols */
+    while ( out_len < XCA_BLOCK_SIZE ) {
+
+        /* Decode Huffman symbol */
+        huf = ( in.next_bits >> 16 );
+        sym = huffman_sym ( &xca.alphabet, huf );
+        raw = huffman_raw ( sym, huf );
+        if ( ( rc = xca_consume ( &in, huffman_len ( sym ) ) ) != 0 )
+            return rc;
+
+        /* Literals are copied directly */
+        if ( raw < XCA_END_MARKER ) {
+            if ( out )
+                out[out_len] = raw;
+            out_len++;
+            continue;
+        }
+
+        /* The end marker terminates the stream once all input has
+         * been consumed; elsewhere it is an ordinary match symbol.
+         */
+        if ( ( raw == XCA_END_MARKER ) && ( ( in.offset + 1 ) >= in.len ) )
+            return out_len;
+
+        /* Decode match length */
+        raw -= XCA_END_MARKER;
+        match_len = ( raw & 0x0f );
+        match_offset_bits = ( raw >> 4 );
+        if ( match_len == 0x0f ) {
+            if ( in.offset >= in.len ) {
+                DBG ( "XCA input overrun in match length\n" );
+                return -1;
+            }
+            match_len = in.data[ in.offset++ ];
+            if ( match_len == 0xff ) {
+                if ( ( rc = xca_get16 ( &in, &match_len ) ) != 0 )
+                    return rc;
+                if ( match_len < 0x0f ) {
+                    DBG ( "XCA invalid match length %#x\n", match_len );
+                    return -1;
+                }
+                match_len -= 0x0f;
+            }
+            match_len += 0x0f;
+        }
+        match_len += XCA_MIN_MATCH;
+
+        /* Decode match offset */
+        match_offset = ( 1 << match_offset_bits );
+        if ( match_offset_bits ) {
+            match_offset |= ( in.next_bits >> ( 32 - match_offset_bits ) );
+            if ( ( rc = xca_consume ( &in, match_offset_bits ) ) != 0 )
+                return rc;
+        }
+        if ( match_offset > out_len ) {
+            DBG ( "XCA match offset %#x out of range at %#lx\n",
+                  match_offset, out_len );
+            return -1;
+        }
+        if ( ( out_len + match_len ) > XCA_BLOCK_SIZE ) {
+            DBG ( "XCA match overruns block at %#lx\n", out_len );
+            return -1;
+        }
+
+        /* Copy match, byte by byte since it may overlap */
+        if ( out ) {
+            for ( i = 0 ; i < match_len ; i++ )
+                out[ out_len + i ] = out[ out_len + i - match_offset ];
+        }
+        out_len += match_len;
+    }
+
+    DBG ( "XCA missing end marker\n" );
+    return -1;
+}
@@ -85,6 +85,8 @@ enum grub_ata_commands
     GRUB_ATA_CMD_READ_SECTORS_EXT	= 0x24,
     GRUB_ATA_CMD_READ_SECTORS_DMA	= 0xc8,
     GRUB_ATA_CMD_READ_SECTORS_DMA_EXT	= 0x25,
+    GRUB_ATA_CMD_READ_FPDMA_QUEUED	= 0x60,
+    GRUB_ATA_CMD_WRITE_FPDMA_QUEUED	= 0x61,
 
     GRUB_ATA_CMD_SECURITY_FREEZE_LOCK	= 0xf5,
     GRUB_ATA_CMD_SET_FEATURES		= 0xef,
@@ -184,6 +186,12 @@ struct grub_ata
 
   grub_size_t maxbuffer;
 
+  /* Number of commands the driver can have outstanding at once through
+     readwrite_queued, and whether it can use NCQ for them.  NCQ is
+     cleared again if the device doesn't support it.  */
+  unsigned queue_depth;
+  int ncq;
+
   int *present;
 
   void *data;
@@ -213,6 +221,12 @@ struct grub_ata_dev
 			   struct grub_disk_ata_pass_through_parms *parms,
 			   int spinup);
 
+  /* Optional.  Issue the COUNT DMA commands in PARMS at the same time
+     and wait for all of them.  COUNT is at most ATA->queue_depth.  */
+  grub_err_t (*readwrite_queued) (struct grub_ata *ata,
+				  struct grub_disk_ata_pass_through_parms *parms,
+				  unsigned count);
+
   /* The next scsi device.  */
   struct grub_ata_dev *next;
 };
@@ -75,6 +75,9 @@ struct grub_command
 
   /* Arbitrary data.  */
   void *data;
+
+  /* The next command in the same name hash bucket.  */
+  struct grub_command *hash_next;
 };
 typedef struct grub_command *grub_command_t;
 
@@ -87,6 +90,7 @@ EXPORT_FUNC(grub_register_command_prio) (const char *name,
 					 const char *description,
 					 int prio);
 void EXPORT_FUNC(grub_unregister_command) (grub_command_t cmd);
+grub_command_t EXPORT_FUNC(grub_command_find) (const char *name);
 
 static inline grub_command_t
 grub_register_command (const char *name,
@@ -106,12 +110,6 @@ grub_register_command_p1 (const char *name,
   return grub_register_command_prio (name, func, summary, description, 1);
 }
 
-static inline grub_command_t
-grub_command_find (const char *name)
-{
-  return grub_named_list_find (GRUB_AS_NAMED_LIST (grub_command_list), name);
-}
-
 static inline grub_err_t
 grub_command_execute (const char *name, int argc, char **argv)
 {
@@ -60,6 +60,9 @@ typedef gcry_err_code_t
 (*grub_cryptodisk_rekey_func_t) (struct grub_cryptodisk *dev,
 				 grub_uint64_t zoneno);
 
+/* Expanded AES keys for the accelerated XTS/CBC path, if in use.  */
+struct grub_cryptodisk_aesni;
+
 struct grub_cryptodisk
 {
   struct grub_cryptodisk *next;
@@ -98,6 +101,7 @@ struct grub_cryptodisk
   grub_uint64_t last_rekey;
   int rekey_derived_size;
   grub_disk_addr_t partition_start;
+  struct grub_cryptodisk_aesni *aesni;
 };
 typedef struct grub_cryptodisk *grub_cryptodisk_t;
 
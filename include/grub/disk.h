@@ -50,6 +50,7 @@ enum grub_disk_dev_id
     GRUB_DISK_DEVICE_UBOOTDISK_ID,
     GRUB_DISK_DEVICE_XEN,
     GRUB_DISK_DEVICE_OBDISK_ID,
+    GRUB_DISK_DEVICE_NVME_ID,
   };
 
 struct grub_disk;
@@ -143,6 +144,13 @@ struct grub_disk
   /* Caller-specific data passed to the read hook.  */
   void *read_hook_data;
 
+  /* Read-ahead state: the sector following the last read, the sector up
+     to which data has been read ahead into the cache and the current
+     read-ahead window in units of GRUB_DISK_CACHE_SIZE.  */
+  grub_disk_addr_t ra_next;
+  grub_disk_addr_t ra_end;
+  unsigned int ra_window;
+
   /* Device-specific data.  */
   void *data;
 };
@@ -161,8 +169,18 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 #define GRUB_DISK_SECTOR_SIZE	0x200
 #define GRUB_DISK_SECTOR_BITS	9
 
-/* The maximum number of disk caches.  */
-#define GRUB_DISK_CACHE_NUM	1021
+/* The disk cache is set-associative: every cache unit maps to one set
+   and may occupy any of its GRUB_DISK_CACHE_WAYS entries.  A single disk
+   may hold at most GRUB_DISK_CACHE_QUOTA_WAYS entries of a full set, so
+   that a large sequential read can't flush the metadata of others.  */
+#define GRUB_DISK_CACHE_WAYS	8
+#define GRUB_DISK_CACHE_QUOTA_WAYS	6
+
+/* Bounds for the number of sets.  The actual number is derived from
+   the free heap when the cache is first used.  */
+#define GRUB_DISK_CACHE_MIN_SETS	16
+#define GRUB_DISK_CACHE_DEFAULT_SETS	128
+#define GRUB_DISK_CACHE_MAX_SETS	1024
 
 /* The size of a disk cache in 512B units. Must be at least as big as the
    largest supported sector size, currently 16K.  */
@@ -171,12 +189,19 @@ typedef struct grub_disk_memberlist *grub_disk_memberlist_t;
 
 #define GRUB_DISK_MAX_MAX_AGGLOMERATE ((1 << (30 - GRUB_DISK_CACHE_BITS - GRUB_DISK_SECTOR_BITS)) - 1)
 
+/* Upper bound of the read-ahead window in units of GRUB_DISK_CACHE_SIZE
+   (4MiB).  The window is further limited by max_agglomerate.  */
+#define GRUB_DISK_READAHEAD_MAX	128
+
 /* Return value of grub_disk_get_size() in case disk size is unknown. */
 #define GRUB_DISK_SIZE_UNKNOWN	 0xffffffffffffffffULL
 
 /* This is called from the memory manager.  */
 void grub_disk_cache_invalidate_all (void);
 
+/* Incremented by every grub_disk_write.  */
+extern unsigned long EXPORT_VAR(grub_disk_write_generation);
+
 void EXPORT_FUNC(grub_disk_dev_register) (grub_disk_dev_t dev);
 void EXPORT_FUNC(grub_disk_dev_unregister) (grub_disk_dev_t dev);
 static inline int
@@ -216,7 +241,13 @@ grub_uint64_t EXPORT_FUNC(grub_disk_get_size) (grub_disk_t disk);
 
 #if DISK_CACHE_STATS
 void
-EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits, unsigned long *misses);
+EXPORT_FUNC(grub_disk_cache_get_performance) (unsigned long *hits,
+					      unsigned long *misses,
+					      unsigned long *evictions);
+void
+EXPORT_FUNC(grub_disk_readahead_get_performance) (unsigned long *requests,
+						  unsigned long *units,
+						  unsigned long *hits);
 #endif
 
 extern void (* EXPORT_VAR(grub_disk_firmware_fini)) (void);
@@ -242,9 +273,16 @@ struct grub_disk_cache
   grub_disk_addr_t sector;
   char *data;
   int lock;
+  /* Value of the access clock when this entry was last used.  */
+  grub_uint64_t last_use;
+  /* Set if the entry was read ahead and hasn't been used yet.  */
+  int readahead;
 };
 
-extern struct grub_disk_cache EXPORT_VAR(grub_disk_cache_table)[GRUB_DISK_CACHE_NUM];
+/* grub_disk_cache_sets * GRUB_DISK_CACHE_WAYS entries, or NULL if the
+   cache hasn't been set up yet.  */
+extern struct grub_disk_cache *EXPORT_VAR(grub_disk_cache_table);
+extern unsigned EXPORT_VAR(grub_disk_cache_sets);
 
 #if defined (GRUB_UTIL)
 void grub_lvm_init (void);
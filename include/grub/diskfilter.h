@@ -193,6 +193,9 @@ typedef grub_err_t (* raid_recover_read_t)(void *data, int disk_nr,
 					   grub_uint64_t addr, void *dest,
 					   grub_size_t size);
 
+/* Set to make RAID6 recovery skip the SSSE3 code, for testing.  */
+extern int grub_raid6_accel_disabled;
+
 extern grub_err_t
 grub_raid6_recover_gen (void *data, grub_uint64_t nstripes, int disknr, int p,
 			    char *buf, grub_uint64_t sector, grub_size_t size,
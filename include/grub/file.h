@@ -132,7 +132,10 @@ enum grub_file_type
 
     /* --skip-sig is specified.  */
     GRUB_FILE_TYPE_SKIP_SIGNATURE = 0x10000,
-    GRUB_FILE_TYPE_NO_DECOMPRESS = 0x20000
+    GRUB_FILE_TYPE_NO_DECOMPRESS = 0x20000,
+    /* The file is read in order and any read error is fatal, so verifiers
+       may check it as it is read instead of buffering it first.  */
+    GRUB_FILE_TYPE_VERIFY_STREAM = 0x40000
   };
 
 /* File description.  */
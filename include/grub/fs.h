@@ -83,6 +83,17 @@ struct grub_fs
   /* Get writing time of filesystem. */
   grub_err_t (*fs_mtime) (grub_device_t device, grub_int32_t *timebuf);
 
+  /* Map the sector-aligned byte OFFSET of FILE to the sector *SECTOR of
+     FILE->device->disk and return in *LEN how many bytes follow it
+     contiguously on disk.  Fail for data that is not stored verbatim
+     (holes, inline or compressed data); callers fall back to fs_read.  */
+  grub_err_t (*fs_map) (struct grub_file *file, grub_off_t offset,
+			grub_disk_addr_t *sector, grub_off_t *len);
+
+  /* Free the mount data MOUNT.  Filesystems that set this opt in to the
+     mount cache, see grub_fs_mount_cache_get.  */
+  void (*fs_unmount) (void *mount);
+
 #ifdef GRUB_UTIL
   /* Determine sectors available for embedding.  */
   grub_err_t (*fs_embed) (grub_device_t device, unsigned int *nsectors,
@@ -118,9 +129,24 @@ grub_fs_register (grub_fs_t fs)
 }
 #endif
 
+/* Mount cache.  A filesystem done with the mount data of DISK hands it
+   to grub_fs_mount_cache_put instead of freeing it, and the next mount of
+   the same partition takes it back with grub_fs_mount_cache_get, which
+   returns NULL if there is none.  Only the partition identity is checked:
+   the driver must rebind any grub_disk_t it keeps to DISK.  Entries are
+   dropped after any disk write and by grub_disk_cache_invalidate_all.  */
+void *EXPORT_FUNC(grub_fs_mount_cache_get) (grub_fs_t fs,
+					    struct grub_disk *disk);
+void EXPORT_FUNC(grub_fs_mount_cache_put) (grub_fs_t fs,
+					   struct grub_disk *disk,
+					   void *mount);
+void EXPORT_FUNC(grub_fs_mount_cache_flush) (grub_fs_t fs);
+void grub_fs_mount_cache_invalidate_all (void);
+
 static inline void
 grub_fs_unregister (grub_fs_t fs)
 {
+  grub_fs_mount_cache_flush (fs);
   grub_list_remove (GRUB_AS_LIST (fs));
 }
 
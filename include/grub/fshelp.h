@@ -73,6 +73,31 @@ EXPORT_FUNC(grub_fshelp_find_file_lookup) (const char *path,
 					   char *(*read_symlink) (grub_fshelp_node_t node),
 					   enum grub_fshelp_filetype expect);
 
+/* Per-mount cache of path lookups, including failed ones.  Node layouts
+   are private to each filesystem, so DUP_NODE must return a malloc'ed
+   copy of NODE that grub_free releases.  Filesystems whose nodes are
+   flat structures pass a NULL DUP_NODE and the NODE_SIZE to copy.  */
+struct grub_fshelp_dcache;
+
+struct grub_fshelp_dcache *
+EXPORT_FUNC(grub_fshelp_dcache_new) (grub_fshelp_node_t (*dup_node) (grub_fshelp_node_t node),
+				     grub_size_t node_size);
+void
+EXPORT_FUNC(grub_fshelp_dcache_free) (struct grub_fshelp_dcache *dcache);
+
+/* Same as grub_fshelp_find_file, but resolve path components through
+   DCACHE first and remember the results there.  DCACHE may be NULL.  */
+grub_err_t
+EXPORT_FUNC(grub_fshelp_find_file_cached) (const char *path,
+					   grub_fshelp_node_t rootnode,
+					   grub_fshelp_node_t *foundnode,
+					   int (*iterate_dir) (grub_fshelp_node_t dir,
+							       grub_fshelp_iterate_dir_hook_t hook,
+							       void *hook_data),
+					   char *(*read_symlink) (grub_fshelp_node_t node),
+					   enum grub_fshelp_filetype expect,
+					   struct grub_fshelp_dcache *dcache);
+
 /* Read LEN bytes from the file NODE on disk DISK into the buffer BUF,
    beginning with the block POS.  READ_HOOK should be set before
    reading a block from the file.  GET_BLOCK is used to translate file
@@ -88,4 +113,22 @@ EXPORT_FUNC(grub_fshelp_read_file) (grub_disk_t disk, grub_fshelp_node_t node,
 				    grub_off_t filesize, int log2blocksize,
 				    grub_disk_addr_t blocks_start);
 
+/* Same as grub_fshelp_read_file, but GET_EXTENT returns the disk block
+   of file block BLOCK together with the number of blocks that follow
+   it contiguously on disk in *RUN (a disk block of 0 is a hole).
+   Physically contiguous blocks are read with a single disk request.  */
+grub_ssize_t
+EXPORT_FUNC(grub_fshelp_read_file_extent) (grub_disk_t disk,
+					   grub_fshelp_node_t node,
+					   grub_disk_read_hook_t read_hook,
+					   void *read_hook_data,
+					   grub_off_t pos, grub_size_t len,
+					   char *buf,
+					   grub_disk_addr_t (*get_extent) (grub_fshelp_node_t node,
+									   grub_disk_addr_t block,
+									   grub_disk_addr_t *run),
+					   grub_off_t filesize,
+					   int log2blocksize,
+					   grub_disk_addr_t blocks_start);
+
 #endif /* ! GRUB_FSHELP_HEADER */
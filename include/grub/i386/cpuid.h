@@ -70,16 +70,65 @@ grub_cpu_is_cpuid_supported (void)
 
 #endif
 
-#ifdef __PIC__
+#if defined (__PIC__) && !defined (__x86_64__)
 #define grub_cpuid(num,a,b,c,d) \
   asm volatile ("xchgl %%ebx, %1; cpuid; xchgl %%ebx, %1" \
                 : "=a" (a), "=r" (b), "=c" (c), "=d" (d)  \
                 : "0" (num))
+#define grub_cpuid_count(num,sub,a,b,c,d) \
+  asm volatile ("xchgl %%ebx, %1; cpuid; xchgl %%ebx, %1" \
+                : "=a" (a), "=r" (b), "=c" (c), "=d" (d)  \
+                : "0" (num), "2" (sub))
 #else
 #define grub_cpuid(num,a,b,c,d) \
   asm volatile ("cpuid" \
                 : "=a" (a), "=b" (b), "=c" (c), "=d" (d)  \
                 : "0" (num))
+#define grub_cpuid_count(num,sub,a,b,c,d) \
+  asm volatile ("cpuid" \
+                : "=a" (a), "=b" (b), "=c" (c), "=d" (d)  \
+                : "0" (num), "2" (sub))
+#endif
+
+/* Where the compiler may use %xmm0-%xmm5 itself (host tools), asm using
+   them has to say so.  With -mno-sse it refuses such clobbers.  */
+#ifdef __SSE__
+#define GRUB_CPU_SSE_CLOBBERS "xmm0", "xmm1", "xmm2", "xmm3", "xmm4", "xmm5",
+#else
+#define GRUB_CPU_SSE_CLOBBERS
+#endif
+
+/* Whether SSE2 instructions can be used: the CPU has them and whoever ran
+   before us enabled them.  UEFI firmware does; BIOS typically doesn't and
+   we leave it alone.  Modules are built with -mno-sse, so code using
+   %xmm registers has to keep that state inside its own asm statements.  */
+static __inline int
+grub_cpu_sse2_usable (void)
+{
+  grub_uint32_t eax, ebx, ecx, edx;
+
+  if (!grub_cpu_is_cpuid_supported ())
+    return 0;
+  grub_cpuid (0, eax, ebx, ecx, edx);
+  if (eax < 1)
+    return 0;
+  grub_cpuid (1, eax, ebx, ecx, edx);
+  if (!(edx & (1 << 26)))
+    return 0;
+
+#if !defined (GRUB_UTIL) && !defined (GRUB_MACHINE_EMU)
+  {
+    unsigned long cr0, cr4;
+
+    asm volatile ("mov %%cr0, %0" : "=r" (cr0));
+    asm volatile ("mov %%cr4, %0" : "=r" (cr4));
+    /* CR0.EM or CR0.TS set, or CR4.OSFXSR clear, make SSE fault.  */
+    if ((cr0 & ((1 << 2) | (1 << 3))) || !(cr4 & (1 << 9)))
+      return 0;
+  }
 #endif
 
+  return 1;
+}
+
 #endif
@@ -21,5 +21,7 @@
 #define GRUB_CRC_H	1
 
 grub_uint32_t grub_getcrc32c (grub_uint32_t crc, const void *buf, int size);
+/* Name of the implementation grub_getcrc32c runs on this machine.  */
+const char *grub_getcrc32c_impl (void);
 
 #endif /* ! GRUB_CRC_H */
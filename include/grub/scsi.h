@@ -103,6 +103,10 @@ struct grub_scsi
   /* Size of one block.  */
   grub_uint32_t blocksize;
 
+  /* Largest transfer in bytes the transport handles reliably, 0 for
+     the conservative default.  */
+  grub_size_t max_transfer;
+
   /* Device-specific data.  */
   void *data;
 };
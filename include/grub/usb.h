@@ -47,7 +47,8 @@ typedef enum
     GRUB_USB_SPEED_NONE,
     GRUB_USB_SPEED_LOW,
     GRUB_USB_SPEED_FULL,
-    GRUB_USB_SPEED_HIGH
+    GRUB_USB_SPEED_HIGH,
+    GRUB_USB_SPEED_SUPER
   } grub_usb_speed_t;
 
 typedef int (*grub_usb_iterate_hook_t) (grub_usb_device_t dev, void *data);
@@ -121,6 +122,15 @@ struct grub_usb_controller_dev
 
   grub_usb_speed_t (*detect_dev) (grub_usb_controller_t dev, int port, int *changed);
 
+  /* Optional.  Called before a new device is first talked to.  Host
+     controllers which assign device addresses themselves (xHCI) do so
+     here, and no SET_ADDRESS request is sent to the device.  */
+  grub_usb_err_t (*attach_dev) (grub_usb_controller_t dev,
+				grub_usb_device_t usbdev);
+
+  /* Optional.  Release what attach_dev set up.  */
+  void (*detach_dev) (grub_usb_controller_t dev, grub_usb_device_t usbdev);
+
   /* Per controller flag - port reset pending, don't do another reset */
   grub_uint64_t pending_reset;
 
@@ -228,6 +238,19 @@ struct grub_usb_device
   int split_hubport;
 
   int split_hubaddr;
+
+  /* The hub this device is connected to, NULL for the root hub.  */
+  grub_usb_device_t hub;
+
+  /* Port number on that hub (1-based, also for the root hub).  */
+  int port;
+
+  /* MaxBurst from the SuperSpeed endpoint companion descriptors of
+     configuration 0, indexed by grub_usb_ep_index.  */
+  grub_uint8_t maxburst[32];
+
+  /* Data used by the USB Host Controller Driver for this device.  */
+  void *hc_data;
 };
 
 
@@ -246,6 +269,14 @@ grub_usb_get_ep_type (struct grub_usb_desc_endp *ep)
   return ep->attrib & 3;
 }
 
+/* Map an endpoint address to a 0..31 index: endpoint number and
+   direction.  */
+static inline int
+grub_usb_ep_index (int endp_addr)
+{
+  return ((endp_addr & 0xf) << 1) | !!(endp_addr & 0x80);
+}
+
 typedef enum
   {
     GRUB_USB_CLASS_NOTHERE,
@@ -148,6 +148,10 @@ extern grub_err_t (*grub_zfs_decrypt) (grub_crypto_cipher_handle_t cipher,
 
 struct grub_zfs_key;
 
+/* Counters of the metadata block cache shared by all pools.  */
+void grub_zfs_cache_stats (grub_uint64_t *hits, grub_uint64_t *misses,
+			   grub_size_t *bytes);
+
 extern grub_crypto_cipher_handle_t (*grub_zfs_load_key) (const struct grub_zfs_key *key,
 							 grub_size_t keysize,
 							 grub_uint64_t salt,
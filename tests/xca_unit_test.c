@@ -0,0 +1,225 @@
+/*
+ *  GRUB  --  GRand Unified Bootloader
+ *  Copyright (C) 2026 Free Software Foundation, Inc.
+ *
+ *  GRUB is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  GRUB is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with GRUB.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <grub/test.h>
+#include <grub/misc.h>
+#include <grub/types.h>
+
+/* Size of the Huffman lengths table heading every stream.  */
+#define XCA_TABLE_SIZE 256
+#define XCA_BLOCK_SIZE 65536
+
+grub_ssize_t xca_decompress (const void *data, grub_size_t len, void *buf);
+
+/* The vectors below follow an all-9-bit lengths table (0x99 in every
+   byte), under which each symbol is coded as its own value.  */
+
+static const grub_uint8_t xca_literals[] =
+  {
+    0x19, 0x24, 0x86, 0x4d, 0x78, 0xc3, 0x40, 0xb0, 0x21, 0x58, 0x44, 0x90,
+    0x00, 0x30, 0x00, 0x00,
+  };
+
+static const grub_uint8_t xca_matches[] =
+  {
+    0x98, 0x30, 0x71, 0x8c, 0xb6, 0x68, 0x60, 0x67, 0x00, 0x30, 0x00, 0x00,
+  };
+
+static const grub_uint8_t xca_long_match[] =
+  {
+    0xc3, 0x30, 0x50, 0xcc, 0x00, 0x00, 0x52, 0x00, 0x00,
+  };
+
+static const grub_uint8_t xca_word_match[] =
+  {
+    0x1e, 0x3c, 0xe3, 0x63, 0x00, 0xd4, 0xff, 0xcc, 0x07, 0x00, 0x00,
+  };
+
+static const grub_uint8_t xca_bad_offset[] =
+  {
+    0xc0, 0x80, 0x00, 0x00, 0x00, 0x00,
+  };
+
+static const grub_uint8_t xca_overrun[] =
+  {
+    0xc3, 0x30, 0x00, 0xe0, 0x00, 0x00, 0xff, 0xfd, 0xff,
+  };
+
+static const grub_uint8_t xca_no_end[] =
+  {
+    0x98, 0x30, 0x60, 0x8c, 0x00, 0x00,
+  };
+
+/* A text with two matches under a lengths table of 3 to 12 bits.  */
+static const grub_uint8_t xca_huffman[] =
+  {
+    0xcc, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xb3, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0x6b, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0x6b, 0x66, 0x56, 0x66, 0x66, 0x66, 0x66, 0x46, 0x66, 0x65, 0x56, 0x66,
+    0x56, 0xb5, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xb5, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0x5b, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0x5b, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb, 0xbb,
+    0xbb, 0xbb, 0xbb, 0xbb, 0x33, 0xb6, 0xd1, 0x0a, 0xf3, 0x23, 0x8e, 0x07,
+    0xd2, 0x57, 0x2c, 0x21, 0xa8, 0x04, 0xab, 0xa2, 0x5c, 0x01, 0x86, 0x63,
+    0xee, 0x7c, 0x22, 0xa9, 0x89, 0x02, 0xd4, 0xc0, 0x00, 0xac, 0x16, 0x00,
+    0x00,
+  };
+
+static const char xca_huffman_text[] =
+  "the quick brown fox jumps over the quick lazy dog; "
+  "brown fox jumps over the quick lazy dog;";
+
+static grub_uint8_t input[XCA_TABLE_SIZE + 512];
+static grub_uint8_t output[XCA_BLOCK_SIZE];
+static grub_uint8_t expected[XCA_BLOCK_SIZE];
+
+static grub_size_t
+xca_flat_input (const grub_uint8_t *payload, grub_size_t len, int lengths)
+{
+  memset (input, lengths, XCA_TABLE_SIZE);
+  memcpy (input + XCA_TABLE_SIZE, payload, len);
+  return XCA_TABLE_SIZE + len;
+}
+
+static void
+xca_check (const char *name, grub_size_t len, grub_size_t expected_len)
+{
+  grub_ssize_t ret;
+  grub_size_t i;
+
+  memset (output, 0, sizeof (output));
+  ret = xca_decompress (input, len, output);
+  grub_test_assert (ret == (grub_ssize_t) expected_len
+		    && memcmp (output, expected, expected_len) == 0,
+		    "%s: decoded to %" PRIdGRUB_SSIZE " bytes, expected %"
+		    PRIuGRUB_SIZE, name, ret, expected_len);
+
+  ret = xca_decompress (input, len, NULL);
+  grub_test_assert (ret == (grub_ssize_t) expected_len,
+		    "%s: sizing pass gave %" PRIdGRUB_SSIZE " bytes",
+		    name, ret);
+
+  /* Only the final word may be missing, it is read as zero padding.  */
+  for (i = 0; i + 2 < len; i++)
+    {
+      ret = xca_decompress (input, i, output);
+      grub_test_assert (ret < 0 || ret != (grub_ssize_t) expected_len
+			|| memcmp (output, expected, expected_len) != 0,
+			"%s: truncated to %" PRIuGRUB_SIZE " bytes still decoded",
+			name, i);
+      grub_test_assert (ret < 0 || i >= XCA_TABLE_SIZE + 4,
+			"%s: accepted %" PRIuGRUB_SIZE " bytes without a bit stream",
+			name, i);
+    }
+}
+
+static void
+xca_check_error (const char *name, grub_size_t len)
+{
+  grub_ssize_t ret;
+
+  ret = xca_decompress (input, len, output);
+  grub_test_assert (ret < 0, "%s: corrupt input decoded to %"
+		    PRIdGRUB_SSIZE " bytes", name, ret);
+}
+
+static void
+xca_test (void)
+{
+  grub_size_t len, i;
+  grub_uint8_t word_match[sizeof (xca_word_match)];
+
+  len = xca_flat_input (xca_literals, sizeof (xca_literals), 0x99);
+  memcpy (expected, "Hello, XCA!", 11);
+  xca_check ("literals", len, 11);
+
+  len = xca_flat_input (xca_matches, sizeof (xca_matches), 0x99);
+  memcpy (expected, "abcabcabcabc-abcabccccc", 23);
+  xca_check ("matches", len, 23);
+
+  /* Length 100 needs the extra length byte.  */
+  len = xca_flat_input (xca_long_match, sizeof (xca_long_match), 0x99);
+  memset (expected, 'a', 101);
+  expected[101] = 'b';
+  xca_check ("long match", len, 102);
+
+  /* Length 1999 needs the 0xff escape and a 16-bit length.  */
+  len = xca_flat_input (xca_word_match, sizeof (xca_word_match), 0x99);
+  for (i = 0; i < 2001; i++)
+    expected[i] = (i & 1) ? 'y' : 'x';
+  expected[2001] = 'z';
+  xca_check ("16-bit match length", len, 2002);
+
+  memcpy (input, xca_huffman, sizeof (xca_huffman));
+  memcpy (expected, xca_huffman_text, sizeof (xca_huffman_text) - 1);
+  xca_check ("variable lengths", sizeof (xca_huffman),
+	     sizeof (xca_huffman_text) - 1);
+
+  len = xca_flat_input (xca_bad_offset, sizeof (xca_bad_offset), 0x99);
+  xca_check_error ("match before start", len);
+
+  len = xca_flat_input (xca_overrun, sizeof (xca_overrun), 0x99);
+  xca_check_error ("match past block", len);
+
+  len = xca_flat_input (xca_no_end, sizeof (xca_no_end), 0x99);
+  xca_check_error ("missing end marker", len);
+
+  /* A 16-bit length below the escape threshold is invalid.  */
+  memcpy (word_match, xca_word_match, sizeof (word_match));
+  word_match[7] = 0x05;
+  word_match[8] = 0x00;
+  len = xca_flat_input (word_match, sizeof (word_match), 0x99);
+  xca_check_error ("short 16-bit match length", len);
+
+  len = xca_flat_input (xca_literals, sizeof (xca_literals), 0xaa);
+  xca_check_error ("incomplete lengths table", len);
+
+  len = xca_flat_input (xca_literals, sizeof (xca_literals), 0x88);
+  xca_check_error ("oversubscribed lengths table", len);
+
+  /* Damage anywhere must not run past the block.  */
+  for (i = 0; i < sizeof (xca_huffman); i++)
+    {
+      grub_ssize_t ret;
+
+      memcpy (input, xca_huffman, sizeof (xca_huffman));
+      input[i] ^= 0xff;
+      ret = xca_decompress (input, sizeof (xca_huffman), output);
+      grub_test_assert (ret <= XCA_BLOCK_SIZE,
+			"byte %" PRIuGRUB_SIZE " flipped: decoded to %"
+			PRIdGRUB_SSIZE " bytes", i, ret);
+    }
+}
+
+GRUB_UNIT_TEST ("xca_unit_test", xca_test);